@@ -28,6 +28,7 @@
 #define HIDAPI_H__
 
 #include <wchar.h>
+#include <stdint.h>
 
 /* #480: this is to be refactored properly for v1.0 */
 #ifdef _WIN32
@@ -193,6 +194,97 @@ extern "C" {
 			hid_bus_type bus_type;
 		};
 
+		/** hidapi info structure with UTF-8 strings.
+
+			The same as struct #hid_device_info, but the strings are UTF-8
+			and don't depend on the locale. Where the system provides
+			UTF-8 (hidraw sysfs attributes, USB string descriptors),
+			the strings are taken as they are, without a round trip
+			through wchar_t.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+		*/
+		struct hid_device_info_utf8 {
+			/** Platform-specific device path */
+			char *path;
+			/** Device Vendor ID */
+			unsigned short vendor_id;
+			/** Device Product ID */
+			unsigned short product_id;
+			/** Serial Number */
+			char *serial_number;
+			/** Device Release Number in binary-coded decimal,
+			    also known as Device Version Number */
+			unsigned short release_number;
+			/** Manufacturer String */
+			char *manufacturer_string;
+			/** Product string */
+			char *product_string;
+			/** Usage Page for this Device/Interface
+			    (Windows/Mac/hidraw only) */
+			unsigned short usage_page;
+			/** Usage for this Device/Interface
+			    (Windows/Mac/hidraw only) */
+			unsigned short usage;
+			/** The USB interface which this logical device
+			    represents.
+
+			    Valid only if the device is a USB HID device.
+			    Set to -1 in all other cases.
+			*/
+			int interface_number;
+
+			/** Pointer to the next device */
+			struct hid_device_info_utf8 *next;
+
+			/** Underlying bus type */
+			hid_bus_type bus_type;
+		};
+
+		/** Flags of struct #hid_enumerate_filter
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+		*/
+		typedef enum {
+			/** Don't fill in the Serial Number, Manufacturer and Product strings,
+			    they are left NULL. Reading them is often the most expensive
+			    part of the enumeration (e.g. control transfers with libusb),
+			    and converting them takes an allocation each. */
+			HID_API_ENUMERATE_NO_STRINGS = 0x1
+		} hid_enumerate_flags;
+
+		/** Filter for hid_enumerate_ex().
+
+			A field set to its "any" value doesn't filter, the other
+			fields must all match. Initialize the structure with
+			@ref HID_API_ENUMERATE_FILTER_INIT, and set the fields
+			to filter on.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+		*/
+		struct hid_enumerate_filter {
+			/** Vendor ID, 0 matches any */
+			unsigned short vendor_id;
+			/** Product ID, 0 matches any */
+			unsigned short product_id;
+			/** Usage Page, 0 matches any */
+			unsigned short usage_page;
+			/** Usage, 0 matches any */
+			unsigned short usage;
+			/** Bus type, @ref HID_API_BUS_UNKNOWN matches any */
+			hid_bus_type bus_type;
+			/** USB interface number, -1 matches any */
+			int interface_number;
+			/** Serial Number, NULL matches any */
+			const wchar_t *serial_number;
+			/** A combination of #hid_enumerate_flags */
+			unsigned int flags;
+		};
+
+		/** Initializer of struct #hid_enumerate_filter, which matches all the devices.
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+		*/
+		#define HID_API_ENUMERATE_FILTER_INIT { 0, 0, 0, 0, HID_API_BUS_UNKNOWN, -1, NULL, 0 }
+
 
 		/** @brief Initialize the HIDAPI library.
 
@@ -261,6 +353,66 @@ extern "C" {
 		*/
 		void  HID_API_EXPORT HID_API_CALL hid_free_enumeration(struct hid_device_info *devs);
 
+		/** @brief Enumerate the HID Devices matching a filter.
+
+			Like hid_enumerate(), but the devices can be filtered by more
+			than VID/PID. The backends evaluate the filter as early as they can,
+			so a device which doesn't match costs as little as possible:
+			with hidraw, e.g. the bus type is checked before anything but
+			the uevent is read, and a Usage Page/Usage pair which doesn't match
+			is skipped before its record is allocated.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			@ingroup API
+			@param filter The filter, or NULL to match all the devices.
+
+			@returns
+				This function returns a pointer to a linked list of type
+				struct #hid_device_info, containing information about the HID devices
+				attached to the system which match the filter,
+				or NULL in the case of failure or if no such HID devices are present in the system.
+				Call hid_error(NULL) to get the failure reason.
+
+			@note The returned value by this function must to be freed by calling hid_free_enumeration(),
+			      when not needed anymore.
+		*/
+		struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate_ex(const struct hid_enumerate_filter *filter);
+
+		/** @brief Enumerate the HID Devices matching a filter, with UTF-8 strings.
+
+			Like hid_enumerate_ex(), but the strings of the devices are UTF-8.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			@ingroup API
+			@param filter The filter, or NULL to match all the devices.
+				The serial number to filter on is still a wide string.
+
+			@returns
+				This function returns a pointer to a linked list of type
+				struct #hid_device_info_utf8, containing information about the HID devices
+				attached to the system which match the filter,
+				or NULL in the case of failure or if no such HID devices are present in the system.
+				Call hid_error(NULL) to get the failure reason.
+
+			@note The returned value by this function must to be freed by calling hid_free_enumeration_utf8(),
+			      when not needed anymore.
+		*/
+		struct hid_device_info_utf8 HID_API_EXPORT * HID_API_CALL hid_enumerate_utf8(const struct hid_enumerate_filter *filter);
+
+		/** @brief Free an enumeration Linked List with UTF-8 strings
+
+			This function frees a linked list created by hid_enumerate_utf8().
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			@ingroup API
+			@param devs Pointer to a list of struct_device returned from
+			            hid_enumerate_utf8().
+		*/
+		void  HID_API_EXPORT HID_API_CALL hid_free_enumeration_utf8(struct hid_device_info_utf8 *devs);
+
 		/** @brief Callback handle.
 
 			Callbacks handles are generated by hid_hotplug_register_callback()
@@ -367,6 +519,57 @@ extern "C" {
 		*/
 		int HID_API_EXPORT HID_API_CALL hid_hotplug_deregister_callback(hid_hotplug_callback_handle callback_handle);
 
+		/** @brief Get a file descriptor, which can be used to process
+			hotplug events in an external event loop.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			Once this function has been called, the library doesn't start
+			any thread to monitor the devices: the hotplug events are only
+			processed, and the hotplug callbacks only invoked, by
+			hid_hotplug_handle_events() on the caller's thread.
+			This lasts until hid_exit().
+			Callback threads explicitly requested with the backend's
+			set_hotplug_threads option are still used to invoke the callbacks.
+
+			The file descriptor becomes readable (POLLIN/EPOLLIN) when
+			hotplug events are pending, at which point hid_hotplug_handle_events()
+			should be called. The readiness is level-triggered.
+
+			It must be called before the first hotplug callback is registered.
+			The file descriptor is owned by the library: it must not be read,
+			written or closed by the caller, and it is only valid until hid_exit().
+			Calling this function again returns the same file descriptor.
+
+			Currently supported by the hidraw backend, and by the libusb backend on Linux.
+
+			@ingroup API
+
+			@returns
+				This function returns a file descriptor on success and -1 on error.
+				Call hid_error(NULL) to get the failure reason.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_hotplug_get_fd(void);
+
+		/** @brief Process the pending hotplug events.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			Updates the list of connected devices and invokes the matching
+			hotplug callbacks on the calling thread, for the events that are
+			pending. It doesn't wait for new events.
+
+			Must only be called after hid_hotplug_get_fd(), from one thread at a time,
+			and not from a hotplug callback.
+
+			@ingroup API
+
+			@returns
+				This function returns the number of events processed,
+				and -1 on error. Call hid_error(NULL) to get the failure reason.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_hotplug_handle_events(void);
+
 		/** @brief Open a HID device using a Vendor ID (VID), Product ID
 			(PID) and optionally a serial number.
 
@@ -486,6 +689,222 @@ extern "C" {
 		*/
 		int  HID_API_EXPORT HID_API_CALL hid_read(hid_device *dev, unsigned char *data, size_t length);
 
+		/** @brief Read an Input report from a HID device with timeout,
+			together with the time the report was received.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			Same as hid_read_timeout(), and in addition stores a monotonic
+			timestamp of the report, in nanoseconds, into @p timestamp_ns.
+			The timestamps can be used to measure the queueing delay of the
+			reports, and to correlate the reports of several devices.
+
+			The clock is CLOCK_MONOTONIC on Linux and NetBSD (comparable with
+			clock_gettime(CLOCK_MONOTONIC)), mach_absolute_time() on macOS
+			and QueryPerformanceCounter() on Windows.
+
+			The libusb and macOS backends stamp each report when it is
+			received from the device (transfer completion), before it is
+			queued. The hidraw, NetBSD and Windows backends stamp the report
+			when it is taken from the OS, i.e. when this function reads it.
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+			@param data A buffer to put the read data into.
+			@param length The number of bytes to read. For devices with
+				multiple reports, make sure to read an extra byte for
+				the report number.
+			@param timestamp_ns Receives the timestamp of the report, in
+				nanoseconds. Only set when a report was read.
+			@param milliseconds timeout in milliseconds or -1 for blocking wait.
+
+			@returns
+				This function returns the actual number of bytes read and
+				-1 on error.
+				Call hid_read_error(dev) to get the failure reason.
+				If no packet was available to be read within
+				the timeout period, this function returns 0.
+
+			@note This function doesn't change the buffer returned by the hid_error(dev).
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_read_timestamped(hid_device *dev, unsigned char *data, size_t length, uint64_t *timestamp_ns, int milliseconds);
+
+		/** @brief Read several Input reports from a HID device at once.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			Waits (at most @p milliseconds) for the first Input report
+			only, and then returns every report that is already queued
+			for the device, up to @p max_reports, without waiting again.
+			This is meant for high-rate devices, where reading one report
+			per call costs more than the report itself.
+
+			Report number i is stored at @p data + i * @p stride and its
+			length is stored in @p lengths[i]. Reports longer than
+			@p stride bytes are truncated, as with hid_read().
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+			@param data A buffer of at least @p stride * @p max_reports bytes.
+			@param stride The size in bytes of one report slot in @p data.
+			@param max_reports The maximum number of reports to read.
+			@param lengths An array of at least @p max_reports elements,
+				receiving the length of each report read.
+			@param milliseconds timeout in milliseconds or -1 for blocking wait.
+
+			@returns
+				This function returns the number of reports read and
+				-1 on error.
+				Call hid_read_error(dev) to get the failure reason.
+				If no report was available to be read within
+				the timeout period, this function returns 0.
+				If an error happens after at least one report was read,
+				the reports read so far are returned and the error is
+				reported by the next call.
+
+			@note This function doesn't change the buffer returned by the hid_error(dev).
+		*/
+		int  HID_API_EXPORT HID_API_CALL hid_read_batch(hid_device *dev, unsigned char *data, size_t stride, size_t max_reports, size_t *lengths, int milliseconds);
+
+		/** A reactor, which waits for Input reports of many devices
+			at once and dispatches them to a callback per device.
+		*/
+		typedef struct hid_reactor_ hid_reactor;
+
+		/** @brief Callback invoked by hid_reactor_run() for each Input report.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			The callback is invoked on the thread which called hid_reactor_run().
+			It is allowed to call hid_reactor_add() and hid_reactor_remove()
+			from within the callback.
+
+			@ingroup API
+			@param dev The device the report was read from.
+			@param data The Input report, in the same format as returned
+				by hid_read(). Only valid for the duration of the callback.
+			@param length The length of the report in bytes, or -1 on error.
+				Call hid_read_error(dev) to get the failure reason.
+				After an error the device is removed from the reactor.
+			@param user_data The user data given to hid_reactor_add().
+		*/
+		typedef void (HID_API_CALL *hid_reactor_callback_fn)(hid_device *dev, const unsigned char *data, int length, void *user_data);
+
+		/** @brief Create a reactor.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			A reactor replaces a thread per device, each blocked in hid_read(),
+			with a single thread calling hid_reactor_run().
+			Currently the reactor is only available on Linux
+			(hidraw and libusb backends).
+
+			@ingroup API
+			@param report_size The size of the buffer the reports are read into.
+				Longer reports are truncated, as with hid_read().
+				Pass 0 to use a default of 4096 bytes.
+
+			@returns
+				A pointer to a new reactor on success,
+				or NULL on failure. Call hid_error(NULL) to get the failure reason.
+		*/
+		HID_API_EXPORT hid_reactor * HID_API_CALL hid_reactor_new(size_t report_size);
+
+		/** @brief Add a device to a reactor.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			While the device is part of the reactor, its Input reports
+			are delivered to @p callback only; the device must not be
+			read with hid_read() and friends.
+			Closing the device with hid_close() removes it from the reactor.
+
+			@ingroup API
+			@param reactor A reactor returned from hid_reactor_new().
+			@param dev A device handle returned from hid_open().
+			@param callback The callback to invoke for each Input report of the device.
+			@param user_data The user data to pass to the callback.
+
+			@returns
+				This function returns 0 on success and -1 on error.
+				Call hid_error(NULL) to get the failure reason.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_reactor_add(hid_reactor *reactor, hid_device *dev, hid_reactor_callback_fn callback, void *user_data);
+
+		/** @brief Remove a device from a reactor.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			No more callbacks are invoked for the device after this function returns.
+
+			@ingroup API
+			@param reactor A reactor returned from hid_reactor_new().
+			@param dev A device previously added with hid_reactor_add().
+
+			@returns
+				This function returns 0 on success and -1 if the
+				device is not part of the reactor.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_reactor_remove(hid_reactor *reactor, hid_device *dev);
+
+		/** @brief Wait for Input reports and dispatch them.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			Waits (at most @p milliseconds) until at least one device
+			has an Input report, and then invokes the callbacks
+			for the reports which are queued for all ready devices.
+
+			@ingroup API
+			@param reactor A reactor returned from hid_reactor_new().
+			@param milliseconds timeout in milliseconds or -1 for blocking wait.
+
+			@returns
+				This function returns the number of callbacks invoked,
+				0 if the timeout expired, and -1 on error.
+				Call hid_error(NULL) to get the failure reason.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_reactor_run(hid_reactor *reactor, int milliseconds);
+
+		/** @brief Destroy a reactor.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			The devices which are still part of the reactor are removed
+			from it, but not closed. Must not be called from a reactor callback.
+
+			@ingroup API
+			@param reactor A reactor returned from hid_reactor_new(), or NULL.
+		*/
+		void HID_API_EXPORT HID_API_CALL hid_reactor_free(hid_reactor *reactor);
+
+		/** @brief Get a file descriptor, which can be used to wait for
+			Input reports of a device in an external event loop.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			The file descriptor becomes readable (POLLIN/EPOLLIN) when an
+			Input report is available, or when the device is disconnected.
+			At that point the reports should be read with hid_read_timeout()
+			(or hid_read_batch()) with a timeout of 0, until it returns 0
+			or -1. The readiness is level-triggered: the file descriptor
+			stays readable as long as reports are available.
+
+			The file descriptor is owned by the device: it must not be read,
+			written or closed by the caller, and it is only valid until hid_close().
+
+			Currently supported by the hidraw backend, by the libusb backend
+			on Linux, and by the NetBSD backend for devices with a single report handle.
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+
+			@returns
+				This function returns a file descriptor on success and -1 on error.
+				Call hid_error(dev) to get the failure reason.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_get_pollable_fd(hid_device *dev);
+
 		/** @brief Set the device handle to be non-blocking.
 
 			In non-blocking mode calls to hid_read() will return
@@ -701,6 +1120,75 @@ extern "C" {
 		*/
 		int HID_API_EXPORT_CALL hid_get_indexed_string(hid_device *dev, int string_index, wchar_t *string, size_t maxlen);
 
+		/** @brief Get The Manufacturer String from a HID device, as UTF-8.
+
+			A string which doesn't fit is truncated at a character boundary.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+			@param string A buffer to put the UTF-8 data into.
+			@param maxlen The length of the buffer in bytes.
+
+			@returns
+				This function returns 0 on success and -1 on error.
+				Call hid_error(dev) to get the failure reason.
+		*/
+		int HID_API_EXPORT_CALL hid_get_manufacturer_string_utf8(hid_device *dev, char *string, size_t maxlen);
+
+		/** @brief Get The Product String from a HID device, as UTF-8.
+
+			A string which doesn't fit is truncated at a character boundary.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+			@param string A buffer to put the UTF-8 data into.
+			@param maxlen The length of the buffer in bytes.
+
+			@returns
+				This function returns 0 on success and -1 on error.
+				Call hid_error(dev) to get the failure reason.
+		*/
+		int HID_API_EXPORT_CALL hid_get_product_string_utf8(hid_device *dev, char *string, size_t maxlen);
+
+		/** @brief Get The Serial Number String from a HID device, as UTF-8.
+
+			A string which doesn't fit is truncated at a character boundary.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+			@param string A buffer to put the UTF-8 data into.
+			@param maxlen The length of the buffer in bytes.
+
+			@returns
+				This function returns 0 on success and -1 on error.
+				Call hid_error(dev) to get the failure reason.
+		*/
+		int HID_API_EXPORT_CALL hid_get_serial_number_string_utf8(hid_device *dev, char *string, size_t maxlen);
+
+		/** @brief Get a string from a HID device, based on its string index, as UTF-8.
+
+			A string which doesn't fit is truncated at a character boundary.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+			@param string_index The index of the string to get.
+			@param string A buffer to put the UTF-8 data into.
+			@param maxlen The length of the buffer in bytes.
+
+			@returns
+				This function returns 0 on success and -1 on error.
+				Call hid_error(dev) to get the failure reason.
+		*/
+		int HID_API_EXPORT_CALL hid_get_indexed_string_utf8(hid_device *dev, int string_index, char *string, size_t maxlen);
+
 		/** @brief Get a report descriptor from a HID device.
 
 			Since version 0.14.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 14, 0)
@@ -735,6 +1223,11 @@ extern "C" {
 			Device-specific error string may remain allocated at most until hid_close() is called.
 			Global error string may remain allocated at most until hid_exit() is called.
 
+			On Windows and with the hidraw backend on Linux the global error
+			is stored per thread: hid_error(NULL) reports the last error of
+			a function called on the same thread, so e.g. hid_enumerate() and
+			hid_open_path() can be called from several threads at once.
+
 			@ingroup API
 			@param dev A device handle returned from hid_open(),
 			  or NULL to get the last non-device-specific error
@@ -745,9 +1238,26 @@ extern "C" {
 		*/
 		HID_API_EXPORT const wchar_t* HID_API_CALL hid_error(hid_device *dev);
 
+		/** @brief Get a string describing the last error which occurred during hid_read/hid_read_timeout.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			The same rules as for hid_error() apply, except that the
+			string is only changed by the functions reading Input reports
+			(hid_read(), hid_read_timeout(), hid_read_batch(), ...).
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+
+			@returns
+				A string describing the last read error (if any).
+		*/
+		HID_API_EXPORT const wchar_t* HID_API_CALL hid_read_error(hid_device *dev);
+
 		/** @brief Get the code corresponding to the last error which occured.
 
-			It will contains a non-zero value if the last error is a win32 API error.
+			It will contains a non-zero value if the last error is a win32 API error
+			(Windows), or an error reported by the OS through errno (Linux/hidraw).
 
 			Any HIDAPI function that can explicitly indicate an execution failure
 			(e.g. by an error code, or by returning NULL) - may set the error code,
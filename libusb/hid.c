@@ -38,6 +38,13 @@
 #include <sys/utsname.h>
 #include <fcntl.h>
 #include <wchar.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
 
 /* GNU / LibUSB */
 #include <libusb.h>
@@ -85,6 +92,7 @@ instead to differentiate between interfaces on a composite HID device. */
 struct input_report {
 	uint8_t *data;
 	size_t len;
+	uint64_t timestamp_ns; /* CLOCK_MONOTONIC time of the transfer completion */
 	struct input_report *next;
 };
 
@@ -123,6 +131,13 @@ struct hid_device_ {
 	/* List of received input reports. */
 	struct input_report *input_reports;
 
+	/* Readable while input_reports is not empty or the read thread
+	   has stopped; -1 until needed, see create_input_event_fd(). */
+	int input_event_fd;
+
+	/* The reactor the device is added to, if any */
+	hid_reactor *reactor;
+
 	/* Was kernel driver detached by libusb */
 #ifdef DETACH_KERNEL_DRIVER
 	int is_driver_detached;
@@ -137,6 +152,12 @@ static struct hid_api_version api_version = {
 
 static libusb_context *usb_context = NULL;
 
+/* Upper bound for hid_libusb_set_enumerate_threads() */
+#define HID_ENUMERATE_MAX_THREADS 32
+
+/* Number of threads hid_enumerate() spreads the devices over */
+static unsigned int enumerate_threads = 1;
+
 struct hid_hotplug_queue {
 	libusb_device* device;
 	int event; /* Arrived or removed */
@@ -159,34 +180,101 @@ static struct hid_hotplug_context {
 	/* A separate thread which processes hidapi's internal event queue */
 	hidapi_thread_state callback_thread;
 
-	/* This mutex prevents changes to the callback list */
+	/* Serializes the changes to the callbacks and to the enumeration cache,
+	 * and the start and the end of the hotplug threads.
+	 * No callback is invoked with it held, so callbacks may register and deregister callbacks. */
 	pthread_mutex_t mutex;
 
+	/* Taken for reading by hid_enumerate() when it is answered from devs and by the
+	 * HID_API_HOTPLUG_ENUMERATE replay, and for writing whenever devs is modified */
+	pthread_rwlock_t devs_lock;
+
+	/* Protects `callbacks`, the reference counts of the callback sets and of the callbacks,
+	 * and their `removed` flags (which are written with `mutex` held too) */
+	pthread_mutex_t callbacks_lock;
+
 	/* Boolean flags */
-	unsigned char mutex_ready;
-	unsigned char mutex_in_use;
-	unsigned char cb_list_dirty;
+	/* The thread states below and the executor's are initialized (protected by `mutex`) */
+	unsigned char thread_states_ready;
+	/* Keep the threads running without any callbacks and answer hid_enumerate() from devs.
+	 * Written with both `mutex` and `devs_lock` held */
+	unsigned char enumerate_cache;
+	/* The hotplug thread was started and not joined yet */
+	unsigned char monitor_running;
+	/* callback_thread has left its loop, and hotplug_thread is leaving.
+	 * Written with both `mutex` and callback_thread's mutex held */
+	unsigned char monitor_exited;
+#ifdef __linux__
+	/* hid_hotplug_get_fd() was called: the threads aren't started, the events are processed
+	 * by hid_hotplug_handle_events(), and epoll_fd and wakeup_fd are kept until hid_exit() */
+	unsigned char external;
+#endif
+	/* devs is kept up to date by the hotplug threads (protected by devs_lock) */
+	unsigned char devs_valid;
+
+#ifdef __linux__
+	/* The epoll set returned by hid_hotplug_get_fd(): wakeup_fd, and the file descriptors
+	 * of `context` while it is open (kept in sync by libusb's pollfd notifiers) */
+	int epoll_fd;
+
+	/* eventfd signalled to make the caller of hid_hotplug_handle_events()
+	 * check whether `context` has to be closed */
+	int wakeup_fd;
+#endif
 
+	/* Events for callback_thread, protected by callback_thread's mutex.
+	 * The thread is only signalled when the queue stops being empty. */
 	struct hid_hotplug_queue* queue;
+	struct hid_hotplug_queue* queue_tail;
 
-	/* Linked list of the hotplug callbacks */
-	struct hid_hotplug_callback *hotplug_cbs;
+	/* Registration order of the next callback, to invoke the callbacks of different chains in that order */
+	unsigned long long next_cb_order;
+
+	/* The registered callbacks, NULL if there are none.
+	 * The set is never modified: it is replaced with `mutex` held */
+	struct hid_hotplug_callback_set *callbacks;
 
 	/* Linked list of the device infos (mandatory when the device is disconnected).
-	 * Protected by `mutex`: all reads, writes and the final free during teardown
-	 * are performed while holding it. The teardown free runs in
-	 * hid_internal_hotplug_cleanup() after the hotplug threads have been joined. */
+	 * Protected by `devs_lock`. Only callback_thread removes records from it while the
+	 * threads run; it is freed by hid_internal_hotplug_join() once they have been joined. */
 	struct hid_device_info *devs;
+
+	/* The devices whose records make up devs, in the same order, hashed by
+	 * hid_internal_device_key_length() bytes of their paths. Protected like devs. */
+	struct hid_hotplug_device **dev_buckets;
+	size_t dev_bucket_count;
+	size_t num_devices;
+	struct hid_hotplug_device *first_device;
+	struct hid_hotplug_device *last_device;
 } hid_hotplug_context = {
 	.next_handle = FIRST_HOTPLUG_CALLBACK_HANDLE,
-	.mutex_ready = 0,
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.devs_lock = PTHREAD_RWLOCK_INITIALIZER,
+	.callbacks_lock = PTHREAD_MUTEX_INITIALIZER,
+	.thread_states_ready = 0,
+	.enumerate_cache = 0,
+	.monitor_running = 0,
+#ifdef __linux__
+	.external = 0,
+	.epoll_fd = -1,
+	.wakeup_fd = -1,
+#endif
+	.devs_valid = 0,
 	.queue = NULL,
-	.hotplug_cbs = NULL,
+	.queue_tail = NULL,
+	.next_cb_order = 0,
+	.callbacks = NULL,
 	.devs = NULL,
+	.dev_buckets = NULL,
+	.dev_bucket_count = 0,
+	.num_devices = 0,
+	.first_device = NULL,
+	.last_device = NULL,
 };
 
 uint16_t get_usb_code_for_current_locale(void);
 static int return_data(hid_device *dev, unsigned char *data, size_t length);
+static hid_device *hid_open_by_id(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number);
 
 static hid_device *new_hid_device(void)
 {
@@ -195,6 +283,7 @@ static hid_device *new_hid_device(void)
 		return NULL;
 
 	dev->blocking = 1;
+	dev->input_event_fd = -1;
 
 	hidapi_thread_state_init(&dev->thread_state);
 
@@ -206,12 +295,70 @@ static void free_hid_device(hid_device *dev)
 	/* Clean up the thread objects */
 	hidapi_thread_state_destroy(&dev->thread_state);
 
+	if (dev->input_event_fd >= 0)
+		close(dev->input_event_fd);
+
 	hid_free_enumeration(dev->device_info);
 
 	/* Free the device itself */
 	free(dev);
 }
 
+/* Make dev->input_event_fd readable.
+   This should be called with dev->mutex locked. */
+static void signal_input_event(hid_device *dev)
+{
+#ifdef __linux__
+	if (dev->input_event_fd >= 0) {
+		uint64_t one = 1;
+		if (write(dev->input_event_fd, &one, sizeof(one)) < 0) {
+			/* The counter can only overflow, which keeps it readable anyway */
+		}
+	}
+#else
+	(void)dev;
+#endif
+}
+
+/* Reset dev->input_event_fd to not readable.
+   This should be called with dev->mutex locked. */
+static void clear_input_event(hid_device *dev)
+{
+#ifdef __linux__
+	if (dev->input_event_fd >= 0) {
+		uint64_t value;
+		if (read(dev->input_event_fd, &value, sizeof(value)) < 0) {
+			/* EAGAIN: wasn't signalled */
+		}
+	}
+#else
+	(void)dev;
+#endif
+}
+
+/* Create dev->input_event_fd if it doesn't exist yet.
+   This should be called with dev->mutex locked. */
+static int create_input_event_fd(hid_device *dev)
+{
+#ifdef __linux__
+	if (dev->input_event_fd >= 0)
+		return 0;
+
+	dev->input_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (dev->input_event_fd < 0)
+		return -1;
+
+	if (dev->input_reports || dev->shutdown_thread)
+		signal_input_event(dev);
+
+	return 0;
+#else
+	(void)dev;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
 #if 0
 /*TODO: Implement this function on hidapi/libusb.. */
 static void register_error(hid_device *dev, const char *op)
@@ -488,6 +635,182 @@ err:
 	return str;
 }
 
+/* Compare the USB device string numbered by the index with a wide string,
+   without converting it. Equivalent to comparing with get_usb_string(). */
+static int usb_string_equals(libusb_device_handle *dev, uint8_t idx, const wchar_t *str)
+{
+	unsigned char buf[512];
+	int len;
+	int i;
+
+	/* Determine which language to use. */
+	uint16_t lang;
+	lang = get_usb_code_for_current_locale();
+	if (!is_language_supported(dev, lang))
+		lang = get_first_language(dev);
+
+	len = libusb_get_string_descriptor(dev, idx, lang, buf, sizeof(buf));
+	if (len < 2) /* we always skip first 2 bytes */
+		return 0;
+
+	for (i = 2; i + 1 < len; i += 2) {
+		uint32_t c = buf[i] | (buf[i + 1] << 8);
+
+#if !defined(__ANDROID__) && !defined(NO_ICONV) && WCHAR_MAX > 0xFFFF
+		/* iconv combines the surrogate pairs into a single wchar_t */
+		if (c >= 0xD800 && c < 0xDC00 && i + 3 < len) {
+			uint32_t low = buf[i + 2] | (buf[i + 3] << 8);
+			if (low >= 0xDC00 && low < 0xE000) {
+				c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+				i += 2;
+			}
+		}
+#endif
+
+		if (*str == L'\0' || (uint32_t) *str != c)
+			return 0;
+		str++;
+	}
+
+	return *str == L'\0';
+}
+
+/* Encode the code point c as UTF-8 into buf, which must have room for 4 bytes.
+   Surrogates and values out of the Unicode range are replaced by U+FFFD.
+   Returns the number of bytes written. */
+static size_t encode_utf8(uint32_t c, char *buf)
+{
+	unsigned char *out = (unsigned char *) buf;
+
+	if (c < 0x80) {
+		out[0] = (unsigned char) c;
+		return 1;
+	}
+	if (c < 0x800) {
+		out[0] = (unsigned char) (0xC0 | (c >> 6));
+		out[1] = (unsigned char) (0x80 | (c & 0x3F));
+		return 2;
+	}
+	if ((c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF)
+		c = 0xFFFD;
+	if (c < 0x10000) {
+		out[0] = (unsigned char) (0xE0 | (c >> 12));
+		out[1] = (unsigned char) (0x80 | ((c >> 6) & 0x3F));
+		out[2] = (unsigned char) (0x80 | (c & 0x3F));
+		return 3;
+	}
+	out[0] = (unsigned char) (0xF0 | (c >> 18));
+	out[1] = (unsigned char) (0x80 | ((c >> 12) & 0x3F));
+	out[2] = (unsigned char) (0x80 | ((c >> 6) & 0x3F));
+	out[3] = (unsigned char) (0x80 | (c & 0x3F));
+	return 4;
+}
+
+/* Convert the UTF-16LE characters of a USB string descriptor (after its
+   2-byte header) to UTF-8, with the terminator. At most out_size bytes are
+   written to out, cutting before the first character which doesn't fit
+   entirely; out may be NULL to only get the size.
+   Returns the size of the whole string, including the terminator. */
+static size_t utf16le_to_utf8(const unsigned char *in, size_t in_len, char *out, size_t out_size)
+{
+	size_t size = 0, out_len = 0;
+	size_t i;
+
+	for (i = 0; i + 1 < in_len; i += 2) {
+		uint32_t c = in[i] | (in[i + 1] << 8);
+		char buf[4];
+		size_t n;
+
+		if (c >= 0xD800 && c < 0xDC00 && i + 3 < in_len) {
+			uint32_t low = in[i + 2] | (in[i + 3] << 8);
+			if (low >= 0xDC00 && low < 0xE000) {
+				c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+				i += 2;
+			}
+		}
+
+		n = encode_utf8(c, buf);
+		if (out && out_len == size && size + n < out_size) {
+			memcpy(out + out_len, buf, n);
+			out_len += n;
+		}
+		size += n;
+	}
+
+	if (out && out_size > 0)
+		out[out_len] = '\0';
+
+	return size + 1;
+}
+
+/* Read the USB string descriptor numbered by the index, in the same
+   language as get_usb_string() does. Returns its length, or -1. */
+static int get_usb_string_descriptor(libusb_device_handle *dev, uint8_t idx, unsigned char *buf, int size)
+{
+	int len;
+
+	/* Determine which language to use. */
+	uint16_t lang;
+	lang = get_usb_code_for_current_locale();
+	if (!is_language_supported(dev, lang))
+		lang = get_first_language(dev);
+
+	len = libusb_get_string_descriptor(dev, idx, lang, buf, size);
+	if (len < 2) /* we always skip first 2 bytes */
+		return -1;
+
+	return len;
+}
+
+/* Like get_usb_string(), but the string is converted straight from
+   UTF-16LE to UTF-8, regardless of the locale. The returned string
+   must be freed by using free(). */
+static char *get_usb_string_utf8(libusb_device_handle *dev, uint8_t idx)
+{
+	unsigned char buf[512];
+	size_t size;
+	char *str;
+	int len;
+
+	len = get_usb_string_descriptor(dev, idx, buf, sizeof(buf));
+	if (len < 0)
+		return NULL;
+
+	size = utf16le_to_utf8(buf + 2, (size_t) len - 2, NULL, 0);
+	str = (char *) malloc(size);
+	if (str)
+		utf16le_to_utf8(buf + 2, (size_t) len - 2, str, size);
+
+	return str;
+}
+
+/* Convert a wide string to UTF-8, regardless of the locale.
+   The returned string must be freed by using free(). */
+static char *wchar_t_to_utf8(const wchar_t *wcs)
+{
+	char buf[4];
+	size_t len = 0;
+	const wchar_t *cur;
+	char *ret, *out;
+
+	if (!wcs)
+		return NULL;
+
+	for (cur = wcs; *cur; cur++)
+		len += encode_utf8((uint32_t) *cur, buf);
+
+	ret = (char *) malloc(len + 1);
+	if (!ret)
+		return NULL;
+
+	out = ret;
+	for (cur = wcs; *cur; cur++)
+		out += encode_utf8((uint32_t) *cur, out);
+	*out = '\0';
+
+	return ret;
+}
+
 /**
   Max length of the result: "000-000.000.000.000.000.000.000:000.000" (39 chars).
   64 is used for simplicity/alignment.
@@ -542,171 +865,997 @@ struct hid_hotplug_callback
 	hid_hotplug_callback_fn callback;
 	void* user_data;
 	int events;
-	struct hid_hotplug_callback* next;
+
+	/* Registration order */
+	unsigned long long order;
 
 	hid_hotplug_callback_handle handle;
+
+	/* The number of callback sets that contain the callback, plus one
+	 * for hid_hotplug_register_callback() while it runs */
+	size_t refs;
+
+	/* Set by hid_hotplug_deregister_callback(): the callback isn't invoked anymore */
+	unsigned char removed;
+
+	/* Held while the callback is invoked by callback_thread, and by
+	 * hid_hotplug_register_callback() until the HID_API_HOTPLUG_ENUMERATE replay is over */
+	pthread_mutex_t call_lock;
+
+	/* Events queued for the executor, and the link in its ready queue.
+	 * Protected by the executor mutex. */
+	struct hid_hotplug_task *tasks;
+	struct hid_hotplug_task *tasks_tail;
+	struct hid_hotplug_callback *ready_next;
+	/* In the ready queue or being run by an executor thread */
+	unsigned char scheduled;
+	/* No set contains it anymore while scheduled: freed by the executor thread */
+	unsigned char detached;
+};
+
+/* Upper bound for hid_libusb_set_hotplug_threads() */
+#define HID_HOTPLUG_MAX_THREADS 32
+
+/* A copy of the device info of an event, shared by the tasks queued for it.
+ * refs is protected by the executor mutex. */
+struct hid_hotplug_snapshot {
+	struct hid_device_info *info;
+	size_t refs;
+};
+
+/* An event waiting to be passed to one callback by the executor */
+struct hid_hotplug_task {
+	struct hid_hotplug_task *next;
+	struct hid_hotplug_snapshot *snapshot;
+	hid_hotplug_event event;
+	/* Queued for HID_API_HOTPLUG_ENUMERATE: the return value is ignored */
+	unsigned char replay;
 };
 
-static void hid_internal_hotplug_remove_postponed()
+/* The threads that invoke the callbacks, see hid_libusb_set_hotplug_threads().
+ * Each callback has its own queue of tasks and is run by one thread at a time,
+ * so it gets its events in order, while different callbacks run concurrently. */
+static struct hid_hotplug_executor {
+	/* The mutex protects everything below and the queues of the callbacks.
+	 * The condition is signalled when a callback becomes ready and when the threads have to stop.
+	 * Initialized by hid_internal_hotplug_init(). */
+	hidapi_thread_state state;
+
+	hidapi_thread_state *threads;
+	unsigned int num_threads;
+
+	/* The threads leave once no callback is ready */
+	unsigned char stopping;
+	/* The threads are stopping and the tasks not started yet are dropped */
+	unsigned char discard;
+
+	/* Callbacks with queued tasks that no thread is running, in the order they became ready */
+	struct hid_hotplug_callback *ready;
+	struct hid_hotplug_callback *ready_tail;
+} hid_hotplug_executor = {
+	.threads = NULL,
+	.num_threads = 0,
+	.stopping = 0,
+	.discard = 0,
+	.ready = NULL,
+	.ready_tail = NULL,
+};
+
+/* Called with the executor mutex locked */
+static void hid_internal_snapshot_release(struct hid_hotplug_snapshot *snapshot)
 {
-	/* Unregister the callbacks whose removal was postponed */
-	/* This function is always called inside a locked mutex */
-	/* However, any actions are only allowed if the mutex is NOT in use and if the DIRTY flag is set */
-	if (!hid_hotplug_context.mutex_ready || hid_hotplug_context.mutex_in_use || !hid_hotplug_context.cb_list_dirty) {
-		return;
-	}
-	
-	/* Traverse the list of callbacks and check if any were marked for removal */
-	struct hid_hotplug_callback **current = &hid_hotplug_context.hotplug_cbs;
-	while (*current) {
-		struct hid_hotplug_callback *callback = *current;
-		if (!callback->events) {
-			*current = (*current)->next;
-			free(callback);
-			continue;
-		}
-		current = &callback->next;
+	if (--snapshot->refs == 0) {
+		hid_free_enumeration(snapshot->info);
+		free(snapshot);
 	}
-	
-	/* Clear the flag so we don't start the cycle unless necessary */
-	hid_hotplug_context.cb_list_dirty = 0;
 }
 
-static void hid_internal_hotplug_cleanup()
+/* Drop the tasks queued for a callback. Called with the executor mutex locked. */
+static void hid_internal_executor_drop_tasks(struct hid_hotplug_callback *callback)
 {
-	if (!hid_hotplug_context.mutex_ready || hid_hotplug_context.mutex_in_use) {
-		return;
+	while (callback->tasks) {
+		struct hid_hotplug_task *task = callback->tasks;
+		callback->tasks = task->next;
+		hid_internal_snapshot_release(task->snapshot);
+		free(task);
 	}
+	callback->tasks_tail = NULL;
+}
 
-	/* Before checking if the list is empty, clear any entries whose removal was postponed first */
-	hid_internal_hotplug_remove_postponed();
+/* The callback won't get any more events: drop its queued tasks */
+static void hid_internal_executor_cancel(struct hid_hotplug_callback *callback)
+{
+	hidapi_thread_mutex_lock(&hid_hotplug_executor.state);
+	hid_internal_executor_drop_tasks(callback);
+	hidapi_thread_mutex_unlock(&hid_hotplug_executor.state);
+}
 
-	if (hid_hotplug_context.hotplug_cbs != NULL) {
-		return;
+static void hid_internal_callback_destroy(struct hid_hotplug_callback *callback)
+{
+	pthread_mutex_destroy(&callback->call_lock);
+	free(callback);
+}
+
+/* Free a callback once no set contains it. A callback that is being run
+ * by the executor is freed by its thread once the call returns. */
+static void hid_internal_callback_free(struct hid_hotplug_callback *callback)
+{
+	hidapi_thread_mutex_lock(&hid_hotplug_executor.state);
+	hid_internal_executor_drop_tasks(callback);
+	if (callback->scheduled) {
+		callback->detached = 1;
+		callback = NULL;
 	}
+	hidapi_thread_mutex_unlock(&hid_hotplug_executor.state);
 
-	/* Wait for both threads to stop */
-	hidapi_thread_join(&hid_hotplug_context.libusb_thread);
+	if (callback) {
+		hid_internal_callback_destroy(callback);
+	}
+}
 
-	/* Both hotplug threads have exited: we now have exclusive access to `devs`
-	 * (the caller holds `mutex` and no hotplug event can reach process_hotplug_event). */
-	hid_free_enumeration(hid_hotplug_context.devs);
-	hid_hotplug_context.devs = NULL;
+/* Whether the callback was deregistered */
+static int hid_internal_callback_removed(struct hid_hotplug_callback *callback)
+{
+	int removed;
+
+	pthread_mutex_lock(&hid_hotplug_context.callbacks_lock);
+	removed = callback->removed;
+	pthread_mutex_unlock(&hid_hotplug_context.callbacks_lock);
+
+	return removed;
 }
 
-static void hid_internal_hotplug_init()
+static void *hid_internal_executor_thread(void *user_data)
 {
-	if (!hid_hotplug_context.mutex_ready) {
-		hidapi_thread_state_init(&hid_hotplug_context.libusb_thread);
-		hidapi_thread_state_init(&hid_hotplug_context.callback_thread);
+	(void) user_data;
+
+	hidapi_thread_mutex_lock(&hid_hotplug_executor.state);
+
+	for (;;) {
+		while (!hid_hotplug_executor.ready && !hid_hotplug_executor.stopping) {
+			hidapi_thread_cond_wait(&hid_hotplug_executor.state);
+		}
+
+		struct hid_hotplug_callback *callback = hid_hotplug_executor.ready;
+		if (!callback) {
+			break;
+		}
+		hid_hotplug_executor.ready = callback->ready_next;
+		if (!hid_hotplug_executor.ready) {
+			hid_hotplug_executor.ready_tail = NULL;
+		}
+
+		/* The tasks of a deregistered callback are dropped, its queue may be empty */
+		struct hid_hotplug_task *task = callback->tasks;
+		if (task) {
+			callback->tasks = task->next;
+			if (!callback->tasks) {
+				callback->tasks_tail = NULL;
+			}
+
+			/* The callback stays allocated while it is scheduled */
+			hidapi_thread_mutex_unlock(&hid_hotplug_executor.state);
+
+			int result = 0;
+			if (!hid_internal_callback_removed(callback)) {
+				result = callback->callback(callback->handle, task->snapshot->info, task->event, callback->user_data);
+			}
+			if (result && !task->replay) {
+				hid_hotplug_deregister_callback(callback->handle);
+			}
+
+			hidapi_thread_mutex_lock(&hid_hotplug_executor.state);
+
+			hid_internal_snapshot_release(task->snapshot);
+			free(task);
+		}
 
-		/* Initialize the mutex as recursive */
-		pthread_mutexattr_t attr;
-		pthread_mutexattr_init(&attr);
-		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-		pthread_mutex_init(&hid_hotplug_context.mutex, &attr);
-		pthread_mutexattr_destroy(&attr);
+		if (hid_hotplug_executor.discard) {
+			hid_internal_executor_drop_tasks(callback);
+		}
 
-		/* Set state to Ready */
-		hid_hotplug_context.mutex_ready = 1;
-		hid_hotplug_context.mutex_in_use = 0;
-		hid_hotplug_context.cb_list_dirty = 0;
+		if (callback->detached) {
+			hid_internal_callback_destroy(callback);
+		}
+		else if (callback->tasks) {
+			/* Go to the back of the queue, so that a busy callback doesn't starve the others */
+			callback->ready_next = NULL;
+			if (hid_hotplug_executor.ready_tail) {
+				hid_hotplug_executor.ready_tail->ready_next = callback;
+			}
+			else {
+				hid_hotplug_executor.ready = callback;
+			}
+			hid_hotplug_executor.ready_tail = callback;
+		}
+		else {
+			callback->scheduled = 0;
+		}
 	}
+
+	hidapi_thread_mutex_unlock(&hid_hotplug_executor.state);
+
+	return NULL;
 }
 
-static void hid_internal_hotplug_exit()
+/* Stop the threads after they have run the queued tasks, or with discard set,
+ * after the calls in progress. Must not be called from a callback. */
+static void hid_internal_executor_stop(int discard)
 {
-	if (!hid_hotplug_context.mutex_ready) {
+	hidapi_thread_mutex_lock(&hid_hotplug_executor.state);
+
+	if (hid_hotplug_executor.num_threads == 0) {
+		hidapi_thread_mutex_unlock(&hid_hotplug_executor.state);
 		return;
 	}
 
-	pthread_mutex_lock(&hid_hotplug_context.mutex);
-	struct hid_hotplug_callback **current = &hid_hotplug_context.hotplug_cbs;
-	/* Remove all callbacks from the list */
-	while (*current) {
-		struct hid_hotplug_callback* next = (*current)->next;
-		free(*current);
-		*current = next;
+	if (discard) {
+		for (struct hid_hotplug_callback *callback = hid_hotplug_executor.ready; callback; callback = callback->ready_next) {
+			hid_internal_executor_drop_tasks(callback);
+		}
 	}
-	hid_internal_hotplug_cleanup();
-	pthread_mutex_unlock(&hid_hotplug_context.mutex);
-	hid_hotplug_context.mutex_ready = 0;
-	pthread_mutex_destroy(&hid_hotplug_context.mutex);
 
-	hidapi_thread_state_destroy(&hid_hotplug_context.callback_thread);
-	hidapi_thread_state_destroy(&hid_hotplug_context.libusb_thread);
+	hid_hotplug_executor.stopping = 1;
+	hid_hotplug_executor.discard = discard ? 1 : 0;
+	hidapi_thread_cond_broadcast(&hid_hotplug_executor.state);
+	hidapi_thread_mutex_unlock(&hid_hotplug_executor.state);
+
+	for (unsigned int i = 0; i < hid_hotplug_executor.num_threads; i++) {
+		hidapi_thread_join(&hid_hotplug_executor.threads[i]);
+		hidapi_thread_state_destroy(&hid_hotplug_executor.threads[i]);
+	}
+
+	hidapi_thread_mutex_lock(&hid_hotplug_executor.state);
+	free(hid_hotplug_executor.threads);
+	hid_hotplug_executor.threads = NULL;
+	hid_hotplug_executor.num_threads = 0;
+	hid_hotplug_executor.stopping = 0;
+	hid_hotplug_executor.discard = 0;
+	hidapi_thread_mutex_unlock(&hid_hotplug_executor.state);
 }
 
-int HID_API_EXPORT hid_init(void)
+static int hid_internal_executor_start(unsigned int num_threads)
 {
-	if (!usb_context) {
-		const char *locale;
+	hidapi_thread_state *threads = (hidapi_thread_state*)calloc(num_threads, sizeof(hidapi_thread_state));
+	unsigned int started = 0;
 
-		/* Init Libusb */
-		if (libusb_init(&usb_context))
-			return -1;
+	if (!threads) {
+		return -1;
+	}
 
-		/* Set the locale if it's not set. */
-		locale = setlocale(LC_CTYPE, NULL);
-		if (!locale)
-			setlocale(LC_CTYPE, "");
+	/* Only the threads that were created are published, and joined by hid_internal_executor_stop() */
+	hidapi_thread_mutex_lock(&hid_hotplug_executor.state);
+	while (started < num_threads) {
+		hidapi_thread_state_init(&threads[started]);
+		if (hidapi_thread_create(&threads[started], hid_internal_executor_thread, NULL) != 0) {
+			hidapi_thread_state_destroy(&threads[started]);
+			break;
+		}
+		started++;
+	}
+	if (started == 0) {
+		free(threads);
+		threads = NULL;
+	}
+	hid_hotplug_executor.threads = threads;
+	hid_hotplug_executor.num_threads = started;
+	hidapi_thread_mutex_unlock(&hid_hotplug_executor.state);
+
+	if (started < num_threads) {
+		hid_internal_executor_stop(0);
+		return -1;
 	}
 
 	return 0;
 }
 
-int HID_API_EXPORT hid_exit(void)
+/* Lock the executor mutex if the callbacks are to be queued instead of invoked.
+ * Returns 1 with the mutex locked, and 0 if the callbacks are invoked inline. */
+static int hid_internal_executor_lock(void)
 {
-	if (usb_context) {
-		libusb_exit(usb_context);
-		usb_context = NULL;
-		hid_internal_hotplug_exit();
+	hidapi_thread_mutex_lock(&hid_hotplug_executor.state);
+	if (hid_hotplug_executor.num_threads != 0 && !hid_hotplug_executor.stopping) {
+		return 1;
 	}
-
+	hidapi_thread_mutex_unlock(&hid_hotplug_executor.state);
 	return 0;
 }
 
-static int hid_internal_match_device_id(unsigned short vendor_id, unsigned short product_id, unsigned short expected_vendor_id, unsigned short expected_product_id)
-{
-	return (expected_vendor_id == 0x0 || vendor_id == expected_vendor_id) && (expected_product_id == 0x0 || product_id == expected_product_id);
-}
+/* A snapshot of the registered callbacks, never modified once published.
+ * callback_thread takes a reference to the current set for each event and invokes
+ * the callbacks without any lock held; hid_hotplug_register_callback() and
+ * hid_hotplug_deregister_callback() build a new set and replace the current one. */
+struct hid_hotplug_callback_set {
+	size_t refs;
+
+	/* The callbacks in registration order */
+	struct hid_hotplug_callback **callbacks;
+	size_t num_callbacks;
+
+	/* Index of callbacks, so that an event only visits the callbacks that can match it.
+	 * The callbacks are hashed by (vendor_id, product_id), a 0 being part of the key;
+	 * those of bucket i are chain[bucket_start[i]] to chain[bucket_start[i + 1] - 1],
+	 * in registration order */
+	struct hid_hotplug_callback **chain;
+	size_t *bucket_start;
+	size_t bucket_count;
+};
 
-static int hid_get_report_descriptor_libusb(libusb_device_handle *handle, int interface_num, uint16_t expected_report_descriptor_size, unsigned char *buf, size_t buf_size)
+static void hid_internal_callback_unref(struct hid_hotplug_callback *callback)
 {
-	unsigned char tmp[HID_API_MAX_REPORT_DESCRIPTOR_SIZE];
+	size_t refs;
 
-	if (expected_report_descriptor_size > HID_API_MAX_REPORT_DESCRIPTOR_SIZE)
-		expected_report_descriptor_size = HID_API_MAX_REPORT_DESCRIPTOR_SIZE;
+	pthread_mutex_lock(&hid_hotplug_context.callbacks_lock);
+	refs = --callback->refs;
+	pthread_mutex_unlock(&hid_hotplug_context.callbacks_lock);
 
-	/* Get the HID Report Descriptor.
-	   See USB HID Specification, section 7.1.1
-	*/
-	int res = libusb_control_transfer(handle, LIBUSB_ENDPOINT_IN|LIBUSB_RECIPIENT_INTERFACE, LIBUSB_REQUEST_GET_DESCRIPTOR, (LIBUSB_DT_REPORT << 8), interface_num, tmp, expected_report_descriptor_size, 5000);
-	if (res < 0) {
-		LOG("libusb_control_transfer() for getting the HID Report descriptor failed with %d: %s\n", res, libusb_error_name(res));
-		return -1;
+	if (refs == 0) {
+		hid_internal_callback_free(callback);
 	}
-
-	if (res > (int)buf_size)
-		res = (int)buf_size;
-
-	memcpy(buf, tmp, (size_t)res);
-	return res;
 }
 
-/**
- * Requires an opened device with *claimed interface*.
- */
-static void fill_device_info_usage(struct hid_device_info *cur_dev, libusb_device_handle *handle, int interface_num, uint16_t expected_report_descriptor_size)
+static size_t hid_internal_callback_bucket(const struct hid_hotplug_callback_set *set, unsigned short vendor_id, unsigned short product_id)
 {
-	unsigned char hid_report_descriptor[HID_API_MAX_REPORT_DESCRIPTOR_SIZE];
-	unsigned short page = 0, usage = 0;
+	unsigned int hash = (((unsigned int)vendor_id << 16) | product_id) * 0x9E3779B1u;
+	return (hash ^ (hash >> 16)) & (set->bucket_count - 1);
+}
 
-	int res = hid_get_report_descriptor_libusb(handle, interface_num, expected_report_descriptor_size, hid_report_descriptor, sizeof(hid_report_descriptor));
-	if (res >= 0) {
-		/* Parse the usage and usage page
-		   out of the report descriptor. */
-		get_usage(hid_report_descriptor, res,  &page, &usage);
+/* Build a set with the callbacks of old which are not removed, and callback (optionally NULL).
+ * *result is NULL if no callbacks are left. Called with the mutex held. */
+static int hid_internal_callback_set_build(const struct hid_hotplug_callback_set *old, struct hid_hotplug_callback *callback, struct hid_hotplug_callback_set **result)
+{
+	struct hid_hotplug_callback_set *set;
+	size_t num_callbacks = callback ? 1 : 0;
+	size_t bucket_count = 16;
+	size_t i;
+
+	if (old) {
+		for (i = 0; i < old->num_callbacks; i++) {
+			if (!old->callbacks[i]->removed) {
+				num_callbacks++;
+			}
+		}
+	}
+
+	if (num_callbacks == 0) {
+		*result = NULL;
+		return 0;
+	}
+
+	while (bucket_count < num_callbacks) {
+		bucket_count *= 2;
+	}
+
+	set = (struct hid_hotplug_callback_set*)calloc(1, sizeof(struct hid_hotplug_callback_set) + 2 * num_callbacks * sizeof(struct hid_hotplug_callback*) + (bucket_count + 1) * sizeof(size_t));
+	if (!set) {
+		return -1;
+	}
+
+	set->refs = 1;
+	set->callbacks = (struct hid_hotplug_callback**)(set + 1);
+	set->chain = set->callbacks + num_callbacks;
+	set->bucket_start = (size_t*)(set->chain + num_callbacks);
+	set->bucket_count = bucket_count;
+
+	if (old) {
+		for (i = 0; i < old->num_callbacks; i++) {
+			if (!old->callbacks[i]->removed) {
+				set->callbacks[set->num_callbacks++] = old->callbacks[i];
+			}
+		}
+	}
+	if (callback) {
+		set->callbacks[set->num_callbacks++] = callback;
+	}
+
+	/* Counting sort by bucket, which keeps the registration order within the buckets */
+	for (i = 0; i < num_callbacks; i++) {
+		set->bucket_start[hid_internal_callback_bucket(set, set->callbacks[i]->vendor_id, set->callbacks[i]->product_id) + 1]++;
+	}
+	for (i = 0; i < bucket_count; i++) {
+		set->bucket_start[i + 1] += set->bucket_start[i];
+	}
+	for (i = 0; i < num_callbacks; i++) {
+		size_t bucket = hid_internal_callback_bucket(set, set->callbacks[i]->vendor_id, set->callbacks[i]->product_id);
+		/* bucket_start[bucket] is used as the insert position, and ends up as the start of the next bucket */
+		set->chain[set->bucket_start[bucket]++] = set->callbacks[i];
+	}
+	for (i = bucket_count; i > 0; i--) {
+		set->bucket_start[i] = set->bucket_start[i - 1];
+	}
+	set->bucket_start[0] = 0;
+
+	pthread_mutex_lock(&hid_hotplug_context.callbacks_lock);
+	for (i = 0; i < num_callbacks; i++) {
+		set->callbacks[i]->refs++;
+	}
+	pthread_mutex_unlock(&hid_hotplug_context.callbacks_lock);
+
+	*result = set;
+	return 0;
+}
+
+static void hid_internal_callback_set_release(struct hid_hotplug_callback_set *set)
+{
+	size_t num_unused = 0;
+
+	if (!set) {
+		return;
+	}
+
+	pthread_mutex_lock(&hid_hotplug_context.callbacks_lock);
+	if (--set->refs != 0) {
+		pthread_mutex_unlock(&hid_hotplug_context.callbacks_lock);
+		return;
+	}
+	/* Gather the callbacks that no other set contains, they are freed without the lock */
+	for (size_t i = 0; i < set->num_callbacks; i++) {
+		if (--set->callbacks[i]->refs == 0) {
+			set->callbacks[num_unused++] = set->callbacks[i];
+		}
+	}
+	pthread_mutex_unlock(&hid_hotplug_context.callbacks_lock);
+
+	for (size_t i = 0; i < num_unused; i++) {
+		hid_internal_callback_free(set->callbacks[i]);
+	}
+	free(set);
+}
+
+/* Take a reference to the current set of callbacks, NULL if there are none */
+static struct hid_hotplug_callback_set *hid_internal_callback_set_acquire(void)
+{
+	struct hid_hotplug_callback_set *set;
+
+	pthread_mutex_lock(&hid_hotplug_context.callbacks_lock);
+	set = hid_hotplug_context.callbacks;
+	if (set) {
+		set->refs++;
+	}
+	pthread_mutex_unlock(&hid_hotplug_context.callbacks_lock);
+
+	return set;
+}
+
+/* Replace the current set of callbacks. Called with the mutex held. */
+static void hid_internal_callback_set_publish(struct hid_hotplug_callback_set *set)
+{
+	struct hid_hotplug_callback_set *old;
+
+	pthread_mutex_lock(&hid_hotplug_context.callbacks_lock);
+	old = hid_hotplug_context.callbacks;
+	hid_hotplug_context.callbacks = set;
+	pthread_mutex_unlock(&hid_hotplug_context.callbacks_lock);
+
+	/* The readers that still use it hold their own references */
+	hid_internal_callback_set_release(old);
+}
+
+/* The records of the interfaces of one USB device share the "<bus>-<port>.<port>..." part of their paths */
+static size_t hid_internal_device_key_length(const char *path)
+{
+	return strcspn(path, ":");
+}
+
+/* The records that one device contributed to devs. devs is the concatenation of the records
+ * of the registered devices, in this order; the devices are also hashed by their key */
+struct hid_hotplug_device {
+	struct hid_device_info *first;
+	struct hid_device_info *last;
+	unsigned int hash;
+
+	struct hid_hotplug_device *prev;
+	struct hid_hotplug_device *next;
+
+	/* Next device in the same bucket of the registry */
+	struct hid_hotplug_device *bucket_next;
+};
+
+static unsigned int hid_internal_device_key_hash(const char *key, size_t length)
+{
+	/* FNV-1a */
+	unsigned int hash = 2166136261u;
+	for (size_t i = 0; i < length; i++) {
+		hash = (hash ^ (unsigned char)key[i]) * 16777619u;
+	}
+	return hash;
+}
+
+static void hid_internal_devices_bucket_link(struct hid_hotplug_device *device)
+{
+	struct hid_hotplug_device **bucket = &hid_hotplug_context.dev_buckets[device->hash & (hid_hotplug_context.dev_bucket_count - 1)];
+	device->bucket_next = *bucket;
+	*bucket = device;
+}
+
+/* Keep at most one device per bucket on average */
+static void hid_internal_devices_reserve()
+{
+	size_t bucket_count = hid_hotplug_context.dev_bucket_count;
+
+	if (hid_hotplug_context.num_devices < bucket_count) {
+		return;
+	}
+
+	struct hid_hotplug_device **buckets = (struct hid_hotplug_device**)calloc(bucket_count ? bucket_count * 2 : 64, sizeof(struct hid_hotplug_device*));
+	if (buckets == NULL) {
+		return;
+	}
+
+	free(hid_hotplug_context.dev_buckets);
+	hid_hotplug_context.dev_buckets = buckets;
+	hid_hotplug_context.dev_bucket_count = bucket_count ? bucket_count * 2 : 64;
+
+	for (struct hid_hotplug_device *device = hid_hotplug_context.first_device; device != NULL; device = device->next) {
+		hid_internal_devices_bucket_link(device);
+	}
+}
+
+/* Append the records of one device to devs.
+ * Called with devs_lock locked for writing. On failure, the records are left to the caller. */
+static int hid_internal_devices_append(struct hid_device_info *info)
+{
+	struct hid_hotplug_device *device;
+
+	hid_internal_devices_reserve();
+	if (hid_hotplug_context.dev_bucket_count == 0) {
+		return -1;
+	}
+
+	device = (struct hid_hotplug_device*)calloc(1, sizeof(struct hid_hotplug_device));
+	if (device == NULL) {
+		return -1;
+	}
+
+	device->first = info;
+	device->last = info;
+	while (device->last->next != NULL) {
+		device->last = device->last->next;
+	}
+	device->hash = hid_internal_device_key_hash(info->path, hid_internal_device_key_length(info->path));
+
+	device->prev = hid_hotplug_context.last_device;
+	if (device->prev != NULL) {
+		device->prev->last->next = info;
+		device->prev->next = device;
+	}
+	else {
+		hid_hotplug_context.devs = info;
+		hid_hotplug_context.first_device = device;
+	}
+	hid_hotplug_context.last_device = device;
+
+	hid_internal_devices_bucket_link(device);
+	hid_hotplug_context.num_devices++;
+
+	return 0;
+}
+
+/* Detach the records of the devices registered under this key from devs and return them.
+ * Called with devs_lock locked for writing. */
+static struct hid_device_info *hid_internal_devices_remove(const char *key, size_t length)
+{
+	struct hid_device_info *removed = NULL;
+	struct hid_device_info **removed_tail = &removed;
+
+	if (hid_hotplug_context.dev_bucket_count == 0) {
+		return NULL;
+	}
+
+	unsigned int hash = hid_internal_device_key_hash(key, length);
+	struct hid_hotplug_device **bucket = &hid_hotplug_context.dev_buckets[hash & (hid_hotplug_context.dev_bucket_count - 1)];
+
+	while (*bucket) {
+		struct hid_hotplug_device *device = *bucket;
+
+		if (device->hash != hash || hid_internal_device_key_length(device->first->path) != length || memcmp(device->first->path, key, length)) {
+			bucket = &device->bucket_next;
+			continue;
+		}
+
+		*bucket = device->bucket_next;
+
+		/* Its records are contiguous in devs: unlink them at once */
+		if (device->prev != NULL) {
+			device->prev->last->next = device->last->next;
+			device->prev->next = device->next;
+		}
+		else {
+			hid_hotplug_context.devs = device->last->next;
+			hid_hotplug_context.first_device = device->next;
+		}
+		if (device->next != NULL) {
+			device->next->prev = device->prev;
+		}
+		else {
+			hid_hotplug_context.last_device = device->prev;
+		}
+
+		device->last->next = NULL;
+		*removed_tail = device->first;
+		removed_tail = &device->last->next;
+
+		free(device);
+		hid_hotplug_context.num_devices--;
+	}
+
+	return removed;
+}
+
+/* Register the records of a full enumeration, in which those of a device are next to each other.
+ * Called with devs_lock locked for writing. */
+static void hid_internal_devices_set(struct hid_device_info *devs)
+{
+	while (devs != NULL) {
+		struct hid_device_info *last = devs;
+		size_t length = hid_internal_device_key_length(devs->path);
+
+		while (last->next != NULL && hid_internal_device_key_length(last->next->path) == length && !memcmp(last->next->path, devs->path, length)) {
+			last = last->next;
+		}
+
+		struct hid_device_info *rest = last->next;
+		last->next = NULL;
+		if (hid_internal_devices_append(devs) < 0) {
+			hid_free_enumeration(devs);
+		}
+		devs = rest;
+	}
+}
+
+/* Free devs and the registry. Called with devs_lock locked for writing. */
+static void hid_internal_devices_clear()
+{
+	struct hid_hotplug_device *device = hid_hotplug_context.first_device;
+	while (device != NULL) {
+		struct hid_hotplug_device *next = device->next;
+		free(device);
+		device = next;
+	}
+
+	free(hid_hotplug_context.dev_buckets);
+	hid_hotplug_context.dev_buckets = NULL;
+	hid_hotplug_context.dev_bucket_count = 0;
+	hid_hotplug_context.num_devices = 0;
+	hid_hotplug_context.first_device = NULL;
+	hid_hotplug_context.last_device = NULL;
+
+	hid_free_enumeration(hid_hotplug_context.devs);
+	hid_hotplug_context.devs = NULL;
+}
+
+/* 0x01000105 is a LIBUSB_API_VERSION for 1.0.21 - version when libusb_interrupt_event_handler was introduced */
+#if (!defined(HIDAPI_TARGET_LIBUSB_API_VERSION) || HIDAPI_TARGET_LIBUSB_API_VERSION >= 0x01000105) && (LIBUSB_API_VERSION >= 0x01000105)
+#define HIDAPI_LIBUSB_HAS_INTERRUPT_EVENT_HANDLER
+#endif
+
+/* Whether the hotplug threads have to keep running */
+static int hid_internal_hotplug_needed(void)
+{
+	int needed;
+
+	pthread_mutex_lock(&hid_hotplug_context.callbacks_lock);
+	needed = hid_hotplug_context.callbacks != NULL;
+	pthread_mutex_unlock(&hid_hotplug_context.callbacks_lock);
+
+	return needed || hid_hotplug_context.enumerate_cache;
+}
+
+/* Make callback_thread check whether the threads still have to run.
+ * Called with the mutex held, after any change that can make them stop. */
+static void hid_internal_hotplug_wake()
+{
+	if (!hid_hotplug_context.monitor_running) {
+		return;
+	}
+
+#ifdef __linux__
+	if (hid_hotplug_context.external) {
+		/* Makes epoll_fd readable until hid_hotplug_handle_events() is called */
+		uint64_t value = 1;
+		ssize_t res = write(hid_hotplug_context.wakeup_fd, &value, sizeof(value));
+		(void) res;
+		return;
+	}
+#endif
+
+	hidapi_thread_mutex_lock(&hid_hotplug_context.callback_thread);
+	hidapi_thread_cond_signal(&hid_hotplug_context.callback_thread);
+	hidapi_thread_mutex_unlock(&hid_hotplug_context.callback_thread);
+}
+
+/* Called by callback_thread, between two events, when the threads aren't needed anymore.
+ * Returns 1 if they have to leave, and 0 if they were needed again in the meantime.
+ * The decision is taken with the mutex held, so that hid_internal_hotplug_start()
+ * either sees the threads leaving or has them keep running. */
+static int hid_internal_hotplug_leave()
+{
+	int leave;
+
+	pthread_mutex_lock(&hid_hotplug_context.mutex);
+	leave = !hid_internal_hotplug_needed();
+	if (leave) {
+		/* Events aren't processed anymore */
+		pthread_rwlock_wrlock(&hid_hotplug_context.devs_lock);
+		hid_hotplug_context.devs_valid = 0;
+		pthread_rwlock_unlock(&hid_hotplug_context.devs_lock);
+
+		hidapi_thread_mutex_lock(&hid_hotplug_context.callback_thread);
+		hid_hotplug_context.monitor_exited = 1;
+		hidapi_thread_mutex_unlock(&hid_hotplug_context.callback_thread);
+	}
+	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+
+	return leave;
+}
+
+/* Free the hotplug context and devs, once no event can come anymore */
+static void hid_internal_hotplug_close()
+{
+	hid_hotplug_context.monitor_running = 0;
+
+	libusb_exit(hid_hotplug_context.context);
+	hid_hotplug_context.context = NULL;
+
+	pthread_rwlock_wrlock(&hid_hotplug_context.devs_lock);
+	hid_hotplug_context.devs_valid = 0;
+	hid_internal_devices_clear();
+	pthread_rwlock_unlock(&hid_hotplug_context.devs_lock);
+}
+
+/* Join the hotplug threads, which have left their loops or are about to, and free
+ * what they kept. Once callback_thread has decided to leave neither thread takes the mutex,
+ * so this can be called with the mutex held. */
+static void hid_internal_hotplug_join()
+{
+	hidapi_thread_join(&hid_hotplug_context.libusb_thread);
+	hid_internal_hotplug_close();
+}
+
+/* Drop the events that are still queued: devs is enumerated again when
+ * the hotplug context is opened again */
+static void hid_internal_hotplug_drop_queue()
+{
+	hidapi_thread_mutex_lock(&hid_hotplug_context.callback_thread);
+	struct hid_hotplug_queue *queue = hid_hotplug_context.queue;
+	hid_hotplug_context.queue = NULL;
+	hid_hotplug_context.queue_tail = NULL;
+	hidapi_thread_mutex_unlock(&hid_hotplug_context.callback_thread);
+
+	while (queue) {
+		struct hid_hotplug_queue *next = queue->next;
+		libusb_unref_device(queue->device);
+		free(queue);
+		queue = next;
+	}
+}
+
+#ifdef __linux__
+static void hid_internal_free_pollfds(const struct libusb_pollfd **pollfds)
+{
+/* 0x01000104 is a LIBUSB_API_VERSION for 1.0.20 - version when libusb_free_pollfds was introduced */
+#if LIBUSB_API_VERSION >= 0x01000104
+	libusb_free_pollfds(pollfds);
+#else
+	free(pollfds);
+#endif
+}
+
+static int hid_internal_hotplug_pollfd_add(int fd, short events)
+{
+	struct epoll_event event;
+
+	memset(&event, 0, sizeof(event));
+	event.events = ((events & POLLIN) ? EPOLLIN : 0) | ((events & POLLOUT) ? EPOLLOUT : 0);
+	event.data.fd = fd;
+	if (epoll_ctl(hid_hotplug_context.epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0 && errno != EEXIST) {
+		LOG("epoll_ctl failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* libusb's pollfd notifiers, called when the hotplug context opens or closes a file descriptor */
+static void hid_internal_hotplug_pollfd_added(int fd, short events, void *user_data)
+{
+	(void) user_data;
+	hid_internal_hotplug_pollfd_add(fd, events);
+}
+
+static void hid_internal_hotplug_pollfd_removed(int fd, void *user_data)
+{
+	(void) user_data;
+	epoll_ctl(hid_hotplug_context.epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+/* Add the file descriptors of the hotplug context to epoll_fd, and keep them in sync.
+ * Called with the mutex held. */
+static int hid_internal_hotplug_watch_pollfds()
+{
+	const struct libusb_pollfd **pollfds = libusb_get_pollfds(hid_hotplug_context.context);
+	int res = 0;
+
+	if (!pollfds) {
+		return -1;
+	}
+
+	libusb_set_pollfd_notifiers(hid_hotplug_context.context, hid_internal_hotplug_pollfd_added, hid_internal_hotplug_pollfd_removed, NULL);
+
+	for (size_t i = 0; pollfds[i] != NULL && res == 0; i++) {
+		res = hid_internal_hotplug_pollfd_add(pollfds[i]->fd, pollfds[i]->events);
+	}
+
+	hid_internal_free_pollfds(pollfds);
+
+	return res;
+}
+
+static void hid_internal_hotplug_unwatch_pollfds()
+{
+	const struct libusb_pollfd **pollfds;
+
+	libusb_set_pollfd_notifiers(hid_hotplug_context.context, NULL, NULL, NULL);
+
+	pollfds = libusb_get_pollfds(hid_hotplug_context.context);
+	if (pollfds) {
+		for (size_t i = 0; pollfds[i] != NULL; i++) {
+			epoll_ctl(hid_hotplug_context.epoll_fd, EPOLL_CTL_DEL, pollfds[i]->fd, NULL);
+		}
+		hid_internal_free_pollfds(pollfds);
+	}
+}
+
+/* The counterpart of hid_internal_hotplug_join() after hid_hotplug_get_fd(), where no thread
+ * was started. Called with the mutex held, by the thread that handles the events or by hid_exit(). */
+static void hid_internal_hotplug_stop_external()
+{
+	hid_internal_hotplug_unwatch_pollfds();
+	libusb_hotplug_deregister_callback(hid_hotplug_context.context, hid_hotplug_context.callback_handle);
+	hid_internal_hotplug_drop_queue();
+	hid_internal_hotplug_close();
+}
+#endif
+
+/* Initialize the thread states on first use. Called with the mutex held. */
+static void hid_internal_hotplug_init()
+{
+	if (!hid_hotplug_context.thread_states_ready) {
+		hidapi_thread_state_init(&hid_hotplug_context.libusb_thread);
+		hidapi_thread_state_init(&hid_hotplug_context.callback_thread);
+		hidapi_thread_state_init(&hid_hotplug_executor.state);
+
+		hid_hotplug_context.thread_states_ready = 1;
+	}
+}
+
+static void hid_internal_hotplug_exit()
+{
+	struct hid_hotplug_callback_set *set;
+	unsigned char running;
+
+	if (!hid_hotplug_context.thread_states_ready) {
+		return;
+	}
+
+	/* The executor threads may deregister callbacks, stop them before taking the mutex */
+	hid_internal_executor_stop(1);
+
+	pthread_mutex_lock(&hid_hotplug_context.mutex);
+	pthread_rwlock_wrlock(&hid_hotplug_context.devs_lock);
+	hid_hotplug_context.enumerate_cache = 0;
+	pthread_rwlock_unlock(&hid_hotplug_context.devs_lock);
+	/* Remove all callbacks, the ones being invoked are freed once their calls return */
+	set = hid_hotplug_context.callbacks;
+	if (set) {
+		pthread_mutex_lock(&hid_hotplug_context.callbacks_lock);
+		for (size_t i = 0; i < set->num_callbacks; i++) {
+			set->callbacks[i]->removed = 1;
+		}
+		pthread_mutex_unlock(&hid_hotplug_context.callbacks_lock);
+	}
+	hid_internal_callback_set_publish(NULL);
+	hid_internal_hotplug_wake();
+	running = hid_hotplug_context.monitor_running;
+#ifdef __linux__
+	if (hid_hotplug_context.external) {
+		/* Without the threads, the hotplug context is closed right away */
+		if (running) {
+			hid_internal_hotplug_stop_external();
+			running = 0;
+		}
+		close(hid_hotplug_context.epoll_fd);
+		close(hid_hotplug_context.wakeup_fd);
+		hid_hotplug_context.epoll_fd = -1;
+		hid_hotplug_context.wakeup_fd = -1;
+		hid_hotplug_context.external = 0;
+	}
+#endif
+	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+
+	/* A callback being invoked by callback_thread may still take the mutex */
+	if (running) {
+		hid_internal_hotplug_join();
+	}
+
+	pthread_mutex_lock(&hid_hotplug_context.mutex);
+	hidapi_thread_state_destroy(&hid_hotplug_executor.state);
+	hidapi_thread_state_destroy(&hid_hotplug_context.callback_thread);
+	hidapi_thread_state_destroy(&hid_hotplug_context.libusb_thread);
+	hid_hotplug_context.thread_states_ready = 0;
+	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+}
+
+int HID_API_EXPORT hid_init(void)
+{
+	if (!usb_context) {
+		const char *locale;
+
+		/* Init Libusb */
+		if (libusb_init(&usb_context))
+			return -1;
+
+		/* Set the locale if it's not set. */
+		locale = setlocale(LC_CTYPE, NULL);
+		if (!locale)
+			setlocale(LC_CTYPE, "");
+	}
+
+	return 0;
+}
+
+int HID_API_EXPORT hid_exit(void)
+{
+	if (usb_context) {
+		libusb_exit(usb_context);
+		usb_context = NULL;
+		hid_internal_hotplug_exit();
+	}
+
+	return 0;
+}
+
+static int hid_internal_match_device_id(unsigned short vendor_id, unsigned short product_id, unsigned short expected_vendor_id, unsigned short expected_product_id)
+{
+	return (expected_vendor_id == 0x0 || vendor_id == expected_vendor_id) && (expected_product_id == 0x0 || product_id == expected_product_id);
+}
+
+static int hid_get_report_descriptor_libusb(libusb_device_handle *handle, int interface_num, uint16_t expected_report_descriptor_size, unsigned char *buf, size_t buf_size)
+{
+	unsigned char tmp[HID_API_MAX_REPORT_DESCRIPTOR_SIZE];
+
+	if (expected_report_descriptor_size > HID_API_MAX_REPORT_DESCRIPTOR_SIZE)
+		expected_report_descriptor_size = HID_API_MAX_REPORT_DESCRIPTOR_SIZE;
+
+	/* Get the HID Report Descriptor.
+	   See USB HID Specification, section 7.1.1
+	*/
+	int res = libusb_control_transfer(handle, LIBUSB_ENDPOINT_IN|LIBUSB_RECIPIENT_INTERFACE, LIBUSB_REQUEST_GET_DESCRIPTOR, (LIBUSB_DT_REPORT << 8), interface_num, tmp, expected_report_descriptor_size, 5000);
+	if (res < 0) {
+		LOG("libusb_control_transfer() for getting the HID Report descriptor failed with %d: %s\n", res, libusb_error_name(res));
+		return -1;
+	}
+
+	if (res > (int)buf_size)
+		res = (int)buf_size;
+
+	memcpy(buf, tmp, (size_t)res);
+	return res;
+}
+
+/**
+ * Requires an opened device with *claimed interface*.
+ */
+static void fill_device_info_usage(struct hid_device_info *cur_dev, libusb_device_handle *handle, int interface_num, uint16_t expected_report_descriptor_size)
+{
+	unsigned char hid_report_descriptor[HID_API_MAX_REPORT_DESCRIPTOR_SIZE];
+	unsigned short page = 0, usage = 0;
+
+	int res = hid_get_report_descriptor_libusb(handle, interface_num, expected_report_descriptor_size, hid_report_descriptor, sizeof(hid_report_descriptor));
+	if (res >= 0) {
+		/* Parse the usage and usage page
+		   out of the report descriptor. */
+		get_usage(hid_report_descriptor, res,  &page, &usage);
 	}
 
 	cur_dev->usage_page = page;
@@ -793,6 +1942,53 @@ static struct hid_device_info * create_device_info_for_device(libusb_device *dev
 	return cur_dev;
 }
 
+/* Copy a single device info to a hid_device_info_utf8, converting its
+   strings, without the link to the next one */
+static struct hid_device_info_utf8 *copy_device_info_utf8(const struct hid_device_info *info)
+{
+	struct hid_device_info_utf8 *copy = (struct hid_device_info_utf8 *) calloc(1, sizeof(struct hid_device_info_utf8));
+	if (!copy)
+		return NULL;
+
+	copy->path = info->path ? strdup(info->path) : NULL;
+	copy->vendor_id = info->vendor_id;
+	copy->product_id = info->product_id;
+	copy->serial_number = wchar_t_to_utf8(info->serial_number);
+	copy->release_number = info->release_number;
+	copy->manufacturer_string = wchar_t_to_utf8(info->manufacturer_string);
+	copy->product_string = wchar_t_to_utf8(info->product_string);
+	copy->usage_page = info->usage_page;
+	copy->usage = info->usage;
+	copy->interface_number = info->interface_number;
+	copy->bus_type = info->bus_type;
+
+	return copy;
+}
+
+/**
+ * Create the hid_device_info_utf8 of a device, from the fields of its
+ * info created without strings. If handle isn't NULL, the strings are
+ * read from the device, as UTF-8.
+ */
+static struct hid_device_info_utf8 *create_device_info_utf8_for_device(const struct hid_device_info *info, libusb_device_handle *handle, struct libusb_device_descriptor *desc)
+{
+	struct hid_device_info_utf8 *cur_dev = copy_device_info_utf8(info);
+	if (cur_dev == NULL || !handle) {
+		return cur_dev;
+	}
+
+	if (desc->iSerialNumber > 0)
+		cur_dev->serial_number = get_usb_string_utf8(handle, desc->iSerialNumber);
+
+	/* Manufacturer and Product strings */
+	if (desc->iManufacturer > 0)
+		cur_dev->manufacturer_string = get_usb_string_utf8(handle, desc->iManufacturer);
+	if (desc->iProduct > 0)
+		cur_dev->product_string = get_usb_string_utf8(handle, desc->iProduct);
+
+	return cur_dev;
+}
+
 static uint16_t get_report_descriptor_size_from_interface_descriptors(const struct libusb_interface_descriptor *intf_desc)
 {
 	int i = 0;
@@ -947,10 +2143,13 @@ static int should_enumerate_interface(unsigned short vendor_id, const struct lib
 	return 0;
 }
 
-static struct hid_device_info* hid_enumerate_from_libusb(libusb_device *dev, unsigned short vendor_id, unsigned short product_id)
+/* Enumerate the HID interfaces of a device. When devs_utf8 isn't NULL,
+   the records are returned there with UTF-8 strings instead. */
+static struct hid_device_info* hid_enumerate_from_libusb(libusb_device *dev, const struct hid_enumerate_filter *filter, struct hid_device_info_utf8 **devs_utf8)
 {
 	struct hid_device_info *root = NULL; /* return object */
 	struct hid_device_info *cur_dev = NULL;
+	struct hid_device_info_utf8 *cur_dev_utf8 = NULL;
 	struct libusb_device_descriptor desc;
 	struct libusb_config_descriptor *conf_desc = NULL;
 	libusb_device_handle *handle = NULL;
@@ -963,11 +2162,21 @@ static struct hid_device_info* hid_enumerate_from_libusb(libusb_device *dev, uns
 	unsigned short dev_vid = desc.idVendor;
 	unsigned short dev_pid = desc.idProduct;
 
-	if ((vendor_id != 0x0 && vendor_id != dev_vid) ||
-		(product_id != 0x0 && product_id != dev_pid)) {
+	if (devs_utf8)
+		*devs_utf8 = NULL;
+
+	if (filter && ((filter->vendor_id != 0x0 && filter->vendor_id != dev_vid) ||
+		(filter->product_id != 0x0 && filter->product_id != dev_pid))) {
 		return NULL;
 	}
 
+	/* Without strings to read, the device doesn't even have to be opened */
+	int read_strings = !filter || !(filter->flags & HID_API_ENUMERATE_NO_STRINGS);
+	int need_handle = read_strings || filter->serial_number;
+#ifdef INVASIVE_GET_USAGE
+	need_handle = 1;
+#endif
+
 	res = libusb_get_active_config_descriptor(dev, &conf_desc);
 	if (res < 0)
 		libusb_get_config_descriptor(dev, 0, &conf_desc);
@@ -980,7 +2189,10 @@ static struct hid_device_info* hid_enumerate_from_libusb(libusb_device *dev, uns
 				if (should_enumerate_interface(dev_vid, intf_desc)) {
 					struct hid_device_info *tmp;
 
-					res = libusb_open(dev, &handle);
+					if (filter && filter->interface_number != -1 && filter->interface_number != intf_desc->bInterfaceNumber)
+						break;
+
+					res = need_handle ? libusb_open(dev, &handle) : LIBUSB_ERROR_NOT_SUPPORTED;
 
 #ifdef __ANDROID__
 					if (handle) {
@@ -995,7 +2207,21 @@ static struct hid_device_info* hid_enumerate_from_libusb(libusb_device *dev, uns
 					}
 #endif
 
-					tmp = create_device_info_for_device(dev, handle, &desc, conf_desc->bConfigurationValue, intf_desc->bInterfaceNumber);
+					/* Check the serial number before reading the other strings */
+					if (filter && filter->serial_number) {
+						wchar_t *serial_number = (handle && desc.iSerialNumber > 0) ? get_usb_string(handle, desc.iSerialNumber) : NULL;
+						int matches = serial_number && wcscmp(serial_number, filter->serial_number) == 0;
+						free(serial_number);
+						if (!matches) {
+							if (res >= 0) {
+								libusb_close(handle);
+								handle = NULL;
+							}
+							break;
+						}
+					}
+
+					tmp = create_device_info_for_device(dev, (read_strings && !devs_utf8) ? handle : NULL, &desc, conf_desc->bConfigurationValue, intf_desc->bInterfaceNumber);
 					if (tmp) {
 #ifdef INVASIVE_GET_USAGE
 						/* TODO: have a runtime check for this section. */
@@ -1022,6 +2248,33 @@ static struct hid_device_info* hid_enumerate_from_libusb(libusb_device *dev, uns
 						}
 #endif /* INVASIVE_GET_USAGE */
 
+						/* The usage is only known with INVASIVE_GET_USAGE, and 0 otherwise */
+						if (filter && ((filter->usage_page != 0 && filter->usage_page != tmp->usage_page) ||
+							(filter->usage != 0 && filter->usage != tmp->usage))) {
+							hid_free_enumeration(tmp);
+							tmp = NULL;
+						}
+					}
+
+					if (tmp && devs_utf8) {
+						struct hid_device_info_utf8 *tmp_utf8 = create_device_info_utf8_for_device(tmp, read_strings ? handle : NULL, &desc);
+
+						hid_free_enumeration(tmp);
+						tmp = NULL;
+
+						if (tmp_utf8) {
+							if (cur_dev_utf8) {
+								cur_dev_utf8->next = tmp_utf8;
+							}
+							else {
+								*devs_utf8 = tmp_utf8;
+							}
+							cur_dev_utf8 = tmp_utf8;
+						}
+					}
+
+					if (tmp) {
+
 						if (cur_dev) {
 							cur_dev->next = tmp;
 						}
@@ -1044,7 +2297,164 @@ static struct hid_device_info* hid_enumerate_from_libusb(libusb_device *dev, uns
 	return root;
 }
 
-struct hid_device_info HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+/* The work shared by the threads of a parallel hid_enumerate() */
+struct hid_enumerate_job {
+	hidapi_thread_state state; /* The mutex protects next */
+	libusb_device **devs;
+	size_t num_devs;
+	size_t next; /* The next device to be enumerated */
+	const struct hid_enumerate_filter *filter;
+	struct hid_device_info **results; /* The devices found on devs[i] are in results[i] */
+	struct hid_device_info_utf8 **results_utf8; /* Used instead of results if not NULL */
+};
+
+static void *enumerate_thread(void *param)
+{
+	struct hid_enumerate_job *job = (struct hid_enumerate_job *) param;
+
+	for (;;) {
+		size_t i;
+
+		hidapi_thread_mutex_lock(&job->state);
+		i = job->next++;
+		hidapi_thread_mutex_unlock(&job->state);
+
+		if (i >= job->num_devs)
+			break;
+
+		if (job->results_utf8)
+			hid_enumerate_from_libusb(job->devs[i], job->filter, &job->results_utf8[i]);
+		else
+			job->results[i] = hid_enumerate_from_libusb(job->devs[i], job->filter, NULL);
+	}
+
+	return NULL;
+}
+
+/* Enumerate the devices with num_threads threads, the calling one included.
+   Each thread takes the next device not yet taken, so a slow device
+   holds up only its own thread. The results are stored by device index,
+   so they can be merged in the same order as by a sequential enumeration.
+   Only one of results and results_utf8 is used, the other is NULL. */
+static int enumerate_parallel(libusb_device **devs, size_t num_devs, const struct hid_enumerate_filter *filter, unsigned int num_threads, struct hid_device_info **results, struct hid_device_info_utf8 **results_utf8)
+{
+	struct hid_enumerate_job job;
+	hidapi_thread_state *threads;
+	unsigned int num_started = 0;
+	unsigned int i;
+
+	threads = (hidapi_thread_state *) calloc(num_threads - 1, sizeof(hidapi_thread_state));
+	if (!threads)
+		return -1;
+
+	job.devs = devs;
+	job.num_devs = num_devs;
+	job.next = 0;
+	job.filter = filter;
+	job.results = results;
+	job.results_utf8 = results_utf8;
+	hidapi_thread_state_init(&job.state);
+
+	while (num_started < num_threads - 1) {
+		hidapi_thread_state_init(&threads[num_started]);
+		if (hidapi_thread_create(&threads[num_started], enumerate_thread, &job) != 0) {
+			hidapi_thread_state_destroy(&threads[num_started]);
+			break; /* carry on with the threads we have */
+		}
+		num_started++;
+	}
+
+	enumerate_thread(&job);
+
+	for (i = 0; i < num_started; i++) {
+		hidapi_thread_join(&threads[i]);
+		hidapi_thread_state_destroy(&threads[i]);
+	}
+
+	hidapi_thread_state_destroy(&job.state);
+	free(threads);
+
+	return 0;
+}
+
+static int hid_internal_match_filter(const struct hid_device_info *info, const struct hid_enumerate_filter *filter)
+{
+	return (filter->vendor_id == 0x0 || info->vendor_id == filter->vendor_id) &&
+		(filter->product_id == 0x0 || info->product_id == filter->product_id) &&
+		(filter->usage_page == 0x0 || info->usage_page == filter->usage_page) &&
+		(filter->usage == 0x0 || info->usage == filter->usage) &&
+		(filter->bus_type == HID_API_BUS_UNKNOWN || info->bus_type == filter->bus_type) &&
+		(filter->interface_number == -1 || info->interface_number == filter->interface_number) &&
+		(!filter->serial_number || (info->serial_number && wcscmp(info->serial_number, filter->serial_number) == 0));
+}
+
+static wchar_t *hid_internal_wcsdup(const wchar_t *s)
+{
+	return s ? wcsdup(s) : NULL;
+}
+
+/* Copy a single device info, without the link to the next one */
+static struct hid_device_info *hid_internal_copy_device_info(const struct hid_device_info *info, int with_strings)
+{
+	struct hid_device_info *copy = (struct hid_device_info*) calloc(1, sizeof(struct hid_device_info));
+	if (!copy)
+		return NULL;
+
+	*copy = *info;
+	copy->next = NULL;
+	copy->path = strdup(info->path);
+	copy->serial_number = with_strings ? hid_internal_wcsdup(info->serial_number) : NULL;
+	copy->manufacturer_string = with_strings ? hid_internal_wcsdup(info->manufacturer_string) : NULL;
+	copy->product_string = with_strings ? hid_internal_wcsdup(info->product_string) : NULL;
+
+	return copy;
+}
+
+/* Answer hid_enumerate() from the device list kept by the hotplug threads.
+   Returns -1 if the list isn't being kept up to date. */
+static int hid_enumerate_cached(const struct hid_enumerate_filter *filter, struct hid_device_info **devs)
+{
+	struct hid_device_info *root = NULL;
+	struct hid_device_info *cur_dev = NULL;
+	int with_strings = !filter || !(filter->flags & HID_API_ENUMERATE_NO_STRINGS);
+	const struct hid_enumerate_filter match_all = HID_API_ENUMERATE_FILTER_INIT;
+
+	if (!filter)
+		filter = &match_all;
+
+	pthread_rwlock_rdlock(&hid_hotplug_context.devs_lock);
+
+	if (!hid_hotplug_context.enumerate_cache || !hid_hotplug_context.devs_valid) {
+		pthread_rwlock_unlock(&hid_hotplug_context.devs_lock);
+		return -1;
+	}
+
+	for (const struct hid_device_info *info = hid_hotplug_context.devs; info; info = info->next) {
+		struct hid_device_info *tmp;
+
+		if (!hid_internal_match_filter(info, filter))
+			continue;
+
+		tmp = hid_internal_copy_device_info(info, with_strings);
+		if (!tmp)
+			continue;
+
+		if (cur_dev) {
+			cur_dev->next = tmp;
+		}
+		else {
+			root = tmp;
+		}
+		cur_dev = tmp;
+	}
+
+	pthread_rwlock_unlock(&hid_hotplug_context.devs_lock);
+
+	*devs = root;
+	return 0;
+}
+
+struct hid_device_info HID_API_EXPORT *hid_enumerate_ex(const struct hid_enumerate_filter *filter)
 {
 	libusb_device **devs;
 	libusb_device *dev;
@@ -1053,16 +2463,121 @@ struct hid_device_info HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, u
 
 	struct hid_device_info *root = NULL; /* return object */
 	struct hid_device_info *cur_dev = NULL;
+	struct hid_device_info **results = NULL;
+	unsigned int num_threads;
+
+	if (hid_init() < 0)
+		return NULL;
+
+	/* Only USB devices are enumerated by this backend */
+	if (filter && filter->bus_type != HID_API_BUS_UNKNOWN && filter->bus_type != HID_API_BUS_USB)
+		return NULL;
+
+	if (hid_enumerate_cached(filter, &root) == 0)
+		return root;
+
+	num_devs = libusb_get_device_list(usb_context, &devs);
+	if (num_devs < 0)
+		return NULL;
+
+	num_threads = enumerate_threads;
+	if ((size_t) num_devs < num_threads)
+		num_threads = (unsigned int) num_devs;
+
+	if (num_threads > 1) {
+		results = (struct hid_device_info **) calloc((size_t) num_devs, sizeof(struct hid_device_info *));
+		if (results && enumerate_parallel(devs, (size_t) num_devs, filter, num_threads, results, NULL) < 0) {
+			free(results);
+			results = NULL;
+		}
+	}
+
+	while ((dev = devs[i]) != NULL) {
+		struct hid_device_info *tmp = results ? results[i] : hid_enumerate_from_libusb(dev, filter, NULL);
+		i++;
+		if (cur_dev) {
+			cur_dev->next = tmp;
+		}
+		else {
+			root = tmp;
+			cur_dev = tmp;
+		}
+		/* Traverse to the end of newly attached tail */
+		if (cur_dev) {
+			while (cur_dev->next) {
+				cur_dev = cur_dev->next;
+			}
+		}
+	}
+
+	free(results);
+	libusb_free_device_list(devs, 1);
+
+	return root;
+}
+
+struct hid_device_info_utf8 HID_API_EXPORT *hid_enumerate_utf8(const struct hid_enumerate_filter *filter)
+{
+	libusb_device **devs;
+	libusb_device *dev;
+	ssize_t num_devs;
+	int i = 0;
+
+	struct hid_device_info_utf8 *root = NULL; /* return object */
+	struct hid_device_info_utf8 *cur_dev = NULL;
+	struct hid_device_info_utf8 **results = NULL;
+	struct hid_device_info *cached;
+	unsigned int num_threads;
 
 	if (hid_init() < 0)
 		return NULL;
 
+	/* Only USB devices are enumerated by this backend */
+	if (filter && filter->bus_type != HID_API_BUS_UNKNOWN && filter->bus_type != HID_API_BUS_USB)
+		return NULL;
+
+	/* The cached records have wide strings to convert */
+	if (hid_enumerate_cached(filter, &cached) == 0) {
+		for (const struct hid_device_info *info = cached; info; info = info->next) {
+			struct hid_device_info_utf8 *tmp = copy_device_info_utf8(info);
+			if (!tmp)
+				continue;
+			if (cur_dev) {
+				cur_dev->next = tmp;
+			}
+			else {
+				root = tmp;
+			}
+			cur_dev = tmp;
+		}
+		hid_free_enumeration(cached);
+		return root;
+	}
+
 	num_devs = libusb_get_device_list(usb_context, &devs);
 	if (num_devs < 0)
 		return NULL;
 
-	while ((dev = devs[i++]) != NULL) {
-		struct hid_device_info *tmp = hid_enumerate_from_libusb(dev, vendor_id, product_id);
+	num_threads = enumerate_threads;
+	if ((size_t) num_devs < num_threads)
+		num_threads = (unsigned int) num_devs;
+
+	if (num_threads > 1) {
+		results = (struct hid_device_info_utf8 **) calloc((size_t) num_devs, sizeof(struct hid_device_info_utf8 *));
+		if (results && enumerate_parallel(devs, (size_t) num_devs, filter, num_threads, NULL, results) < 0) {
+			free(results);
+			results = NULL;
+		}
+	}
+
+	while ((dev = devs[i]) != NULL) {
+		struct hid_device_info_utf8 *tmp = NULL;
+
+		if (results)
+			tmp = results[i];
+		else
+			hid_enumerate_from_libusb(dev, filter, &tmp);
+		i++;
 		if (cur_dev) {
 			cur_dev->next = tmp;
 		}
@@ -1077,60 +2592,214 @@ struct hid_device_info HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, u
 			}
 		}
 	}
-
-	libusb_free_device_list(devs, 1);
-
-	return root;
+
+	free(results);
+	libusb_free_device_list(devs, 1);
+
+	return root;
+}
+
+struct hid_device_info HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+{
+	struct hid_enumerate_filter filter = HID_API_ENUMERATE_FILTER_INIT;
+
+	filter.vendor_id = vendor_id;
+	filter.product_id = product_id;
+
+	return hid_enumerate_ex(&filter);
+}
+
+void HID_API_EXPORT_CALL hid_libusb_set_enumerate_threads(unsigned int num_threads)
+{
+	if (num_threads == 0)
+		num_threads = 1;
+	if (num_threads > HID_ENUMERATE_MAX_THREADS)
+		num_threads = HID_ENUMERATE_MAX_THREADS;
+
+	enumerate_threads = num_threads;
+}
+
+unsigned int HID_API_EXPORT_CALL hid_libusb_get_enumerate_threads(void)
+{
+	return enumerate_threads;
+}
+
+void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
+{
+	struct hid_device_info *d = devs;
+	while (d) {
+		struct hid_device_info *next = d->next;
+		free(d->path);
+		free(d->serial_number);
+		free(d->manufacturer_string);
+		free(d->product_string);
+		free(d);
+		d = next;
+	}
+}
+
+void  HID_API_EXPORT hid_free_enumeration_utf8(struct hid_device_info_utf8 *devs)
+{
+	struct hid_device_info_utf8 *d = devs;
+	while (d) {
+		struct hid_device_info_utf8 *next = d->next;
+		free(d->path);
+		free(d->serial_number);
+		free(d->manufacturer_string);
+		free(d->product_string);
+		free(d);
+		d = next;
+	}
+}
+
+/* Queue an event for a callback. The device info is copied once per event, into *snapshot.
+ * Called with the executor mutex locked. */
+static void hid_internal_executor_queue(struct hid_hotplug_callback *callback, const struct hid_device_info *info, struct hid_hotplug_snapshot **snapshot, hid_hotplug_event event, int replay)
+{
+	struct hid_hotplug_task *task = (struct hid_hotplug_task*)calloc(1, sizeof(struct hid_hotplug_task));
+	if (!task) {
+		/* Out of memory: the callback misses the event */
+		return;
+	}
+
+	if (!*snapshot) {
+		*snapshot = (struct hid_hotplug_snapshot*)calloc(1, sizeof(struct hid_hotplug_snapshot));
+		if (*snapshot) {
+			(*snapshot)->info = hid_internal_copy_device_info(info, 1);
+			if (!(*snapshot)->info) {
+				free(*snapshot);
+				*snapshot = NULL;
+			}
+		}
+		if (!*snapshot) {
+			free(task);
+			return;
+		}
+	}
+
+	(*snapshot)->refs++;
+	task->snapshot = *snapshot;
+	task->event = event;
+	task->replay = replay ? 1 : 0;
+
+	if (callback->tasks_tail) {
+		callback->tasks_tail->next = task;
+	}
+	else {
+		callback->tasks = task;
+	}
+	callback->tasks_tail = task;
+
+	if (!callback->scheduled) {
+		callback->scheduled = 1;
+		callback->ready_next = NULL;
+		if (hid_hotplug_executor.ready_tail) {
+			hid_hotplug_executor.ready_tail->ready_next = callback;
+		}
+		else {
+			hid_hotplug_executor.ready = callback;
+		}
+		hid_hotplug_executor.ready_tail = callback;
+		hidapi_thread_cond_signal(&hid_hotplug_executor.state);
+	}
 }
 
-void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
+/* Invoke a callback from callback_thread. The calls of a callback are serialized,
+ * and wait for its HID_API_HOTPLUG_ENUMERATE replay. */
+static void hid_internal_invoke_callback(struct hid_hotplug_callback *callback, struct hid_device_info *info, hid_hotplug_event event)
 {
-	struct hid_device_info *d = devs;
-	while (d) {
-		struct hid_device_info *next = d->next;
-		free(d->path);
-		free(d->serial_number);
-		free(d->manufacturer_string);
-		free(d->product_string);
-		free(d);
-		d = next;
+	int result = 0;
+
+	pthread_mutex_lock(&callback->call_lock);
+	/* Checked again, as it may have been deregistered while the replay was running */
+	if (!hid_internal_callback_removed(callback)) {
+		result = callback->callback(callback->handle, info, event, callback->user_data);
+	}
+	pthread_mutex_unlock(&callback->call_lock);
+
+	/* If the result is non-zero, the callback is deregistered */
+	if (result) {
+		hid_hotplug_deregister_callback(callback->handle);
 	}
 }
 
-static int match_libusb_to_info(libusb_device *device, struct hid_device_info* info)
+/* Find the first callback with the given ids, from position i of a chain that ends before end */
+static size_t hid_internal_callback_chain_find(const struct hid_hotplug_callback_set *set, size_t i, size_t end, unsigned short vendor_id, unsigned short product_id)
 {
-	/* make a path from this libusb device, but leave the last 2 fields as 0 */
-	char pseudo_path[64];
-	get_path(&pseudo_path, device, 0, 0);
-	int len = strlen(pseudo_path) - sizeof("0.0");
-	/* If the path on this HID device matches the template, aside from the last 2 fields, */
-	/* we assume the HID device is located on this libusb device */
-	return !strncmp(info->path, pseudo_path, len);
+	while (i < end && (set->chain[i]->vendor_id != vendor_id || set->chain[i]->product_id != product_id)) {
+		i++;
+	}
+	return i;
 }
 
-static void hid_internal_invoke_callbacks(struct hid_device_info* info, hid_hotplug_event event)
+static void hid_internal_invoke_callbacks(struct hid_hotplug_callback_set *set, struct hid_device_info* info, hid_hotplug_event event)
 {
-	pthread_mutex_lock(&hid_hotplug_context.mutex);
-	hid_hotplug_context.mutex_in_use = 1;
+	struct hid_hotplug_snapshot *snapshot = NULL;
 
-	struct hid_hotplug_callback **current = &hid_hotplug_context.hotplug_cbs;
-	while (*current) {
-		struct hid_hotplug_callback *callback = *current;
-		if ((callback->events & event) && hid_internal_match_device_id(info->vendor_id, info->product_id, callback->vendor_id, callback->product_id)) {
-			int result = callback->callback(callback->handle, info, event, callback->user_data);
-			/* If the result is non-zero, we mark the callback for removal and proceed */
-			if (result) {
-				(*current)->events = 0;
-				hid_hotplug_context.cb_list_dirty = 1;
-				continue;
+	if (!set) {
+		return;
+	}
+
+	/* A device can only be matched by the callbacks for its (vendor_id, product_id), (vendor_id, any),
+	 * (any, product_id) and for any device: follow those chains, in registration order across them */
+	unsigned short keys[4][2] = {
+		{ 0, 0 },
+		{ info->vendor_id, 0 },
+		{ 0, info->product_id },
+		{ info->vendor_id, info->product_id },
+	};
+	size_t cursors[4];
+	size_t ends[4];
+	size_t num_chains = 0;
+
+	for (size_t i = 0; i < 4; i++) {
+		/* Ids of 0 make some keys the same */
+		size_t j = 0;
+		while (j < num_chains && (keys[j][0] != keys[i][0] || keys[j][1] != keys[i][1])) {
+			j++;
+		}
+		if (j < num_chains) {
+			continue;
+		}
+
+		size_t bucket = hid_internal_callback_bucket(set, keys[i][0], keys[i][1]);
+		keys[num_chains][0] = keys[i][0];
+		keys[num_chains][1] = keys[i][1];
+		ends[num_chains] = set->bucket_start[bucket + 1];
+		cursors[num_chains] = hid_internal_callback_chain_find(set, set->bucket_start[bucket], ends[num_chains], keys[i][0], keys[i][1]);
+		num_chains++;
+	}
+
+	/* With the executor running the callbacks are only queued */
+	int queue = hid_internal_executor_lock();
+
+	for (;;) {
+		size_t next = num_chains;
+		for (size_t i = 0; i < num_chains; i++) {
+			if (cursors[i] < ends[i] && (next == num_chains || set->chain[cursors[i]]->order < set->chain[cursors[next]]->order)) {
+				next = i;
+			}
+		}
+		if (next == num_chains) {
+			break;
+		}
+
+		struct hid_hotplug_callback *callback = set->chain[cursors[next]];
+		if ((callback->events & event) && !hid_internal_callback_removed(callback)) {
+			if (queue) {
+				hid_internal_executor_queue(callback, info, &snapshot, event, 0);
+			}
+			else {
+				hid_internal_invoke_callback(callback, info, event);
 			}
 		}
-		current = &callback->next;
+
+		cursors[next] = hid_internal_callback_chain_find(set, cursors[next] + 1, ends[next], keys[next][0], keys[next][1]);
 	}
 
-	hid_hotplug_context.mutex_in_use = 0;
-	hid_internal_hotplug_remove_postponed();
-	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+	if (queue) {
+		hidapi_thread_mutex_unlock(&hid_hotplug_executor.state);
+	}
 }
 
 static int hid_libusb_hotplug_callback(libusb_context *ctx, libusb_device *device, libusb_hotplug_event event, void * user_data)
@@ -1153,18 +2822,16 @@ static int hid_libusb_hotplug_callback(libusb_context *ctx, libusb_device *devic
 
 	/* Use callback_thread's mutex to protect the queue and signal it */
 	hidapi_thread_mutex_lock(&hid_hotplug_context.callback_thread);
-	struct hid_hotplug_queue* end = hid_hotplug_context.queue;
-	if (end) {
-		while (end->next) {
-			end = end->next;
-		}
-		end->next = msg;
+	if (hid_hotplug_context.queue) {
+		hid_hotplug_context.queue_tail->next = msg;
 	} else {
 		hid_hotplug_context.queue = msg;
-	}
 
-	/* Wake up the callback thread so it can react to the new message immediately */
-	hidapi_thread_cond_signal(&hid_hotplug_context.callback_thread);
+		/* Wake up the callback thread so it can react to the new message immediately.
+		   While the queue isn't empty the thread is busy with it and doesn't wait. */
+		hidapi_thread_cond_signal(&hid_hotplug_context.callback_thread);
+	}
+	hid_hotplug_context.queue_tail = msg;
 	hidapi_thread_mutex_unlock(&hid_hotplug_context.callback_thread);
 
 	return 0;
@@ -1172,59 +2839,72 @@ static int hid_libusb_hotplug_callback(libusb_context *ctx, libusb_device *devic
 
 static void process_hotplug_event(struct hid_hotplug_queue* msg)
 {
-	/* Lock the mutex to avoid race conditions with hid_hotplug_register_callback(),
-	 * which may iterate devs during HID_API_HOTPLUG_ENUMERATE while holding this mutex.
-	 * The mutex is recursive, so hid_internal_invoke_callbacks() can safely re-acquire it. */
-	pthread_mutex_lock(&hid_hotplug_context.mutex);
+	struct hid_hotplug_callback_set *set = NULL;
 
 	if (msg->event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
-		struct hid_device_info* info = hid_enumerate_from_libusb(msg->device, 0, 0);
-		struct hid_device_info* info_cur = info;
-		while (info_cur) {
+		/* Probe the arriving device without any lock held: opening it and reading
+		 * its string descriptors may take seconds.
+		 * The events are processed one by one, so the device can't have left yet. */
+		struct hid_device_info* info = hid_enumerate_from_libusb(msg->device, NULL, NULL);
+		struct hid_device_info* info_cur;
+		size_t num_records = 0;
+		int tracked = 0;
+
+		for (info_cur = info; info_cur; info_cur = info_cur->next) {
+			num_records++;
+		}
+
+		/* Append all we got to the end of the device list, and take the callbacks to
+		 * notify at the same time: a callback registered meanwhile either finds
+		 * the device in devs or gets the event (see hid_hotplug_register_callback()) */
+		if (info) {
+			pthread_rwlock_wrlock(&hid_hotplug_context.devs_lock);
+			/* Out of memory: the device is not tracked */
+			tracked = hid_internal_devices_append(info) == 0;
+			set = hid_internal_callback_set_acquire();
+			pthread_rwlock_unlock(&hid_hotplug_context.devs_lock);
+		}
+
+		/* The records stay valid in devs, only this thread removes them */
+		info_cur = info;
+		while (num_records--) {
 			/* For each device, call all matching callbacks */
 			/* TODO: possibly make the `next` field NULL to match the behavior on other systems */
-			hid_internal_invoke_callbacks(info_cur, HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED);
+			hid_internal_invoke_callbacks(set, info_cur, HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED);
 			info_cur = info_cur->next;
 		}
 
-		/* Append all we got to the end of the device list */
-		if (info) {
-			if (hid_hotplug_context.devs != NULL) {
-				struct hid_device_info* last = hid_hotplug_context.devs;
-				while (last->next != NULL) {
-					last = last->next;
-				}
-				last->next = info;
-			}
-			else {
-				hid_hotplug_context.devs = info;
-			}
+		if (!tracked) {
+			hid_free_enumeration(info);
 		}
 	}
 	else if (msg->event == LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT) {
-		for (struct hid_device_info **current = &hid_hotplug_context.devs; *current;) {
-			struct hid_device_info* info = *current;
-			if (match_libusb_to_info(msg->device, *current)) {
-				/* If the libusb device that's left matches this HID device, we detach it from the list */
-				*current = (*current)->next;
-				info->next = NULL;
-				hid_internal_invoke_callbacks(info, HID_API_HOTPLUG_EVENT_DEVICE_LEFT);
-				/* Free every removed device (and its internal allocations) */
-				hid_free_enumeration(info);
-			} else {
-				current = &info->next;
-			}
+		struct hid_device_info *removed;
+		char key[64];
+
+		/* The interfaces of this device all have paths that start with its pseudo path */
+		get_path(&key, msg->device, 0, 0);
+
+		/* Detach the devices first, so that the callbacks run without devs_lock */
+		pthread_rwlock_wrlock(&hid_hotplug_context.devs_lock);
+		removed = hid_internal_devices_remove(key, hid_internal_device_key_length(key));
+		set = hid_internal_callback_set_acquire();
+		pthread_rwlock_unlock(&hid_hotplug_context.devs_lock);
+
+		while (removed) {
+			struct hid_device_info *info = removed;
+			removed = info->next;
+			info->next = NULL;
+			hid_internal_invoke_callbacks(set, info, HID_API_HOTPLUG_EVENT_DEVICE_LEFT);
+			/* Free every removed device (and its internal allocations) */
+			hid_free_enumeration(info);
 		}
 	}
 
-	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+	hid_internal_callback_set_release(set);
 
 	/* Release the libusb device - we are done with it */
 	libusb_unref_device(msg->device);
-
-	/* Cleanup note: this function is called inside a thread that the clenup function would be waiting to finish */
-	/* Any callbacks that await removal are removed in hid_internal_invoke_callbacks */
-	/* No further cleaning is needed */
 }
 
 static void* callback_thread(void* user_data)
@@ -1233,10 +2913,9 @@ static void* callback_thread(void* user_data)
 
 	hidapi_thread_mutex_lock(&hid_hotplug_context.callback_thread);
 
-	/* We stop the thread if by the moment there are no events left in the queue there are no callbacks left */
-	while (1) {
-		/* Wait for events to arrive or shutdown signal */
-		while (!hid_hotplug_context.queue && hid_hotplug_context.hotplug_cbs) {
+	for (;;) {
+		/* Wait for events to arrive, or for the threads not to be needed anymore */
+		while (!hid_hotplug_context.queue && hid_internal_hotplug_needed()) {
 			hidapi_thread_cond_wait(&hid_hotplug_context.callback_thread);
 		}
 
@@ -1244,6 +2923,9 @@ static void* callback_thread(void* user_data)
 		while (hid_hotplug_context.queue) {
 			struct hid_hotplug_queue *cur_event = hid_hotplug_context.queue;
 			hid_hotplug_context.queue = cur_event->next;
+			if (!hid_hotplug_context.queue) {
+				hid_hotplug_context.queue_tail = NULL;
+			}
 
 			/* Release the lock while processing to avoid blocking event producers */
 			hidapi_thread_mutex_unlock(&hid_hotplug_context.callback_thread);
@@ -1252,12 +2934,21 @@ static void* callback_thread(void* user_data)
 			hidapi_thread_mutex_lock(&hid_hotplug_context.callback_thread);
 		}
 
-		if (!hid_hotplug_context.hotplug_cbs) {
-			break;
+		/* No callback is running here, so that once the decision is taken
+		 * this thread doesn't take the hotplug mutex anymore */
+		if (!hid_internal_hotplug_needed()) {
+			hidapi_thread_mutex_unlock(&hid_hotplug_context.callback_thread);
+			if (hid_internal_hotplug_leave()) {
+				break;
+			}
+			hidapi_thread_mutex_lock(&hid_hotplug_context.callback_thread);
 		}
 	}
 
-	hidapi_thread_mutex_unlock(&hid_hotplug_context.callback_thread);
+	/* Wake hotplug_thread up to leave */
+#ifdef HIDAPI_LIBUSB_HAS_INTERRUPT_EVENT_HANDLER
+	libusb_interrupt_event_handler(hid_hotplug_context.context);
+#endif
 
 	return NULL;
 }
@@ -1268,35 +2959,118 @@ static void* hotplug_thread(void* user_data)
 
 	hidapi_thread_create(&hid_hotplug_context.callback_thread, callback_thread, NULL);
 
-	/* 5 msec timeout seems reasonable; don't set too low to avoid high CPU usage */
-	/* This timeout only affects how much time it takes to stop the thread */
+#ifndef HIDAPI_LIBUSB_HAS_INTERRUPT_EVENT_HANDLER
+	/* Without libusb_interrupt_event_handler() the thread can't be woken up,
+	   the timeout only affects how much time it takes to stop the thread */
 	struct timeval tv;
 	tv.tv_sec = 0;
 	tv.tv_usec = 5000;
+#endif
+
+	for (;;) {
+		unsigned char exited;
+
+		hidapi_thread_mutex_lock(&hid_hotplug_context.callback_thread);
+		exited = hid_hotplug_context.monitor_exited;
+		hidapi_thread_mutex_unlock(&hid_hotplug_context.callback_thread);
+
+		/* callback_thread decides when to leave, and wakes this thread up */
+		if (exited) {
+			break;
+		}
 
-	while (hid_hotplug_context.hotplug_cbs) {
 		/* This will allow libusb to call the callbacks, which will fill up the queue */
+#ifdef HIDAPI_LIBUSB_HAS_INTERRUPT_EVENT_HANDLER
+		/* Sleeps until a hotplug event comes or libusb_interrupt_event_handler() is called
+		   (libusb wakes up once a minute on its own) */
+		libusb_handle_events_completed(hid_hotplug_context.context, NULL);
+#else
 		libusb_handle_events_timeout_completed(hid_hotplug_context.context, &tv, NULL);
+#endif
 	}
 
-	/* Disarm the libusb listener */
+	/* Disarm the libusb listener. The context itself is only freed once the
+	   thread is joined. */
 	libusb_hotplug_deregister_callback(hid_hotplug_context.context, hid_hotplug_context.callback_handle);
-	libusb_exit(hid_hotplug_context.context);
-
-	/* hotplug_cbs is already NULL here (the loop above exited because of that).
-	 * Signal callback_thread under the mutex so it can observe the NULL hotplug_cbs
-	 * and exit cleanly, rather than waiting indefinitely in cond_wait. */
-	hidapi_thread_mutex_lock(&hid_hotplug_context.callback_thread);
-	hidapi_thread_cond_signal(&hid_hotplug_context.callback_thread);
-	hidapi_thread_mutex_unlock(&hid_hotplug_context.callback_thread);
 
 	hidapi_thread_join(&hid_hotplug_context.callback_thread);
 
+	/* Drop the events that came after callback_thread left */
+	hid_internal_hotplug_drop_queue();
+
 	return NULL;
 }
 
+/* Arm the libusb hotplug callback, enumerate all devices and start the threads
+ * that keep the device list up to date, unless they are running already.
+ * After hid_hotplug_get_fd(), the hotplug context is only added to its epoll set.
+ * Always called with the mutex held. */
+static int hid_internal_hotplug_start()
+{
+	/* The threads leave on their own once their last callback is gone */
+	if (hid_hotplug_context.monitor_running && hid_hotplug_context.monitor_exited) {
+		hid_internal_hotplug_join();
+	}
+
+	if (hid_hotplug_context.monitor_running) {
+		return 0;
+	}
+
+	/* Fill already connected devices so we can use this info in disconnection notification */
+	if (libusb_init(&hid_hotplug_context.context)) {
+		return -1;
+	}
+
+	/* devs_valid is 0 here, so this is a regular enumeration */
+	struct hid_device_info *devs = hid_enumerate(0, 0);
+
+	/* Arm a global callback to receive ALL notifications for HID class devices */
+	if (libusb_hotplug_register_callback(hid_hotplug_context.context,
+										LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+										0, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, &hid_libusb_hotplug_callback, NULL,
+										&hid_hotplug_context.callback_handle)) {
+		/* Major malfunction, failed to register a callback */
+		libusb_exit(hid_hotplug_context.context);
+		hid_hotplug_context.context = NULL;
+		hid_free_enumeration(devs);
+		return -1;
+	}
+
+#ifdef __linux__
+	if (hid_hotplug_context.external && hid_internal_hotplug_watch_pollfds() < 0) {
+		hid_internal_hotplug_unwatch_pollfds();
+		libusb_hotplug_deregister_callback(hid_hotplug_context.context, hid_hotplug_context.callback_handle);
+		libusb_exit(hid_hotplug_context.context);
+		hid_hotplug_context.context = NULL;
+		hid_free_enumeration(devs);
+		return -1;
+	}
+#endif
+
+	pthread_rwlock_wrlock(&hid_hotplug_context.devs_lock);
+	hid_internal_devices_set(devs);
+	hid_hotplug_context.devs_valid = 1;
+	pthread_rwlock_unlock(&hid_hotplug_context.devs_lock);
+
+	/* Initialization succeeded! We run the threads now */
+	hid_hotplug_context.monitor_exited = 0;
+	hid_hotplug_context.monitor_running = 1;
+#ifdef __linux__
+	if (hid_hotplug_context.external) {
+		return 0;
+	}
+#endif
+	hidapi_thread_create(&hid_hotplug_context.libusb_thread, hotplug_thread, NULL);
+
+	return 0;
+}
+
 int HID_API_EXPORT HID_API_CALL hid_hotplug_register_callback(unsigned short vendor_id, unsigned short product_id, int events, int flags, hid_hotplug_callback_fn callback, void *user_data, hid_hotplug_callback_handle *callback_handle)
 {
+	struct hid_hotplug_callback_set *set;
+	struct hid_device_info *replay = NULL;
+	struct hid_device_info *replay_last = NULL;
+
 	if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
 		return -1;
 	}
@@ -1316,20 +3090,34 @@ int HID_API_EXPORT HID_API_CALL hid_hotplug_register_callback(unsigned short ven
 	}
 
 	/* Fill out the record */
-	hotplug_cb->next = NULL;
 	hotplug_cb->vendor_id = vendor_id;
 	hotplug_cb->product_id = product_id;
 	hotplug_cb->events = events;
 	hotplug_cb->user_data = user_data;
 	hotplug_cb->callback = callback;
+	/* Held by this function until the end of the replay */
+	hotplug_cb->refs = 1;
+	pthread_mutex_init(&hotplug_cb->call_lock, NULL);
 
-	/* Ensure we are ready to actually use the mutex */
-	hid_internal_hotplug_init();
+	/* callback_thread waits for the replay before it invokes the callback.
+	 * Taken before the mutex, like in the calls made while the callback runs */
+	pthread_mutex_lock(&hotplug_cb->call_lock);
 
-	/* Lock the mutex to avoid race itions */
+	/* Lock the mutex to avoid race conditions */
 	pthread_mutex_lock(&hid_hotplug_context.mutex);
 
+	hid_internal_hotplug_init();
+
+	/* The threads may already be running for another callback or for the enumeration cache */
+	if (hid_internal_hotplug_start() < 0) {
+		pthread_mutex_unlock(&hid_hotplug_context.mutex);
+		pthread_mutex_unlock(&hotplug_cb->call_lock);
+		hid_internal_callback_unref(hotplug_cb);
+		return -1;
+	}
+
 	hotplug_cb->handle = hid_hotplug_context.next_handle++;
+	hotplug_cb->order = hid_hotplug_context.next_cb_order++;
 
 	/* handle the unlikely case of handle overflow */
 	if (hid_hotplug_context.next_handle < 0)
@@ -1337,120 +3125,344 @@ int HID_API_EXPORT HID_API_CALL hid_hotplug_register_callback(unsigned short ven
 		hid_hotplug_context.next_handle = 1;
 	}
 
+	if (hid_internal_callback_set_build(hid_hotplug_context.callbacks, hotplug_cb, &set) < 0) {
+		/* The threads may have been started for this callback alone */
+		hid_internal_hotplug_wake();
+		pthread_mutex_unlock(&hid_hotplug_context.mutex);
+		pthread_mutex_unlock(&hotplug_cb->call_lock);
+		hid_internal_callback_unref(hotplug_cb);
+		return -1;
+	}
+
 	/* Return allocated handle */
 	if (callback_handle != NULL) {
 		*callback_handle = hotplug_cb->handle;
 	}
-	/* Append a new callback to the end */
-	if (hid_hotplug_context.hotplug_cbs != NULL) {
-		struct hid_hotplug_callback *last = hid_hotplug_context.hotplug_cbs;
-		while (last->next != NULL) {
-			last = last->next;
-		}
-		last->next = hotplug_cb;
-	}
-	else {
-		/* Fill already connected devices so we can use this info in disconnection notification */
-		if (libusb_init(&hid_hotplug_context.context)) {
-			free(hotplug_cb);
-			pthread_mutex_unlock(&hid_hotplug_context.mutex);
-			return -1;
-		}
 
-		hid_hotplug_context.devs = hid_enumerate(0, 0);
-		hid_hotplug_context.hotplug_cbs = hotplug_cb;
-
-		/* Arm a global callback to receive ALL notifications for HID class devices */
-		if (libusb_hotplug_register_callback(hid_hotplug_context.context,
-											LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
-											0, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, &hid_libusb_hotplug_callback, NULL,
-											&hid_hotplug_context.callback_handle)) {
-			/* Major malfunction, failed to register a callback.
-			 * No hotplug thread was started, so we must unwind `devs` ourselves
-			 * (hid_internal_hotplug_cleanup() would try to join a non-existent thread). */
-			libusb_exit(hid_hotplug_context.context);
-			hid_free_enumeration(hid_hotplug_context.devs);
-			hid_hotplug_context.devs = NULL;
-			free(hotplug_cb);
-			hid_hotplug_context.hotplug_cbs = NULL;
-			pthread_mutex_unlock(&hid_hotplug_context.mutex);
-			return -1;
-		}
+	/* Publish the callback and take the devices to replay while callback_thread can't update devs,
+	 * so that the callback either finds a device here or gets its event, never both */
+	pthread_rwlock_rdlock(&hid_hotplug_context.devs_lock);
 
-		/* Initialization succeeded! We run the threads now */
-		hidapi_thread_create(&hid_hotplug_context.libusb_thread, hotplug_thread, NULL);
-	}
+	hid_internal_callback_set_publish(set);
 
-	/* Mark the mutex as IN USE, to prevent callback removal from inside a callback */
-	unsigned char old_state = hid_hotplug_context.mutex_in_use;
-	hid_hotplug_context.mutex_in_use = 1;
-	
 	if ((flags & HID_API_HOTPLUG_ENUMERATE) && (events & HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED)) {
+		/* With the executor running, the replay is queued ahead of the later events */
+		int queue = hid_internal_executor_lock();
 		struct hid_device_info* device = hid_hotplug_context.devs;
-		/* Notify about already connected devices, if asked so */
 		while (device != NULL) {
 			if (hid_internal_match_device_id(device->vendor_id, device->product_id, hotplug_cb->vendor_id, hotplug_cb->product_id)) {
-				(*hotplug_cb->callback)(hotplug_cb->handle, device, HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED, hotplug_cb->user_data);
+				if (queue) {
+					struct hid_hotplug_snapshot *snapshot = NULL;
+					hid_internal_executor_queue(hotplug_cb, device, &snapshot, HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED, 1);
+				}
+				else {
+					/* Copied, so that the callback runs without any lock held */
+					struct hid_device_info *tmp = hid_internal_copy_device_info(device, 1);
+					if (tmp) {
+						if (replay_last) {
+							replay_last->next = tmp;
+						}
+						else {
+							replay = tmp;
+						}
+						replay_last = tmp;
+					}
+				}
 			}
 
 			device = device->next;
 		}
+		if (queue) {
+			hidapi_thread_mutex_unlock(&hid_hotplug_executor.state);
+		}
 	}
 
-	hid_hotplug_context.mutex_in_use = old_state;
-
-	hid_internal_hotplug_cleanup();
+	pthread_rwlock_unlock(&hid_hotplug_context.devs_lock);
 
 	pthread_mutex_unlock(&hid_hotplug_context.mutex);
 
+	/* Notify about already connected devices, if asked so.
+	 * The callback may deregister itself or register other callbacks */
+	for (struct hid_device_info *device = replay; device != NULL; device = device->next) {
+		if (hid_internal_callback_removed(hotplug_cb)) {
+			break;
+		}
+		(*hotplug_cb->callback)(hotplug_cb->handle, device, HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED, hotplug_cb->user_data);
+	}
+
+	pthread_mutex_unlock(&hotplug_cb->call_lock);
+
+	hid_free_enumeration(replay);
+	hid_internal_callback_unref(hotplug_cb);
+
 	return 0;
 }
 
 int HID_API_EXPORT HID_API_CALL hid_hotplug_deregister_callback(hid_hotplug_callback_handle callback_handle)
 {
-	if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG) || !hid_hotplug_context.mutex_ready || callback_handle <= 0) {
+	struct hid_hotplug_callback_set *set;
+	struct hid_hotplug_callback_set *new_set;
+	struct hid_hotplug_callback *callback = NULL;
+
+	if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG) || callback_handle <= 0) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&hid_hotplug_context.mutex);
+
+	set = hid_hotplug_context.callbacks;
+	if (set) {
+		for (size_t i = 0; i < set->num_callbacks; i++) {
+			if (set->callbacks[i]->handle == callback_handle && !set->callbacks[i]->removed) {
+				callback = set->callbacks[i];
+				break;
+			}
+		}
+	}
+
+	if (callback == NULL) {
+		pthread_mutex_unlock(&hid_hotplug_context.mutex);
+		return -1;
+	}
+
+	/* callback_thread and the other readers may still hold the current set:
+	 * mark the callback so that they skip it */
+	pthread_mutex_lock(&hid_hotplug_context.callbacks_lock);
+	callback->removed = 1;
+	pthread_mutex_unlock(&hid_hotplug_context.callbacks_lock);
+	hid_internal_executor_cancel(callback);
+
+	/* Without memory for a new set the callback stays in the current one, marked as removed */
+	if (hid_internal_callback_set_build(set, NULL, &new_set) == 0) {
+		hid_internal_callback_set_publish(new_set);
+	}
+
+	/* Stop the threads if nothing else needs them */
+	if (!hid_internal_hotplug_needed()) {
+		hid_internal_hotplug_wake();
+	}
+
+	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_hotplug_get_fd(void)
+{
+#ifdef __linux__
+	struct epoll_event event;
+	int fd = -1;
+
+	if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
 		return -1;
 	}
 
 	pthread_mutex_lock(&hid_hotplug_context.mutex);
 
-	if (hid_hotplug_context.hotplug_cbs == NULL) {
+	hid_internal_hotplug_init();
+
+	if (!hid_hotplug_context.external) {
+		/* The threads leave on their own once their last callback is gone */
+		if (hid_hotplug_context.monitor_running && hid_hotplug_context.monitor_exited) {
+			hid_internal_hotplug_join();
+		}
+
+		if (hid_hotplug_context.monitor_running) {
+			LOG("hid_hotplug_get_fd: the hotplug threads are already running\n");
+			goto end;
+		}
+
+		hid_hotplug_context.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		hid_hotplug_context.wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.fd = hid_hotplug_context.wakeup_fd;
+		if (hid_hotplug_context.epoll_fd < 0 || hid_hotplug_context.wakeup_fd < 0
+			|| epoll_ctl(hid_hotplug_context.epoll_fd, EPOLL_CTL_ADD, hid_hotplug_context.wakeup_fd, &event) < 0) {
+			LOG("hid_hotplug_get_fd failed: %s\n", strerror(errno));
+			if (hid_hotplug_context.epoll_fd >= 0)
+				close(hid_hotplug_context.epoll_fd);
+			if (hid_hotplug_context.wakeup_fd >= 0)
+				close(hid_hotplug_context.wakeup_fd);
+			hid_hotplug_context.epoll_fd = -1;
+			hid_hotplug_context.wakeup_fd = -1;
+			goto end;
+		}
+
+		hid_hotplug_context.external = 1;
+	}
+
+	fd = hid_hotplug_context.epoll_fd;
+
+end:
+	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+
+	return fd;
+#else
+	LOG("hid_hotplug_get_fd: not supported on this platform\n");
+	return -1;
+#endif
+}
+
+int HID_API_EXPORT HID_API_CALL hid_hotplug_handle_events(void)
+{
+#ifdef __linux__
+	struct timeval tv;
+	libusb_context *context;
+	uint64_t value;
+	ssize_t res;
+	int count = 0;
+
+	pthread_mutex_lock(&hid_hotplug_context.mutex);
+	if (!hid_hotplug_context.thread_states_ready || !hid_hotplug_context.external) {
 		pthread_mutex_unlock(&hid_hotplug_context.mutex);
+		LOG("hid_hotplug_handle_events: hid_hotplug_get_fd() wasn't called\n");
 		return -1;
 	}
+	/* Only this function and hid_exit() close the hotplug context */
+	context = hid_hotplug_context.context;
+	pthread_mutex_unlock(&hid_hotplug_context.mutex);
 
-	int result = -1;
+	/* Reset the counter, whether the hotplug context is needed is checked below */
+	res = read(hid_hotplug_context.wakeup_fd, &value, sizeof(value));
+	(void) res;
+
+	if (context) {
+		/* Doesn't block: libusb invokes hid_libusb_hotplug_callback(), which fills the queue */
+		tv.tv_sec = 0;
+		tv.tv_usec = 0;
+		int err = libusb_handle_events_timeout_completed(context, &tv, NULL);
+		if (err < 0 && err != LIBUSB_ERROR_INTERRUPTED) {
+			LOG("hid_hotplug_handle_events: %s\n", libusb_error_name(err));
+			return -1;
+		}
 
-	/* Remove this notification */
-	for (struct hid_hotplug_callback **current = &hid_hotplug_context.hotplug_cbs; *current != NULL; current = &(*current)->next) {
-		if ((*current)->handle == callback_handle) {
-			/* Check if we were already in a locked state, as we are NOT allowed to remove any callbacks if we are */
-			if (hid_hotplug_context.mutex_in_use) {
-				(*current)->events = 0;
-				hid_hotplug_context.cb_list_dirty = 1;
-			} else {
-				struct hid_hotplug_callback *next = (*current)->next;
-				free(*current);
-				*current = next;
+		/* Process the queue on this thread, like callback_thread does */
+		hidapi_thread_mutex_lock(&hid_hotplug_context.callback_thread);
+		while (hid_hotplug_context.queue) {
+			struct hid_hotplug_queue *cur_event = hid_hotplug_context.queue;
+			hid_hotplug_context.queue = cur_event->next;
+			if (!hid_hotplug_context.queue) {
+				hid_hotplug_context.queue_tail = NULL;
 			}
-			result = 0;
-			break;
+
+			hidapi_thread_mutex_unlock(&hid_hotplug_context.callback_thread);
+			process_hotplug_event(cur_event);
+			free(cur_event);
+			count++;
+			hidapi_thread_mutex_lock(&hid_hotplug_context.callback_thread);
 		}
+		hidapi_thread_mutex_unlock(&hid_hotplug_context.callback_thread);
+	}
+
+	/* Close the hotplug context once nothing needs it anymore */
+	pthread_mutex_lock(&hid_hotplug_context.mutex);
+	if (hid_hotplug_context.monitor_running && !hid_internal_hotplug_needed()) {
+		hid_internal_hotplug_stop_external();
+	}
+	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+
+	return count;
+#else
+	LOG("hid_hotplug_handle_events: not supported on this platform\n");
+	return -1;
+#endif
+}
+
+int HID_API_EXPORT_CALL hid_libusb_set_enumerate_cache(int enable)
+{
+	int result = 0;
+
+	if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+		return enable ? -1 : 0;
+	}
+
+	pthread_mutex_lock(&hid_hotplug_context.mutex);
+
+	hid_internal_hotplug_init();
+
+	pthread_rwlock_wrlock(&hid_hotplug_context.devs_lock);
+	hid_hotplug_context.enumerate_cache = enable ? 1 : 0;
+	pthread_rwlock_unlock(&hid_hotplug_context.devs_lock);
+
+	if (enable && hid_internal_hotplug_start() < 0) {
+		pthread_rwlock_wrlock(&hid_hotplug_context.devs_lock);
+		hid_hotplug_context.enumerate_cache = 0;
+		pthread_rwlock_unlock(&hid_hotplug_context.devs_lock);
+		result = -1;
 	}
 
-	hid_internal_hotplug_cleanup();
+	/* Stop the threads if nothing else needs them */
+	if (!hid_internal_hotplug_needed()) {
+		hid_internal_hotplug_wake();
+	}
 
 	pthread_mutex_unlock(&hid_hotplug_context.mutex);
 
 	return result;
 }
 
+int HID_API_EXPORT_CALL hid_libusb_get_enumerate_cache(void)
+{
+	return hid_hotplug_context.enumerate_cache;
+}
+
+int HID_API_EXPORT_CALL hid_libusb_set_hotplug_threads(unsigned int num_threads)
+{
+	if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+		return num_threads ? -1 : 0;
+	}
+
+	if (num_threads > HID_HOTPLUG_MAX_THREADS)
+		num_threads = HID_HOTPLUG_MAX_THREADS;
+
+	/* The events of a callback would be split between the threads and callback_thread */
+	pthread_mutex_lock(&hid_hotplug_context.mutex);
+	hid_internal_hotplug_init();
+	if (hid_hotplug_context.callbacks != NULL) {
+		pthread_mutex_unlock(&hid_hotplug_context.mutex);
+		return -1;
+	}
+	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+
+	hid_internal_executor_stop(0);
+
+	if (num_threads == 0)
+		return 0;
+
+	return hid_internal_executor_start(num_threads);
+}
+
+unsigned int HID_API_EXPORT_CALL hid_libusb_get_hotplug_threads(void)
+{
+	unsigned int num_threads;
+
+	if (!hid_hotplug_context.thread_states_ready) {
+		return 0;
+	}
+
+	hidapi_thread_mutex_lock(&hid_hotplug_executor.state);
+	num_threads = hid_hotplug_executor.num_threads;
+	hidapi_thread_mutex_unlock(&hid_hotplug_executor.state);
+
+	return num_threads;
+}
+
 hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
 {
 	struct hid_device_info *devs, *cur_dev;
 	const char *path_to_open = NULL;
 	hid_device *handle = NULL;
 
+	/* Unless hid_enumerate() is answered from the hotplug device list,
+	   look the device up directly instead of enumerating everything */
+	if (!hid_hotplug_context.enumerate_cache) {
+		if (hid_init() < 0)
+			return NULL;
+
+		return hid_open_by_id(vendor_id, product_id, serial_number);
+	}
+
 	devs = hid_enumerate(vendor_id, product_id);
 	cur_dev = devs;
 	while (cur_dev) {
@@ -1481,6 +3493,14 @@ hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, const
 	return handle;
 }
 
+/* Current CLOCK_MONOTONIC time, in nanoseconds */
+static uint64_t get_monotonic_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
 static void LIBUSB_CALL read_callback(struct libusb_transfer *transfer)
 {
 	hid_device *dev = transfer->user_data;
@@ -1492,6 +3512,7 @@ static void LIBUSB_CALL read_callback(struct libusb_transfer *transfer)
 		rpt->data = (uint8_t*) malloc(transfer->actual_length);
 		memcpy(rpt->data, transfer->buffer, transfer->actual_length);
 		rpt->len = transfer->actual_length;
+		rpt->timestamp_ns = get_monotonic_time_ns();
 		rpt->next = NULL;
 
 		hidapi_thread_mutex_lock(&dev->thread_state);
@@ -1501,6 +3522,7 @@ static void LIBUSB_CALL read_callback(struct libusb_transfer *transfer)
 			/* The list is empty. Put it at the root. */
 			dev->input_reports = rpt;
 			hidapi_thread_cond_signal(&dev->thread_state);
+			signal_input_event(dev);
 		}
 		else {
 			/* Find the end of the list and attach. */
@@ -1612,6 +3634,7 @@ static void *read_thread(void *param)
 	   signaled. */
 	hidapi_thread_mutex_lock(&dev->thread_state);
 	hidapi_thread_cond_broadcast(&dev->thread_state);
+	signal_input_event(dev);
 	hidapi_thread_mutex_unlock(&dev->thread_state);
 
 	/* The dev->transfer->buffer and dev->transfer objects are cleaned up
@@ -1865,6 +3888,100 @@ hid_device * HID_API_EXPORT hid_open_path(const char *path)
 	}
 }
 
+/* Open the first device hid_enumerate() would list with the given VID/PID
+   (and serial number, if not NULL), without building the list.
+   Only the devices with a matching VID/PID are opened, no string but
+   the serial number is read, and the device found is opened only once. */
+static hid_device *hid_open_by_id(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
+{
+	hid_device *dev = NULL;
+
+	libusb_device **devs = NULL;
+	libusb_device *usb_dev = NULL;
+	int found = 0;
+	int d = 0;
+
+	if (libusb_get_device_list(usb_context, &devs) < 0)
+		return NULL;
+
+	while (!found && (usb_dev = devs[d++]) != NULL) {
+		struct libusb_device_descriptor desc;
+		struct libusb_config_descriptor *conf_desc = NULL;
+		const struct libusb_interface_descriptor *intf_desc = NULL;
+		libusb_device_handle *handle = NULL;
+		int j, k;
+
+		if (libusb_get_device_descriptor(usb_dev, &desc) < 0)
+			continue;
+
+		if (desc.idVendor != vendor_id || desc.idProduct != product_id)
+			continue;
+
+		if (libusb_get_active_config_descriptor(usb_dev, &conf_desc) < 0)
+			libusb_get_config_descriptor(usb_dev, 0, &conf_desc);
+		if (!conf_desc)
+			continue;
+
+		/* The first HID interface is the first one hid_enumerate() lists */
+		for (j = 0; j < conf_desc->bNumInterfaces && !intf_desc; j++) {
+			const struct libusb_interface *intf = &conf_desc->interface[j];
+			for (k = 0; k < intf->num_altsetting; k++) {
+				if (should_enumerate_interface(desc.idVendor, &intf->altsetting[k])) {
+					intf_desc = &intf->altsetting[k];
+					break;
+				}
+			}
+		}
+
+		if (!intf_desc) {
+			libusb_free_config_descriptor(conf_desc);
+			continue;
+		}
+
+		if (libusb_open(usb_dev, &handle) < 0) {
+			/* hid_enumerate() lists it without a serial number, and opening it fails */
+			LOG("can't open device\n");
+			found = !serial_number;
+			libusb_free_config_descriptor(conf_desc);
+			continue;
+		}
+
+#ifdef __ANDROID__
+		/* See hid_enumerate_from_libusb() */
+		libusb_get_device_descriptor(usb_dev, &desc);
+#endif
+
+		if (serial_number && !(desc.iSerialNumber > 0 && usb_string_equals(handle, desc.iSerialNumber, serial_number))) {
+			libusb_close(handle);
+			libusb_free_config_descriptor(conf_desc);
+			continue;
+		}
+
+		found = 1;
+
+		dev = new_hid_device();
+		if (dev) {
+			dev->device_handle = handle;
+			if (!hidapi_initialize_device(dev, intf_desc, conf_desc)) {
+				free_hid_device(dev);
+				dev = NULL;
+			}
+		}
+		else {
+			LOG("hid_open failed: Couldn't allocate memory\n");
+		}
+
+		if (!dev)
+			libusb_close(handle);
+
+		libusb_free_config_descriptor(conf_desc);
+	}
+
+	libusb_free_device_list(devs, 1);
+
+	return dev;
+}
+
 
 HID_API_EXPORT hid_device * HID_API_CALL hid_libusb_wrap_sys_device(intptr_t sys_dev, int interface_num)
 {
@@ -1997,9 +4114,20 @@ static int return_data(hid_device *dev, unsigned char *data, size_t length)
 	dev->input_reports = rpt->next;
 	free(rpt->data);
 	free(rpt);
+	if (dev->input_reports == NULL && !dev->shutdown_thread)
+		clear_input_event(dev);
 	return (int)len;
 }
 
+/* Same as return_data(), and also returns the timestamp of the report.
+   This should be called with dev->mutex locked. */
+static int return_data_timestamped(hid_device *dev, unsigned char *data, size_t length, uint64_t *timestamp_ns)
+{
+	if (timestamp_ns)
+		*timestamp_ns = dev->input_reports->timestamp_ns;
+	return return_data(dev, data, length);
+}
+
 static void cleanup_mutex(void *param)
 {
 	hid_device *dev = param;
@@ -2007,7 +4135,7 @@ static void cleanup_mutex(void *param)
 }
 
 
-int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+int HID_API_EXPORT HID_API_CALL hid_read_timestamped(hid_device *dev, unsigned char *data, size_t length, uint64_t *timestamp_ns, int milliseconds)
 {
 #if 0
 	int transferred;
@@ -2027,7 +4155,7 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 	/* There's an input report queued up. Return it. */
 	if (dev->input_reports) {
 		/* Return the first one */
-		bytes_read = return_data(dev, data, length);
+		bytes_read = return_data_timestamped(dev, data, length, timestamp_ns);
 		goto ret;
 	}
 
@@ -2044,7 +4172,7 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 			hidapi_thread_cond_wait(&dev->thread_state);
 		}
 		if (dev->input_reports) {
-			bytes_read = return_data(dev, data, length);
+			bytes_read = return_data_timestamped(dev, data, length, timestamp_ns);
 		}
 	}
 	else if (milliseconds > 0) {
@@ -2058,7 +4186,7 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 			res = hidapi_thread_cond_timedwait(&dev->thread_state, &ts);
 			if (res == 0) {
 				if (dev->input_reports) {
-					bytes_read = return_data(dev, data, length);
+					bytes_read = return_data_timestamped(dev, data, length, timestamp_ns);
 					break;
 				}
 
@@ -2091,12 +4219,81 @@ ret:
 }
 
 
+int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+	return hid_read_timestamped(dev, data, length, NULL, milliseconds);
+}
+
+
 int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
 {
 	return hid_read_timeout(dev, data, length, dev->blocking ? -1 : 0);
 }
 
 
+int HID_API_EXPORT hid_read_batch(hid_device *dev, unsigned char *data, size_t stride, size_t max_reports, size_t *lengths, int milliseconds)
+{
+	/* Not initialised right here for the same reason as bytes_read in hid_read_timeout() */
+	int count; /* = 0; */
+
+	if (!data || (stride == 0) || (max_reports == 0) || !lengths) {
+		return -1;
+	}
+
+	hidapi_thread_mutex_lock(&dev->thread_state);
+	hidapi_thread_cleanup_push(cleanup_mutex, dev);
+
+	count = 0;
+
+	/* Wait for the first report only, the same way hid_read_timeout() does */
+	if (!dev->input_reports && !dev->shutdown_thread) {
+		if (milliseconds == -1) {
+			/* Blocking */
+			while (!dev->input_reports && !dev->shutdown_thread) {
+				hidapi_thread_cond_wait(&dev->thread_state);
+			}
+		}
+		else if (milliseconds > 0) {
+			/* Non-blocking, but called with timeout. */
+			int res;
+			hidapi_timespec ts;
+			hidapi_thread_gettime(&ts);
+			hidapi_thread_addtime(&ts, milliseconds);
+
+			while (!dev->input_reports && !dev->shutdown_thread) {
+				res = hidapi_thread_cond_timedwait(&dev->thread_state, &ts);
+				if (res == HIDAPI_THREAD_TIMED_OUT) {
+					break;
+				}
+				else if (res != 0) {
+					/* Error. */
+					count = -1;
+					break;
+				}
+			}
+		}
+	}
+
+	if (count == 0) {
+		/* Drain everything that is queued, in one go */
+		while (dev->input_reports && (size_t) count < max_reports) {
+			lengths[count] = (size_t) return_data(dev, data + (size_t) count * stride, stride);
+			count++;
+		}
+
+		if (count == 0 && dev->shutdown_thread) {
+			/* This means the device has been disconnected. */
+			count = -1;
+		}
+	}
+
+	hidapi_thread_mutex_unlock(&dev->thread_state);
+	hidapi_thread_cleanup_pop(0);
+
+	return count;
+}
+
+
 HID_API_EXPORT const wchar_t * HID_API_CALL hid_read_error(hid_device *dev)
 {
 	(void)dev;
@@ -2104,6 +4301,299 @@ HID_API_EXPORT const wchar_t * HID_API_CALL hid_read_error(hid_device *dev)
 }
 
 
+#ifdef __linux__
+
+/* Size of the reactor's read buffer, when not given by the caller */
+#define HID_REACTOR_DEFAULT_REPORT_SIZE 4096
+
+/* Maximum number of reports dequeued from one device per wakeup,
+   so a single busy device can't starve the others */
+#define HID_REACTOR_MAX_REPORTS_PER_WAKEUP 64
+
+/* Maximum number of epoll events handled per hid_reactor_run() */
+#define HID_REACTOR_MAX_EVENTS 64
+
+struct hid_reactor_entry {
+	hid_device *dev;
+	hid_reactor_callback_fn callback;
+	void *user_data;
+	/* Removed while hid_reactor_run() was dispatching;
+	   freed by hid_reactor_run() before it returns */
+	int removed;
+	struct hid_reactor_entry *next;
+};
+
+struct hid_reactor_ {
+	int epoll_fd;
+	size_t report_size;
+	unsigned char *buffer;
+	int running; /* hid_reactor_run() is dispatching */
+	struct hid_reactor_entry *entries; /* Linked list of the added devices */
+};
+
+static void hid_reactor_detach(hid_reactor *reactor, struct hid_reactor_entry *entry)
+{
+	struct hid_reactor_entry **current;
+
+	epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, entry->dev->input_event_fd, NULL);
+	entry->dev->reactor = NULL;
+
+	if (reactor->running) {
+		/* The entry may still be referenced by the events being dispatched */
+		entry->removed = 1;
+		return;
+	}
+
+	for (current = &reactor->entries; *current; current = &(*current)->next) {
+		if (*current == entry) {
+			*current = entry->next;
+			break;
+		}
+	}
+	free(entry);
+}
+
+hid_reactor * HID_API_EXPORT HID_API_CALL hid_reactor_new(size_t report_size)
+{
+	hid_reactor *reactor;
+
+	if (report_size == 0)
+		report_size = HID_REACTOR_DEFAULT_REPORT_SIZE;
+
+	reactor = (hid_reactor *) calloc(1, sizeof(hid_reactor));
+	if (reactor == NULL) {
+		LOG("hid_reactor_new failed: Couldn't allocate memory\n");
+		return NULL;
+	}
+
+	reactor->report_size = report_size;
+	reactor->buffer = (unsigned char *) malloc(report_size);
+	if (reactor->buffer == NULL) {
+		LOG("hid_reactor_new failed: Couldn't allocate memory\n");
+		free(reactor);
+		return NULL;
+	}
+
+	reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (reactor->epoll_fd < 0) {
+		LOG("epoll_create1 failed: %s\n", strerror(errno));
+		free(reactor->buffer);
+		free(reactor);
+		return NULL;
+	}
+
+	return reactor;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_reactor_add(hid_reactor *reactor, hid_device *dev, hid_reactor_callback_fn callback, void *user_data)
+{
+	struct hid_reactor_entry *entry;
+	struct epoll_event ev;
+	int res;
+
+	if (!reactor || !dev || !callback || dev->reactor)
+		return -1;
+
+	hidapi_thread_mutex_lock(&dev->thread_state);
+	res = create_input_event_fd(dev);
+	hidapi_thread_mutex_unlock(&dev->thread_state);
+	if (res < 0) {
+		LOG("hid_reactor_add: eventfd failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	entry = (struct hid_reactor_entry *) calloc(1, sizeof(struct hid_reactor_entry));
+	if (entry == NULL) {
+		LOG("hid_reactor_add failed: Couldn't allocate memory\n");
+		return -1;
+	}
+
+	entry->dev = dev;
+	entry->callback = callback;
+	entry->user_data = user_data;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = entry;
+	if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, dev->input_event_fd, &ev) < 0) {
+		LOG("hid_reactor_add: epoll_ctl failed: %s\n", strerror(errno));
+		free(entry);
+		return -1;
+	}
+
+	entry->next = reactor->entries;
+	reactor->entries = entry;
+	dev->reactor = reactor;
+
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_reactor_remove(hid_reactor *reactor, hid_device *dev)
+{
+	struct hid_reactor_entry *entry;
+
+	if (!reactor || !dev || dev->reactor != reactor)
+		return -1;
+
+	for (entry = reactor->entries; entry; entry = entry->next) {
+		if (entry->dev == dev && !entry->removed) {
+			hid_reactor_detach(reactor, entry);
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_reactor_run(hid_reactor *reactor, int milliseconds)
+{
+	struct epoll_event events[HID_REACTOR_MAX_EVENTS];
+	struct hid_reactor_entry **current;
+	int num_events, i, count = 0;
+
+	if (!reactor)
+		return -1;
+
+	num_events = epoll_wait(reactor->epoll_fd, events, HID_REACTOR_MAX_EVENTS, milliseconds);
+	if (num_events < 0) {
+		if (errno == EINTR)
+			return 0;
+		LOG("hid_reactor_run: epoll_wait failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	reactor->running = 1;
+
+	for (i = 0; i < num_events; i++) {
+		struct hid_reactor_entry *entry = (struct hid_reactor_entry *) events[i].data.ptr;
+		hid_device *dev = entry->dev;
+		int n;
+
+		for (n = 0; n < HID_REACTOR_MAX_REPORTS_PER_WAKEUP && !entry->removed; n++) {
+			int bytes_read = 0;
+			int disconnected = 0;
+			int has_report = 0;
+
+			/* The callback is invoked without the lock held, so it may call
+			   any hidapi function on the device, including hid_close() */
+			hidapi_thread_mutex_lock(&dev->thread_state);
+			if (dev->input_reports) {
+				bytes_read = return_data(dev, reactor->buffer, reactor->report_size);
+				has_report = 1;
+			}
+			else if (dev->shutdown_thread) {
+				disconnected = 1;
+			}
+			hidapi_thread_mutex_unlock(&dev->thread_state);
+
+			if (disconnected) {
+				hid_reactor_callback_fn callback = entry->callback;
+				void *user_data = entry->user_data;
+
+				hid_reactor_detach(reactor, entry);
+				callback(dev, NULL, -1, user_data);
+				count++;
+				break;
+			}
+
+			if (!has_report)
+				break;
+
+			entry->callback(dev, reactor->buffer, bytes_read, entry->user_data);
+			count++;
+		}
+	}
+
+	reactor->running = 0;
+
+	/* Free the entries removed during the dispatch */
+	current = &reactor->entries;
+	while (*current) {
+		struct hid_reactor_entry *entry = *current;
+		if (entry->removed) {
+			*current = entry->next;
+			free(entry);
+		}
+		else {
+			current = &entry->next;
+		}
+	}
+
+	return count;
+}
+
+void HID_API_EXPORT HID_API_CALL hid_reactor_free(hid_reactor *reactor)
+{
+	if (!reactor)
+		return;
+
+	while (reactor->entries) {
+		hid_reactor_detach(reactor, reactor->entries);
+	}
+
+	close(reactor->epoll_fd);
+	free(reactor->buffer);
+	free(reactor);
+}
+
+#else /* __linux__ */
+
+hid_reactor * HID_API_EXPORT HID_API_CALL hid_reactor_new(size_t report_size)
+{
+	(void)report_size;
+	LOG("hid_reactor_new: not supported on this platform\n");
+	return NULL;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_reactor_add(hid_reactor *reactor, hid_device *dev, hid_reactor_callback_fn callback, void *user_data)
+{
+	(void)reactor;
+	(void)dev;
+	(void)callback;
+	(void)user_data;
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_reactor_remove(hid_reactor *reactor, hid_device *dev)
+{
+	(void)reactor;
+	(void)dev;
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_reactor_run(hid_reactor *reactor, int milliseconds)
+{
+	(void)reactor;
+	(void)milliseconds;
+	return -1;
+}
+
+void HID_API_EXPORT HID_API_CALL hid_reactor_free(hid_reactor *reactor)
+{
+	(void)reactor;
+}
+
+#endif /* __linux__ */
+
+int HID_API_EXPORT HID_API_CALL hid_get_pollable_fd(hid_device *dev)
+{
+	int res;
+
+	/* The input reports are queued by read_thread(), so the device
+	   has no file descriptor of its own; use dev->input_event_fd */
+	hidapi_thread_mutex_lock(&dev->thread_state);
+	res = create_input_event_fd(dev);
+	hidapi_thread_mutex_unlock(&dev->thread_state);
+
+	if (res < 0) {
+		LOG("hid_get_pollable_fd failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return dev->input_event_fd;
+}
+
+
 int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 {
 	dev->blocking = !nonblock;
@@ -2237,6 +4727,9 @@ void HID_API_EXPORT hid_close(hid_device *dev)
 	if (!dev)
 		return;
 
+	if (dev->reactor)
+		hid_reactor_remove(dev->reactor, dev);
+
 	/* Cause read_thread() to stop. */
 	dev->shutdown_thread = 1;
 	libusb_cancel_transfer(dev->transfer);
@@ -2322,6 +4815,38 @@ int HID_API_EXPORT_CALL hid_get_indexed_string(hid_device *dev, int string_index
 		return -1;
 }
 
+int HID_API_EXPORT_CALL hid_get_manufacturer_string_utf8(hid_device *dev, char *string, size_t maxlen)
+{
+	return hid_get_indexed_string_utf8(dev, dev->manufacturer_index, string, maxlen);
+}
+
+int HID_API_EXPORT_CALL hid_get_product_string_utf8(hid_device *dev, char *string, size_t maxlen)
+{
+	return hid_get_indexed_string_utf8(dev, dev->product_index, string, maxlen);
+}
+
+int HID_API_EXPORT_CALL hid_get_serial_number_string_utf8(hid_device *dev, char *string, size_t maxlen)
+{
+	return hid_get_indexed_string_utf8(dev, dev->serial_index, string, maxlen);
+}
+
+int HID_API_EXPORT_CALL hid_get_indexed_string_utf8(hid_device *dev, int string_index, char *string, size_t maxlen)
+{
+	unsigned char buf[512];
+	int len;
+
+	if (!string || !maxlen)
+		return -1;
+
+	/* Converted straight into the caller's buffer */
+	len = get_usb_string_descriptor(dev->device_handle, string_index, buf, sizeof(buf));
+	if (len < 0)
+		return -1;
+
+	utf16le_to_utf8(buf + 2, (size_t) len - 2, string, maxlen);
+	return 0;
+}
+
 
 int HID_API_EXPORT_CALL hid_get_report_descriptor(hid_device *dev, unsigned char *buf, size_t buf_size)
 {
@@ -49,6 +49,117 @@ extern "C" {
 		*/
 		HID_API_EXPORT hid_device * HID_API_CALL hid_libusb_wrap_sys_device(intptr_t sys_dev, int interface_num);
 
+		/** @brief Set the number of threads used by @ref hid_enumerate.
+
+			By default the devices are enumerated one at a time, and as reading
+			the string descriptors of each device takes blocking control transfers,
+			the enumeration takes as long as all the devices together.
+
+			With more than one thread, the devices are spread over
+			a pool of threads created for each @ref hid_enumerate call,
+			so the enumeration takes about as long as the slowest device.
+			The resulting list is in the same order as with a single thread.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			@ingroup API
+			@param num_threads The number of threads, the calling one included.
+				1 (the default) enumerates on the calling thread only,
+				0 is treated as 1, and the value is capped at 32.
+
+			@note Must not be called concurrently with @ref hid_enumerate.
+		*/
+		void HID_API_EXPORT_CALL hid_libusb_set_enumerate_threads(unsigned int num_threads);
+
+		/** @brief Getter for option set by @ref hid_libusb_set_enumerate_threads.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			@ingroup API
+			@return The number of threads used by @ref hid_enumerate.
+		*/
+		unsigned int HID_API_EXPORT_CALL hid_libusb_get_enumerate_threads(void);
+
+		/** @brief Answer @ref hid_enumerate from a device list kept up to date by hotplug events.
+
+			When enabled, the threads used by @ref hid_hotplug_register_callback
+			keep running even with no callbacks registered. @ref hid_enumerate,
+			@ref hid_enumerate_ex and @ref hid_open then copy the matching devices
+			from the list they maintain, instead of opening every device
+			on the bus to read its string descriptors again.
+
+			The threads run until the cache is disabled (or @ref hid_exit is called)
+			and no callbacks are left.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			@ingroup API
+			@param enable Non-zero to enable the cache, 0 to disable it (the default).
+
+			@returns
+				This function returns 0 on success and -1 if libusb
+				doesn't support hotplug or the threads could not be started.
+		*/
+		int HID_API_EXPORT_CALL hid_libusb_set_enumerate_cache(int enable);
+
+		/** @brief Getter for option set by @ref hid_libusb_set_enumerate_cache.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			@ingroup API
+			@return 1 if the enumeration cache is enabled, 0 otherwise.
+		*/
+		int HID_API_EXPORT_CALL hid_libusb_get_enumerate_cache(void);
+
+		/** @brief Invoke the hotplug callbacks on a pool of threads.
+
+			By default the hotplug callbacks are invoked by an internal
+			thread, one after the other, so a slow callback delays every
+			later event, and @ref hid_hotplug_register_callback waits
+			for it in other threads.
+
+			With one or more threads, that thread only queues a copy of
+			the device info of each event for the matching callbacks,
+			and the threads of the pool invoke them. A callback is run by
+			one thread at a time and gets its events in the order they
+			happened, the @ref HID_API_HOTPLUG_ENUMERATE replay first;
+			different callbacks run concurrently. The device info passed
+			to a callback is only valid for the duration of the call.
+
+			@ref hid_hotplug_deregister_callback drops the events queued for
+			the callback. If the callback is being run by another thread
+			at that moment, that call still completes after
+			@ref hid_hotplug_deregister_callback returns.
+
+			The threads are stopped by @ref hid_exit, without running
+			the callbacks for the events still queued.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			@ingroup API
+			@param num_threads The number of threads, capped at 32.
+				0 (the default) invokes the callbacks on the internal thread.
+
+			@returns
+				This function returns 0 on success and -1 if libusb
+				doesn't support hotplug, hotplug callbacks are registered,
+				or the threads could not be started. The callbacks are then
+				invoked on the internal thread.
+
+			@note Must not be called from a hotplug callback.
+		*/
+		int HID_API_EXPORT_CALL hid_libusb_set_hotplug_threads(unsigned int num_threads);
+
+		/** @brief Getter for option set by @ref hid_libusb_set_hotplug_threads.
+
+			Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0)
+
+			@ingroup API
+			@return The number of threads that invoke the hotplug callbacks,
+				0 if they are invoked on the internal thread.
+		*/
+		unsigned int HID_API_EXPORT_CALL hid_libusb_get_hotplug_threads(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -148,9 +148,10 @@ static void hidapi_thread_barrier_wait(hidapi_thread_state *state)
 	pthread_barrier_wait(&state->barrier);
 }
 
-static void hidapi_thread_create(hidapi_thread_state *state, void *(*func)(void*), void *func_arg)
+/* Returns 0 on success, and an error number if the thread couldn't be created */
+static int hidapi_thread_create(hidapi_thread_state *state, void *(*func)(void*), void *func_arg)
 {
-	pthread_create(&state->thread, NULL, func, func_arg);
+	return pthread_create(&state->thread, NULL, func, func_arg);
 }
 
 static void hidapi_thread_join(hidapi_thread_state *state)
@@ -31,11 +31,17 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/ioctl.h>
 #include <sys/utsname.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
 #include <poll.h>
 #include <pthread.h>
+#include <time.h>
 
 /* Linux */
 #include <linux/hidraw.h>
@@ -43,7 +49,12 @@
 #include <linux/input.h>
 #include <libudev.h>
 
-#include "hidapi.h"
+#ifdef HIDAPI_HAVE_LIBURING
+#include <stdint.h>
+#include <liburing.h>
+#endif
+
+#include "hidapi_hidraw.h"
 
 #ifdef HIDAPI_ALLOW_BUILD_WORKAROUND_KERNEL_2_6_39
 /* This definitions first appeared in Linux Kernel 2.6.39 in linux/hidraw.h.
@@ -72,16 +83,85 @@
 #define HIDIOCSOUTPUT(len)   _IOC(_IOC_WRITE|_IOC_READ, 'H', 0x0B, len)
 #endif
 
+// HIDIOCGRAWUNIQ is not defined in Linux kernel headers < 5.6.
+// Older kernels fail it with EINVAL, see create_device_info_from_hidraw().
+#ifndef HIDIOCGRAWUNIQ
+#define HIDIOCGRAWUNIQ(len)  _IOC(_IOC_READ, 'H', 0x08, len)
+#endif
+
 /* The value of the first callback handle to be given upon registration */
 /* Can be any arbitrary positive integer */
 #define FIRST_HOTPLUG_CALLBACK_HANDLE 1
 
+#if defined(__GNUC__)
+#define thread_local __thread
+#elif __STDC_VERSION__ >= 201112L
+#define thread_local _Thread_local
+#else
+#error Cannot define thread_local
+#endif
+
+/* Size of the message buffers of struct hid_error, in characters */
+#define HID_ERROR_MESSAGE_SIZE 256
+
+/* Identifies the message of an error, see error_messages[] */
+enum hid_error_id {
+	HID_ERROR_SUCCESS = 0,
+	HID_ERROR_ERRNO, /* the message is only strerror(errnum) */
+	HID_ERROR_TEXT, /* the message is in hid_error.text */
+	HID_ERROR_ZERO_BUFFER,
+	HID_ERROR_NO_MEMORY,
+	HID_ERROR_DISCONNECTED,
+	HID_ERROR_IOCTL_SFEATURE,
+	HID_ERROR_IOCTL_GFEATURE,
+	HID_ERROR_IOCTL_SOUTPUT,
+	HID_ERROR_IOCTL_GINPUT,
+	HID_ERROR_IOCTL_GRDESCSIZE,
+	HID_ERROR_IOCTL_GRDESC,
+};
+
+static const char *const error_messages[] = {
+	[HID_ERROR_SUCCESS] = "Success",
+	[HID_ERROR_ERRNO] = NULL,
+	[HID_ERROR_TEXT] = NULL,
+	[HID_ERROR_ZERO_BUFFER] = "Zero buffer/length",
+	[HID_ERROR_NO_MEMORY] = "Couldn't allocate memory",
+	[HID_ERROR_DISCONNECTED] = "unexpected poll error (device disconnected)",
+	[HID_ERROR_IOCTL_SFEATURE] = "ioctl (SFEATURE)",
+	[HID_ERROR_IOCTL_GFEATURE] = "ioctl (GFEATURE)",
+	[HID_ERROR_IOCTL_SOUTPUT] = "ioctl (SOUTPUT)",
+	[HID_ERROR_IOCTL_GINPUT] = "ioctl (GINPUT)",
+	[HID_ERROR_IOCTL_GRDESCSIZE] = "ioctl(GRDESCSIZE)",
+	[HID_ERROR_IOCTL_GRDESC] = "ioctl(GRDESC)",
+};
+
+/* The last error of a device (or the global one).
+   Registering an error only stores the id and errno (or copies the text
+   of an error which doesn't have an id), so neither success nor failure
+   allocates. The wide string is built when hid_error()/hid_read_error()
+   asks for it. */
+struct hid_error {
+	enum hid_error_id id;
+	int errnum; /* if non-zero, strerror(errnum) is appended to the message */
+	char text[HID_ERROR_MESSAGE_SIZE];
+	wchar_t wide[HID_ERROR_MESSAGE_SIZE];
+};
+
 struct hid_device_ {
 	int device_handle;
 	int blocking;
-	wchar_t *last_error_str;
-	wchar_t *last_read_error_str;
+	int fd_nonblocking; /* device_handle has O_NONBLOCK set, see set_fd_nonblocking() */
+	hid_hidraw_uring *uring; /* the io_uring engine the device is added to, if any */
+	unsigned int uring_slot; /* index of the device in uring->slots */
+	hid_reactor *reactor; /* the reactor the device is added to, if any */
+	struct hidraw_read_ring *read_ring; /* the background reader, see hid_hidraw_enable_read_ring() */
+	struct hidraw_report_descriptor *report_descriptor; /* read once by hid_open_path() */
+	struct hid_hidraw_usage *usages; /* the Usage Page/Usage pairs of report_descriptor */
+	struct hid_hidraw_report_info report_info; /* derived from report_descriptor */
+	struct hid_error last_error;
+	struct hid_error last_read_error;
 	struct hid_device_info* device_info;
+	struct hid_device_info_utf8 *device_info_utf8; /* built by the first hid_get_*_string_utf8() */
 };
 
 static struct hid_api_version api_version = {
@@ -90,7 +170,10 @@ static struct hid_api_version api_version = {
 	.patch = HID_API_VERSION_PATCH
 };
 
-static wchar_t *last_global_error_str = NULL;
+/* The global error is per thread, so functions which don't take a device
+   (hid_enumerate(), hid_open_path(), ...) can run on several threads at once.
+   It holds no heap memory, so nothing has to be freed on thread exit. */
+static thread_local struct hid_error last_global_error;
 
 
 static hid_device *new_hid_device(void)
@@ -102,9 +185,18 @@ static hid_device *new_hid_device(void)
 
 	dev->device_handle = -1;
 	dev->blocking = 1;
-	dev->last_error_str = NULL;
-	dev->last_read_error_str = NULL;
+	dev->fd_nonblocking = 0;
+	dev->uring = NULL;
+	dev->uring_slot = 0;
+	dev->reactor = NULL;
+	dev->read_ring = NULL;
+	dev->report_descriptor = NULL;
+	dev->usages = NULL;
+	memset(&dev->report_info, 0, sizeof(dev->report_info));
+	dev->last_error.id = HID_ERROR_SUCCESS;
+	dev->last_read_error.id = HID_ERROR_SUCCESS;
 	dev->device_info = NULL;
+	dev->device_info_utf8 = NULL;
 
 	return dev;
 }
@@ -132,34 +224,180 @@ static wchar_t *utf8_to_wchar_t(const char *utf8)
 	return ret;
 }
 
+/* Encode the code point c as UTF-8 into buf, which must have room for 4 bytes.
+   Surrogates and values out of the Unicode range are replaced by U+FFFD.
+   Returns the number of bytes written. */
+static size_t encode_utf8(unsigned long c, char *buf)
+{
+	unsigned char *out = (unsigned char *) buf;
+
+	if (c < 0x80) {
+		out[0] = (unsigned char) c;
+		return 1;
+	}
+	if (c < 0x800) {
+		out[0] = (unsigned char) (0xC0 | (c >> 6));
+		out[1] = (unsigned char) (0x80 | (c & 0x3F));
+		return 2;
+	}
+	if ((c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF)
+		c = 0xFFFD;
+	if (c < 0x10000) {
+		out[0] = (unsigned char) (0xE0 | (c >> 12));
+		out[1] = (unsigned char) (0x80 | ((c >> 6) & 0x3F));
+		out[2] = (unsigned char) (0x80 | (c & 0x3F));
+		return 3;
+	}
+	out[0] = (unsigned char) (0xF0 | (c >> 18));
+	out[1] = (unsigned char) (0x80 | ((c >> 12) & 0x3F));
+	out[2] = (unsigned char) (0x80 | ((c >> 6) & 0x3F));
+	out[3] = (unsigned char) (0x80 | (c & 0x3F));
+	return 4;
+}
+
+/* Convert a wide string to UTF-8, regardless of the locale.
+   The caller must free the returned string with free(). */
+static char *wchar_t_to_utf8(const wchar_t *wcs)
+{
+	char buf[4];
+	size_t len = 0;
+	const wchar_t *cur;
+	char *ret, *out;
+
+	if (!wcs)
+		return NULL;
+
+	for (cur = wcs; *cur; cur++)
+		len += encode_utf8((unsigned long) *cur, buf);
+
+	ret = (char *) malloc(len + 1);
+	if (!ret)
+		return NULL;
+
+	out = ret;
+	for (cur = wcs; *cur; cur++)
+		out += encode_utf8((unsigned long) *cur, out);
+	*out = '\0';
+
+	return ret;
+}
+
+/* Copy the UTF-8 string str into a buffer of maxlen bytes. A string which
+   doesn't fit is cut before the first character which doesn't fit entirely. */
+static void copy_utf8_string(char *string, size_t maxlen, const char *str)
+{
+	size_t len = str ? strlen(str) : 0;
+
+	if (len > maxlen - 1) {
+		len = maxlen - 1;
+		/* Step back over the continuation bytes of the character cut in two */
+		while (len > 0 && (str[len] & 0xC0) == 0x80)
+			len--;
+	}
+
+	if (len > 0)
+		memcpy(string, str, len);
+	string[len] = '\0';
+}
+
+/* Compare a wide string with a multibyte one, without converting
+   the whole string. Equivalent to comparing with utf8_to_wchar_t(mbs). */
+static int wcs_equals_mbs(const wchar_t *wcs, const char *mbs)
+{
+	const wchar_t *cur = wcs;
+	size_t len = strlen(mbs) + 1; /* Including the terminator */
+	mbstate_t state;
+
+	memset(&state, 0, sizeof(state));
+
+	for (;;) {
+		wchar_t wc;
+		size_t res = mbrtowc(&wc, mbs, len, &state);
+
+		if (res == (size_t) -1 || res == (size_t) -2) {
+			/* utf8_to_wchar_t() gives an empty string for invalid input */
+			return wcs[0] == L'\0';
+		}
+		if (res == 0)
+			return *cur == L'\0';
+		if (*cur != wc)
+			return 0;
+
+		cur++;
+		mbs += res;
+		len -= res;
+	}
+}
+
+
+/* Set the error to the message with the given id.
+   If errnum is non-zero, strerror(errnum) is appended to the message.
+   Use register_error(error, HID_ERROR_SUCCESS, 0) to indicate "no error". */
+static void register_error(struct hid_error *error, enum hid_error_id id, int errnum)
+{
+	error->id = id;
+	error->errnum = errnum;
+}
 
-/* Makes a copy of the given error message (and decoded according to the
- * currently locale) into the wide string pointer pointed by error_str.
- * The last stored error string is freed.
- * Use register_error_str(NULL) to free the error message completely. */
-static void register_error_str(wchar_t **error_str, const char *msg)
+/* Makes a copy of the given error message into error.
+   Use register_error_str(NULL) to indicate "no error". */
+static void register_error_str(struct hid_error *error, const char *msg)
 {
-	free(*error_str);
-	*error_str = utf8_to_wchar_t(msg);
+	if (msg == NULL) {
+		register_error(error, HID_ERROR_SUCCESS, 0);
+		return;
+	}
+
+	strncpy(error->text, msg, sizeof(error->text) - 1);
+	error->text[sizeof(error->text) - 1] = '\0';
+	register_error(error, HID_ERROR_TEXT, 0);
 }
 
 /* Semilar to register_error_str, but allows passing a format string with va_list args into this function. */
-static void register_error_str_vformat(wchar_t **error_str, const char *format, va_list args)
+static void register_error_str_vformat(struct hid_error *error, const char *format, va_list args)
+{
+	vsnprintf(error->text, sizeof(error->text), format, args);
+	register_error(error, HID_ERROR_TEXT, 0);
+}
+
+/* Build the message of the error, decoded according to the current locale.
+   The returned string is owned by error, and valid until the next call. */
+static const wchar_t *error_to_wchar_t(struct hid_error *error)
 {
-	char msg[256];
-	vsnprintf(msg, sizeof(msg), format, args);
+	char msg[HID_ERROR_MESSAGE_SIZE];
+	const char *src;
+
+	switch (error->id) {
+	case HID_ERROR_SUCCESS:
+		return L"Success";
+	case HID_ERROR_ERRNO:
+		src = strerror(error->errnum);
+		break;
+	case HID_ERROR_TEXT:
+		src = error->text;
+		break;
+	default:
+		src = error_messages[error->id];
+		if (error->errnum) {
+			snprintf(msg, sizeof(msg), "%s: %s", src, strerror(error->errnum));
+			src = msg;
+		}
+		break;
+	}
 
-	register_error_str(error_str, msg);
+	if (mbstowcs(error->wide, src, HID_ERROR_MESSAGE_SIZE) == (size_t) -1)
+		error->wide[0] = L'\0';
+	error->wide[HID_ERROR_MESSAGE_SIZE - 1] = L'\0';
+
+	return error->wide;
 }
 
 /* Set the last global error to be reported by hid_error(NULL).
- * The given error message will be copied (and decoded according to the
- * currently locale, so do not pass in string constants).
- * The last stored global error message is freed.
- * Use register_global_error(NULL) to indicate "no error". */
+   The given error message will be copied.
+   Use register_global_error(NULL) to indicate "no error". */
 static void register_global_error(const char *msg)
 {
-	register_error_str(&last_global_error_str, msg);
+	register_error_str(&last_global_error, msg);
 }
 
 /* Similar to register_global_error, but allows passing a format string into this function. */
@@ -167,34 +405,29 @@ static void register_global_error_format(const char *format, ...)
 {
 	va_list args;
 	va_start(args, format);
-	register_error_str_vformat(&last_global_error_str, format, args);
+	register_error_str_vformat(&last_global_error, format, args);
 	va_end(args);
 }
 
 /* Set the last error for a device to be reported by hid_error(dev).
- * The given error message will be copied (and decoded according to the
- * currently locale, so do not pass in string constants).
- * The last stored device error message is freed.
- * Use register_device_error(dev, NULL) to indicate "no error". */
+   The given error message will be copied.
+   Use register_device_error(dev, NULL) to indicate "no error". */
 static void register_device_error(hid_device *dev, const char *msg)
 {
-	register_error_str(&dev->last_error_str, msg);
+	register_error_str(&dev->last_error, msg);
 }
 
-/* Similar to register_device_error, but you can pass a format string into this function. */
-static void register_device_error_format(hid_device *dev, const char *format, ...)
+/* Set the last error for a device to the message with the given id.
+   This is what the I/O functions use, as it doesn't copy anything. */
+static void register_device_error_id(hid_device *dev, enum hid_error_id id, int errnum)
 {
-	va_list args;
-	va_start(args, format);
-	register_error_str_vformat(&dev->last_error_str, format, args);
-	va_end(args);
+	register_error(&dev->last_error, id, errnum);
 }
 
-/* Get an attribute value from a udev_device and return it as a whar_t
-   string. The returned string must be freed with free() when done.*/
-static wchar_t *copy_udev_string(struct udev_device *dev, const char *udev_name)
+/* Set the last read error for a device, to be reported by hid_read_error(dev). */
+static void register_device_read_error_id(hid_device *dev, enum hid_error_id id, int errnum)
 {
-	return utf8_to_wchar_t(udev_device_get_sysattr_value(dev, udev_name));
+	register_error(&dev->last_read_error, id, errnum);
 }
 
 /*
@@ -414,6 +647,124 @@ static int get_next_hid_usage(const __u8 *report_descriptor, __u32 size, struct
 	return 1; /* finished processing */
 }
 
+/* Depth of the Push/Pop stack of the Global items */
+#define HID_GLOBAL_STACK_SIZE 16
+
+/*
+ * Computes the size of the largest Input, Output and Feature report
+ * in the report descriptor, in the form the reports are exchanged
+ * with hidraw:
+ *  - Input reports, as returned by read(), start with the Report ID
+ *    only when the device uses Report IDs;
+ *  - Output and Feature reports always start with the Report ID,
+ *    which is 0 when the device doesn't use Report IDs.
+ * A type the device has no reports of gets a size of 0.
+ *
+ * Returns 0 on success and -1 on a malformed report.
+ */
+static int get_hid_report_sizes(const __u8 *report_descriptor, __u32 size, size_t *max_input, size_t *max_output, size_t *max_feature)
+{
+	struct hid_globals {
+		__u32 report_size;
+		__u32 report_count;
+		unsigned int report_id;
+	} globals, stack[HID_GLOBAL_STACK_SIZE];
+	unsigned int stack_depth = 0;
+	/* Total size of each report in bits, by type (Input, Output, Feature) and Report ID */
+	unsigned long long (*bits)[256];
+	unsigned int pos = 0, type, id;
+	int data_len, key_size;
+	int res = 0;
+
+	*max_input = *max_output = *max_feature = 0;
+
+	bits = (unsigned long long (*)[256]) calloc(3, sizeof(*bits));
+	if (!bits)
+		return -1;
+
+	memset(&globals, 0, sizeof(globals));
+
+	while (pos < size) {
+		int key = report_descriptor[pos];
+		int key_cmd = key & 0xfc;
+		__u32 value;
+
+		/* Determine data_len and key_size */
+		if (!get_hid_item_size(report_descriptor, size, pos, &data_len, &key_size)) {
+			res = -1; /* malformed report */
+			break;
+		}
+
+		value = get_hid_report_bytes(report_descriptor, size, data_len, pos);
+
+		switch (key_cmd) {
+		case 0x80: /* Input 6.2.2.4 (Main) */
+		case 0x90: /* Output 6.2.2.4 (Main) */
+		case 0xb0: /* Feature 6.2.2.4 (Main) */
+			type = key_cmd == 0x80 ? 0 : key_cmd == 0x90 ? 1 : 2;
+			bits[type][globals.report_id] += (unsigned long long) globals.report_size * globals.report_count;
+			break;
+
+		case 0x74: /* Report Size 6.2.2.7 (Global) */
+			globals.report_size = value;
+			break;
+
+		case 0x94: /* Report Count 6.2.2.7 (Global) */
+			globals.report_count = value;
+			break;
+
+		case 0x84: /* Report ID 6.2.2.7 (Global) */
+			globals.report_id = value & 0xff;
+			break;
+
+		case 0xa4: /* Push 6.2.2.7 (Global) */
+			if (stack_depth < HID_GLOBAL_STACK_SIZE)
+				stack[stack_depth] = globals;
+			stack_depth++;
+			break;
+
+		case 0xb4: /* Pop 6.2.2.7 (Global) */
+			if (stack_depth == 0) {
+				res = -1; /* malformed report */
+				break;
+			}
+			stack_depth--;
+			if (stack_depth < HID_GLOBAL_STACK_SIZE)
+				globals = stack[stack_depth];
+			break;
+		}
+
+		if (res < 0)
+			break;
+
+		/* Skip over this key and its associated data */
+		pos += data_len + key_size;
+	}
+
+	if (res == 0) {
+		size_t *max_sizes[3] = { max_input, max_output, max_feature };
+
+		for (type = 0; type < 3; type++) {
+			for (id = 0; id < 256; id++) {
+				size_t report_size;
+
+				if (bits[type][id] == 0)
+					continue;
+
+				report_size = (size_t) ((bits[type][id] + 7) / 8);
+				if (id != 0 || type != 0)
+					report_size++; /* the Report ID byte */
+
+				if (report_size > *max_sizes[type])
+					*max_sizes[type] = report_size;
+			}
+		}
+	}
+
+	free(bits);
+	return res;
+}
+
 /*
  * Retrieves the hidraw report descriptor from a file.
  * When using this form, <sysfs_path>/device/report_descriptor, elevated privileges are not required.
@@ -555,7 +906,7 @@ static int get_hid_report_descriptor_from_hidraw(hid_device *dev, struct hidraw_
 	/* Get Report Descriptor Size */
 	int res = ioctl(dev->device_handle, HIDIOCGRDESCSIZE, &desc_size);
 	if (res < 0) {
-		register_device_error_format(dev, "ioctl(GRDESCSIZE): %s", strerror(errno));
+		register_device_error_id(dev, HID_ERROR_IOCTL_GRDESCSIZE, errno);
 		return res;
 	}
 
@@ -564,12 +915,67 @@ static int get_hid_report_descriptor_from_hidraw(hid_device *dev, struct hidraw_
 	rpt_desc->size = desc_size;
 	res = ioctl(dev->device_handle, HIDIOCGRDESC, rpt_desc);
 	if (res < 0) {
-		register_device_error_format(dev, "ioctl(GRDESC): %s", strerror(errno));
+		register_device_error_id(dev, HID_ERROR_IOCTL_GRDESC, errno);
 	}
 
 	return res;
 }
 
+/* Read the report descriptor once, and cache it together with
+   the metadata derived from it, so later queries don't need ioctls.
+   Returns -1 only if the node doesn't respond to HIDIOCGRDESCSIZE.
+   The cache is best-effort: if the descriptor can't be read, or there is
+   no memory for it, dev->report_descriptor stays NULL and
+   hid_get_report_descriptor() reads it on each call.
+   Failing to parse the descriptor is not an error, the derived
+   metadata is then only what could be parsed. */
+static int cache_report_descriptor(hid_device *dev)
+{
+	struct hidraw_report_descriptor *rpt_desc;
+	struct hid_usage_iterator usage_iterator;
+	unsigned short page = 0, usage = 0;
+	size_t num_usages = 0;
+	int desc_size = 0;
+
+	if (ioctl(dev->device_handle, HIDIOCGRDESCSIZE, &desc_size) < 0) {
+		register_device_error_id(dev, HID_ERROR_IOCTL_GRDESCSIZE, errno);
+		return -1;
+	}
+
+	rpt_desc = (struct hidraw_report_descriptor *) malloc(sizeof(struct hidraw_report_descriptor));
+	if (!rpt_desc)
+		return 0;
+
+	if (get_hid_report_descriptor_from_hidraw(dev, rpt_desc) < 0) {
+		free(rpt_desc);
+		register_device_error(dev, NULL);
+		return 0;
+	}
+
+	memset(&usage_iterator, 0, sizeof(usage_iterator));
+	while (!get_next_hid_usage(rpt_desc->value, rpt_desc->size, &usage_iterator, &page, &usage)) {
+		/* A descriptor has only a few top-level collections, grow one by one */
+		struct hid_hidraw_usage *usages = (struct hid_hidraw_usage *) realloc(dev->usages, (num_usages + 1) * sizeof(struct hid_hidraw_usage));
+		if (!usages)
+			break;
+		dev->usages = usages;
+		dev->usages[num_usages].usage_page = page;
+		dev->usages[num_usages].usage = usage;
+		num_usages++;
+	}
+
+	get_hid_report_sizes(rpt_desc->value, rpt_desc->size,
+		&dev->report_info.max_input_report_size,
+		&dev->report_info.max_output_report_size,
+		&dev->report_info.max_feature_report_size);
+
+	dev->report_info.usages = dev->usages;
+	dev->report_info.num_usages = num_usages;
+	dev->report_descriptor = rpt_desc;
+
+	return 0;
+}
+
 /*
  * The caller is responsible for free()ing the (newly-allocated) character
  * strings pointed to by serial_number_utf8 and product_name_utf8 after use.
@@ -636,493 +1042,1055 @@ next_line:
 	return (found_id && found_name && found_serial);
 }
 
-
-static struct hid_device_info * create_device_info_for_device(struct udev_device *raw_dev)
+/*
+ * Like parse_uevent_info(), but without copying anything: the uevent is
+ * split in place and serial_number_utf8 and product_name_utf8 point into it.
+ * product_name_utf8 may be NULL when the name isn't needed.
+ */
+static int parse_uevent_info_in_place(char *uevent, unsigned *bus_type,
+	unsigned short *vendor_id, unsigned short *product_id,
+	const char **serial_number_utf8, const char **product_name_utf8)
 {
-	struct hid_device_info *root = NULL;
-	struct hid_device_info *cur_dev = NULL;
-
-	const char *sysfs_path;
-	const char *dev_path;
-	const char *str;
-	struct udev_device *hid_dev; /* The device's HID udev node. */
-	struct udev_device *usb_dev; /* The device's USB udev node. */
-	struct udev_device *intf_dev; /* The device's interface (in the USB sense). */
-	unsigned short dev_vid;
-	unsigned short dev_pid;
-	char *serial_number_utf8 = NULL;
-	char *product_name_utf8 = NULL;
-	unsigned bus_type;
-	int result;
-	struct hidraw_report_descriptor report_desc;
+	char *saveptr = NULL;
+	char *line;
+	char *value;
 
-	sysfs_path = udev_device_get_syspath(raw_dev);
-	dev_path = udev_device_get_devnode(raw_dev);
+	int found_id = 0;
+	int found_serial = 0;
+	int found_name = 0;
 
-	hid_dev = udev_device_get_parent_with_subsystem_devtype(
-		raw_dev,
-		"hid",
-		NULL);
+	for (line = strtok_r(uevent, "\n", &saveptr); line != NULL; line = strtok_r(NULL, "\n", &saveptr)) {
+		value = strchr(line, '=');
+		if (!value)
+			continue;
+		*value++ = '\0';
 
-	if (!hid_dev) {
-		/* Unable to find parent hid device. */
-		goto end;
+		if (strcmp(line, "HID_ID") == 0) {
+			if (sscanf(value, "%x:%hx:%hx", bus_type, vendor_id, product_id) == 3)
+				found_id = 1;
+		} else if (strcmp(line, "HID_NAME") == 0) {
+			if (product_name_utf8)
+				*product_name_utf8 = value;
+			found_name = 1;
+		} else if (strcmp(line, "HID_UNIQ") == 0) {
+			*serial_number_utf8 = value;
+			found_serial = 1;
+		}
 	}
 
-	result = parse_uevent_info(
-		udev_device_get_sysattr_value(hid_dev, "uevent"),
-		&bus_type,
-		&dev_vid,
-		&dev_pid,
-		&serial_number_utf8,
-		&product_name_utf8);
+	/* The same devices as parse_uevent_info() accepts */
+	return (found_id && found_name && found_serial);
+}
 
-	if (!result) {
-		/* parse_uevent_info() failed for at least one field. */
-		goto end;
-	}
 
-	/* Filter out unhandled devices right away */
-	switch (bus_type) {
-		case BUS_BLUETOOTH:
-		case BUS_I2C:
-		case BUS_USB:
-		case BUS_SPI:
-		case BUS_VIRTUAL:
-			break;
+/* The attributes of a hidraw device its hid_device_info is built from,
+   whether they were read through udev, directly from sysfs, or with ioctls */
+struct hidraw_device_attributes {
+	const char *dev_path; /* The device node, e.g. /dev/hidraw0 */
+	unsigned bus_type;
+	unsigned short vendor_id;
+	unsigned short product_id;
+	const char *serial_number; /* HID_UNIQ of the HID device */
+	const char *product_name; /* HID_NAME of the HID device */
+
+	/* BUS_USB only: the attributes of the USB device and interface
+	   the HID device belongs to. NULL if an attribute doesn't exist. */
+	int has_usb_device;
+	const char *usb_manufacturer;
+	const char *usb_product;
+	const char *usb_bcd_device;
+	const char *usb_interface_number; /* NULL if there is no USB interface */
+
+	const __u8 *report_descriptor; /* NULL if it couldn't be read */
+	__u32 report_descriptor_size;
+};
 
-		default:
-			goto end;
-	}
+/* A hid_device_info record allocated by alloc_device_infos() */
+struct hidraw_device_info {
+	struct hid_device_info info; /* Must be the first member */
+	struct hidraw_device_info_block *block;
+};
 
-	/* Create the record. */
-	root = (struct hid_device_info*) calloc(1, sizeof(struct hid_device_info));
-	if (!root)
-		goto end;
+/* A single allocation holding the records of one device, followed by
+   the strings they share. It is freed along with its last record. */
+struct hidraw_device_info_block {
+	size_t num_records; /* The records not freed by hid_free_enumeration() yet */
+	struct hidraw_device_info records[];
+};
 
-	cur_dev = root;
+/* A hid_device_info_utf8 record allocated by alloc_device_infos_utf8() */
+struct hidraw_device_info_utf8 {
+	struct hid_device_info_utf8 info; /* Must be the first member */
+	struct hidraw_device_info_utf8_block *block;
+};
 
-	/* Fill out the record */
-	cur_dev->next = NULL;
-	cur_dev->path = dev_path? strdup(dev_path): NULL;
+/* Like struct hidraw_device_info_block, for hid_device_info_utf8 records */
+struct hidraw_device_info_utf8_block {
+	size_t num_records; /* The records not freed by hid_free_enumeration_utf8() yet */
+	struct hidraw_device_info_utf8 records[];
+};
 
-	/* VID/PID */
-	cur_dev->vendor_id = dev_vid;
-	cur_dev->product_id = dev_pid;
+/* Number of wchar_t taken by a copy of str, including the terminator */
+static size_t wcs_size(const wchar_t *str)
+{
+	return str ? wcslen(str) + 1 : 0;
+}
 
-	/* Serial Number */
-	cur_dev->serial_number = utf8_to_wchar_t(serial_number_utf8);
+static wchar_t *copy_wcs_to(wchar_t **dst, const wchar_t *str)
+{
+	wchar_t *copy = *dst;
 
-	/* Release Number */
-	cur_dev->release_number = 0x0;
+	if (!str)
+		return NULL;
 
-	/* Interface Number */
-	cur_dev->interface_number = -1;
+	wcscpy(copy, str);
+	*dst += wcslen(str) + 1;
 
-	switch (bus_type) {
-		case BUS_USB:
-			/* The device pointed to by raw_dev contains information about
-				the hidraw device. In order to get information about the
-				USB device, get the parent device with the
-				subsystem/devtype pair of "usb"/"usb_device". This will
-				be several levels up the tree, but the function will find
-				it. */
-			usb_dev = udev_device_get_parent_with_subsystem_devtype(
-					raw_dev,
-					"usb",
-					"usb_device");
+	return copy;
+}
 
-			/* uhid USB devices
-			 * Since this is a virtual hid interface, no USB information will
-			 * be available. */
-			if (!usb_dev) {
-				/* Manufacturer and Product strings */
-				cur_dev->manufacturer_string = wcsdup(L"");
-				cur_dev->product_string = utf8_to_wchar_t(product_name_utf8);
-				break;
-			}
+/*
+ * Allocate num records linked into a list, all with the fields of info.
+ * The strings of info are copied once, and shared by all the records.
+ * The list is freed with hid_free_enumeration(), as a whole or record by record.
+ */
+static struct hid_device_info *alloc_device_infos(const struct hid_device_info *info, size_t num)
+{
+	struct hidraw_device_info_block *block;
+	size_t num_wchars = wcs_size(info->serial_number) + wcs_size(info->manufacturer_string) + wcs_size(info->product_string);
+	size_t path_size = info->path ? strlen(info->path) + 1 : 0;
+	wchar_t *serial_number, *manufacturer_string, *product_string;
+	wchar_t *wcs;
+	char *path = NULL;
+	size_t i;
+
+	if (num == 0)
+		return NULL;
 
-			cur_dev->manufacturer_string = copy_udev_string(usb_dev, "manufacturer");
-			cur_dev->product_string = copy_udev_string(usb_dev, "product");
+	block = (struct hidraw_device_info_block *) malloc(sizeof(struct hidraw_device_info_block)
+		+ num * sizeof(struct hidraw_device_info) + num_wchars * sizeof(wchar_t) + path_size);
+	if (!block)
+		return NULL;
 
-			cur_dev->bus_type = HID_API_BUS_USB;
+	wcs = (wchar_t *) &block->records[num];
+	serial_number = copy_wcs_to(&wcs, info->serial_number);
+	manufacturer_string = copy_wcs_to(&wcs, info->manufacturer_string);
+	product_string = copy_wcs_to(&wcs, info->product_string);
 
-			str = udev_device_get_sysattr_value(usb_dev, "bcdDevice");
-			cur_dev->release_number = (str)? strtol(str, NULL, 16): 0x0;
+	if (info->path) {
+		path = (char *) wcs;
+		memcpy(path, info->path, path_size);
+	}
 
-			/* Get a handle to the interface's udev node. */
-			intf_dev = udev_device_get_parent_with_subsystem_devtype(
-					raw_dev,
-					"usb",
-					"usb_interface");
-			if (intf_dev) {
-				str = udev_device_get_sysattr_value(intf_dev, "bInterfaceNumber");
-				cur_dev->interface_number = (str)? strtol(str, NULL, 16): -1;
-			}
+	block->num_records = num;
 
-			break;
+	for (i = 0; i < num; i++) {
+		struct hid_device_info *record = &block->records[i].info;
 
-		case BUS_BLUETOOTH:
-			cur_dev->manufacturer_string = wcsdup(L"");
-			cur_dev->product_string = utf8_to_wchar_t(product_name_utf8);
+		*record = *info;
+		record->path = path;
+		record->serial_number = serial_number;
+		record->manufacturer_string = manufacturer_string;
+		record->product_string = product_string;
+		record->next = (i + 1 < num) ? &block->records[i + 1].info : NULL;
 
-			cur_dev->bus_type = HID_API_BUS_BLUETOOTH;
+		block->records[i].block = block;
+	}
 
-			break;
-		case BUS_I2C:
-			cur_dev->manufacturer_string = wcsdup(L"");
-			cur_dev->product_string = utf8_to_wchar_t(product_name_utf8);
+	return &block->records[0].info;
+}
 
-			cur_dev->bus_type = HID_API_BUS_I2C;
+static size_t str_size(const char *str)
+{
+	return str ? strlen(str) + 1 : 0;
+}
 
-			break;
+static char *copy_str_to(char **dst, const char *str)
+{
+	char *copy = *dst;
+	size_t size = str_size(str);
 
-		case BUS_SPI:
-			cur_dev->manufacturer_string = wcsdup(L"");
-			cur_dev->product_string = utf8_to_wchar_t(product_name_utf8);
+	if (!str)
+		return NULL;
 
-			cur_dev->bus_type = HID_API_BUS_SPI;
+	memcpy(copy, str, size);
+	*dst += size;
 
-			break;
+	return copy;
+}
 
-		case BUS_VIRTUAL:
-			cur_dev->manufacturer_string = wcsdup(L"");
-			cur_dev->product_string = utf8_to_wchar_t(product_name_utf8);
+/* Like alloc_device_infos(), for hid_device_info_utf8 records.
+   The list is freed with hid_free_enumeration_utf8(). */
+static struct hid_device_info_utf8 *alloc_device_infos_utf8(const struct hid_device_info_utf8 *info, size_t num)
+{
+	struct hidraw_device_info_utf8_block *block;
+	size_t strings_size = str_size(info->path) + str_size(info->serial_number) + str_size(info->manufacturer_string) + str_size(info->product_string);
+	char *path, *serial_number, *manufacturer_string, *product_string;
+	char *str;
+	size_t i;
 
-			cur_dev->bus_type = HID_API_BUS_VIRTUAL;
+	if (num == 0)
+		return NULL;
 
-			break;
+	block = (struct hidraw_device_info_utf8_block *) malloc(sizeof(struct hidraw_device_info_utf8_block)
+		+ num * sizeof(struct hidraw_device_info_utf8) + strings_size);
+	if (!block)
+		return NULL;
 
-		default:
-			/* Unknown device type - this should never happen, as we
-			 * check for USB and Bluetooth devices above */
-			break;
-	}
+	str = (char *) &block->records[num];
+	path = copy_str_to(&str, info->path);
+	serial_number = copy_str_to(&str, info->serial_number);
+	manufacturer_string = copy_str_to(&str, info->manufacturer_string);
+	product_string = copy_str_to(&str, info->product_string);
 
-	/* Usage Page and Usage */
+	block->num_records = num;
 
-	if (sysfs_path) {
-		result = get_hid_report_descriptor_from_sysfs(sysfs_path, &report_desc);
-	}
-	else {
-		result = -1;
-	}
+	for (i = 0; i < num; i++) {
+		struct hid_device_info_utf8 *record = &block->records[i].info;
 
-	if (result >= 0) {
-		unsigned short page = 0, usage = 0;
-		struct hid_usage_iterator usage_iterator;
-		memset(&usage_iterator, 0, sizeof(usage_iterator));
+		*record = *info;
+		record->path = path;
+		record->serial_number = serial_number;
+		record->manufacturer_string = manufacturer_string;
+		record->product_string = product_string;
+		record->next = (i + 1 < num) ? &block->records[i + 1].info : NULL;
 
-		/*
-		 * Parse the first usage and usage page
-		 * out of the report descriptor.
-		 */
-		if (!get_next_hid_usage(report_desc.value, report_desc.size, &usage_iterator, &page, &usage)) {
-			cur_dev->usage_page = page;
-			cur_dev->usage = usage;
-		}
+		block->records[i].block = block;
+	}
 
-		/*
-		 * Parse any additional usage and usage pages
-		 * out of the report descriptor.
-		 */
-		while (!get_next_hid_usage(report_desc.value, report_desc.size, &usage_iterator, &page, &usage)) {
-			/* Create new record for additional usage pairs */
-			struct hid_device_info *tmp = (struct hid_device_info*) calloc(1, sizeof(struct hid_device_info));
-			struct hid_device_info *prev_dev = cur_dev;
+	return &block->records[0].info;
+}
 
-			if (!tmp)
-				break;
-			cur_dev->next = tmp;
-			cur_dev = tmp;
+static int is_supported_bus_type(unsigned bus_type)
+{
+	switch (bus_type) {
+		case BUS_BLUETOOTH:
+		case BUS_I2C:
+		case BUS_USB:
+		case BUS_SPI:
+		case BUS_VIRTUAL:
+			return 1;
 
-			/* Update fields */
-			cur_dev->path = dev_path? strdup(dev_path): NULL;
-			cur_dev->vendor_id = dev_vid;
-			cur_dev->product_id = dev_pid;
-			cur_dev->serial_number = prev_dev->serial_number? wcsdup(prev_dev->serial_number): NULL;
-			cur_dev->release_number = prev_dev->release_number;
-			cur_dev->interface_number = prev_dev->interface_number;
-			cur_dev->manufacturer_string = prev_dev->manufacturer_string? wcsdup(prev_dev->manufacturer_string): NULL;
-			cur_dev->product_string = prev_dev->product_string? wcsdup(prev_dev->product_string): NULL;
-			cur_dev->usage_page = page;
-			cur_dev->usage = usage;
-			cur_dev->bus_type = prev_dev->bus_type;
-		}
+		default:
+			return 0;
 	}
+}
 
-end:
-	free(serial_number_utf8);
-	free(product_name_utf8);
+/* Check the filter against what is known from the uevent alone,
+   before reading anything else. BUS_USB devices which turn out not to be
+   backed by a USB device (uhid) are only rejected later, by
+   describe_device_attributes(). */
+static int uevent_matches_filter(unsigned bus_type, unsigned short vendor_id, unsigned short product_id, const struct hid_enumerate_filter *filter)
+{
+	if (!is_supported_bus_type(bus_type))
+		return 0;
 
-	return root;
+	if (!filter)
+		return 1;
+
+	if (filter->vendor_id != 0 && filter->vendor_id != vendor_id)
+		return 0;
+	if (filter->product_id != 0 && filter->product_id != product_id)
+		return 0;
+
+	switch (filter->bus_type) {
+		case HID_API_BUS_UNKNOWN:
+			return 1;
+		case HID_API_BUS_USB:
+			return bus_type == BUS_USB;
+		case HID_API_BUS_BLUETOOTH:
+			return bus_type == BUS_BLUETOOTH;
+		case HID_API_BUS_I2C:
+			return bus_type == BUS_I2C;
+		case HID_API_BUS_SPI:
+			return bus_type == BUS_SPI;
+		case HID_API_BUS_VIRTUAL:
+			return bus_type == BUS_VIRTUAL;
+		default:
+			return 0;
+	}
 }
 
-static struct hid_device_info * create_device_info_for_hid_device(hid_device *dev) {
-	struct udev *udev;
-	struct udev_device *udev_dev;
-	struct stat s;
-	int ret = -1;
-	struct hid_device_info *root = NULL;
+/*
+ * Fill out the fields of the records of a device which are the same for all
+ * its usage pairs. The strings point to the UTF-8 strings of attrs, or are
+ * NULL with HID_API_ENUMERATE_NO_STRINGS.
+ * Returns 0 if the device doesn't match the filter.
+ */
+static int describe_device_attributes(const struct hidraw_device_attributes *attrs, const struct hid_enumerate_filter *filter, struct hid_device_info_utf8 *info)
+{
+	int no_strings = filter && (filter->flags & HID_API_ENUMERATE_NO_STRINGS);
 
-	register_device_error(dev, NULL);
+	/* Filter out unhandled devices right away */
+	if (!uevent_matches_filter(attrs->bus_type, attrs->vendor_id, attrs->product_id, filter))
+		return 0;
 
-	/* Get the dev_t (major/minor numbers) from the file handle. */
-	ret = fstat(dev->device_handle, &s);
-	if (-1 == ret) {
-		register_device_error(dev, "Failed to stat device handle");
-		return NULL;
-	}
+	memset(info, 0, sizeof(*info));
 
-	/* Create the udev object */
-	udev = udev_new();
-	if (!udev) {
-		errno = ENOMEM;
-		register_device_error(dev, "Couldn't create udev context");
-		return NULL;
-	}
+	info->path = (char *) attrs->dev_path;
 
-	/* Open a udev device from the dev_t. 'c' means character device. */
-	udev_dev = udev_device_new_from_devnum(udev, 'c', s.st_rdev);
-	if (udev_dev) {
-		root = create_device_info_for_device(udev_dev);
-	}
+	/* VID/PID */
+	info->vendor_id = attrs->vendor_id;
+	info->product_id = attrs->product_id;
 
-	if (!root) {
-		/* TODO: have a better error reporting via create_device_info_for_device */
-		errno = EIO;
-		register_device_error(dev, "Couldn't create hid_device_info");
-	}
+	/* Release Number */
+	info->release_number = 0x0;
 
-	udev_device_unref(udev_dev);
-	udev_unref(udev);
+	/* Interface Number */
+	info->interface_number = -1;
 
-	return root;
-}
+	switch (attrs->bus_type) {
+		case BUS_USB:
+			/* uhid USB devices
+			 * Since this is a virtual hid interface, no USB information will
+			 * be available. */
+			if (!attrs->has_usb_device)
+				break;
 
-HID_API_EXPORT const struct hid_api_version* HID_API_CALL hid_version(void)
-{
-	return &api_version;
-}
+			info->bus_type = HID_API_BUS_USB;
 
-HID_API_EXPORT const char* HID_API_CALL hid_version_str(void)
-{
-	return HID_API_VERSION_STR;
-}
+			info->release_number = (attrs->usb_bcd_device)? strtol(attrs->usb_bcd_device, NULL, 16): 0x0;
 
-static struct hid_hotplug_context {
-	/* UDEV context that handles the monitor */
-	struct udev* udev_ctx;
+			if (attrs->usb_interface_number) {
+				info->interface_number = strtol(attrs->usb_interface_number, NULL, 16);
+			}
 
-	/* UDEV monitor that receives events */
-	struct udev_monitor* mon;
+			break;
 
-	/* File descriptor for the UDEV monitor that allows to check for new events with select() */
-	int monitor_fd;
+		case BUS_BLUETOOTH:
+			info->bus_type = HID_API_BUS_BLUETOOTH;
+			break;
 
-	/* Thread for the UDEV monitor */
-	pthread_t thread;
+		case BUS_I2C:
+			info->bus_type = HID_API_BUS_I2C;
+			break;
 
-	pthread_mutex_t mutex;
+		case BUS_SPI:
+			info->bus_type = HID_API_BUS_SPI;
+			break;
 
-	/* Boolean flags */
-	unsigned char mutex_ready;
-	unsigned char mutex_in_use;
-	unsigned char cb_list_dirty;
+		case BUS_VIRTUAL:
+			info->bus_type = HID_API_BUS_VIRTUAL;
+			break;
+	}
 
-	/* HIDAPI unique callback handle counter */
-	hid_hotplug_callback_handle next_handle;
+	if (filter) {
+		if (filter->bus_type != HID_API_BUS_UNKNOWN && filter->bus_type != info->bus_type)
+			return 0;
+		if (filter->interface_number != -1 && filter->interface_number != info->interface_number)
+			return 0;
+		if (filter->serial_number && (!attrs->serial_number || !wcs_equals_mbs(filter->serial_number, attrs->serial_number)))
+			return 0;
+	}
 
-	/* Linked list of the hotplug callbacks */
-	struct hid_hotplug_callback *hotplug_cbs;
+	if (no_strings)
+		return 1;
 
-	/* Linked list of the device infos (mandatory when the device is disconnected) */
-	struct hid_device_info *devs;
-} hid_hotplug_context = {
-	.udev_ctx = NULL,
-	.monitor_fd = -1,
-	.next_handle = FIRST_HOTPLUG_CALLBACK_HANDLE,
-	.mutex_ready = 0,
-	.hotplug_cbs = NULL,
-	.devs = NULL
-};
+	/* Serial Number */
+	info->serial_number = (char *) attrs->serial_number;
 
-struct hid_hotplug_callback {
-	hid_hotplug_callback_handle handle;
-	unsigned short vendor_id;
-	unsigned short product_id;
-	hid_hotplug_event events;
-	void *user_data;
-	hid_hotplug_callback_fn callback;
+	/* Manufacturer and Product strings */
+	if (attrs->bus_type == BUS_USB && attrs->has_usb_device) {
+		info->manufacturer_string = (char *) attrs->usb_manufacturer;
+		info->product_string = (char *) attrs->usb_product;
+	}
+	else {
+		info->manufacturer_string = "";
+		info->product_string = (char *) attrs->product_name;
+	}
 
-	/* Pointer to the next notification */
-	struct hid_hotplug_callback *next;
+	return 1;
+}
+
+/* The Usage Page/Usage pairs of a device which match a filter */
+struct hidraw_usage_pairs {
+	const struct hidraw_device_attributes *attrs;
+	const struct hid_enumerate_filter *filter;
+	struct hid_usage_iterator iterator;
+	size_t num_pairs; /* The pairs gone through so far, matching or not */
+	int done;
 };
 
-static void hid_internal_hotplug_remove_postponed()
+static void init_usage_pairs(struct hidraw_usage_pairs *pairs, const struct hidraw_device_attributes *attrs, const struct hid_enumerate_filter *filter)
 {
-	/* Unregister the callbacks whose removal was postponed */
-	/* This function is always called inside a locked mutex */
-	/* However, any actions are only allowed if the mutex is NOT in use and if the DIRTY flag is set */
-	if (!hid_hotplug_context.mutex_ready || hid_hotplug_context.mutex_in_use || !hid_hotplug_context.cb_list_dirty) {
-		return;
-	}
+	memset(pairs, 0, sizeof(*pairs));
+	pairs->attrs = attrs;
+	pairs->filter = filter;
+}
 
-	/* Traverse the list of callbacks and check if any were marked for removal */
-	struct hid_hotplug_callback **current = &hid_hotplug_context.hotplug_cbs;
-	while (*current) {
-		struct hid_hotplug_callback *callback = *current;
-		if (!callback->events) {
-			*current = (*current)->next;
-			free(callback);
-			continue;
+/* Get the next matching pair: each pair of the report descriptor,
+   or a single 0/0 pair if there are none.
+   Returns 0 when there are no more. */
+static int next_usage_pair(struct hidraw_usage_pairs *pairs, unsigned short *page, unsigned short *usage)
+{
+	const struct hid_enumerate_filter *filter = pairs->filter;
+
+	while (!pairs->done) {
+		int res = pairs->attrs->report_descriptor
+			? get_next_hid_usage(pairs->attrs->report_descriptor, pairs->attrs->report_descriptor_size, &pairs->iterator, page, usage)
+			: 1;
+
+		if (res != 0) {
+			pairs->done = 1;
+			if (pairs->num_pairs > 0)
+				break;
+			*page = 0;
+			*usage = 0;
 		}
-		current = &callback->next;
+		pairs->num_pairs++;
+
+		if (!filter
+		 || ((filter->usage_page == 0 || filter->usage_page == *page)
+		  && (filter->usage == 0 || filter->usage == *usage)))
+			return 1;
 	}
-	
-	/* Clear the flag so we don't start the cycle unless necessary */
-	hid_hotplug_context.cb_list_dirty = 0;
+
+	return 0;
 }
 
-static void hid_internal_hotplug_cleanup()
+static struct hid_device_info * create_device_info_from_attributes(const struct hidraw_device_attributes *attrs, const struct hid_enumerate_filter *filter)
 {
-	if (!hid_hotplug_context.mutex_ready || hid_hotplug_context.mutex_in_use) {
-		return;
-	}
-
-	/* Before checking if the list is empty, clear any entries whose removal was postponed first */
-	hid_internal_hotplug_remove_postponed();
+	struct hid_device_info *root;
+	struct hid_device_info *cur_dev;
+	struct hid_device_info info; /* The fields common to all the usage pairs */
+	struct hid_device_info_utf8 desc;
+	struct hidraw_usage_pairs pairs;
+	unsigned short page, usage;
+	size_t num_records = 0;
+
+	if (!describe_device_attributes(attrs, filter, &desc))
+		return NULL;
 
-	if (hid_hotplug_context.hotplug_cbs != NULL) {
-		return;
+	memset(&info, 0, sizeof(info));
+	info.path = desc.path;
+	info.vendor_id = desc.vendor_id;
+	info.product_id = desc.product_id;
+	info.release_number = desc.release_number;
+	info.interface_number = desc.interface_number;
+	info.bus_type = desc.bus_type;
+	info.serial_number = utf8_to_wchar_t(desc.serial_number);
+	info.manufacturer_string = utf8_to_wchar_t(desc.manufacturer_string);
+	info.product_string = utf8_to_wchar_t(desc.product_string);
+
+	/* Usage Page and Usage: one record for each matching pair.
+	   The pairs are counted first, so that all the records of the device
+	   and their strings take a single allocation. */
+	init_usage_pairs(&pairs, attrs, filter);
+	while (next_usage_pair(&pairs, &page, &usage))
+		num_records++;
+
+	root = alloc_device_infos(&info, num_records);
+
+	init_usage_pairs(&pairs, attrs, filter);
+	for (cur_dev = root; cur_dev && next_usage_pair(&pairs, &page, &usage); cur_dev = cur_dev->next) {
+		cur_dev->usage_page = page;
+		cur_dev->usage = usage;
 	}
 
-	pthread_join(hid_hotplug_context.thread, NULL);
+	free(info.serial_number);
+	free(info.manufacturer_string);
+	free(info.product_string);
+
+	return root;
 }
 
-static void hid_internal_hotplug_init()
+/* Like create_device_info_from_attributes(), with the UTF-8 strings
+   copied as they are */
+static struct hid_device_info_utf8 * create_device_info_utf8_from_attributes(const struct hidraw_device_attributes *attrs, const struct hid_enumerate_filter *filter)
 {
-	if (!hid_hotplug_context.mutex_ready) {
-		/* Initialize the mutex as recursive */
-		pthread_mutexattr_t attr;
-		pthread_mutexattr_init(&attr);
-		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-		pthread_mutex_init(&hid_hotplug_context.mutex, &attr);
-		pthread_mutexattr_destroy(&attr);
+	struct hid_device_info_utf8 *root;
+	struct hid_device_info_utf8 *cur_dev;
+	struct hid_device_info_utf8 info;
+	struct hidraw_usage_pairs pairs;
+	unsigned short page, usage;
+	size_t num_records = 0;
+
+	if (!describe_device_attributes(attrs, filter, &info))
+		return NULL;
+
+	init_usage_pairs(&pairs, attrs, filter);
+	while (next_usage_pair(&pairs, &page, &usage))
+		num_records++;
 
-		/* Set state to Ready */
-		hid_hotplug_context.mutex_ready = 1;
-		hid_hotplug_context.mutex_in_use = 0;
-		hid_hotplug_context.cb_list_dirty = 0;
+	root = alloc_device_infos_utf8(&info, num_records);
+
+	init_usage_pairs(&pairs, attrs, filter);
+	for (cur_dev = root; cur_dev && next_usage_pair(&pairs, &page, &usage); cur_dev = cur_dev->next) {
+		cur_dev->usage_page = page;
+		cur_dev->usage = usage;
 	}
+
+	return root;
 }
 
-static void hid_internal_hotplug_exit()
+static struct hid_device_info * create_device_info_for_device(struct udev_device *raw_dev, const struct hid_enumerate_filter *filter)
 {
-	if (!hid_hotplug_context.mutex_ready) {
-		return;
+	struct hid_device_info *root = NULL;
+	struct hidraw_device_attributes attrs;
+
+	const char *sysfs_path;
+	struct udev_device *hid_dev; /* The device's HID udev node. */
+	struct udev_device *usb_dev; /* The device's USB udev node. */
+	struct udev_device *intf_dev; /* The device's interface (in the USB sense). */
+	char *serial_number_utf8 = NULL;
+	char *product_name_utf8 = NULL;
+	struct hidraw_report_descriptor report_desc;
+
+	memset(&attrs, 0, sizeof(attrs));
+
+	sysfs_path = udev_device_get_syspath(raw_dev);
+	attrs.dev_path = udev_device_get_devnode(raw_dev);
+
+	hid_dev = udev_device_get_parent_with_subsystem_devtype(
+		raw_dev,
+		"hid",
+		NULL);
+
+	if (!hid_dev) {
+		/* Unable to find parent hid device. */
+		goto end;
 	}
 
-	pthread_mutex_lock(&hid_hotplug_context.mutex);
-	struct hid_hotplug_callback **current = &hid_hotplug_context.hotplug_cbs;
-	/* Remove all callbacks from the list */
-	while (*current) {
-		struct hid_hotplug_callback* next = (*current)->next;
-		free(*current);
-		*current = next;
+	if (!parse_uevent_info(
+		udev_device_get_sysattr_value(hid_dev, "uevent"),
+		&attrs.bus_type,
+		&attrs.vendor_id,
+		&attrs.product_id,
+		&serial_number_utf8,
+		&product_name_utf8)) {
+		/* parse_uevent_info() failed for at least one field. */
+		goto end;
 	}
-	hid_internal_hotplug_cleanup();
-	pthread_mutex_unlock(&hid_hotplug_context.mutex);
-	hid_hotplug_context.mutex_ready = 0;
-	pthread_mutex_destroy(&hid_hotplug_context.mutex);
-}
 
-int HID_API_EXPORT hid_init(void)
-{
-	const char *locale;
+	attrs.serial_number = serial_number_utf8;
+	attrs.product_name = product_name_utf8;
 
-	/* indicate no error */
-	register_global_error(NULL);
+	if (!uevent_matches_filter(attrs.bus_type, attrs.vendor_id, attrs.product_id, filter))
+		goto end;
 
-	/* Set the locale if it's not set. */
-	locale = setlocale(LC_CTYPE, NULL);
-	if (!locale)
-		setlocale(LC_CTYPE, "");
+	if (attrs.bus_type == BUS_USB) {
+		/* The device pointed to by raw_dev contains information about
+			the hidraw device. In order to get information about the
+			USB device, get the parent device with the
+			subsystem/devtype pair of "usb"/"usb_device". This will
+			be several levels up the tree, but the function will find
+			it. */
+		usb_dev = udev_device_get_parent_with_subsystem_devtype(
+				raw_dev,
+				"usb",
+				"usb_device");
+
+		if (usb_dev) {
+			attrs.has_usb_device = 1;
+			attrs.usb_manufacturer = udev_device_get_sysattr_value(usb_dev, "manufacturer");
+			attrs.usb_product = udev_device_get_sysattr_value(usb_dev, "product");
+			attrs.usb_bcd_device = udev_device_get_sysattr_value(usb_dev, "bcdDevice");
 
-	return 0;
-}
+			/* Get a handle to the interface's udev node. */
+			intf_dev = udev_device_get_parent_with_subsystem_devtype(
+					raw_dev,
+					"usb",
+					"usb_interface");
+			if (intf_dev) {
+				attrs.usb_interface_number = udev_device_get_sysattr_value(intf_dev, "bInterfaceNumber");
+			}
+		}
+	}
 
+	if (sysfs_path && get_hid_report_descriptor_from_sysfs(sysfs_path, &report_desc) >= 0) {
+		attrs.report_descriptor = report_desc.value;
+		attrs.report_descriptor_size = report_desc.size;
+	}
 
-int HID_API_EXPORT hid_exit(void)
-{
-	/* Free global error message */
-	register_global_error(NULL);
+	root = create_device_info_from_attributes(&attrs, filter);
 
-	hid_internal_hotplug_exit();
-	
-	return 0;
+end:
+	free(serial_number_utf8);
+	free(product_name_utf8);
+
+	return root;
 }
 
-static int hid_internal_match_device_id(unsigned short vendor_id, unsigned short product_id, unsigned short expected_vendor_id, unsigned short expected_product_id)
+/* Read a sysfs attribute relative to the directory dir_fd.
+   Like libudev does, the trailing newline is removed.
+   Returns the attribute length, or -1 if it can't be read. */
+static ssize_t read_sysfs_attr_at(int dir_fd, const char *path, char *buf, size_t buf_size)
 {
-    return (expected_vendor_id == 0x0 || vendor_id == expected_vendor_id) && (expected_product_id == 0x0 || product_id == expected_product_id);
+	int handle;
+	ssize_t res;
+
+	handle = openat(dir_fd, path, O_RDONLY | O_CLOEXEC);
+	if (handle < 0)
+		return -1;
+
+	res = read(handle, buf, buf_size - 1);
+	close(handle);
+	if (res < 0)
+		return -1;
+
+	while (res > 0 && (buf[res - 1] == '\n' || buf[res - 1] == '\r'))
+		res--;
+	buf[res] = '\0';
+
+	return res;
 }
 
-struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+/* Return non-zero if the uevent has a DEVTYPE=<devtype> line */
+static int uevent_has_devtype(const char *uevent, const char *devtype)
 {
-	struct udev *udev;
-	struct udev_enumerate *enumerate;
-	struct udev_list_entry *devices, *dev_list_entry;
+	size_t devtype_len = strlen(devtype);
+	const char *line = uevent;
 
-	struct hid_device_info *root = NULL; /* return object */
-	struct hid_device_info *cur_dev = NULL;
+	while (line && *line) {
+		if (strncmp(line, "DEVTYPE=", 8) == 0
+		 && strncmp(line + 8, devtype, devtype_len) == 0
+		 && (line[8 + devtype_len] == '\n' || line[8 + devtype_len] == '\0'))
+			return 1;
 
-	hid_init();
-	/* register_global_error: global error is reset by hid_init */
+		line = strchr(line, '\n');
+		if (line)
+			line++;
+	}
 
-	/* Create the udev object */
-	udev = udev_new();
-	if (!udev) {
-		register_global_error("Couldn't create udev context");
+	return 0;
+}
+
+/* Deepest level of the sysfs tree searched for the USB device */
+#define HIDRAW_SYSFS_MAX_DEPTH 32
+
+/* Storage for the USB attributes read by read_usb_attributes_at() */
+struct hidraw_usb_attribute_buffers {
+	char manufacturer[512];
+	char product[512];
+	char bcd_device[16];
+	char interface_number[16];
+};
+
+/* Read the attributes of the USB device and interface of a hidraw device,
+   given the handle of its sysfs directory. Like
+   udev_device_get_parent_with_subsystem_devtype() does, the parents of
+   the device are searched for the nearest "usb_interface" and "usb_device". */
+static void read_usb_attributes_at(int dir_fd, struct hidraw_usb_attribute_buffers *buffers, struct hidraw_device_attributes *attrs)
+{
+	char path[sizeof("device") + 3 * HIDRAW_SYSFS_MAX_DEPTH + sizeof("/bInterfaceNumber")];
+	size_t path_len = strlen("device");
+	char uevent[4096];
+	int interface_found = 0;
+	int depth;
+
+	strcpy(path, "device");
+
+	for (depth = 0; depth < HIDRAW_SYSFS_MAX_DEPTH; depth++) {
+		/* One level up; at the top /sys/devices has no uevent */
+		strcpy(path + path_len, "/..");
+		path_len += 3;
+
+		strcpy(path + path_len, "/uevent");
+		if (read_sysfs_attr_at(dir_fd, path, uevent, sizeof(uevent)) < 0)
+			break;
+
+		if (!interface_found && uevent_has_devtype(uevent, "usb_interface")) {
+			interface_found = 1;
+			strcpy(path + path_len, "/bInterfaceNumber");
+			if (read_sysfs_attr_at(dir_fd, path, buffers->interface_number, sizeof(buffers->interface_number)) >= 0)
+				attrs->usb_interface_number = buffers->interface_number;
+		}
+
+		if (uevent_has_devtype(uevent, "usb_device")) {
+			attrs->has_usb_device = 1;
+
+			strcpy(path + path_len, "/manufacturer");
+			if (read_sysfs_attr_at(dir_fd, path, buffers->manufacturer, sizeof(buffers->manufacturer)) >= 0)
+				attrs->usb_manufacturer = buffers->manufacturer;
+
+			strcpy(path + path_len, "/product");
+			if (read_sysfs_attr_at(dir_fd, path, buffers->product, sizeof(buffers->product)) >= 0)
+				attrs->usb_product = buffers->product;
+
+			strcpy(path + path_len, "/bcdDevice");
+			if (read_sysfs_attr_at(dir_fd, path, buffers->bcd_device, sizeof(buffers->bcd_device)) >= 0)
+				attrs->usb_bcd_device = buffers->bcd_device;
+
+			break;
+		}
+	}
+
+	/* The interface is only looked up under a USB device */
+	if (!attrs->has_usb_device)
+		attrs->usb_interface_number = NULL;
+}
+
+/* Storage for the attributes read by read_hidraw_attributes()
+   and read_sysfs_dir_attributes() */
+struct hidraw_attribute_buffers {
+	char uevent[4096];
+	char name[256];
+	char uniq[256];
+	char dev_path[64];
+	struct hidraw_usb_attribute_buffers usb;
+	struct hidraw_report_descriptor report_desc;
+};
+
+/*
+ * Read the attributes of an open device from the hidraw ioctls and the
+ * report descriptor cached by hid_open_path(), without udev. Only what
+ * the ioctls don't provide is read from sysfs: the name of the device node,
+ * and for USB devices the attributes of the USB interface and device.
+ *
+ * Returns -1 when the ioctls aren't available (HIDIOCGRAWUNIQ needs
+ * Linux 5.6), and the caller falls back to udev.
+ */
+static int read_hidraw_attributes(hid_device *dev, dev_t devnum, struct hidraw_attribute_buffers *buffers, struct hidraw_device_attributes *attrs)
+{
+	struct hidraw_devinfo raw_info;
+	char sysfs_link[64];
+	char link[PATH_MAX];
+	const char *node;
+	ssize_t res;
+	int dir_fd;
+
+	if (ioctl(dev->device_handle, HIDIOCGRAWINFO, &raw_info) < 0)
+		return -1;
+
+	memset(buffers->name, 0, sizeof(buffers->name));
+	if (ioctl(dev->device_handle, HIDIOCGRAWNAME(sizeof(buffers->name) - 1), buffers->name) < 0)
+		return -1;
+
+	memset(buffers->uniq, 0, sizeof(buffers->uniq));
+	if (ioctl(dev->device_handle, HIDIOCGRAWUNIQ(sizeof(buffers->uniq) - 1), buffers->uniq) < 0)
+		return -1;
+
+	/* /sys/dev/char/<major>:<minor> links to .../hidraw/hidrawN */
+	snprintf(sysfs_link, sizeof(sysfs_link), "/sys/dev/char/%u:%u", major(devnum), minor(devnum));
+	res = readlink(sysfs_link, link, sizeof(link) - 1);
+	if (res < 0)
+		return -1;
+	link[res] = '\0';
+	node = strrchr(link, '/');
+	res = snprintf(buffers->dev_path, sizeof(buffers->dev_path), "/dev/%s", node ? node + 1 : link);
+	if (res < 0 || (size_t) res >= sizeof(buffers->dev_path))
+		return -1;
+
+	memset(attrs, 0, sizeof(*attrs));
+	attrs->dev_path = buffers->dev_path;
+	attrs->bus_type = raw_info.bustype;
+	attrs->vendor_id = (unsigned short) raw_info.vendor;
+	attrs->product_id = (unsigned short) raw_info.product;
+	attrs->serial_number = buffers->uniq;
+	attrs->product_name = buffers->name;
+	if (!dev->report_descriptor)
+		return -1;
+
+	attrs->report_descriptor = dev->report_descriptor->value;
+	attrs->report_descriptor_size = dev->report_descriptor->size;
+
+	if (attrs->bus_type == BUS_USB) {
+		dir_fd = open(sysfs_link, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dir_fd < 0)
+			return -1;
+		read_usb_attributes_at(dir_fd, &buffers->usb, attrs);
+		close(dir_fd);
+	}
+
+	return 0;
+}
+
+/* Creates the hid_device_info of an open device, see read_hidraw_attributes() */
+static struct hid_device_info *create_device_info_from_hidraw(hid_device *dev, dev_t devnum)
+{
+	struct hidraw_attribute_buffers buffers;
+	struct hidraw_device_attributes attrs;
+
+	if (read_hidraw_attributes(dev, devnum, &buffers, &attrs) < 0)
+		return NULL;
+
+	return create_device_info_from_attributes(&attrs, NULL);
+}
+
+/* Like create_device_info_from_hidraw(), with UTF-8 strings */
+static struct hid_device_info_utf8 *create_device_info_utf8_from_hidraw(hid_device *dev, dev_t devnum)
+{
+	struct hidraw_attribute_buffers buffers;
+	struct hidraw_device_attributes attrs;
+
+	if (read_hidraw_attributes(dev, devnum, &buffers, &attrs) < 0)
 		return NULL;
+
+	return create_device_info_utf8_from_attributes(&attrs, NULL);
+}
+
+/* Read the attributes of the hidraw device with the sysfs directory dir_fd,
+   relative to it, without udev.
+   Returns 0 for a device which can't be read or doesn't match the filter. */
+static int read_sysfs_dir_attributes(int dir_fd, const char *name, const struct hid_enumerate_filter *filter, struct hidraw_attribute_buffers *buffers, struct hidraw_device_attributes *attrs)
+{
+	ssize_t res;
+	int handle;
+
+	memset(attrs, 0, sizeof(*attrs));
+
+	/* The uevent of the parent HID device */
+	if (read_sysfs_attr_at(dir_fd, "device/uevent", buffers->uevent, sizeof(buffers->uevent)) < 0)
+		return 0;
+
+	if (!parse_uevent_info_in_place(buffers->uevent, &attrs->bus_type, &attrs->vendor_id, &attrs->product_id,
+			&attrs->serial_number, &attrs->product_name))
+		return 0;
+
+	if (!uevent_matches_filter(attrs->bus_type, attrs->vendor_id, attrs->product_id, filter))
+		return 0;
+
+	/* A truncated name would be the wrong device node */
+	res = snprintf(buffers->dev_path, sizeof(buffers->dev_path), "/dev/%s", name);
+	if (res < 0 || (size_t) res >= sizeof(buffers->dev_path))
+		return 0;
+	attrs->dev_path = buffers->dev_path;
+
+	if (attrs->bus_type == BUS_USB)
+		read_usb_attributes_at(dir_fd, &buffers->usb, attrs);
+
+	handle = openat(dir_fd, "device/report_descriptor", O_RDONLY | O_CLOEXEC);
+	if (handle >= 0) {
+		/* See get_hid_report_descriptor() */
+		res = read(handle, buffers->report_desc.value, HID_MAX_DESCRIPTOR_SIZE);
+		close(handle);
+		if (res >= 0) {
+			attrs->report_descriptor = buffers->report_desc.value;
+			attrs->report_descriptor_size = (__u32) res;
+		}
 	}
 
-	/* Create a list of the devices in the 'hidraw' subsystem. */
-	enumerate = udev_enumerate_new(udev);
-	udev_enumerate_add_match_subsystem(enumerate, "hidraw");
-	udev_enumerate_scan_devices(enumerate);
-	devices = udev_enumerate_get_list_entry(enumerate);
-	/* For each item, see if it matches the vid/pid, and if so
-	   create a udev_device record for it */
-	udev_list_entry_foreach(dev_list_entry, devices) {
-		const char *sysfs_path;
-		unsigned short dev_vid = 0;
-		unsigned short dev_pid = 0;
-		unsigned bus_type = 0;
-		struct udev_device *raw_dev; /* The device's hidraw udev node. */
-		struct hid_device_info * tmp;
+	return 1;
+}
 
-		/* Get the filename of the /sys entry for the device
-		   and create a udev_device object (dev) representing it */
-		sysfs_path = udev_list_entry_get_name(dev_list_entry);
-		if (!sysfs_path)
+/* Create the hid_device_info of the hidraw device with the sysfs directory
+   dir_fd, see read_sysfs_dir_attributes().
+   Returns NULL for a device which doesn't match the filter. */
+static struct hid_device_info *create_device_info_for_sysfs_dir(int dir_fd, const char *name, const struct hid_enumerate_filter *filter)
+{
+	struct hidraw_attribute_buffers buffers;
+	struct hidraw_device_attributes attrs;
+
+	if (!read_sysfs_dir_attributes(dir_fd, name, filter, &buffers, &attrs))
+		return NULL;
+
+	return create_device_info_from_attributes(&attrs, filter);
+}
+
+/* Like create_device_info_for_sysfs_dir(), with UTF-8 strings */
+static struct hid_device_info_utf8 *create_device_info_utf8_for_sysfs_dir(int dir_fd, const char *name, const struct hid_enumerate_filter *filter)
+{
+	struct hidraw_attribute_buffers buffers;
+	struct hidraw_device_attributes attrs;
+
+	if (!read_sysfs_dir_attributes(dir_fd, name, filter, &buffers, &attrs))
+		return NULL;
+
+	return create_device_info_utf8_from_attributes(&attrs, filter);
+}
+
+struct hidraw_sysfs_entry {
+	char *name; /* hidrawN */
+	char *target; /* the link target, ../../devices/<...>/hidraw/hidrawN */
+};
+
+static int compare_sysfs_entries(const void *a, const void *b)
+{
+	return strcmp(((const struct hidraw_sysfs_entry *) a)->target, ((const struct hidraw_sysfs_entry *) b)->target);
+}
+
+/* List the entries of /sys/class/hidraw (opened as dir, class_fd),
+   sorted by their link target, which is the order udev enumerates them in */
+static void read_sysfs_entries(DIR *dir, int class_fd, struct hidraw_sysfs_entry **entries, size_t *num_entries)
+{
+	size_t max_entries = 0;
+	struct dirent *entry;
+
+	*entries = NULL;
+	*num_entries = 0;
+
+	while ((entry = readdir(dir)) != NULL) {
+		char target[PATH_MAX];
+		ssize_t res;
+
+		if (entry->d_name[0] == '.')
 			continue;
 
-		if (vendor_id != 0 || product_id != 0) {
-			if (!parse_hid_vid_pid_from_sysfs(sysfs_path, &bus_type, &dev_vid, &dev_pid))
-				continue;
+		res = readlinkat(class_fd, entry->d_name, target, sizeof(target) - 1);
+		if (res < 0)
+			continue;
+		target[res] = '\0';
 
-			if (vendor_id != 0 && vendor_id != dev_vid)
-				continue;
-			if (product_id != 0 && product_id != dev_pid)
-				continue;
+		if (*num_entries == max_entries) {
+			size_t new_max = max_entries ? max_entries * 2 : 32;
+			struct hidraw_sysfs_entry *tmp = (struct hidraw_sysfs_entry *) realloc(*entries, new_max * sizeof(struct hidraw_sysfs_entry));
+			if (!tmp)
+				break;
+			*entries = tmp;
+			max_entries = new_max;
 		}
 
-		raw_dev = udev_device_new_from_syspath(udev, sysfs_path);
-		if (!raw_dev)
+		(*entries)[*num_entries].name = strdup(entry->d_name);
+		(*entries)[*num_entries].target = strdup(target);
+		if (!(*entries)[*num_entries].name || !(*entries)[*num_entries].target) {
+			free((*entries)[*num_entries].name);
+			free((*entries)[*num_entries].target);
+			break;
+		}
+		(*num_entries)++;
+	}
+
+	if (*num_entries > 0)
+		qsort(*entries, *num_entries, sizeof(struct hidraw_sysfs_entry), compare_sysfs_entries);
+}
+
+static void free_sysfs_entries(struct hidraw_sysfs_entry *entries, size_t num_entries)
+{
+	size_t i;
+
+	for (i = 0; i < num_entries; i++) {
+		free(entries[i].name);
+		free(entries[i].target);
+	}
+	free(entries);
+}
+
+/* Upper bound for hid_hidraw_set_enumerate_threads() */
+#define HID_ENUMERATE_MAX_THREADS 32
+
+/* Number of threads hid_enumerate() spreads the devices over */
+static unsigned int enumerate_threads = 1;
+
+/* The work shared by the threads of a parallel hid_enumerate() */
+struct hid_enumerate_job {
+	int class_fd; /* /sys/class/hidraw */
+	const struct hidraw_sysfs_entry *entries;
+	size_t num_entries;
+	size_t next; /* The next entry to be enumerated, taken with __atomic_fetch_add */
+	const struct hid_enumerate_filter *filter;
+	struct hid_device_info **results; /* The devices found for entries[i] are in results[i] */
+	struct hid_device_info_utf8 **results_utf8; /* Used instead of results if not NULL */
+};
+
+static void *enumerate_thread(void *param)
+{
+	struct hid_enumerate_job *job = (struct hid_enumerate_job *) param;
+
+	for (;;) {
+		size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+		int dir_fd;
+
+		if (i >= job->num_entries)
+			break;
+
+		dir_fd = openat(job->class_fd, job->entries[i].name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dir_fd < 0)
 			continue;
 
-		tmp = create_device_info_for_device(raw_dev);
+		if (job->results_utf8)
+			job->results_utf8[i] = create_device_info_utf8_for_sysfs_dir(dir_fd, job->entries[i].name, job->filter);
+		else
+			job->results[i] = create_device_info_for_sysfs_dir(dir_fd, job->entries[i].name, job->filter);
+		close(dir_fd);
+	}
+
+	return NULL;
+}
+
+/* Run the job with num_threads threads, the calling one included.
+   Each thread takes the next entry not yet taken, so the results
+   can be merged in the same order as by a single thread. */
+static void enumerate_parallel(struct hid_enumerate_job *job, unsigned int num_threads)
+{
+	pthread_t threads[HID_ENUMERATE_MAX_THREADS];
+	unsigned int num_started = 0;
+	unsigned int i;
+
+	while (num_started < num_threads - 1) {
+		if (pthread_create(&threads[num_started], NULL, &enumerate_thread, job) != 0)
+			break; /* carry on with the threads we have */
+		num_started++;
+	}
+
+	enumerate_thread(job);
+
+	for (i = 0; i < num_started; i++)
+		pthread_join(threads[i], NULL);
+}
+
+/*
+ * Enumerate the hidraw devices by walking /sys/class/hidraw directly,
+ * instead of through udev_enumerate, which allocates a udev_device for
+ * every node and looks up its parents by stat()ing large parts of sysfs.
+ * Everything is read relative to directory handles.
+ *
+ * The devices are sorted by their sysfs path like udev_enumerate does,
+ * so the resulting list is the same as with udev.
+ *
+ * The list is returned in devs, or with UTF-8 strings in devs_utf8
+ * if devs is NULL.
+ *
+ * Returns 0 on success, -1 if /sys/class/hidraw can't be read,
+ * and -2 if out of memory (the global error is registered then).
+ */
+static int hid_enumerate_sysfs(const struct hid_enumerate_filter *filter, struct hid_device_info **devs, struct hid_device_info_utf8 **devs_utf8)
+{
+	struct hid_device_info *root = NULL; /* return object */
+	struct hid_device_info *cur_dev = NULL;
+	struct hid_device_info_utf8 *root_utf8 = NULL;
+	struct hid_device_info_utf8 *cur_dev_utf8 = NULL;
+	struct hidraw_sysfs_entry *entries = NULL;
+	size_t num_entries = 0, i;
+	struct hid_enumerate_job job;
+	unsigned int num_threads;
+	int class_fd;
+	DIR *dir;
+
+	class_fd = open("/sys/class/hidraw", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (class_fd < 0)
+		return -1;
+
+	dir = fdopendir(class_fd);
+	if (!dir) {
+		close(class_fd);
+		return -1;
+	}
+
+	read_sysfs_entries(dir, class_fd, &entries, &num_entries);
+
+	job.class_fd = class_fd;
+	job.entries = entries;
+	job.num_entries = num_entries;
+	job.next = 0;
+	job.filter = filter;
+	job.results = NULL;
+	job.results_utf8 = NULL;
+	if (num_entries > 0) {
+		if (devs)
+			job.results = (struct hid_device_info **) calloc(num_entries, sizeof(struct hid_device_info *));
+		else
+			job.results_utf8 = (struct hid_device_info_utf8 **) calloc(num_entries, sizeof(struct hid_device_info_utf8 *));
+
+		/* Not an empty list: callers have to tell it from "no devices" */
+		if (!job.results && !job.results_utf8) {
+			free_sysfs_entries(entries, num_entries);
+			closedir(dir);
+			errno = ENOMEM;
+			register_global_error("Couldn't allocate memory");
+			return -2;
+		}
+	}
+
+	num_threads = enumerate_threads;
+	if (num_entries < num_threads)
+		num_threads = (unsigned int) num_entries;
+
+	if (num_entries > 0)
+		enumerate_parallel(&job, num_threads);
+
+	for (i = 0; job.results && i < num_entries; i++) {
+		struct hid_device_info *tmp = job.results[i];
+
 		if (tmp) {
 			if (cur_dev) {
 				cur_dev->next = tmp;
@@ -1137,720 +2105,3952 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 				cur_dev = cur_dev->next;
 			}
 		}
-
-		udev_device_unref(raw_dev);
 	}
-	/* Free the enumerator and udev objects. */
-	udev_enumerate_unref(enumerate);
-	udev_unref(udev);
 
-	if (root == NULL) {
-		if (vendor_id == 0 && product_id == 0) {
-			register_global_error("No HID devices found in the system.");
-		} else {
-			register_global_error("No HID devices with requested VID/PID found in the system.");
+	for (i = 0; job.results_utf8 && i < num_entries; i++) {
+		struct hid_device_info_utf8 *tmp = job.results_utf8[i];
+
+		if (tmp) {
+			if (cur_dev_utf8) {
+				cur_dev_utf8->next = tmp;
+			}
+			else {
+				root_utf8 = tmp;
+			}
+			cur_dev_utf8 = tmp;
+
+			while (cur_dev_utf8->next != NULL) {
+				cur_dev_utf8 = cur_dev_utf8->next;
+			}
 		}
 	}
 
-	return root;
+	free_sysfs_entries(entries, num_entries);
+	free(job.results);
+	free(job.results_utf8);
+	closedir(dir);
+
+	if (devs)
+		*devs = root;
+	else
+		*devs_utf8 = root_utf8;
+	return 0;
 }
 
-void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
+/*
+ * Find the device node of the first device hid_enumerate() would list
+ * with the given VID/PID (and serial number, if not NULL). Only the uevent
+ * of each device is read, and the search stops at the first match.
+ *
+ * Returns 1 if found, 0 if not, and -1 if /sys/class/hidraw isn't available.
+ */
+static int find_hidraw_device_sysfs(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number, char *dev_path, size_t dev_path_size)
 {
-	struct hid_device_info *d = devs;
-	while (d) {
-		struct hid_device_info *next = d->next;
-		free(d->path);
-		free(d->serial_number);
-		free(d->manufacturer_string);
-		free(d->product_string);
-		free(d);
-		d = next;
+	struct hidraw_sysfs_entry *entries = NULL;
+	size_t num_entries = 0, i;
+	int found = 0;
+	int class_fd;
+	DIR *dir;
+
+	class_fd = open("/sys/class/hidraw", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (class_fd < 0)
+		return -1;
+
+	dir = fdopendir(class_fd);
+	if (!dir) {
+		close(class_fd);
+		return -1;
+	}
+
+	read_sysfs_entries(dir, class_fd, &entries, &num_entries);
+
+	for (i = 0; i < num_entries && !found; i++) {
+		char path[PATH_MAX];
+		char uevent[4096];
+		unsigned bus_type;
+		unsigned short dev_vid, dev_pid;
+		const char *serial_number_utf8 = NULL;
+		int res;
+
+		snprintf(path, sizeof(path), "%s/device/uevent", entries[i].name);
+		if (read_sysfs_attr_at(class_fd, path, uevent, sizeof(uevent)) < 0)
+			continue;
+
+		if (!parse_uevent_info_in_place(uevent, &bus_type, &dev_vid, &dev_pid, &serial_number_utf8, NULL))
+			continue;
+
+		if (!is_supported_bus_type(bus_type) || dev_vid != vendor_id || dev_pid != product_id)
+			continue;
+
+		if (serial_number && !wcs_equals_mbs(serial_number, serial_number_utf8))
+			continue;
+
+		/* Skipped like hid_enumerate() does, a truncated name would be the wrong device node */
+		res = snprintf(dev_path, dev_path_size, "/dev/%s", entries[i].name);
+		if (res < 0 || (size_t) res >= dev_path_size)
+			continue;
+		found = 1;
+	}
+
+	free_sysfs_entries(entries, num_entries);
+	closedir(dir);
+
+	return found;
+}
+
+static struct hid_device_info * create_device_info_for_hid_device(hid_device *dev) {
+	struct udev *udev;
+	struct udev_device *udev_dev;
+	struct stat s;
+	int ret = -1;
+	struct hid_device_info *root = NULL;
+
+	register_device_error(dev, NULL);
+
+	/* Get the dev_t (major/minor numbers) from the file handle. */
+	ret = fstat(dev->device_handle, &s);
+	if (-1 == ret) {
+		register_device_error(dev, "Failed to stat device handle");
+		return NULL;
+	}
+
+	/* The fast path, which doesn't need udev */
+	root = create_device_info_from_hidraw(dev, s.st_rdev);
+	if (root)
+		return root;
+
+	/* Create the udev object */
+	udev = udev_new();
+	if (!udev) {
+		errno = ENOMEM;
+		register_device_error(dev, "Couldn't create udev context");
+		return NULL;
+	}
+
+	/* Open a udev device from the dev_t. 'c' means character device. */
+	udev_dev = udev_device_new_from_devnum(udev, 'c', s.st_rdev);
+	if (udev_dev) {
+		root = create_device_info_for_device(udev_dev, NULL);
+	}
+
+	if (!root) {
+		/* TODO: have a better error reporting via create_device_info_for_device */
+		errno = EIO;
+		register_device_error(dev, "Couldn't create hid_device_info");
+	}
+
+	udev_device_unref(udev_dev);
+	udev_unref(udev);
+
+	return root;
+}
+
+HID_API_EXPORT const struct hid_api_version* HID_API_CALL hid_version(void)
+{
+	return &api_version;
+}
+
+HID_API_EXPORT const char* HID_API_CALL hid_version_str(void)
+{
+	return HID_API_VERSION_STR;
+}
+
+static void signal_event_fd(int fd)
+{
+	uint64_t one = 1;
+	ssize_t res;
+
+	/* EAGAIN means the counter is saturated, it is readable either way */
+	do {
+		res = write(fd, &one, sizeof(one));
+	} while (res < 0 && errno == EINTR);
+}
+
+static struct hid_hotplug_context {
+	/* UDEV context that handles the monitor */
+	struct udev* udev_ctx;
+
+	/* UDEV monitor that receives events */
+	struct udev_monitor* mon;
+
+	/* File descriptor for the UDEV monitor that allows to check for new events with epoll */
+	int monitor_fd;
+
+	/* The epoll set of the monitor thread, or the one returned by hid_hotplug_get_fd():
+	   monitor_fd and wakeup_fd */
+	int epoll_fd;
+
+	/* eventfd signalled to make the monitor thread, or the caller of
+	   hid_hotplug_handle_events(), check whether the monitor has to stop */
+	int wakeup_fd;
+
+	/* Thread for the UDEV monitor */
+	pthread_t thread;
+
+	/* Serializes the changes to the callbacks and to the enumeration cache,
+	   and the start and the end of the monitor thread.
+	   No callback is invoked with it locked, so callbacks may register and deregister callbacks. */
+	pthread_mutex_t mutex;
+
+	/* Taken for reading by hid_enumerate() when it is answered from devs and by the
+	   HID_API_HOTPLUG_ENUMERATE replay, and for writing whenever devs is modified */
+	pthread_rwlock_t devs_lock;
+
+	/* Protects callbacks while a reference to the set is taken */
+	pthread_mutex_t callbacks_lock;
+
+	/* Boolean flags */
+	/* Keep the monitor running without any callbacks and answer hid_enumerate() from devs */
+	unsigned char enumerate_cache;
+	/* The monitor thread was started and not joined yet,
+	   or with `external` set, the monitor is set up */
+	unsigned char monitor_running;
+	/* hid_hotplug_get_fd() was called: no thread is started, the events are processed
+	   by hid_hotplug_handle_events(), and epoll_fd and wakeup_fd are kept until hid_exit() */
+	unsigned char external;
+	/* The monitor thread has left its loop (set by the thread itself, with the mutex locked) */
+	unsigned char monitor_exited;
+	/* devs is kept up to date by the monitor thread (protected by devs_lock) */
+	unsigned char devs_valid;
+
+	/* HIDAPI unique callback handle counter */
+	hid_hotplug_callback_handle next_handle;
+
+	/* Registration order of the next callback, to invoke the callbacks of different chains in that order */
+	unsigned long long next_cb_order;
+
+	/* The registered callbacks, NULL if there are none.
+	   The set is never modified: it is replaced with the mutex locked */
+	struct hid_hotplug_callback_set *callbacks;
+
+	/* Linked list of the device infos (mandatory when the device is disconnected) */
+	struct hid_device_info *devs;
+
+	/* The devices whose records make up devs, in the same order, hashed by
+	   hid_internal_device_key_length() bytes of their paths. Protected like devs. */
+	struct hid_hotplug_device **dev_buckets;
+	size_t dev_bucket_count;
+	size_t num_devices;
+	struct hid_hotplug_device *first_device;
+	struct hid_hotplug_device *last_device;
+} hid_hotplug_context = {
+	.udev_ctx = NULL,
+	.monitor_fd = -1,
+	.epoll_fd = -1,
+	.wakeup_fd = -1,
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.devs_lock = PTHREAD_RWLOCK_INITIALIZER,
+	.callbacks_lock = PTHREAD_MUTEX_INITIALIZER,
+	.enumerate_cache = 0,
+	.monitor_running = 0,
+	.external = 0,
+	.devs_valid = 0,
+	.next_handle = FIRST_HOTPLUG_CALLBACK_HANDLE,
+	.next_cb_order = 0,
+	.callbacks = NULL,
+	.devs = NULL,
+	.dev_buckets = NULL,
+	.dev_bucket_count = 0,
+	.num_devices = 0,
+	.first_device = NULL,
+	.last_device = NULL
+};
+
+struct hid_hotplug_callback {
+	hid_hotplug_callback_handle handle;
+	unsigned short vendor_id;
+	unsigned short product_id;
+	hid_hotplug_event events;
+	void *user_data;
+	hid_hotplug_callback_fn callback;
+
+	/* Registration order */
+	unsigned long long order;
+
+	/* The number of callback sets that contain the callback, plus one
+	   for hid_hotplug_register_callback() while it runs */
+	size_t refs;
+
+	/* Set by hid_hotplug_deregister_callback(): the callback isn't invoked anymore */
+	unsigned char removed;
+
+	/* Held while the callback is invoked by the monitor thread, and by
+	   hid_hotplug_register_callback() until the HID_API_HOTPLUG_ENUMERATE replay is over */
+	pthread_mutex_t call_lock;
+
+	/* Events queued for the executor, and the link in its ready queue.
+	   Protected by the executor mutex. */
+	struct hid_hotplug_task *tasks;
+	struct hid_hotplug_task *tasks_tail;
+	struct hid_hotplug_callback *ready_next;
+	/* In the ready queue or being run by an executor thread */
+	unsigned char scheduled;
+	/* Removed from the list while scheduled: freed by the executor thread */
+	unsigned char detached;
+};
+
+/* Upper bound for hid_hidraw_set_hotplug_threads() */
+#define HID_HOTPLUG_MAX_THREADS 32
+
+/* A copy of the device info of an event, shared by the tasks queued for it */
+struct hid_hotplug_snapshot {
+	struct hid_device_info *info;
+	size_t refs;
+};
+
+/* An event waiting to be passed to one callback by the executor */
+struct hid_hotplug_task {
+	struct hid_hotplug_task *next;
+	struct hid_hotplug_snapshot *snapshot;
+	hid_hotplug_event event;
+	/* Queued for HID_API_HOTPLUG_ENUMERATE: the return value is ignored */
+	unsigned char replay;
+};
+
+/* The threads that invoke the callbacks, see hid_hidraw_set_hotplug_threads().
+   Each callback has its own queue of tasks and is run by one thread at a time,
+   so it gets its events in order, while different callbacks run concurrently. */
+static struct hid_hotplug_executor {
+	pthread_mutex_t mutex;
+
+	/* Signalled when a callback becomes ready and when the threads have to stop */
+	pthread_cond_t cond;
+
+	pthread_t *threads;
+	unsigned int num_threads;
+
+	/* The threads leave once no callback is ready */
+	unsigned char stopping;
+	/* The threads are stopping and the tasks not started yet are dropped */
+	unsigned char discard;
+
+	/* Callbacks with queued tasks that no thread is running, in the order they became ready */
+	struct hid_hotplug_callback *ready;
+	struct hid_hotplug_callback *ready_tail;
+} hid_hotplug_executor = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.threads = NULL,
+	.num_threads = 0,
+	.stopping = 0,
+	.discard = 0,
+	.ready = NULL,
+	.ready_tail = NULL
+};
+
+static void hid_internal_snapshot_release(struct hid_hotplug_snapshot *snapshot)
+{
+	if (__atomic_sub_fetch(&snapshot->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		hid_free_enumeration(snapshot->info);
+		free(snapshot);
+	}
+}
+
+/* Drop the tasks queued for a callback. Called with the executor mutex locked. */
+static void hid_internal_executor_drop_tasks(struct hid_hotplug_callback *callback)
+{
+	while (callback->tasks) {
+		struct hid_hotplug_task *task = callback->tasks;
+		callback->tasks = task->next;
+		hid_internal_snapshot_release(task->snapshot);
+		free(task);
+	}
+	callback->tasks_tail = NULL;
+}
+
+/* The callback won't get any more events: drop its queued tasks */
+static void hid_internal_executor_cancel(struct hid_hotplug_callback *callback)
+{
+	pthread_mutex_lock(&hid_hotplug_executor.mutex);
+	hid_internal_executor_drop_tasks(callback);
+	pthread_mutex_unlock(&hid_hotplug_executor.mutex);
+}
+
+static void hid_internal_callback_destroy(struct hid_hotplug_callback *callback)
+{
+	pthread_mutex_destroy(&callback->call_lock);
+	free(callback);
+}
+
+/* Free a callback once no set contains it. A callback that is being run
+   by the executor is freed by its thread once the call returns. */
+static void hid_internal_callback_free(struct hid_hotplug_callback *callback)
+{
+	pthread_mutex_lock(&hid_hotplug_executor.mutex);
+	hid_internal_executor_drop_tasks(callback);
+	if (callback->scheduled) {
+		callback->detached = 1;
+		callback = NULL;
+	}
+	pthread_mutex_unlock(&hid_hotplug_executor.mutex);
+
+	if (callback) {
+		hid_internal_callback_destroy(callback);
+	}
+}
+
+static void *hid_internal_executor_thread(void *user_data)
+{
+	(void) user_data;
+
+	pthread_mutex_lock(&hid_hotplug_executor.mutex);
+
+	for (;;) {
+		while (!hid_hotplug_executor.ready && !hid_hotplug_executor.stopping) {
+			pthread_cond_wait(&hid_hotplug_executor.cond, &hid_hotplug_executor.mutex);
+		}
+
+		struct hid_hotplug_callback *callback = hid_hotplug_executor.ready;
+		if (!callback) {
+			break;
+		}
+		hid_hotplug_executor.ready = callback->ready_next;
+		if (!hid_hotplug_executor.ready) {
+			hid_hotplug_executor.ready_tail = NULL;
+		}
+
+		/* The tasks of a deregistered callback are dropped, its queue may be empty */
+		struct hid_hotplug_task *task = callback->tasks;
+		if (task) {
+			callback->tasks = task->next;
+			if (!callback->tasks) {
+				callback->tasks_tail = NULL;
+			}
+
+			/* The callback stays allocated while it is scheduled */
+			pthread_mutex_unlock(&hid_hotplug_executor.mutex);
+
+			int result = 0;
+			if (!__atomic_load_n(&callback->removed, __ATOMIC_ACQUIRE)) {
+				result = callback->callback(callback->handle, task->snapshot->info, task->event, callback->user_data);
+			}
+			if (result && !task->replay) {
+				hid_hotplug_deregister_callback(callback->handle);
+			}
+
+			hid_internal_snapshot_release(task->snapshot);
+			free(task);
+
+			pthread_mutex_lock(&hid_hotplug_executor.mutex);
+		}
+
+		if (hid_hotplug_executor.discard) {
+			hid_internal_executor_drop_tasks(callback);
+		}
+
+		if (callback->detached) {
+			hid_internal_callback_destroy(callback);
+		}
+		else if (callback->tasks) {
+			/* Go to the back of the queue, so that a busy callback doesn't starve the others */
+			callback->ready_next = NULL;
+			if (hid_hotplug_executor.ready_tail) {
+				hid_hotplug_executor.ready_tail->ready_next = callback;
+			}
+			else {
+				hid_hotplug_executor.ready = callback;
+			}
+			hid_hotplug_executor.ready_tail = callback;
+		}
+		else {
+			callback->scheduled = 0;
+		}
+	}
+
+	pthread_mutex_unlock(&hid_hotplug_executor.mutex);
+
+	return NULL;
+}
+
+/* Stop the threads after they have run the queued tasks, or with discard set,
+   after the calls in progress. Must not be called from a callback. */
+static void hid_internal_executor_stop(int discard)
+{
+	pthread_mutex_lock(&hid_hotplug_executor.mutex);
+
+	if (hid_hotplug_executor.num_threads == 0) {
+		pthread_mutex_unlock(&hid_hotplug_executor.mutex);
+		return;
+	}
+
+	if (discard) {
+		for (struct hid_hotplug_callback *callback = hid_hotplug_executor.ready; callback; callback = callback->ready_next) {
+			hid_internal_executor_drop_tasks(callback);
+		}
+	}
+
+	hid_hotplug_executor.stopping = 1;
+	hid_hotplug_executor.discard = discard ? 1 : 0;
+	pthread_cond_broadcast(&hid_hotplug_executor.cond);
+	pthread_mutex_unlock(&hid_hotplug_executor.mutex);
+
+	for (unsigned int i = 0; i < hid_hotplug_executor.num_threads; i++) {
+		pthread_join(hid_hotplug_executor.threads[i], NULL);
+	}
+
+	pthread_mutex_lock(&hid_hotplug_executor.mutex);
+	free(hid_hotplug_executor.threads);
+	hid_hotplug_executor.threads = NULL;
+	hid_hotplug_executor.num_threads = 0;
+	hid_hotplug_executor.stopping = 0;
+	hid_hotplug_executor.discard = 0;
+	pthread_mutex_unlock(&hid_hotplug_executor.mutex);
+}
+
+static int hid_internal_executor_start(unsigned int num_threads)
+{
+	pthread_t *threads = (pthread_t*)calloc(num_threads, sizeof(pthread_t));
+	unsigned int started = 0;
+
+	if (!threads) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&hid_hotplug_executor.mutex);
+	hid_hotplug_executor.threads = threads;
+	while (started < num_threads && pthread_create(&threads[started], NULL, &hid_internal_executor_thread, NULL) == 0) {
+		started++;
+	}
+	if (started == 0) {
+		/* hid_internal_executor_stop() has nothing to free then */
+		free(threads);
+		hid_hotplug_executor.threads = NULL;
+	}
+	hid_hotplug_executor.num_threads = started;
+	pthread_mutex_unlock(&hid_hotplug_executor.mutex);
+
+	if (started < num_threads) {
+		hid_internal_executor_stop(0);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Lock the executor mutex if the callbacks are to be queued instead of invoked.
+   Returns 1 with the mutex locked, and 0 if the callbacks are invoked inline. */
+static int hid_internal_executor_lock(void)
+{
+	pthread_mutex_lock(&hid_hotplug_executor.mutex);
+	if (hid_hotplug_executor.num_threads != 0 && !hid_hotplug_executor.stopping) {
+		return 1;
+	}
+	pthread_mutex_unlock(&hid_hotplug_executor.mutex);
+	return 0;
+}
+
+/* A snapshot of the registered callbacks, never modified once published.
+   The monitor thread takes a reference to the current set for each event and invokes
+   the callbacks without any lock held; hid_hotplug_register_callback() and
+   hid_hotplug_deregister_callback() build a new set and replace the current one. */
+struct hid_hotplug_callback_set {
+	size_t refs;
+
+	/* The callbacks in registration order */
+	struct hid_hotplug_callback **callbacks;
+	size_t num_callbacks;
+
+	/* Index of callbacks, so that an event only visits the callbacks that can match it.
+	   The callbacks are hashed by (vendor_id, product_id), a 0 being part of the key;
+	   those of bucket i are chain[bucket_start[i]] to chain[bucket_start[i + 1] - 1],
+	   in registration order */
+	struct hid_hotplug_callback **chain;
+	size_t *bucket_start;
+	size_t bucket_count;
+};
+
+static void hid_internal_callback_unref(struct hid_hotplug_callback *callback)
+{
+	if (__atomic_sub_fetch(&callback->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		hid_internal_callback_free(callback);
+	}
+}
+
+static size_t hid_internal_callback_bucket(const struct hid_hotplug_callback_set *set, unsigned short vendor_id, unsigned short product_id)
+{
+	unsigned int hash = (((unsigned int)vendor_id << 16) | product_id) * 0x9E3779B1u;
+	return (hash ^ (hash >> 16)) & (set->bucket_count - 1);
+}
+
+/* Build a set with the callbacks of old which are not removed, and callback (optionally NULL).
+   *result is NULL if no callbacks are left. Called with the mutex locked. */
+static int hid_internal_callback_set_build(const struct hid_hotplug_callback_set *old, struct hid_hotplug_callback *callback, struct hid_hotplug_callback_set **result)
+{
+	struct hid_hotplug_callback_set *set;
+	size_t num_callbacks = callback ? 1 : 0;
+	size_t bucket_count = 16;
+	size_t i;
+
+	if (old) {
+		for (i = 0; i < old->num_callbacks; i++) {
+			if (!old->callbacks[i]->removed) {
+				num_callbacks++;
+			}
+		}
+	}
+
+	if (num_callbacks == 0) {
+		*result = NULL;
+		return 0;
+	}
+
+	while (bucket_count < num_callbacks) {
+		bucket_count *= 2;
+	}
+
+	set = (struct hid_hotplug_callback_set*)calloc(1, sizeof(struct hid_hotplug_callback_set) + 2 * num_callbacks * sizeof(struct hid_hotplug_callback*) + (bucket_count + 1) * sizeof(size_t));
+	if (!set) {
+		return -1;
+	}
+
+	set->refs = 1;
+	set->callbacks = (struct hid_hotplug_callback**)(set + 1);
+	set->chain = set->callbacks + num_callbacks;
+	set->bucket_start = (size_t*)(set->chain + num_callbacks);
+	set->bucket_count = bucket_count;
+
+	if (old) {
+		for (i = 0; i < old->num_callbacks; i++) {
+			if (!old->callbacks[i]->removed) {
+				set->callbacks[set->num_callbacks++] = old->callbacks[i];
+			}
+		}
+	}
+	if (callback) {
+		set->callbacks[set->num_callbacks++] = callback;
+	}
+
+	/* Counting sort by bucket, which keeps the registration order within the buckets */
+	for (i = 0; i < num_callbacks; i++) {
+		set->bucket_start[hid_internal_callback_bucket(set, set->callbacks[i]->vendor_id, set->callbacks[i]->product_id) + 1]++;
+	}
+	for (i = 0; i < bucket_count; i++) {
+		set->bucket_start[i + 1] += set->bucket_start[i];
+	}
+	for (i = 0; i < num_callbacks; i++) {
+		size_t bucket = hid_internal_callback_bucket(set, set->callbacks[i]->vendor_id, set->callbacks[i]->product_id);
+		/* bucket_start[bucket] is used as the insert position, and ends up as the start of the next bucket */
+		set->chain[set->bucket_start[bucket]++] = set->callbacks[i];
+		__atomic_add_fetch(&set->callbacks[i]->refs, 1, __ATOMIC_RELAXED);
+	}
+	for (i = bucket_count; i > 0; i--) {
+		set->bucket_start[i] = set->bucket_start[i - 1];
+	}
+	set->bucket_start[0] = 0;
+
+	*result = set;
+	return 0;
+}
+
+static void hid_internal_callback_set_release(struct hid_hotplug_callback_set *set)
+{
+	if (!set || __atomic_sub_fetch(&set->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+		return;
+	}
+
+	for (size_t i = 0; i < set->num_callbacks; i++) {
+		hid_internal_callback_unref(set->callbacks[i]);
+	}
+	free(set);
+}
+
+/* Take a reference to the current set of callbacks, NULL if there are none */
+static struct hid_hotplug_callback_set *hid_internal_callback_set_acquire(void)
+{
+	struct hid_hotplug_callback_set *set;
+
+	pthread_mutex_lock(&hid_hotplug_context.callbacks_lock);
+	set = hid_hotplug_context.callbacks;
+	if (set) {
+		__atomic_add_fetch(&set->refs, 1, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&hid_hotplug_context.callbacks_lock);
+
+	return set;
+}
+
+/* Replace the current set of callbacks. Called with the mutex locked. */
+static void hid_internal_callback_set_publish(struct hid_hotplug_callback_set *set)
+{
+	struct hid_hotplug_callback_set *old;
+
+	pthread_mutex_lock(&hid_hotplug_context.callbacks_lock);
+	old = hid_hotplug_context.callbacks;
+	__atomic_store_n(&hid_hotplug_context.callbacks, set, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&hid_hotplug_context.callbacks_lock);
+
+	/* The readers that still use it hold their own references */
+	hid_internal_callback_set_release(old);
+}
+
+/* The records of the usages of one hidraw device share its devnode as their path */
+static size_t hid_internal_device_key_length(const char *path)
+{
+	return strlen(path);
+}
+
+/* The records that one device contributed to devs. devs is the concatenation of the records
+   of the registered devices, in this order; the devices are also hashed by their key */
+struct hid_hotplug_device {
+	struct hid_device_info *first;
+	struct hid_device_info *last;
+	unsigned int hash;
+
+	struct hid_hotplug_device *prev;
+	struct hid_hotplug_device *next;
+
+	/* Next device in the same bucket of the registry */
+	struct hid_hotplug_device *bucket_next;
+};
+
+static unsigned int hid_internal_device_key_hash(const char *key, size_t length)
+{
+	/* FNV-1a */
+	unsigned int hash = 2166136261u;
+	for (size_t i = 0; i < length; i++) {
+		hash = (hash ^ (unsigned char)key[i]) * 16777619u;
+	}
+	return hash;
+}
+
+static void hid_internal_devices_bucket_link(struct hid_hotplug_device *device)
+{
+	struct hid_hotplug_device **bucket = &hid_hotplug_context.dev_buckets[device->hash & (hid_hotplug_context.dev_bucket_count - 1)];
+	device->bucket_next = *bucket;
+	*bucket = device;
+}
+
+/* Keep at most one device per bucket on average */
+static void hid_internal_devices_reserve()
+{
+	size_t bucket_count = hid_hotplug_context.dev_bucket_count;
+
+	if (hid_hotplug_context.num_devices < bucket_count) {
+		return;
+	}
+
+	struct hid_hotplug_device **buckets = (struct hid_hotplug_device**)calloc(bucket_count ? bucket_count * 2 : 64, sizeof(struct hid_hotplug_device*));
+	if (buckets == NULL) {
+		return;
+	}
+
+	free(hid_hotplug_context.dev_buckets);
+	hid_hotplug_context.dev_buckets = buckets;
+	hid_hotplug_context.dev_bucket_count = bucket_count ? bucket_count * 2 : 64;
+
+	for (struct hid_hotplug_device *device = hid_hotplug_context.first_device; device != NULL; device = device->next) {
+		hid_internal_devices_bucket_link(device);
+	}
+}
+
+/* Append the records of one device to devs.
+   Called with devs_lock locked for writing. On failure, the records are left to the caller. */
+static int hid_internal_devices_append(struct hid_device_info *info)
+{
+	struct hid_hotplug_device *device;
+
+	hid_internal_devices_reserve();
+	if (hid_hotplug_context.dev_bucket_count == 0) {
+		return -1;
+	}
+
+	device = (struct hid_hotplug_device*)calloc(1, sizeof(struct hid_hotplug_device));
+	if (device == NULL) {
+		return -1;
+	}
+
+	device->first = info;
+	device->last = info;
+	while (device->last->next != NULL) {
+		device->last = device->last->next;
+	}
+	device->hash = hid_internal_device_key_hash(info->path, hid_internal_device_key_length(info->path));
+
+	device->prev = hid_hotplug_context.last_device;
+	if (device->prev != NULL) {
+		device->prev->last->next = info;
+		device->prev->next = device;
+	}
+	else {
+		hid_hotplug_context.devs = info;
+		hid_hotplug_context.first_device = device;
+	}
+	hid_hotplug_context.last_device = device;
+
+	hid_internal_devices_bucket_link(device);
+	hid_hotplug_context.num_devices++;
+
+	return 0;
+}
+
+/* Detach the records of the devices registered under this key from devs and return them.
+   Called with devs_lock locked for writing. */
+static struct hid_device_info *hid_internal_devices_remove(const char *key, size_t length)
+{
+	struct hid_device_info *removed = NULL;
+	struct hid_device_info **removed_tail = &removed;
+
+	if (hid_hotplug_context.dev_bucket_count == 0) {
+		return NULL;
+	}
+
+	unsigned int hash = hid_internal_device_key_hash(key, length);
+	struct hid_hotplug_device **bucket = &hid_hotplug_context.dev_buckets[hash & (hid_hotplug_context.dev_bucket_count - 1)];
+
+	while (*bucket) {
+		struct hid_hotplug_device *device = *bucket;
+
+		if (device->hash != hash || hid_internal_device_key_length(device->first->path) != length || memcmp(device->first->path, key, length)) {
+			bucket = &device->bucket_next;
+			continue;
+		}
+
+		*bucket = device->bucket_next;
+
+		/* Its records are contiguous in devs: unlink them at once */
+		if (device->prev != NULL) {
+			device->prev->last->next = device->last->next;
+			device->prev->next = device->next;
+		}
+		else {
+			hid_hotplug_context.devs = device->last->next;
+			hid_hotplug_context.first_device = device->next;
+		}
+		if (device->next != NULL) {
+			device->next->prev = device->prev;
+		}
+		else {
+			hid_hotplug_context.last_device = device->prev;
+		}
+
+		device->last->next = NULL;
+		*removed_tail = device->first;
+		removed_tail = &device->last->next;
+
+		free(device);
+		hid_hotplug_context.num_devices--;
+	}
+
+	return removed;
+}
+
+/* Register the records of a full enumeration, in which those of a device are next to each other.
+   Called with devs_lock locked for writing. */
+static void hid_internal_devices_set(struct hid_device_info *devs)
+{
+	while (devs != NULL) {
+		struct hid_device_info *last = devs;
+		size_t length = hid_internal_device_key_length(devs->path);
+
+		while (last->next != NULL && hid_internal_device_key_length(last->next->path) == length && !memcmp(last->next->path, devs->path, length)) {
+			last = last->next;
+		}
+
+		struct hid_device_info *rest = last->next;
+		last->next = NULL;
+		if (hid_internal_devices_append(devs) < 0) {
+			hid_free_enumeration(devs);
+		}
+		devs = rest;
+	}
+}
+
+/* Free devs and the registry. Called with devs_lock locked for writing. */
+static void hid_internal_devices_clear()
+{
+	struct hid_hotplug_device *device = hid_hotplug_context.first_device;
+	while (device != NULL) {
+		struct hid_hotplug_device *next = device->next;
+		free(device);
+		device = next;
+	}
+
+	free(hid_hotplug_context.dev_buckets);
+	hid_hotplug_context.dev_buckets = NULL;
+	hid_hotplug_context.dev_bucket_count = 0;
+	hid_hotplug_context.num_devices = 0;
+	hid_hotplug_context.first_device = NULL;
+	hid_hotplug_context.last_device = NULL;
+
+	hid_free_enumeration(hid_hotplug_context.devs);
+	hid_hotplug_context.devs = NULL;
+}
+
+/* Free devs and disarm the udev monitor */
+static void hid_internal_hotplug_close_monitor(void)
+{
+	/* Cleanup connected device list */
+	pthread_rwlock_wrlock(&hid_hotplug_context.devs_lock);
+	hid_hotplug_context.devs_valid = 0;
+	hid_internal_devices_clear();
+	pthread_rwlock_unlock(&hid_hotplug_context.devs_lock);
+
+	/* epoll_fd outlives the monitor with hid_hotplug_get_fd() */
+	epoll_ctl(hid_hotplug_context.epoll_fd, EPOLL_CTL_DEL, hid_hotplug_context.monitor_fd, NULL);
+	hid_hotplug_context.monitor_fd = -1;
+
+	/* Disarm the udev monitor */
+	udev_monitor_unref(hid_hotplug_context.mon);
+	udev_unref(hid_hotplug_context.udev_ctx);
+	hid_hotplug_context.mon = NULL;
+	hid_hotplug_context.udev_ctx = NULL;
+}
+
+/* Create epoll_fd with wakeup_fd in it. Called with the mutex locked. */
+static int hid_internal_hotplug_open_epoll(void)
+{
+	struct epoll_event event;
+	int err;
+
+	hid_hotplug_context.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	hid_hotplug_context.wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (hid_hotplug_context.epoll_fd < 0 || hid_hotplug_context.wakeup_fd < 0) {
+		goto err;
+	}
+
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = hid_hotplug_context.wakeup_fd;
+	if (epoll_ctl(hid_hotplug_context.epoll_fd, EPOLL_CTL_ADD, hid_hotplug_context.wakeup_fd, &event) < 0) {
+		goto err;
+	}
+
+	return 0;
+
+err:
+	err = errno;
+	if (hid_hotplug_context.epoll_fd >= 0)
+		close(hid_hotplug_context.epoll_fd);
+	if (hid_hotplug_context.wakeup_fd >= 0)
+		close(hid_hotplug_context.wakeup_fd);
+	hid_hotplug_context.epoll_fd = -1;
+	hid_hotplug_context.wakeup_fd = -1;
+	errno = err;
+	return -1;
+}
+
+/* Join the monitor thread, which has left its loop or is about to */
+static void hid_internal_hotplug_join_monitor(void)
+{
+	pthread_join(hid_hotplug_context.thread, NULL);
+	hid_hotplug_context.monitor_running = 0;
+
+	close(hid_hotplug_context.epoll_fd);
+	close(hid_hotplug_context.wakeup_fd);
+	hid_hotplug_context.epoll_fd = -1;
+	hid_hotplug_context.wakeup_fd = -1;
+}
+
+/* Whether the monitor thread has to keep running. Checked without the mutex by the thread,
+   which is why hid_internal_hotplug_wake() is called after any change that can make it stop */
+static int hid_internal_hotplug_needed(void)
+{
+	return __atomic_load_n(&hid_hotplug_context.callbacks, __ATOMIC_ACQUIRE) != NULL
+		|| __atomic_load_n(&hid_hotplug_context.enumerate_cache, __ATOMIC_RELAXED);
+}
+
+/* Make the monitor thread check whether it still has to run. Called with the mutex locked. */
+static void hid_internal_hotplug_wake(void)
+{
+	if (hid_hotplug_context.monitor_running && !__atomic_load_n(&hid_hotplug_context.monitor_exited, __ATOMIC_ACQUIRE)) {
+		signal_event_fd(hid_hotplug_context.wakeup_fd);
+	}
+}
+
+/* Called by the monitor thread when it isn't needed anymore, or with force set, when it can't go on.
+   Returns 1 if the thread has to leave, and 0 if it was needed again in the meantime.
+   The decision is taken with the mutex locked, so that hid_internal_hotplug_start_monitor()
+   either sees the thread leaving or has it keep running. */
+static int hid_internal_hotplug_leave(int force)
+{
+	int leave;
+
+	pthread_mutex_lock(&hid_hotplug_context.mutex);
+	leave = force || !hid_internal_hotplug_needed();
+	if (leave) {
+		__atomic_store_n(&hid_hotplug_context.monitor_exited, 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+
+	return leave;
+}
+
+static void hid_internal_hotplug_exit()
+{
+	struct hid_hotplug_callback_set *set;
+	unsigned char running;
+
+	/* The executor threads may deregister callbacks, stop them before taking the mutex */
+	hid_internal_executor_stop(1);
+
+	pthread_mutex_lock(&hid_hotplug_context.mutex);
+	__atomic_store_n(&hid_hotplug_context.enumerate_cache, 0, __ATOMIC_RELAXED);
+	/* Remove all callbacks, the ones being invoked are freed once their calls return */
+	set = hid_hotplug_context.callbacks;
+	if (set) {
+		for (size_t i = 0; i < set->num_callbacks; i++) {
+			__atomic_store_n(&set->callbacks[i]->removed, 1, __ATOMIC_RELEASE);
+		}
+	}
+	hid_internal_callback_set_publish(NULL);
+	hid_internal_hotplug_wake();
+	running = hid_hotplug_context.monitor_running;
+	if (hid_hotplug_context.external) {
+		/* Without a thread, the monitor is closed right away */
+		if (running) {
+			hid_internal_hotplug_close_monitor();
+			hid_hotplug_context.monitor_running = 0;
+			running = 0;
+		}
+		close(hid_hotplug_context.epoll_fd);
+		close(hid_hotplug_context.wakeup_fd);
+		hid_hotplug_context.epoll_fd = -1;
+		hid_hotplug_context.wakeup_fd = -1;
+		hid_hotplug_context.external = 0;
+	}
+	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+
+	/* The thread takes the mutex to leave */
+	if (running) {
+		hid_internal_hotplug_join_monitor();
+	}
+}
+
+int HID_API_EXPORT hid_init(void)
+{
+	const char *locale;
+
+	/* indicate no error */
+	register_global_error(NULL);
+
+	/* Set the locale if it's not set. */
+	locale = setlocale(LC_CTYPE, NULL);
+	if (!locale)
+		setlocale(LC_CTYPE, "");
+
+	return 0;
+}
+
+
+int HID_API_EXPORT hid_exit(void)
+{
+	/* Reset the global error of the calling thread */
+	register_global_error(NULL);
+
+	hid_internal_hotplug_exit();
+	
+	return 0;
+}
+
+static int hid_internal_match_device_id(unsigned short vendor_id, unsigned short product_id, unsigned short expected_vendor_id, unsigned short expected_product_id)
+{
+    return (expected_vendor_id == 0x0 || vendor_id == expected_vendor_id) && (expected_product_id == 0x0 || product_id == expected_product_id);
+}
+
+/* Enumerate the hidraw devices through udev_enumerate.
+   Returns 0 on success, and -1 if udev can't be used. */
+static int hid_enumerate_udev(const struct hid_enumerate_filter *filter, struct hid_device_info **devs)
+{
+	struct udev *udev;
+	struct udev_enumerate *enumerate;
+	struct udev_list_entry *devices, *dev_list_entry;
+
+	struct hid_device_info *root = NULL; /* return object */
+	struct hid_device_info *cur_dev = NULL;
+
+	/* Create the udev object */
+	udev = udev_new();
+	if (!udev) {
+		register_global_error("Couldn't create udev context");
+		return -1;
+	}
+
+	/* Create a list of the devices in the 'hidraw' subsystem. */
+	enumerate = udev_enumerate_new(udev);
+	udev_enumerate_add_match_subsystem(enumerate, "hidraw");
+	udev_enumerate_scan_devices(enumerate);
+	devices = udev_enumerate_get_list_entry(enumerate);
+	/* For each item, see if it matches the vid/pid, and if so
+	   create a udev_device record for it */
+	udev_list_entry_foreach(dev_list_entry, devices) {
+		const char *sysfs_path;
+		unsigned short dev_vid = 0;
+		unsigned short dev_pid = 0;
+		unsigned bus_type = 0;
+		struct udev_device *raw_dev; /* The device's hidraw udev node. */
+		struct hid_device_info * tmp;
+
+		/* Get the filename of the /sys entry for the device
+		   and create a udev_device object (dev) representing it */
+		sysfs_path = udev_list_entry_get_name(dev_list_entry);
+		if (!sysfs_path)
+			continue;
+
+		/* Check what the uevent tells before creating the udev_device */
+		if (filter->vendor_id != 0 || filter->product_id != 0 || filter->bus_type != HID_API_BUS_UNKNOWN) {
+			if (!parse_hid_vid_pid_from_sysfs(sysfs_path, &bus_type, &dev_vid, &dev_pid))
+				continue;
+
+			if (!uevent_matches_filter(bus_type, dev_vid, dev_pid, filter))
+				continue;
+		}
+
+		raw_dev = udev_device_new_from_syspath(udev, sysfs_path);
+		if (!raw_dev)
+			continue;
+
+		tmp = create_device_info_for_device(raw_dev, filter);
+		if (tmp) {
+			if (cur_dev) {
+				cur_dev->next = tmp;
+			}
+			else {
+				root = tmp;
+			}
+			cur_dev = tmp;
+
+			/* move the pointer to the tail of returned list */
+			while (cur_dev->next != NULL) {
+				cur_dev = cur_dev->next;
+			}
+		}
+
+		udev_device_unref(raw_dev);
+	}
+	/* Free the enumerator and udev objects. */
+	udev_enumerate_unref(enumerate);
+	udev_unref(udev);
+
+	*devs = root;
+	return 0;
+}
+
+void HID_API_EXPORT HID_API_CALL hid_hidraw_set_enumerate_threads(unsigned int num_threads)
+{
+	if (num_threads == 0)
+		num_threads = 1;
+	if (num_threads > HID_ENUMERATE_MAX_THREADS)
+		num_threads = HID_ENUMERATE_MAX_THREADS;
+
+	enumerate_threads = num_threads;
+}
+
+unsigned int HID_API_EXPORT HID_API_CALL hid_hidraw_get_enumerate_threads(void)
+{
+	return enumerate_threads;
+}
+
+static int hid_internal_match_filter(const struct hid_device_info *info, const struct hid_enumerate_filter *filter)
+{
+	return (filter->vendor_id == 0x0 || info->vendor_id == filter->vendor_id) &&
+		(filter->product_id == 0x0 || info->product_id == filter->product_id) &&
+		(filter->usage_page == 0x0 || info->usage_page == filter->usage_page) &&
+		(filter->usage == 0x0 || info->usage == filter->usage) &&
+		(filter->bus_type == HID_API_BUS_UNKNOWN || info->bus_type == filter->bus_type) &&
+		(filter->interface_number == -1 || info->interface_number == filter->interface_number) &&
+		(!filter->serial_number || (info->serial_number && wcscmp(info->serial_number, filter->serial_number) == 0));
+}
+
+/* Copy a single device info, without the link to the next one */
+static struct hid_device_info *hid_internal_copy_device_info(const struct hid_device_info *info, int with_strings)
+{
+	struct hid_device_info copy = *info;
+
+	if (!with_strings) {
+		copy.serial_number = NULL;
+		copy.manufacturer_string = NULL;
+		copy.product_string = NULL;
+	}
+
+	return alloc_device_infos(&copy, 1);
+}
+
+/* Convert a list of device infos to UTF-8, for when the strings
+   weren't read as UTF-8 in the first place */
+static struct hid_device_info_utf8 *hid_internal_convert_device_infos(const struct hid_device_info *devs)
+{
+	struct hid_device_info_utf8 *root = NULL;
+	struct hid_device_info_utf8 *cur_dev = NULL;
+
+	for (const struct hid_device_info *info = devs; info; info = info->next) {
+		struct hid_device_info_utf8 desc;
+		struct hid_device_info_utf8 *tmp;
+
+		memset(&desc, 0, sizeof(desc));
+		desc.path = info->path;
+		desc.vendor_id = info->vendor_id;
+		desc.product_id = info->product_id;
+		desc.release_number = info->release_number;
+		desc.usage_page = info->usage_page;
+		desc.usage = info->usage;
+		desc.interface_number = info->interface_number;
+		desc.bus_type = info->bus_type;
+		desc.serial_number = wchar_t_to_utf8(info->serial_number);
+		desc.manufacturer_string = wchar_t_to_utf8(info->manufacturer_string);
+		desc.product_string = wchar_t_to_utf8(info->product_string);
+
+		tmp = alloc_device_infos_utf8(&desc, 1);
+
+		free(desc.serial_number);
+		free(desc.manufacturer_string);
+		free(desc.product_string);
+
+		if (!tmp)
+			continue;
+
+		if (cur_dev) {
+			cur_dev->next = tmp;
+		}
+		else {
+			root = tmp;
+		}
+		cur_dev = tmp;
+	}
+
+	return root;
+}
+
+/* Answer hid_enumerate() from the device list kept by the hotplug monitor.
+   Returns -1 if the list isn't being kept up to date. */
+static int hid_enumerate_cached(const struct hid_enumerate_filter *filter, struct hid_device_info **devs)
+{
+	struct hid_device_info *root = NULL;
+	struct hid_device_info *cur_dev = NULL;
+	int with_strings = !(filter->flags & HID_API_ENUMERATE_NO_STRINGS);
+
+	/* Unlocked check, a stale value only costs a regular enumeration */
+	if (!__atomic_load_n(&hid_hotplug_context.enumerate_cache, __ATOMIC_RELAXED))
+		return -1;
+
+	pthread_rwlock_rdlock(&hid_hotplug_context.devs_lock);
+
+	if (!hid_hotplug_context.devs_valid) {
+		pthread_rwlock_unlock(&hid_hotplug_context.devs_lock);
+		return -1;
+	}
+
+	for (const struct hid_device_info *info = hid_hotplug_context.devs; info; info = info->next) {
+		struct hid_device_info *tmp;
+
+		if (!hid_internal_match_filter(info, filter))
+			continue;
+
+		tmp = hid_internal_copy_device_info(info, with_strings);
+		if (!tmp)
+			continue;
+
+		if (cur_dev) {
+			cur_dev->next = tmp;
+		}
+		else {
+			root = tmp;
+		}
+		cur_dev = tmp;
+	}
+
+	pthread_rwlock_unlock(&hid_hotplug_context.devs_lock);
+
+	*devs = root;
+	return 0;
+}
+
+/* Tell why hid_enumerate_ex() found nothing */
+static void register_enumerate_error(const struct hid_enumerate_filter *filter)
+{
+	if (filter->usage_page != 0 || filter->usage != 0 || filter->bus_type != HID_API_BUS_UNKNOWN
+	 || filter->interface_number != -1 || filter->serial_number) {
+		register_global_error("No HID devices matching the filter found in the system.");
+	} else if (filter->vendor_id == 0 && filter->product_id == 0) {
+		register_global_error("No HID devices found in the system.");
+	} else {
+		register_global_error("No HID devices with requested VID/PID found in the system.");
+	}
+}
+
+struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate_ex(const struct hid_enumerate_filter *filter)
+{
+	const struct hid_enumerate_filter match_all = HID_API_ENUMERATE_FILTER_INIT;
+	struct hid_device_info *root = NULL; /* return object */
+	int res;
+
+	hid_init();
+	/* register_global_error: global error is reset by hid_init */
+
+	if (!filter)
+		filter = &match_all;
+
+	/* Walking sysfs directly is much faster, udev is the fallback
+	   for when /sys/class/hidraw isn't available */
+	if (hid_enumerate_cached(filter, &root) < 0) {
+		res = hid_enumerate_sysfs(filter, &root, NULL);
+		if (res == -2)
+			return NULL;
+		if (res < 0 && hid_enumerate_udev(filter, &root) < 0)
+			return NULL;
+	}
+
+	if (root == NULL)
+		register_enumerate_error(filter);
+
+	return root;
+}
+
+struct hid_device_info_utf8 HID_API_EXPORT * HID_API_CALL hid_enumerate_utf8(const struct hid_enumerate_filter *filter)
+{
+	const struct hid_enumerate_filter match_all = HID_API_ENUMERATE_FILTER_INIT;
+	struct hid_device_info_utf8 *root = NULL; /* return object */
+	struct hid_device_info *devs = NULL;
+	int res;
+
+	hid_init();
+	/* register_global_error: global error is reset by hid_init */
+
+	if (!filter)
+		filter = &match_all;
+
+	/* The sysfs attributes are UTF-8 already. The cached records
+	   and the ones made through udev have wide strings to convert. */
+	if (hid_enumerate_cached(filter, &devs) < 0) {
+		res = hid_enumerate_sysfs(filter, NULL, &root);
+		if (res == -2)
+			return NULL;
+		if (res < 0 && hid_enumerate_udev(filter, &devs) < 0)
+			return NULL;
+	}
+
+	if (devs) {
+		root = hid_internal_convert_device_infos(devs);
+		hid_free_enumeration(devs);
+	}
+
+	if (root == NULL)
+		register_enumerate_error(filter);
+
+	return root;
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+{
+	struct hid_enumerate_filter filter = HID_API_ENUMERATE_FILTER_INIT;
+
+	filter.vendor_id = vendor_id;
+	filter.product_id = product_id;
+
+	return hid_enumerate_ex(&filter);
+}
+
+void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
+{
+	/* All the records come from alloc_device_infos() */
+	struct hid_device_info *d = devs;
+	while (d) {
+		struct hid_device_info *next = d->next;
+		struct hidraw_device_info_block *block = ((struct hidraw_device_info *) d)->block;
+		if (--block->num_records == 0)
+			free(block);
+		d = next;
+	}
+}
+
+void  HID_API_EXPORT hid_free_enumeration_utf8(struct hid_device_info_utf8 *devs)
+{
+	/* All the records come from alloc_device_infos_utf8() */
+	struct hid_device_info_utf8 *d = devs;
+	while (d) {
+		struct hid_device_info_utf8 *next = d->next;
+		struct hidraw_device_info_utf8_block *block = ((struct hidraw_device_info_utf8 *) d)->block;
+		if (--block->num_records == 0)
+			free(block);
+		d = next;
+	}
+}
+
+/* Queue an event for a callback. The device info is copied once per event, into *snapshot.
+   Called with the executor mutex locked. */
+static void hid_internal_executor_queue(struct hid_hotplug_callback *callback, const struct hid_device_info *info, struct hid_hotplug_snapshot **snapshot, hid_hotplug_event event, int replay)
+{
+	struct hid_hotplug_task *task = (struct hid_hotplug_task*)calloc(1, sizeof(struct hid_hotplug_task));
+	if (!task) {
+		/* Out of memory: the callback misses the event */
+		return;
+	}
+
+	if (!*snapshot) {
+		*snapshot = (struct hid_hotplug_snapshot*)calloc(1, sizeof(struct hid_hotplug_snapshot));
+		if (*snapshot) {
+			(*snapshot)->info = hid_internal_copy_device_info(info, 1);
+			if (!(*snapshot)->info) {
+				free(*snapshot);
+				*snapshot = NULL;
+			}
+		}
+		if (!*snapshot) {
+			free(task);
+			return;
+		}
+	}
+
+	/* Released by the executor threads without the mutex */
+	__atomic_add_fetch(&(*snapshot)->refs, 1, __ATOMIC_RELAXED);
+	task->snapshot = *snapshot;
+	task->event = event;
+	task->replay = replay ? 1 : 0;
+
+	if (callback->tasks_tail) {
+		callback->tasks_tail->next = task;
+	}
+	else {
+		callback->tasks = task;
+	}
+	callback->tasks_tail = task;
+
+	if (!callback->scheduled) {
+		callback->scheduled = 1;
+		callback->ready_next = NULL;
+		if (hid_hotplug_executor.ready_tail) {
+			hid_hotplug_executor.ready_tail->ready_next = callback;
+		}
+		else {
+			hid_hotplug_executor.ready = callback;
+		}
+		hid_hotplug_executor.ready_tail = callback;
+		pthread_cond_signal(&hid_hotplug_executor.cond);
+	}
+}
+
+/* Invoke a callback from the monitor thread. The calls of a callback are serialized,
+   and wait for its HID_API_HOTPLUG_ENUMERATE replay. */
+static void hid_internal_invoke_callback(struct hid_hotplug_callback *callback, struct hid_device_info *info, hid_hotplug_event event)
+{
+	int result = 0;
+
+	pthread_mutex_lock(&callback->call_lock);
+	/* Checked again, as it may have been deregistered while the replay was running */
+	if (!__atomic_load_n(&callback->removed, __ATOMIC_ACQUIRE)) {
+		result = callback->callback(callback->handle, info, event, callback->user_data);
+	}
+	pthread_mutex_unlock(&callback->call_lock);
+
+	/* If the result is non-zero, the callback is deregistered */
+	if (result) {
+		hid_hotplug_deregister_callback(callback->handle);
+	}
+}
+
+/* Find the first callback with the given ids, from position i of a chain that ends before end */
+static size_t hid_internal_callback_chain_find(const struct hid_hotplug_callback_set *set, size_t i, size_t end, unsigned short vendor_id, unsigned short product_id)
+{
+	while (i < end && (set->chain[i]->vendor_id != vendor_id || set->chain[i]->product_id != product_id)) {
+		i++;
+	}
+	return i;
+}
+
+static void hid_internal_invoke_callbacks(struct hid_hotplug_callback_set *set, struct hid_device_info *info, hid_hotplug_event event)
+{
+	struct hid_hotplug_snapshot *snapshot = NULL;
+
+	if (!set) {
+		return;
+	}
+
+	/* A device can only be matched by the callbacks for its (vendor_id, product_id), (vendor_id, any),
+	   (any, product_id) and for any device: follow those chains, in registration order across them */
+	unsigned short keys[4][2] = {
+		{ 0, 0 },
+		{ info->vendor_id, 0 },
+		{ 0, info->product_id },
+		{ info->vendor_id, info->product_id },
+	};
+	size_t cursors[4];
+	size_t ends[4];
+	size_t num_chains = 0;
+
+	for (size_t i = 0; i < 4; i++) {
+		/* Ids of 0 make some keys the same */
+		size_t j = 0;
+		while (j < num_chains && (keys[j][0] != keys[i][0] || keys[j][1] != keys[i][1])) {
+			j++;
+		}
+		if (j < num_chains) {
+			continue;
+		}
+
+		size_t bucket = hid_internal_callback_bucket(set, keys[i][0], keys[i][1]);
+		keys[num_chains][0] = keys[i][0];
+		keys[num_chains][1] = keys[i][1];
+		ends[num_chains] = set->bucket_start[bucket + 1];
+		cursors[num_chains] = hid_internal_callback_chain_find(set, set->bucket_start[bucket], ends[num_chains], keys[i][0], keys[i][1]);
+		num_chains++;
+	}
+
+	/* With the executor running the callbacks are only queued */
+	int queue = hid_internal_executor_lock();
+
+	for (;;) {
+		size_t next = num_chains;
+		for (size_t i = 0; i < num_chains; i++) {
+			if (cursors[i] < ends[i] && (next == num_chains || set->chain[cursors[i]]->order < set->chain[cursors[next]]->order)) {
+				next = i;
+			}
+		}
+		if (next == num_chains) {
+			break;
+		}
+
+		struct hid_hotplug_callback *callback = set->chain[cursors[next]];
+		if ((callback->events & event) && !__atomic_load_n(&callback->removed, __ATOMIC_ACQUIRE)) {
+			if (queue) {
+				hid_internal_executor_queue(callback, info, &snapshot, event, 0);
+			}
+			else {
+				hid_internal_invoke_callback(callback, info, event);
+			}
+		}
+
+		cursors[next] = hid_internal_callback_chain_find(set, cursors[next] + 1, ends[next], keys[next][0], keys[next][1]);
+	}
+
+	if (queue) {
+		pthread_mutex_unlock(&hid_hotplug_executor.mutex);
+	}
+}
+
+/* Update devs and invoke the callbacks for one event of the udev monitor */
+static void hid_internal_hotplug_process_device(struct udev_device *raw_dev)
+{
+	struct hid_hotplug_callback_set *set = NULL;
+	const char* action = udev_device_get_action(raw_dev);
+
+	if (!action) {
+		return;
+	}
+
+	if (!strcmp(action, "add")) {
+		// We create a list of all usages on this UDEV device
+		struct hid_device_info *info = create_device_info_for_device(raw_dev, NULL);
+		struct hid_device_info *info_cur;
+		size_t num_records = 0;
+		int tracked = 0;
+
+		for (info_cur = info; info_cur; info_cur = info_cur->next) {
+			num_records++;
+		}
+
+		/* Append all we got to the end of the device list, and take the callbacks to
+		   notify at the same time (see hid_hotplug_register_callback()) */
+		if (info) {
+			pthread_rwlock_wrlock(&hid_hotplug_context.devs_lock);
+			/* Out of memory: the device is not tracked */
+			tracked = hid_internal_devices_append(info) == 0;
+			set = hid_internal_callback_set_acquire();
+			pthread_rwlock_unlock(&hid_hotplug_context.devs_lock);
+		}
+
+		/* The records stay valid in devs, only the events of the monitor remove them */
+		info_cur = info;
+		while (num_records--) {
+			/* For each device, call all matching callbacks */
+			/* TODO: possibly make the `next` field NULL to match the behavior on other systems */
+			hid_internal_invoke_callbacks(set, info_cur, HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED);
+			info_cur = info_cur->next;
+		}
+
+		if (!tracked) {
+			hid_free_enumeration(info);
+		}
+	} else if (!strcmp(action, "remove")) {
+		struct hid_device_info *removed;
+		const char *devnode = udev_device_get_devnode(raw_dev);
+
+		/* Detach the devices first, so that the callbacks run without devs_lock */
+		pthread_rwlock_wrlock(&hid_hotplug_context.devs_lock);
+		removed = devnode ? hid_internal_devices_remove(devnode, hid_internal_device_key_length(devnode)) : NULL;
+		set = hid_internal_callback_set_acquire();
+		pthread_rwlock_unlock(&hid_hotplug_context.devs_lock);
+
+		while (removed) {
+			struct hid_device_info *info = removed;
+			removed = info->next;
+			info->next = NULL;
+			hid_internal_invoke_callbacks(set, info, HID_API_HOTPLUG_EVENT_DEVICE_LEFT);
+			/* Free every removed device */
+			hid_free_enumeration(info);
+		}
+	}
+
+	hid_internal_callback_set_release(set);
+}
+
+static void* hotplug_thread(void* user_data)
+{
+	(void) user_data;
+
+	for (;;) {
+		struct epoll_event events[2];
+		int monitor_ready = 0;
+		int ret, i;
+
+		/* On every iteration, check if we still have any callbacks left and leave if none are left */
+		if (!hid_internal_hotplug_needed() && hid_internal_hotplug_leave(0)) {
+			break;
+		}
+
+		/* Sleep until a device event comes or the thread is woken up */
+		ret = epoll_wait(hid_hotplug_context.epoll_fd, events, 2, -1);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			hid_internal_hotplug_leave(1);
+			break;
+		}
+
+		for (i = 0; i < ret; i++) {
+			if (events[i].data.fd == hid_hotplug_context.wakeup_fd) {
+				uint64_t count;
+				/* Reset the counter, the condition is checked at the top of the loop */
+				ssize_t res = read(hid_hotplug_context.wakeup_fd, &count, sizeof(count));
+				(void) res;
+			}
+			else {
+				monitor_ready = 1;
+			}
+		}
+
+		/* An extra check, just in case the thread was told to stop while it was sleeping */
+		if (!hid_internal_hotplug_needed() && hid_internal_hotplug_leave(0)) {
+			break;
+		}
+
+		/* Check if our file descriptor has received data. */
+		if (monitor_ready) {
+
+			/* Make the call to receive the device.
+			   epoll ensured that this will not block. */
+			struct udev_device *raw_dev = udev_monitor_receive_device(hid_hotplug_context.mon);
+			if (raw_dev) {
+				hid_internal_hotplug_process_device(raw_dev);
+				udev_device_unref(raw_dev);
+			}
+		}
+	}
+
+	hid_internal_hotplug_close_monitor();
+
+	return NULL;
+}
+
+/* Set up the udev monitor, enumerate all devices and start the thread
+   that keeps the device list up to date, unless it is running already.
+   After hid_hotplug_get_fd(), the monitor is only added to its epoll set.
+   Always called with the mutex locked. */
+static int hid_internal_hotplug_start_monitor(void)
+{
+	static const struct hid_enumerate_filter match_all = HID_API_ENUMERATE_FILTER_INIT;
+	struct hid_device_info *devs = NULL;
+	struct epoll_event event;
+	int res;
+
+	/* The thread leaves on its own once its last callback is gone */
+	if (hid_hotplug_context.monitor_running && __atomic_load_n(&hid_hotplug_context.monitor_exited, __ATOMIC_ACQUIRE)) {
+		hid_internal_hotplug_join_monitor();
+	}
+
+	if (hid_hotplug_context.monitor_running) {
+		return 0;
+	}
+
+	hid_init();
+
+	if (!hid_hotplug_context.external && hid_internal_hotplug_open_epoll() < 0) {
+		return -1;
+	}
+
+	// Prepare a UDEV context to run monitoring on
+	hid_hotplug_context.udev_ctx = udev_new();
+	if (!hid_hotplug_context.udev_ctx)
+	{
+		goto err;
+	}
+
+	hid_hotplug_context.mon = udev_monitor_new_from_netlink(hid_hotplug_context.udev_ctx, "udev");
+	udev_monitor_filter_add_match_subsystem_devtype(hid_hotplug_context.mon, "hidraw", NULL);
+	udev_monitor_enable_receiving(hid_hotplug_context.mon);
+	hid_hotplug_context.monitor_fd = udev_monitor_get_fd(hid_hotplug_context.mon);
+
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = hid_hotplug_context.monitor_fd;
+	if (epoll_ctl(hid_hotplug_context.epoll_fd, EPOLL_CTL_ADD, hid_hotplug_context.monitor_fd, &event) < 0) {
+		goto err_udev;
+	}
+
+	/* After monitoring is all set up, enumerate all devices.
+	   Without memory for it, the device list would start out empty */
+	res = hid_enumerate_sysfs(&match_all, &devs, NULL);
+	if (res == -2) {
+		goto err_udev;
+	}
+	if (res < 0) {
+		hid_enumerate_udev(&match_all, &devs);
+	}
+
+	pthread_rwlock_wrlock(&hid_hotplug_context.devs_lock);
+	hid_internal_devices_set(devs);
+	hid_hotplug_context.devs_valid = 1;
+	pthread_rwlock_unlock(&hid_hotplug_context.devs_lock);
+
+	/* Start the thread that will be doing the event scanning */
+	hid_hotplug_context.monitor_exited = 0;
+	hid_hotplug_context.monitor_running = 1;
+	if (!hid_hotplug_context.external) {
+		pthread_create(&hid_hotplug_context.thread, NULL, &hotplug_thread, NULL);
+	}
+
+	return 0;
+
+err_udev:
+	udev_monitor_unref(hid_hotplug_context.mon);
+	udev_unref(hid_hotplug_context.udev_ctx);
+	hid_hotplug_context.mon = NULL;
+	hid_hotplug_context.udev_ctx = NULL;
+	hid_hotplug_context.monitor_fd = -1;
+err:
+	if (!hid_hotplug_context.external) {
+		close(hid_hotplug_context.epoll_fd);
+		close(hid_hotplug_context.wakeup_fd);
+		hid_hotplug_context.epoll_fd = -1;
+		hid_hotplug_context.wakeup_fd = -1;
+	}
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_hotplug_get_fd(void)
+{
+	int fd = -1;
+
+	pthread_mutex_lock(&hid_hotplug_context.mutex);
+
+	if (!hid_hotplug_context.external) {
+		/* The thread leaves on its own once its last callback is gone */
+		if (hid_hotplug_context.monitor_running && __atomic_load_n(&hid_hotplug_context.monitor_exited, __ATOMIC_ACQUIRE)) {
+			hid_internal_hotplug_join_monitor();
+		}
+
+		if (hid_hotplug_context.monitor_running) {
+			register_global_error("hid_hotplug_get_fd: the hotplug monitor thread is already running");
+			goto end;
+		}
+
+		if (hid_internal_hotplug_open_epoll() < 0) {
+			register_global_error_format("hid_hotplug_get_fd: %s", strerror(errno));
+			goto end;
+		}
+
+		hid_hotplug_context.external = 1;
+	}
+
+	fd = hid_hotplug_context.epoll_fd;
+
+end:
+	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+
+	return fd;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_hotplug_handle_events(void)
+{
+	struct epoll_event events[2];
+	struct udev_monitor *mon;
+	int monitor_ready = 0;
+	int count = 0;
+	int ret, i;
+
+	pthread_mutex_lock(&hid_hotplug_context.mutex);
+	if (!hid_hotplug_context.external) {
+		pthread_mutex_unlock(&hid_hotplug_context.mutex);
+		register_global_error("hid_hotplug_handle_events: hid_hotplug_get_fd() wasn't called");
+		return -1;
+	}
+	/* Only this function and hid_exit() close the monitor */
+	mon = hid_hotplug_context.mon;
+	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+
+	do {
+		ret = epoll_wait(hid_hotplug_context.epoll_fd, events, 2, 0);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0) {
+		register_global_error_format("hid_hotplug_handle_events: %s", strerror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < ret; i++) {
+		if (events[i].data.fd == hid_hotplug_context.wakeup_fd) {
+			uint64_t value;
+			/* Reset the counter, whether the monitor is needed is checked below */
+			ssize_t res = read(hid_hotplug_context.wakeup_fd, &value, sizeof(value));
+			(void) res;
+		}
+		else {
+			monitor_ready = 1;
+		}
+	}
+
+	/* The monitor socket is non-blocking: receive the queued devices */
+	if (monitor_ready && mon) {
+		struct udev_device *raw_dev;
+		while ((raw_dev = udev_monitor_receive_device(mon)) != NULL) {
+			hid_internal_hotplug_process_device(raw_dev);
+			udev_device_unref(raw_dev);
+			count++;
+		}
+	}
+
+	/* Close the monitor once nothing needs it, it is set up again by the next registration */
+	pthread_mutex_lock(&hid_hotplug_context.mutex);
+	if (hid_hotplug_context.monitor_running && !hid_internal_hotplug_needed()) {
+		hid_internal_hotplug_close_monitor();
+		hid_hotplug_context.monitor_running = 0;
+	}
+	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+
+	return count;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_hotplug_register_callback(unsigned short vendor_id, unsigned short product_id, int events, int flags, hid_hotplug_callback_fn callback, void *user_data, hid_hotplug_callback_handle *callback_handle)
+{
+	struct hid_hotplug_callback* hotplug_cb;
+	struct hid_hotplug_callback_set *set;
+	struct hid_device_info *replay = NULL;
+	struct hid_device_info *replay_last = NULL;
+
+	/* Check params */
+	if (events == 0
+		|| (events & ~(HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED | HID_API_HOTPLUG_EVENT_DEVICE_LEFT))
+		|| (flags & ~(HID_API_HOTPLUG_ENUMERATE))
+		|| callback == NULL) {
+		return -1;
+	}
+
+	hotplug_cb = (struct hid_hotplug_callback*)calloc(1, sizeof(struct hid_hotplug_callback));
+
+	if (hotplug_cb == NULL) {
+		return -1;
+	}
+
+	/* Fill out the record */
+	hotplug_cb->vendor_id = vendor_id;
+	hotplug_cb->product_id = product_id;
+	hotplug_cb->events = events;
+	hotplug_cb->user_data = user_data;
+	hotplug_cb->callback = callback;
+	/* Held by this function until the end of the replay */
+	hotplug_cb->refs = 1;
+	pthread_mutex_init(&hotplug_cb->call_lock, NULL);
+
+	/* The monitor thread waits for the replay before it invokes the callback.
+	   Taken before the mutex, like in the calls made while the callback runs */
+	pthread_mutex_lock(&hotplug_cb->call_lock);
+
+	/* Lock the mutex to avoid race conditions */
+	pthread_mutex_lock(&hid_hotplug_context.mutex);
+
+	/* The monitor may already be running for another callback or for the enumeration cache */
+	if (hid_internal_hotplug_start_monitor() < 0) {
+		pthread_mutex_unlock(&hid_hotplug_context.mutex);
+		pthread_mutex_unlock(&hotplug_cb->call_lock);
+		hid_internal_callback_unref(hotplug_cb);
+		return -1;
+	}
+
+	hotplug_cb->handle = hid_hotplug_context.next_handle++;
+	hotplug_cb->order = hid_hotplug_context.next_cb_order++;
+
+	/* handle the unlikely case of handle overflow */
+	if (hid_hotplug_context.next_handle < 0)
+	{
+		hid_hotplug_context.next_handle = 1;
+	}
+
+	if (hid_internal_callback_set_build(hid_hotplug_context.callbacks, hotplug_cb, &set) < 0) {
+		/* The monitor may have been started for this callback alone */
+		hid_internal_hotplug_wake();
+		pthread_mutex_unlock(&hid_hotplug_context.mutex);
+		pthread_mutex_unlock(&hotplug_cb->call_lock);
+		hid_internal_callback_unref(hotplug_cb);
+		return -1;
+	}
+
+	/* Return allocated handle */
+	if (callback_handle != NULL) {
+		*callback_handle = hotplug_cb->handle;
+	}
+
+	/* Publish the callback and take the devices to replay while the monitor can't update devs,
+	   so that the callback either finds a device here or gets its event, never both */
+	pthread_rwlock_rdlock(&hid_hotplug_context.devs_lock);
+
+	hid_internal_callback_set_publish(set);
+
+	if ((flags & HID_API_HOTPLUG_ENUMERATE) && (events & HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED)) {
+		/* With the executor running, the replay is queued ahead of the later events */
+		int queue = hid_internal_executor_lock();
+		struct hid_device_info* device = hid_hotplug_context.devs;
+		while (device != NULL) {
+			if (hid_internal_match_device_id(device->vendor_id, device->product_id, hotplug_cb->vendor_id, hotplug_cb->product_id)) {
+				if (queue) {
+					struct hid_hotplug_snapshot *snapshot = NULL;
+					hid_internal_executor_queue(hotplug_cb, device, &snapshot, HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED, 1);
+				}
+				else {
+					/* Copied, so that the callback runs without any lock held */
+					struct hid_device_info *tmp = hid_internal_copy_device_info(device, 1);
+					if (tmp) {
+						if (replay_last) {
+							replay_last->next = tmp;
+						}
+						else {
+							replay = tmp;
+						}
+						replay_last = tmp;
+					}
+				}
+			}
+
+			device = device->next;
+		}
+		if (queue) {
+			pthread_mutex_unlock(&hid_hotplug_executor.mutex);
+		}
+	}
+
+	pthread_rwlock_unlock(&hid_hotplug_context.devs_lock);
+
+	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+
+	/* Notify about already connected devices, if asked so.
+	   The callback may deregister itself or register other callbacks */
+	for (struct hid_device_info *device = replay; device != NULL; device = device->next) {
+		if (__atomic_load_n(&hotplug_cb->removed, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+		(*hotplug_cb->callback)(hotplug_cb->handle, device, HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED, hotplug_cb->user_data);
+	}
+
+	pthread_mutex_unlock(&hotplug_cb->call_lock);
+
+	hid_free_enumeration(replay);
+	hid_internal_callback_unref(hotplug_cb);
+
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_hotplug_deregister_callback(hid_hotplug_callback_handle callback_handle)
+{
+	struct hid_hotplug_callback_set *set;
+	struct hid_hotplug_callback_set *new_set;
+	struct hid_hotplug_callback *callback = NULL;
+
+	if (callback_handle <= 0) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&hid_hotplug_context.mutex);
+
+	set = hid_hotplug_context.callbacks;
+	if (set) {
+		for (size_t i = 0; i < set->num_callbacks; i++) {
+			if (set->callbacks[i]->handle == callback_handle && !set->callbacks[i]->removed) {
+				callback = set->callbacks[i];
+				break;
+			}
+		}
+	}
+
+	if (callback == NULL) {
+		pthread_mutex_unlock(&hid_hotplug_context.mutex);
+		return -1;
+	}
+
+	/* The monitor thread and the other readers may still hold the current set:
+	   mark the callback so that they skip it */
+	__atomic_store_n(&callback->removed, 1, __ATOMIC_RELEASE);
+	hid_internal_executor_cancel(callback);
+
+	/* Without memory for a new set the callback stays in the current one, marked as removed */
+	if (hid_internal_callback_set_build(set, NULL, &new_set) == 0) {
+		hid_internal_callback_set_publish(new_set);
+	}
+
+	/* Stop the monitor if nothing else needs it */
+	if (!hid_internal_hotplug_needed()) {
+		hid_internal_hotplug_wake();
+	}
+
+	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_hidraw_set_enumerate_cache(int enable)
+{
+	int result = 0;
+
+	pthread_mutex_lock(&hid_hotplug_context.mutex);
+
+	__atomic_store_n(&hid_hotplug_context.enumerate_cache, enable ? 1 : 0, __ATOMIC_RELAXED);
+
+	if (enable) {
+		result = hid_internal_hotplug_start_monitor();
+		if (result < 0) {
+			__atomic_store_n(&hid_hotplug_context.enumerate_cache, 0, __ATOMIC_RELAXED);
+		}
+	}
+
+	/* Stop the monitor if nothing else needs it */
+	if (!hid_internal_hotplug_needed()) {
+		hid_internal_hotplug_wake();
+	}
+
+	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+
+	return result;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_hidraw_get_enumerate_cache(void)
+{
+	return __atomic_load_n(&hid_hotplug_context.enumerate_cache, __ATOMIC_RELAXED);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_hidraw_set_hotplug_threads(unsigned int num_threads)
+{
+	if (num_threads > HID_HOTPLUG_MAX_THREADS)
+		num_threads = HID_HOTPLUG_MAX_THREADS;
+
+	/* The events of a callback would be split between the threads and the monitor */
+	pthread_mutex_lock(&hid_hotplug_context.mutex);
+	if (hid_hotplug_context.callbacks != NULL) {
+		pthread_mutex_unlock(&hid_hotplug_context.mutex);
+		return -1;
+	}
+	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+
+	hid_internal_executor_stop(0);
+
+	if (num_threads == 0)
+		return 0;
+
+	return hid_internal_executor_start(num_threads);
+}
+
+unsigned int HID_API_EXPORT HID_API_CALL hid_hidraw_get_hotplug_threads(void)
+{
+	unsigned int num_threads;
+
+	pthread_mutex_lock(&hid_hotplug_executor.mutex);
+	num_threads = hid_hotplug_executor.num_threads;
+	pthread_mutex_unlock(&hid_hotplug_executor.mutex);
+
+	return num_threads;
+}
+
+hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
+{
+	struct hid_device_info *devs, *cur_dev;
+	const char *path_to_open = NULL;
+	hid_device *handle = NULL;
+
+	/* Unless hid_enumerate() is answered from the hotplug device list,
+	   look the device up directly instead of enumerating everything */
+	if (!__atomic_load_n(&hid_hotplug_context.enumerate_cache, __ATOMIC_RELAXED)) {
+		char dev_path[64];
+		int res;
+
+		hid_init();
+		/* register_global_error: global error is reset by hid_init */
+
+		res = find_hidraw_device_sysfs(vendor_id, product_id, serial_number, dev_path, sizeof(dev_path));
+		if (res > 0)
+			return hid_open_path(dev_path);
+		if (res == 0) {
+			register_global_error("Device with requested VID/PID/(SerialNumber) not found");
+			return NULL;
+		}
+		/* /sys/class/hidraw isn't available, fall back to udev */
+	}
+
+	/* register_global_error: global error is reset by hid_enumerate/hid_init */
+	devs = hid_enumerate(vendor_id, product_id);
+	if (devs == NULL) {
+		/* register_global_error: global error is already set by hid_enumerate */
+		return NULL;
+	}
+
+	cur_dev = devs;
+	while (cur_dev) {
+		if (cur_dev->vendor_id == vendor_id &&
+		    cur_dev->product_id == product_id) {
+			if (serial_number) {
+				if (wcscmp(serial_number, cur_dev->serial_number) == 0) {
+					path_to_open = cur_dev->path;
+					break;
+				}
+			}
+			else {
+				path_to_open = cur_dev->path;
+				break;
+			}
+		}
+		cur_dev = cur_dev->next;
+	}
+
+	if (path_to_open) {
+		/* Open the device */
+		handle = hid_open_path(path_to_open);
+	} else {
+		register_global_error("Device with requested VID/PID/(SerialNumber) not found");
+	}
+
+	hid_free_enumeration(devs);
+
+	return handle;
+}
+
+hid_device * HID_API_EXPORT hid_open_path(const char *path)
+{
+	hid_device *dev = NULL;
+
+	hid_init();
+	/* register_global_error: global error is reset by hid_init */
+
+	dev = new_hid_device();
+	if (!dev) {
+		errno = ENOMEM;
+		register_global_error("Couldn't allocate memory");
+		return NULL;
+	}
+
+	dev->device_handle = open(path, O_RDWR | O_CLOEXEC);
+
+	if (dev->device_handle >= 0) {
+		/* Make sure this is a HIDRAW device - responds to HIDIOCGRDESCSIZE.
+		   The descriptor is cached, as it never changes while the device is open. */
+		if (cache_report_descriptor(dev) < 0) {
+			register_global_error_format("ioctl(GRDESCSIZE) error for '%s', not a HIDRAW device?: %ls", path, hid_error(dev));
+			hid_close(dev);
+			return NULL;
+		}
+
+		return dev;
+	}
+	else {
+		/* Unable to open a device. */
+		free(dev);
+		register_global_error_format("Failed to open a device with path '%s': %s", path, strerror(errno));
+		return NULL;
+	}
+}
+
+
+int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t length)
+{
+	int bytes_written;
+
+	if (!data || (length == 0)) {
+		errno = EINVAL;
+		register_device_error_id(dev, HID_ERROR_ZERO_BUFFER, 0);
+		return -1;
+	}
+
+	bytes_written = write(dev->device_handle, data, length);
+
+	if (bytes_written == -1)
+		register_device_error_id(dev, HID_ERROR_ERRNO, errno);
+	else
+		register_device_error_id(dev, HID_ERROR_SUCCESS, 0);
+
+	return bytes_written;
+}
+
+
+/* Current CLOCK_MONOTONIC time, in nanoseconds */
+static uint64_t get_monotonic_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/* Switch the device handle to O_NONBLOCK, so the queued reports can be drained
+   with one read() each and no poll() in between. This is done once, the first
+   time hid_read_batch() is called. From then on, hid_read_timeout() always
+   waits with poll(), also when blocking. */
+static int set_fd_nonblocking(hid_device *dev)
+{
+	int flags;
+
+	if (dev->fd_nonblocking)
+		return 0;
+
+	flags = fcntl(dev->device_handle, F_GETFL);
+	if (flags == -1)
+		return -1;
+
+	if (fcntl(dev->device_handle, F_SETFL, flags | O_NONBLOCK) == -1)
+		return -1;
+
+	dev->fd_nonblocking = 1;
+	return 0;
+}
+
+/* Wait for an Input report to become available.
+   Returns 1 if a report can be read, 0 on timeout and -1 on error. */
+static int wait_for_input(hid_device *dev, int milliseconds)
+{
+	/* Milliseconds is either 0 (non-blocking) or > 0 (contains
+	   a valid timeout), or -1 when the handle itself is non-blocking.
+	   In all cases we want to call poll() and wait for data to arrive.
+	   Don't rely on non-blocking operation (O_NONBLOCK) since some
+	   kernels don't seem to properly report device disconnection
+	   through read() when in non-blocking mode.  */
+	int ret;
+	struct pollfd fds;
+
+	fds.fd = dev->device_handle;
+	fds.events = POLLIN;
+	fds.revents = 0;
+	ret = poll(&fds, 1, milliseconds);
+	if (ret == 0) {
+		/* Timeout */
+		return ret;
+	}
+	if (ret == -1) {
+		/* Error */
+		register_device_read_error_id(dev, HID_ERROR_ERRNO, errno);
+		return ret;
+	}
+
+	/* Check for errors on the file descriptor. This will
+	   indicate a device disconnection. */
+	if (fds.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+		// We cannot use strerror() here as no -1 was returned from poll().
+		errno = EIO;
+		register_device_read_error_id(dev, HID_ERROR_DISCONNECTED, 0);
+		return -1;
+	}
+
+	return 1;
+}
+
+/* Default number of reports the background reader can queue */
+#define HIDRAW_READ_RING_DEFAULT_REPORTS 1024
+
+/* Size of each report in the background reader ring,
+   when the report descriptor has no Input reports */
+#define HIDRAW_READ_RING_DEFAULT_REPORT_SIZE 4096
+
+/* Background reader, see hid_hidraw_enable_read_ring().
+
+   The reader thread is the only producer and hid_read() and friends are
+   the only consumer, so the ring needs no lock: head is only written by
+   the reader thread and tail only by the consumer. Both indexes run
+   freely and are masked with (capacity - 1) to get the slot. */
+struct hidraw_read_ring {
+	int device_handle;
+	size_t capacity; /* number of slots, a power of two */
+	size_t report_size; /* size of each slot, in bytes */
+	unsigned char *data; /* capacity * report_size bytes */
+	size_t *lengths; /* length of the report in each slot */
+	uint64_t *timestamps; /* CLOCK_MONOTONIC time each report was read at */
+	unsigned char *scratch; /* reports dropped because the ring is full are read here */
+
+	size_t head; /* next slot to fill, written by the reader thread */
+	size_t tail; /* next slot to consume, written by the consumer */
+
+	/* Statistics, written by the reader thread */
+	size_t received;
+	size_t dropped;
+	size_t high_watermark;
+
+	/* Set once the reader thread has stopped because of an error */
+	int stopped;
+	enum hid_error_id error_id;
+	int errnum;
+
+	int event_fd; /* readable while the ring has reports, or once the reader has stopped */
+	int stop_fd; /* signalled by hid_close() to stop the reader thread */
+	pthread_t thread;
+};
+
+static void read_ring_stop(struct hidraw_read_ring *ring, enum hid_error_id error_id, int errnum)
+{
+	ring->error_id = error_id;
+	ring->errnum = errnum;
+	__atomic_store_n(&ring->stopped, 1, __ATOMIC_RELEASE);
+	signal_event_fd(ring->event_fd);
+}
+
+static void *read_ring_thread(void *param)
+{
+	struct hidraw_read_ring *ring = (struct hidraw_read_ring *) param;
+	const size_t mask = ring->capacity - 1;
+	size_t head = ring->head;
+	struct pollfd fds[2];
+
+	fds[0].fd = ring->device_handle;
+	fds[0].events = POLLIN;
+	fds[1].fd = ring->stop_fd;
+	fds[1].events = POLLIN;
+
+	for (;;) {
+		size_t published = head;
+		size_t tail;
+
+		fds[0].revents = 0;
+		fds[1].revents = 0;
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			read_ring_stop(ring, HID_ERROR_ERRNO, errno);
+			return NULL;
+		}
+
+		if (fds[1].revents)
+			return NULL;
+
+		if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+			/* This indicates a device disconnection */
+			read_ring_stop(ring, HID_ERROR_DISCONNECTED, 0);
+			return NULL;
+		}
+
+		/* Drain the kernel queue, and publish all the reports at once */
+		for (;;) {
+			int full = (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) == ring->capacity;
+			unsigned char *buffer = full ? ring->scratch : ring->data + (head & mask) * ring->report_size;
+			ssize_t bytes_read = read(ring->device_handle, buffer, ring->report_size);
+
+			if (bytes_read < 0) {
+				if (errno == EAGAIN || errno == EINPROGRESS || errno == EINTR)
+					break;
+				/* Let the consumer have the reports read so far first */
+				__atomic_store_n(&ring->head, head, __ATOMIC_SEQ_CST);
+				read_ring_stop(ring, HID_ERROR_ERRNO, errno);
+				return NULL;
+			}
+
+			__atomic_store_n(&ring->received, ring->received + 1, __ATOMIC_RELAXED);
+			if (full) {
+				/* Like the kernel does, keep the oldest reports */
+				__atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+				continue;
+			}
+
+			ring->lengths[head & mask] = (size_t) bytes_read;
+			ring->timestamps[head & mask] = get_monotonic_time_ns();
+			head++;
+		}
+
+		if (head == published)
+			continue;
+
+		/* The store of head and the load of tail pair up with the store of
+		   tail and the load of head in read_ring_pop(): either the consumer
+		   sees the new reports, or we see that it has drained the ring
+		   and may be waiting on event_fd. */
+		__atomic_store_n(&ring->head, head, __ATOMIC_SEQ_CST);
+		tail = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+		if (tail == published)
+			signal_event_fd(ring->event_fd);
+
+		if (head - tail > ring->high_watermark)
+			__atomic_store_n(&ring->high_watermark, head - tail, __ATOMIC_RELAXED);
+	}
+}
+
+/* Take the oldest report out of the ring, without waiting.
+   Returns the number of bytes copied, or -1 if the ring is empty. */
+static int read_ring_pop(struct hidraw_read_ring *ring, unsigned char *data, size_t length, uint64_t *timestamp_ns)
+{
+	size_t tail = ring->tail;
+	size_t slot = tail & (ring->capacity - 1);
+	size_t bytes_read;
+
+	if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
+		return -1;
+
+	bytes_read = ring->lengths[slot];
+	if (bytes_read > length)
+		bytes_read = length;
+	memcpy(data, ring->data + slot * ring->report_size, bytes_read);
+	if (timestamp_ns)
+		*timestamp_ns = ring->timestamps[slot];
+
+	tail++;
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) == tail) {
+		/* The ring is empty: reset event_fd, and set it again
+		   if more reports were published in the meantime */
+		uint64_t value;
+		ssize_t res;
+		do {
+			res = read(ring->event_fd, &value, sizeof(value));
+		} while (res < 0 && errno == EINTR);
+
+		if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != tail
+		 || __atomic_load_n(&ring->stopped, __ATOMIC_ACQUIRE))
+			signal_event_fd(ring->event_fd);
+	}
+
+	return (int) bytes_read;
+}
+
+/* Register the error which stopped the reader thread as the read error */
+static int read_ring_fail(hid_device *dev)
+{
+	struct hidraw_read_ring *ring = dev->read_ring;
+
+	errno = ring->errnum ? ring->errnum : EIO;
+	register_device_read_error_id(dev, ring->error_id, ring->errnum);
+	return -1;
+}
+
+/* hid_read_timestamped() for a device with the background reader enabled */
+static int read_ring_read(hid_device *dev, unsigned char *data, size_t length, uint64_t *timestamp_ns, int milliseconds)
+{
+	struct hidraw_read_ring *ring = dev->read_ring;
+	uint64_t deadline = 0;
+
+	if (milliseconds > 0)
+		deadline = get_monotonic_time_ns() + (uint64_t) milliseconds * 1000000ULL;
+
+	for (;;) {
+		struct pollfd fds;
+		int bytes_read = read_ring_pop(ring, data, length, timestamp_ns);
+
+		if (bytes_read >= 0)
+			return bytes_read;
+
+		if (__atomic_load_n(&ring->stopped, __ATOMIC_ACQUIRE))
+			return read_ring_fail(dev);
+
+		if (milliseconds > 0) {
+			uint64_t now = get_monotonic_time_ns();
+			if (now >= deadline)
+				return 0;
+			/* Round up, so we don't spin on a sub-millisecond remainder */
+			milliseconds = (int) ((deadline - now + 999999ULL) / 1000000ULL);
+		}
+		else if (milliseconds == 0) {
+			return 0;
+		}
+
+		/* event_fd may be signalled with the ring already drained,
+		   so it is only a hint to try again */
+		fds.fd = ring->event_fd;
+		fds.events = POLLIN;
+		fds.revents = 0;
+		if (poll(&fds, 1, milliseconds) < 0 && errno != EINTR) {
+			register_device_read_error_id(dev, HID_ERROR_ERRNO, errno);
+			return -1;
+		}
+	}
+}
+
+static void read_ring_free(struct hidraw_read_ring *ring)
+{
+	if (ring->stop_fd >= 0)
+		close(ring->stop_fd);
+	if (ring->event_fd >= 0)
+		close(ring->event_fd);
+	free(ring->data);
+	free(ring->lengths);
+	free(ring->timestamps);
+	free(ring->scratch);
+	free(ring);
+}
+
+static void read_ring_destroy(struct hidraw_read_ring *ring)
+{
+	signal_event_fd(ring->stop_fd);
+	pthread_join(ring->thread, NULL);
+	read_ring_free(ring);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_hidraw_enable_read_ring(hid_device *dev, size_t num_reports, size_t report_size)
+{
+	struct hidraw_read_ring *ring;
+	size_t capacity = 1;
+
+	register_device_error(dev, NULL);
+
+	if (dev->read_ring || dev->reactor || dev->uring) {
+		errno = EBUSY;
+		register_device_error(dev, "hid_hidraw_enable_read_ring: the background reader is already enabled, or the device is added to a reactor or an io_uring engine");
+		return -1;
+	}
+
+	if (num_reports == 0)
+		num_reports = HIDRAW_READ_RING_DEFAULT_REPORTS;
+	if (report_size == 0)
+		report_size = dev->report_info.max_input_report_size;
+	if (report_size == 0)
+		report_size = HIDRAW_READ_RING_DEFAULT_REPORT_SIZE;
+
+	/* The indexes are masked, so round up to a power of two */
+	while (capacity < num_reports) {
+		if (capacity > SIZE_MAX / 2) {
+			errno = EINVAL;
+			register_device_error(dev, "hid_hidraw_enable_read_ring: the ring is too large");
+			return -1;
+		}
+		capacity *= 2;
+	}
+
+	if (capacity > SIZE_MAX / report_size) {
+		errno = EINVAL;
+		register_device_error(dev, "hid_hidraw_enable_read_ring: the ring is too large");
+		return -1;
+	}
+
+	/* The reader thread drains all the queued reports on each wakeup */
+	if (set_fd_nonblocking(dev) < 0) {
+		register_device_error_id(dev, HID_ERROR_ERRNO, errno);
+		return -1;
+	}
+
+	ring = (struct hidraw_read_ring *) calloc(1, sizeof(struct hidraw_read_ring));
+	if (ring == NULL) {
+		errno = ENOMEM;
+		register_device_error_id(dev, HID_ERROR_NO_MEMORY, 0);
+		return -1;
+	}
+
+	ring->device_handle = dev->device_handle;
+	ring->capacity = capacity;
+	ring->report_size = report_size;
+	ring->event_fd = -1;
+	ring->stop_fd = -1;
+
+	/* Everything is allocated upfront, the reader thread never allocates */
+	ring->data = (unsigned char *) malloc(capacity * report_size);
+	ring->lengths = (size_t *) calloc(capacity, sizeof(size_t));
+	ring->timestamps = (uint64_t *) calloc(capacity, sizeof(uint64_t));
+	ring->scratch = (unsigned char *) malloc(report_size);
+	if (!ring->data || !ring->lengths || !ring->timestamps || !ring->scratch) {
+		read_ring_free(ring);
+		errno = ENOMEM;
+		register_device_error_id(dev, HID_ERROR_NO_MEMORY, 0);
+		return -1;
+	}
+
+	ring->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	ring->stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (ring->event_fd < 0 || ring->stop_fd < 0) {
+		int err = errno;
+		read_ring_free(ring);
+		register_device_error_id(dev, HID_ERROR_ERRNO, err);
+		errno = err;
+		return -1;
+	}
+
+	errno = pthread_create(&ring->thread, NULL, &read_ring_thread, ring);
+	if (errno != 0) {
+		int err = errno;
+		read_ring_free(ring);
+		register_device_error_id(dev, HID_ERROR_ERRNO, err);
+		errno = err;
+		return -1;
+	}
+
+	dev->read_ring = ring;
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_hidraw_get_read_ring_stats(hid_device *dev, struct hid_hidraw_read_ring_stats *stats)
+{
+	struct hidraw_read_ring *ring = dev->read_ring;
+
+	register_device_error(dev, NULL);
+
+	if (!stats || !ring) {
+		errno = EINVAL;
+		register_device_error(dev, "hid_hidraw_get_read_ring_stats: the background reader is not enabled");
+		return -1;
+	}
+
+	stats->capacity = ring->capacity;
+	stats->queued = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - ring->tail;
+	stats->high_watermark = __atomic_load_n(&ring->high_watermark, __ATOMIC_RELAXED);
+	stats->received = __atomic_load_n(&ring->received, __ATOMIC_RELAXED);
+	stats->dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+/* Read one queued report without waiting, from the background reader
+   if it is enabled, or from the device handle otherwise.
+   Returns -1 with errno set to EAGAIN if no report is queued,
+   and -1 with the read error registered on failure. */
+static ssize_t read_queued_report(hid_device *dev, unsigned char *data, size_t length)
+{
+	ssize_t bytes_read;
+
+	if (dev->read_ring) {
+		bytes_read = read_ring_pop(dev->read_ring, data, length, NULL);
+		if (bytes_read < 0) {
+			if (__atomic_load_n(&dev->read_ring->stopped, __ATOMIC_ACQUIRE))
+				return read_ring_fail(dev);
+			errno = EAGAIN;
+		}
+		return bytes_read;
+	}
+
+	bytes_read = read(dev->device_handle, data, length);
+	if (bytes_read < 0) {
+		if (errno == EAGAIN || errno == EINPROGRESS || errno == EINTR)
+			errno = EAGAIN;
+		else
+			register_device_read_error_id(dev, HID_ERROR_ERRNO, errno);
+	}
+
+	return bytes_read;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_read_timestamped(hid_device *dev, unsigned char *data, size_t length, uint64_t *timestamp_ns, int milliseconds)
+{
+	if (!data || (length == 0)) {
+		errno = EINVAL;
+		register_device_read_error_id(dev, HID_ERROR_ZERO_BUFFER, 0);
+		return -1;
+	}
+
+	/* Set device error to none */
+	register_device_read_error_id(dev, HID_ERROR_SUCCESS, 0);
+
+	/* The reader thread stamps each report as it reads it */
+	if (dev->read_ring)
+		return read_ring_read(dev, data, length, timestamp_ns, milliseconds);
+
+	int bytes_read;
+
+	if (milliseconds >= 0 || dev->fd_nonblocking) {
+		int ret = wait_for_input(dev, milliseconds);
+		if (ret <= 0) {
+			return ret;
+		}
+	}
+
+	bytes_read = read(dev->device_handle, data, length);
+	if (bytes_read < 0) {
+		if (errno == EAGAIN || errno == EINPROGRESS)
+			bytes_read = 0;
+		else
+			register_device_read_error_id(dev, HID_ERROR_ERRNO, errno);
+	}
+	else if (bytes_read > 0 && timestamp_ns) {
+		/* hidraw doesn't keep the arrival time of the reports,
+		   so the closest we can get is the moment read() returns */
+		*timestamp_ns = get_monotonic_time_ns();
+	}
+
+	return bytes_read;
+}
+
+int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+	return hid_read_timestamped(dev, data, length, NULL, milliseconds);
+}
+
+int HID_API_EXPORT hid_read_batch(hid_device *dev, unsigned char *data, size_t stride, size_t max_reports, size_t *lengths, int milliseconds)
+{
+	size_t count = 0;
+
+	if (!data || (stride == 0) || (max_reports == 0) || !lengths) {
+		errno = EINVAL;
+		register_device_read_error_id(dev, HID_ERROR_ZERO_BUFFER, 0);
+		return -1;
+	}
+
+	/* Set device error to none */
+	register_device_read_error_id(dev, HID_ERROR_SUCCESS, 0);
+
+	if (dev->read_ring) {
+		int ret = read_ring_read(dev, data, stride, NULL, milliseconds);
+		if (ret <= 0) {
+			return ret;
+		}
+
+		lengths[count++] = (size_t) ret;
+		while (count < max_reports) {
+			ret = read_ring_pop(dev->read_ring, data + count * stride, stride, NULL);
+			if (ret < 0)
+				break;
+			lengths[count++] = (size_t) ret;
+		}
+
+		return (int) count;
+	}
+
+	if (set_fd_nonblocking(dev) < 0) {
+		register_device_read_error_id(dev, HID_ERROR_ERRNO, errno);
+		return -1;
+	}
+
+	/* Wait only once, for the first report */
+	int ret = wait_for_input(dev, milliseconds);
+	if (ret <= 0) {
+		return ret;
+	}
+
+	/* hidraw returns exactly one report per read(); keep reading
+	   until the kernel queue is empty or the caller's buffer is full. */
+	while (count < max_reports) {
+		ssize_t bytes_read = read(dev->device_handle, data + count * stride, stride);
+		if (bytes_read < 0) {
+			if (errno == EAGAIN || errno == EINPROGRESS || errno == EINTR)
+				break;
+
+			if (count == 0) {
+				register_device_read_error_id(dev, HID_ERROR_ERRNO, errno);
+				return -1;
+			}
+
+			/* Return what we have; the error is reported by the next call */
+			break;
+		}
+
+		lengths[count++] = (size_t) bytes_read;
+	}
+
+	return (int) count;
+}
+
+int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
+{
+	return hid_read_timeout(dev, data, length, (dev->blocking)? -1: 0);
+}
+
+HID_API_EXPORT const wchar_t * HID_API_CALL  hid_read_error(hid_device *dev)
+{
+	return error_to_wchar_t(&dev->last_read_error);
+}
+
+/* hidraw reports POLLIN while the kernel queue has reports, and
+   POLLERR/POLLHUP once the device is disconnected. With the background
+   reader enabled the kernel queue belongs to the reader thread, and its
+   event_fd is readable while the ring has reports or once it has stopped. */
+static int get_pollable_fd(hid_device *dev)
+{
+	if (dev->read_ring)
+		return dev->read_ring->event_fd;
+
+	return dev->device_handle;
+}
+
+/* Size of the reactor's read buffer, when not given by the caller */
+#define HID_REACTOR_DEFAULT_REPORT_SIZE 4096
+
+/* Maximum number of reports read from one device per wakeup,
+   so a single busy device can't starve the others */
+#define HID_REACTOR_MAX_REPORTS_PER_WAKEUP 64
+
+/* Maximum number of epoll events handled per hid_reactor_run() */
+#define HID_REACTOR_MAX_EVENTS 64
+
+struct hid_reactor_entry {
+	hid_device *dev;
+	hid_reactor_callback_fn callback;
+	void *user_data;
+	/* Removed while hid_reactor_run() was dispatching;
+	   freed by hid_reactor_run() before it returns */
+	int removed;
+	struct hid_reactor_entry *next;
+};
+
+struct hid_reactor_ {
+	int epoll_fd;
+	size_t report_size;
+	unsigned char *buffer;
+	int running; /* hid_reactor_run() is dispatching */
+	struct hid_reactor_entry *entries; /* Linked list of the added devices */
+};
+
+static void hid_reactor_detach(hid_reactor *reactor, struct hid_reactor_entry *entry)
+{
+	struct hid_reactor_entry **current;
+
+	epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, get_pollable_fd(entry->dev), NULL);
+	entry->dev->reactor = NULL;
+
+	if (reactor->running) {
+		/* The entry may still be referenced by the events being dispatched */
+		entry->removed = 1;
+		return;
+	}
+
+	for (current = &reactor->entries; *current; current = &(*current)->next) {
+		if (*current == entry) {
+			*current = entry->next;
+			break;
+		}
+	}
+	free(entry);
+}
+
+/* Report the read error to the callback, and remove the device from the reactor */
+static void hid_reactor_fail(hid_reactor *reactor, struct hid_reactor_entry *entry)
+{
+	hid_device *dev = entry->dev;
+	hid_reactor_callback_fn callback = entry->callback;
+	void *user_data = entry->user_data;
+
+	hid_reactor_detach(reactor, entry);
+	callback(dev, NULL, -1, user_data);
+}
+
+hid_reactor * HID_API_EXPORT HID_API_CALL hid_reactor_new(size_t report_size)
+{
+	hid_reactor *reactor;
+
+	register_global_error(NULL);
+
+	if (report_size == 0)
+		report_size = HID_REACTOR_DEFAULT_REPORT_SIZE;
+
+	reactor = (hid_reactor *) calloc(1, sizeof(hid_reactor));
+	if (reactor == NULL) {
+		errno = ENOMEM;
+		register_global_error("Couldn't allocate memory");
+		return NULL;
+	}
+
+	reactor->report_size = report_size;
+	reactor->buffer = (unsigned char *) malloc(report_size);
+	if (reactor->buffer == NULL) {
+		free(reactor);
+		errno = ENOMEM;
+		register_global_error("Couldn't allocate memory");
+		return NULL;
+	}
+
+	reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (reactor->epoll_fd < 0) {
+		register_global_error_format("epoll_create1: %s", strerror(errno));
+		free(reactor->buffer);
+		free(reactor);
+		return NULL;
+	}
+
+	return reactor;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_reactor_add(hid_reactor *reactor, hid_device *dev, hid_reactor_callback_fn callback, void *user_data)
+{
+	struct hid_reactor_entry *entry;
+	struct epoll_event ev;
+
+	register_global_error(NULL);
+
+	if (!reactor || !dev || !callback) {
+		errno = EINVAL;
+		register_global_error("hid_reactor_add: invalid argument");
+		return -1;
+	}
+
+	if (dev->reactor || dev->uring) {
+		errno = EBUSY;
+		register_global_error("hid_reactor_add: the device is already added to a reactor or an io_uring engine");
+		return -1;
+	}
+
+	/* The reactor drains all the queued reports on each wakeup */
+	if (set_fd_nonblocking(dev) < 0) {
+		register_global_error_format("hid_reactor_add: %s", strerror(errno));
+		return -1;
+	}
+
+	entry = (struct hid_reactor_entry *) calloc(1, sizeof(struct hid_reactor_entry));
+	if (entry == NULL) {
+		errno = ENOMEM;
+		register_global_error("Couldn't allocate memory");
+		return -1;
+	}
+
+	entry->dev = dev;
+	entry->callback = callback;
+	entry->user_data = user_data;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = entry;
+	if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, get_pollable_fd(dev), &ev) < 0) {
+		register_global_error_format("epoll_ctl: %s", strerror(errno));
+		free(entry);
+		return -1;
+	}
+
+	entry->next = reactor->entries;
+	reactor->entries = entry;
+	dev->reactor = reactor;
+
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_reactor_remove(hid_reactor *reactor, hid_device *dev)
+{
+	struct hid_reactor_entry *entry;
+
+	if (!reactor || !dev || dev->reactor != reactor) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (entry = reactor->entries; entry; entry = entry->next) {
+		if (entry->dev == dev && !entry->removed) {
+			hid_reactor_detach(reactor, entry);
+			return 0;
+		}
+	}
+
+	errno = EINVAL;
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_reactor_run(hid_reactor *reactor, int milliseconds)
+{
+	struct epoll_event events[HID_REACTOR_MAX_EVENTS];
+	struct hid_reactor_entry **current;
+	int num_events, i, count = 0;
+
+	if (!reactor) {
+		errno = EINVAL;
+		register_global_error("hid_reactor_run: invalid argument");
+		return -1;
+	}
+
+	register_global_error(NULL);
+
+	num_events = epoll_wait(reactor->epoll_fd, events, HID_REACTOR_MAX_EVENTS, milliseconds);
+	if (num_events < 0) {
+		if (errno == EINTR)
+			return 0;
+		register_global_error_format("epoll_wait: %s", strerror(errno));
+		return -1;
+	}
+
+	reactor->running = 1;
+
+	for (i = 0; i < num_events; i++) {
+		struct hid_reactor_entry *entry = (struct hid_reactor_entry *) events[i].data.ptr;
+		hid_device *dev = entry->dev;
+		int n;
+
+		if (entry->removed)
+			continue;
+
+		if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+			/* This indicates a device disconnection */
+			errno = EIO;
+			register_device_read_error_id(dev, HID_ERROR_DISCONNECTED, 0);
+			hid_reactor_fail(reactor, entry);
+			count++;
+			continue;
+		}
+
+		for (n = 0; n < HID_REACTOR_MAX_REPORTS_PER_WAKEUP && !entry->removed; n++) {
+			ssize_t bytes_read = read_queued_report(dev, reactor->buffer, reactor->report_size);
+			if (bytes_read < 0) {
+				if (errno == EAGAIN)
+					break;
+
+				hid_reactor_fail(reactor, entry);
+				count++;
+				break;
+			}
+
+			entry->callback(dev, reactor->buffer, (int) bytes_read, entry->user_data);
+			count++;
+		}
+	}
+
+	reactor->running = 0;
+
+	/* Free the entries removed during the dispatch */
+	current = &reactor->entries;
+	while (*current) {
+		struct hid_reactor_entry *entry = *current;
+		if (entry->removed) {
+			*current = entry->next;
+			free(entry);
+		}
+		else {
+			current = &entry->next;
+		}
+	}
+
+	return count;
+}
+
+void HID_API_EXPORT HID_API_CALL hid_reactor_free(hid_reactor *reactor)
+{
+	if (!reactor)
+		return;
+
+	while (reactor->entries) {
+		hid_reactor_detach(reactor, reactor->entries);
+	}
+
+	close(reactor->epoll_fd);
+	free(reactor->buffer);
+	free(reactor);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_get_pollable_fd(hid_device *dev)
+{
+	register_device_error(dev, NULL);
+
+	return get_pollable_fd(dev);
+}
+
+int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
+{
+	/* Do all non-blocking in userspace using poll(), since it looks
+	   like there's a bug in the kernel in some versions where
+	   read() will not return -1 on disconnection of the USB device */
+
+	dev->blocking = !nonblock;
+	return 0; /* Success */
+}
+
+int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length)
+{
+	int res;
+
+	if (!data || (length == 0)) {
+		errno = EINVAL;
+		register_device_error_id(dev, HID_ERROR_ZERO_BUFFER, 0);
+		return -1;
+	}
+
+	register_device_error(dev, NULL);
+
+	res = ioctl(dev->device_handle, HIDIOCSFEATURE(length), data);
+	if (res < 0)
+		register_device_error_id(dev, HID_ERROR_IOCTL_SFEATURE, errno);
+
+	return res;
+}
+
+int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data, size_t length)
+{
+	int res;
+
+	if (!data || (length == 0)) {
+		errno = EINVAL;
+		register_device_error_id(dev, HID_ERROR_ZERO_BUFFER, 0);
+		return -1;
+	}
+
+	register_device_error(dev, NULL);
+
+	res = ioctl(dev->device_handle, HIDIOCGFEATURE(length), data);
+	if (res < 0)
+		register_device_error_id(dev, HID_ERROR_IOCTL_GFEATURE, errno);
+
+	return res;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_send_output_report(hid_device *dev, const unsigned char *data, size_t length)
+{
+	int res;
+
+	if (!data || (length == 0)) {
+		errno = EINVAL;
+		register_device_error_id(dev, HID_ERROR_ZERO_BUFFER, 0);
+		return -1;
+	}
+
+	register_device_error(dev, NULL);
+
+	res = ioctl(dev->device_handle, HIDIOCSOUTPUT(length), data);
+	if (res < 0)
+		register_device_error_id(dev, HID_ERROR_IOCTL_SOUTPUT, errno);
+
+	return res;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_get_input_report(hid_device *dev, unsigned char *data, size_t length)
+{
+	int res;
+
+	if (!data || (length == 0)) {
+		errno = EINVAL;
+		register_device_error_id(dev, HID_ERROR_ZERO_BUFFER, 0);
+		return -1;
+	}
+
+	register_device_error(dev, NULL);
+
+	res = ioctl(dev->device_handle, HIDIOCGINPUT(length), data);
+	if (res < 0)
+		register_device_error_id(dev, HID_ERROR_IOCTL_GINPUT, errno);
+
+	return res;
+}
+
+void HID_API_EXPORT hid_close(hid_device *dev)
+{
+	if (!dev)
+		return;
+
+	if (dev->uring)
+		hid_hidraw_uring_remove_device(dev->uring, dev);
+	if (dev->reactor)
+		hid_reactor_remove(dev->reactor, dev);
+	if (dev->read_ring)
+		read_ring_destroy(dev->read_ring);
+
+	close(dev->device_handle);
+
+	hid_free_enumeration(dev->device_info);
+	hid_free_enumeration_utf8(dev->device_info_utf8);
+
+	free(dev->report_descriptor);
+	free(dev->usages);
+	free(dev);
+}
+
+
+int HID_API_EXPORT_CALL hid_get_manufacturer_string(hid_device *dev, wchar_t *string, size_t maxlen)
+{
+	if (!string || !maxlen) {
+		errno = EINVAL;
+		register_device_error_id(dev, HID_ERROR_ZERO_BUFFER, 0);
+		return -1;
+	}
+
+	struct hid_device_info *info = hid_get_device_info(dev);
+	if (!info) {
+		// hid_get_device_info will have set an error already
+		return -1;
+	}
+
+	if (info->manufacturer_string) {
+		wcsncpy(string, info->manufacturer_string, maxlen);
+		string[maxlen - 1] = L'\0';
+	}
+	else {
+		string[0] = L'\0';
+	}
+
+	return 0;
+}
+
+int HID_API_EXPORT_CALL hid_get_product_string(hid_device *dev, wchar_t *string, size_t maxlen)
+{
+	if (!string || !maxlen) {
+		errno = EINVAL;
+		register_device_error_id(dev, HID_ERROR_ZERO_BUFFER, 0);
+		return -1;
+	}
+
+	struct hid_device_info *info = hid_get_device_info(dev);
+	if (!info) {
+		// hid_get_device_info will have set an error already
+		return -1;
+	}
+
+	if (info->product_string) {
+		wcsncpy(string, info->product_string, maxlen);
+		string[maxlen - 1] = L'\0';
+	}
+	else {
+		string[0] = L'\0';
+	}
+
+	return 0;
+}
+
+int HID_API_EXPORT_CALL hid_get_serial_number_string(hid_device *dev, wchar_t *string, size_t maxlen)
+{
+	if (!string || !maxlen) {
+		errno = EINVAL;
+		register_device_error_id(dev, HID_ERROR_ZERO_BUFFER, 0);
+		return -1;
+	}
+
+	struct hid_device_info *info = hid_get_device_info(dev);
+	if (!info) {
+		// hid_get_device_info will have set an error already
+		return -1;
+	}
+
+	if (info->serial_number) {
+		wcsncpy(string, info->serial_number, maxlen);
+		string[maxlen - 1] = L'\0';
 	}
+	else {
+		string[0] = L'\0';
+	}
+
+	return 0;
 }
 
-static void hid_internal_invoke_callbacks(struct hid_device_info *info, hid_hotplug_event event)
-{
-	pthread_mutex_lock(&hid_hotplug_context.mutex);
-	hid_hotplug_context.mutex_in_use = 1;
 
-	struct hid_hotplug_callback **current = &hid_hotplug_context.hotplug_cbs;
-	while (*current) {
-		struct hid_hotplug_callback *callback = *current;
-		if ((callback->events & event) && hid_internal_match_device_id(info->vendor_id, info->product_id,
-																	   callback->vendor_id, callback->product_id)) {
-			int result = callback->callback(callback->handle, info, event, callback->user_data);
-			/* If the result is non-zero, we mark the callback for removal and proceed */
-			if (result) {
-				(*current)->events = 0;
-				hid_hotplug_context.cb_list_dirty = 1;
-				continue;
-			}
-		}
-		current = &callback->next;
+HID_API_EXPORT struct hid_device_info *HID_API_CALL hid_get_device_info(hid_device *dev) {
+	if (dev->device_info) {
+		register_device_error(dev, NULL);
+	}
+	else {
+		// Lazy initialize device_info
+		dev->device_info = create_device_info_for_hid_device(dev);
 	}
 
-	hid_hotplug_context.mutex_in_use = 0;
-	hid_internal_hotplug_remove_postponed();
-	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+	// create_device_info_for_hid_device will set an error if needed
+	return dev->device_info;
 }
 
-static int match_udev_to_info(struct udev_device* raw_dev, struct hid_device_info *info)
+int HID_API_EXPORT_CALL hid_get_indexed_string(hid_device *dev, int string_index, wchar_t *string, size_t maxlen)
 {
-	const char *path = udev_device_get_devnode(raw_dev);
-	if (!strcmp(path, info->path)) {
-		return 1;
-	}
-	return 0;
+	(void)string_index;
+	(void)string;
+	(void)maxlen;
+
+	errno = ENOSYS;
+	register_device_error(dev, "hid_get_indexed_string: not supported by hidraw");
+
+	return -1;
 }
 
-static void* hotplug_thread(void* user_data)
+/* The device info with UTF-8 strings, built on the first call.
+   The strings are read with the hidraw ioctls when possible,
+   and converted from hid_get_device_info() otherwise. */
+static struct hid_device_info_utf8 *get_device_info_utf8(hid_device *dev)
 {
-	(void) user_data;
+	struct stat s;
 
-	/* Note: the cleanup sequence is always executed with the mutex locked, so we shoud never lock the mutex without checking if we need to stop */
+	if (dev->device_info_utf8) {
+		register_device_error(dev, NULL);
+		return dev->device_info_utf8;
+	}
 
-	while (hid_hotplug_context.monitor_fd > 0) {
-		fd_set fds;
-		struct timeval tv;
-		int ret;
+	if (fstat(dev->device_handle, &s) == 0)
+		dev->device_info_utf8 = create_device_info_utf8_from_hidraw(dev, s.st_rdev);
 
-		/* On every iteration, check if we still have any callbacks left and leave if none are left */
-		/* NOTE: the check is performed UNLOCKED and the value CAN change in the background */
-		if (!hid_hotplug_context.hotplug_cbs) {
-			break;
+	if (!dev->device_info_utf8) {
+		struct hid_device_info *info = hid_get_device_info(dev);
+		if (!info) {
+			// hid_get_device_info will have set an error already
+			return NULL;
 		}
 
-		FD_ZERO(&fds);
-		FD_SET(hid_hotplug_context.monitor_fd, &fds);
-		/* 5 msec timeout seems reasonable; don't set too low to avoid high CPU usage */
-		/* This timeout only affects how much time it takes to stop the thread */
-		tv.tv_sec = 0;
-		tv.tv_usec = 5000;
-
-		ret = select(hid_hotplug_context.monitor_fd+1, &fds, NULL, NULL, &tv);
-
-		/* An extra check, just in case within those 5msec the thread was told to stop */
-		if (!hid_hotplug_context.hotplug_cbs) {
-			break;
+		dev->device_info_utf8 = hid_internal_convert_device_infos(info);
+		if (!dev->device_info_utf8) {
+			errno = ENOMEM;
+			register_device_error(dev, "Couldn't create hid_device_info");
+			return NULL;
 		}
+	}
 
-		/* Check if our file descriptor has received data. */
-		if (ret > 0 && FD_ISSET(hid_hotplug_context.monitor_fd, &fds)) {
+	register_device_error(dev, NULL);
+	return dev->device_info_utf8;
+}
 
-			/* Make the call to receive the device.
-			   select() ensured that this will not block. */
-			struct udev_device *raw_dev = udev_monitor_receive_device(hid_hotplug_context.mon);
-			if (raw_dev) {
-				pthread_mutex_lock(&hid_hotplug_context.mutex);
-				const char* action = udev_device_get_action(raw_dev);
-				if (!strcmp(action, "add")) {
-					// We create a list of all usages on this UDEV device
-					struct hid_device_info *info = create_device_info_for_device(raw_dev);
-					struct hid_device_info *info_cur = info;
-					while (info_cur) {
-						/* For each device, call all matching callbacks */
-						/* TODO: possibly make the `next` field NULL to match the behavior on other systems */
-						hid_internal_invoke_callbacks(info_cur, HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED);
-						info_cur = info_cur->next;
-					}
+int HID_API_EXPORT_CALL hid_get_manufacturer_string_utf8(hid_device *dev, char *string, size_t maxlen)
+{
+	if (!string || !maxlen) {
+		errno = EINVAL;
+		register_device_error_id(dev, HID_ERROR_ZERO_BUFFER, 0);
+		return -1;
+	}
 
-					/* Append all we got to the end of the device list */
-					if (info) {
-						if (hid_hotplug_context.devs != NULL) {
-							struct hid_device_info *last = hid_hotplug_context.devs;
-							while (last->next != NULL) {
-								last = last->next;
-							}
-							last->next = info;
-						} else {
-							hid_hotplug_context.devs = info;
-						}
-					}
-				} else if (!strcmp(action, "remove")) {
-					for (struct hid_device_info **current = &hid_hotplug_context.devs; *current;) {
-						struct hid_device_info* info = *current;
-						if (match_udev_to_info(raw_dev, *current)) {
-							/* If the libusb device that's left matches this HID device, we detach it from the list */
-							*current = (*current)->next;
-							info->next = NULL;
-							hid_internal_invoke_callbacks(info, HID_API_HOTPLUG_EVENT_DEVICE_LEFT);
-							/* Free every removed device */
-							hid_free_enumeration(info);
-						} else {
-							current = &info->next;
-						}
-					}
-				}
-				udev_device_unref(raw_dev);
-				pthread_mutex_unlock(&hid_hotplug_context.mutex);
-			}
-		}
+	struct hid_device_info_utf8 *info = get_device_info_utf8(dev);
+	if (!info) {
+		return -1;
 	}
 
-	/* Cleanup connected device list */
-	hid_free_enumeration(hid_hotplug_context.devs);
-	hid_hotplug_context.devs = NULL;
-	/* Disarm the udev monitor */
-	udev_monitor_unref(hid_hotplug_context.mon);
-	udev_unref(hid_hotplug_context.udev_ctx);
+	copy_utf8_string(string, maxlen, info->manufacturer_string);
 
-	return NULL;
+	return 0;
 }
 
-int HID_API_EXPORT HID_API_CALL hid_hotplug_register_callback(unsigned short vendor_id, unsigned short product_id, int events, int flags, hid_hotplug_callback_fn callback, void *user_data, hid_hotplug_callback_handle *callback_handle)
+int HID_API_EXPORT_CALL hid_get_product_string_utf8(hid_device *dev, char *string, size_t maxlen)
 {
-	struct hid_hotplug_callback* hotplug_cb;
+	if (!string || !maxlen) {
+		errno = EINVAL;
+		register_device_error_id(dev, HID_ERROR_ZERO_BUFFER, 0);
+		return -1;
+	}
 
-	/* Check params */
-	if (events == 0
-		|| (events & ~(HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED | HID_API_HOTPLUG_EVENT_DEVICE_LEFT))
-		|| (flags & ~(HID_API_HOTPLUG_ENUMERATE))
-		|| callback == NULL) {
+	struct hid_device_info_utf8 *info = get_device_info_utf8(dev);
+	if (!info) {
 		return -1;
 	}
 
-	hotplug_cb = (struct hid_hotplug_callback*)calloc(1, sizeof(struct hid_hotplug_callback));
+	copy_utf8_string(string, maxlen, info->product_string);
 
-	if (hotplug_cb == NULL) {
+	return 0;
+}
+
+int HID_API_EXPORT_CALL hid_get_serial_number_string_utf8(hid_device *dev, char *string, size_t maxlen)
+{
+	if (!string || !maxlen) {
+		errno = EINVAL;
+		register_device_error_id(dev, HID_ERROR_ZERO_BUFFER, 0);
 		return -1;
 	}
 
-	/* Fill out the record */
-	hotplug_cb->next = NULL;
-	hotplug_cb->vendor_id = vendor_id;
-	hotplug_cb->product_id = product_id;
-	hotplug_cb->events = events;
-	hotplug_cb->user_data = user_data;
-	hotplug_cb->callback = callback;
+	struct hid_device_info_utf8 *info = get_device_info_utf8(dev);
+	if (!info) {
+		return -1;
+	}
 
-	/* Ensure we are ready to actually use the mutex */
-	hid_internal_hotplug_init();
+	copy_utf8_string(string, maxlen, info->serial_number);
 
-	/* Lock the mutex to avoid race conditions */
-	pthread_mutex_lock(&hid_hotplug_context.mutex);
+	return 0;
+}
 
-	hotplug_cb->handle = hid_hotplug_context.next_handle++;
+int HID_API_EXPORT_CALL hid_get_indexed_string_utf8(hid_device *dev, int string_index, char *string, size_t maxlen)
+{
+	(void)string_index;
+	(void)string;
+	(void)maxlen;
 
-	/* handle the unlikely case of handle overflow */
-	if (hid_hotplug_context.next_handle < 0)
-	{
-		hid_hotplug_context.next_handle = 1;
-	}
+	errno = ENOSYS;
+	register_device_error(dev, "hid_get_indexed_string_utf8: not supported by hidraw");
 
-	/* Return allocated handle */
-	if (callback_handle != NULL) {
-		*callback_handle = hotplug_cb->handle;
-	}
+	return -1;
+}
 
-	/* Append a new callback to the end */
-	if (hid_hotplug_context.hotplug_cbs != NULL) {
-		struct hid_hotplug_callback *last = hid_hotplug_context.hotplug_cbs;
-		while (last->next != NULL) {
-			last = last->next;
-		}
-		last->next = hotplug_cb;
-	}
-	else {
-		// Prepare a UDEV context to run monitoring on
-		hid_hotplug_context.udev_ctx = udev_new();
-		if (!hid_hotplug_context.udev_ctx)
-		{
-			pthread_mutex_unlock(&hid_hotplug_context.mutex);
-			return -1;
-		}
 
-		hid_hotplug_context.mon = udev_monitor_new_from_netlink(hid_hotplug_context.udev_ctx, "udev");
-		udev_monitor_filter_add_match_subsystem_devtype(hid_hotplug_context.mon, "hidraw", NULL);
-		udev_monitor_enable_receiving(hid_hotplug_context.mon);
-		hid_hotplug_context.monitor_fd = udev_monitor_get_fd(hid_hotplug_context.mon);
+int HID_API_EXPORT_CALL hid_get_report_descriptor(hid_device *dev, unsigned char *buf, size_t buf_size)
+{
+	const struct hidraw_report_descriptor *rpt_desc = dev->report_descriptor;
+	struct hidraw_report_descriptor read_desc;
 
-		/* After monitoring is all set up, enumerate all devices */
-		hid_hotplug_context.devs = hid_enumerate(0, 0);
+	if (!buf || !buf_size) {
+		errno = EINVAL;
+		register_device_error_id(dev, HID_ERROR_ZERO_BUFFER, 0);
+		return -1;
+	}
 
-		/* Don't forget to actually register the callback */
-		hid_hotplug_context.hotplug_cbs = hotplug_cb;
+	register_device_error(dev, NULL);
 
-		/* Start the thread that will be doing the event scanning */
-		pthread_create(&hid_hotplug_context.thread, NULL, &hotplug_thread, NULL);
-	}
+	/* Cached by hid_open_path(), unless it couldn't be read then */
+	if (!rpt_desc) {
+		if (get_hid_report_descriptor_from_hidraw(dev, &read_desc) < 0) {
+			struct stat s;
+			char sysfs_path[64];
+			int err = errno;
 
-	/* Mark the mutex as IN USE, to prevent callback removal from inside a callback */
-	unsigned char old_state = hid_hotplug_context.mutex_in_use;
-	hid_hotplug_context.mutex_in_use = 1;
-	
-	if ((flags & HID_API_HOTPLUG_ENUMERATE) && (events & HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED)) {
-		struct hid_device_info* device = hid_hotplug_context.devs;
-		/* Notify about already connected devices, if asked so */
-		while (device != NULL) {
-			if (hid_internal_match_device_id(device->vendor_id, device->product_id, hotplug_cb->vendor_id, hotplug_cb->product_id)) {
-				(*hotplug_cb->callback)(hotplug_cb->handle, device, HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED, hotplug_cb->user_data);
+			/* Error already registered, try sysfs before reporting it */
+			if (fstat(dev->device_handle, &s) < 0) {
+				errno = err;
+				return -1;
 			}
-
-			device = device->next;
+			snprintf(sysfs_path, sizeof(sysfs_path), "/sys/dev/char/%u:%u", major(s.st_rdev), minor(s.st_rdev));
+			if (get_hid_report_descriptor_from_sysfs(sysfs_path, &read_desc) < 0) {
+				errno = err;
+				return -1;
+			}
+			register_device_error(dev, NULL);
 		}
+		rpt_desc = &read_desc;
 	}
 
-	hid_hotplug_context.mutex_in_use = old_state;
+	if (rpt_desc->size < buf_size) {
+		buf_size = (size_t) rpt_desc->size;
+	}
 
-	hid_internal_hotplug_cleanup();
+	memcpy(buf, rpt_desc->value, buf_size);
 
-	pthread_mutex_unlock(&hid_hotplug_context.mutex);
-	
-	return 0;
+	return (int) buf_size;
 }
 
-int HID_API_EXPORT HID_API_CALL hid_hotplug_deregister_callback(hid_hotplug_callback_handle callback_handle)
+const struct hid_hidraw_report_info * HID_API_EXPORT HID_API_CALL hid_hidraw_get_report_info(hid_device *dev)
 {
-	if (!hid_hotplug_context.mutex_ready || callback_handle <= 0) {
-		return -1;
+	if (!dev->report_descriptor) {
+		errno = EIO;
+		register_device_error(dev, "hid_hidraw_get_report_info: the report descriptor couldn't be read when the device was opened");
+		return NULL;
 	}
 
-	pthread_mutex_lock(&hid_hotplug_context.mutex);
+	register_device_error(dev, NULL);
 
-	if (hid_hotplug_context.hotplug_cbs == NULL) {
-		pthread_mutex_unlock(&hid_hotplug_context.mutex);
-		return -1;
-	}
+	return &dev->report_info;
+}
 
-	int result = -1;
 
-	/* Remove this notification */
-	for (struct hid_hotplug_callback **current = &hid_hotplug_context.hotplug_cbs; *current != NULL; current = &(*current)->next) {
-		if ((*current)->handle == callback_handle) {
-			/* Check if we were already in a locked state, as we are NOT allowed to remove any callbacks if we are */
-			if (hid_hotplug_context.mutex_in_use) {
-				(*current)->events = 0;
-				hid_hotplug_context.cb_list_dirty = 1;
-			} else {
-				struct hid_hotplug_callback *next = (*current)->next;
-				free(*current);
-				*current = next;
-			}
-			result = 0;
-			break;
-		}
-	}
+#ifdef HIDAPI_HAVE_LIBURING
 
-	hid_internal_hotplug_cleanup();
+/* Size of a read buffer of the io_uring engine, when not given by the caller */
+#define HIDRAW_URING_DEFAULT_REPORT_SIZE 4096
 
-	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+/* Upper bound for the submission queue size, the queue is flushed when full */
+#define HIDRAW_URING_MAX_ENTRIES 4096
 
-	return result;
-}
+enum hidraw_uring_op_kind {
+	HIDRAW_URING_OP_POLL,
+	HIDRAW_URING_OP_READ,
+	HIDRAW_URING_OP_WRITE
+};
 
-hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
-{
-	struct hid_device_info *devs, *cur_dev;
-	const char *path_to_open = NULL;
-	hid_device *handle = NULL;
+struct hidraw_uring_slot;
 
-	/* register_global_error: global error is reset by hid_enumerate/hid_init */
-	devs = hid_enumerate(vendor_id, product_id);
-	if (devs == NULL) {
-		/* register_global_error: global error is already set by hid_enumerate */
-		return NULL;
-	}
+/* The user_data of each submitted request; tells what a completion belongs to.
+   Cancellation requests have NULL user_data. */
+struct hidraw_uring_op {
+	enum hidraw_uring_op_kind kind;
+	struct hidraw_uring_slot *slot;
+};
 
-	cur_dev = devs;
-	while (cur_dev) {
-		if (cur_dev->vendor_id == vendor_id &&
-		    cur_dev->product_id == product_id) {
-			if (serial_number) {
-				if (wcscmp(serial_number, cur_dev->serial_number) == 0) {
-					path_to_open = cur_dev->path;
-					break;
-				}
-			}
-			else {
-				path_to_open = cur_dev->path;
-				break;
-			}
-		}
-		cur_dev = cur_dev->next;
-	}
+struct hidraw_uring_slot {
+	struct hidraw_uring_op poll_op;
+	struct hidraw_uring_op read_op;
+	hid_device *dev; /* NULL when the slot is not in use */
+	hid_hidraw_uring_callback_fn callback;
+	void *user_data;
+	unsigned char *buffer;
+	int read_armed; /* the read is in flight, so the slot can't be reused yet */
+	unsigned int generation; /* incremented each time a device is removed */
+};
 
-	if (path_to_open) {
-		/* Open the device */
-		handle = hid_open_path(path_to_open);
-	} else {
-		register_global_error("Device with requested VID/PID/(SerialNumber) not found");
-	}
+struct hidraw_uring_write {
+	struct hidraw_uring_op op; /* must be the first member */
+	hid_device *dev;
+	unsigned int generation; /* slot->generation when the write was queued */
+	size_t length;
+	unsigned char data[];
+};
 
-	hid_free_enumeration(devs);
+struct hid_hidraw_uring_ {
+	struct io_uring ring;
+	struct hidraw_uring_slot *slots;
+	unsigned int num_slots;
+	size_t report_size;
+	unsigned char *buffers; /* num_slots * report_size bytes, one buffer per slot */
+	int fixed_buffers; /* buffers are registered with the kernel */
+	unsigned int num_inflight; /* reads and writes which are not completed yet */
+};
 
-	return handle;
+static struct io_uring_sqe *hidraw_uring_get_sqe(hid_hidraw_uring *ring)
+{
+	struct io_uring_sqe *sqe = io_uring_get_sqe(&ring->ring);
+	if (sqe == NULL) {
+		/* The submission queue is full - flush it */
+		io_uring_submit(&ring->ring);
+		sqe = io_uring_get_sqe(&ring->ring);
+	}
+	return sqe;
 }
 
-hid_device * HID_API_EXPORT hid_open_path(const char *path)
+static int hidraw_uring_arm_read(hid_hidraw_uring *ring, struct hidraw_uring_slot *slot)
 {
-	hid_device *dev = NULL;
+	struct io_uring_sqe *sqe;
+	int fd = slot->dev->device_handle;
 
-	hid_init();
-	/* register_global_error: global error is reset by hid_init */
-
-	dev = new_hid_device();
-	if (!dev) {
-		errno = ENOMEM;
-		register_global_error("Couldn't allocate memory");
-		return NULL;
+	if (io_uring_sq_space_left(&ring->ring) < 2)
+		io_uring_submit(&ring->ring);
+	if (io_uring_sq_space_left(&ring->ring) < 2) {
+		errno = EBUSY;
+		return -1;
 	}
 
-	dev->device_handle = open(path, O_RDWR | O_CLOEXEC);
-
-	if (dev->device_handle >= 0) {
-		int res, desc_size = 0;
+	/* Wait for a report with a poll first, linked to the read,
+	   so the read never blocks an io_uring worker thread,
+	   regardless of the O_NONBLOCK state of the file descriptor. */
+	sqe = io_uring_get_sqe(&ring->ring);
+	io_uring_prep_poll_add(sqe, fd, POLLIN);
+	io_uring_sqe_set_data(sqe, &slot->poll_op);
+	io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+
+	sqe = io_uring_get_sqe(&ring->ring);
+	if (ring->fixed_buffers)
+		io_uring_prep_read_fixed(sqe, fd, slot->buffer, (unsigned) ring->report_size, 0, 0);
+	else
+		io_uring_prep_read(sqe, fd, slot->buffer, (unsigned) ring->report_size, 0);
+	io_uring_sqe_set_data(sqe, &slot->read_op);
 
-		/* Make sure this is a HIDRAW device - responds to HIDIOCGRDESCSIZE */
-		res = ioctl(dev->device_handle, HIDIOCGRDESCSIZE, &desc_size);
-		if (res < 0) {
-			register_global_error_format("ioctl(GRDESCSIZE) error for '%s', not a HIDRAW device?: %s", path, strerror(errno));
-			hid_close(dev);
-			return NULL;
-		}
+	slot->read_armed = 1;
+	ring->num_inflight++;
 
-		return dev;
-	}
-	else {
-		/* Unable to open a device. */
-		free(dev);
-		register_global_error_format("Failed to open a device with path '%s': %s", path, strerror(errno));
-		return NULL;
-	}
+	return 0;
 }
 
-
-int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t length)
+static void hidraw_uring_cancel(hid_hidraw_uring *ring, struct hidraw_uring_op *op)
 {
-	int bytes_written;
+	struct io_uring_sqe *sqe = hidraw_uring_get_sqe(ring);
+	if (sqe == NULL) {
+		/* The request completes eventually, and gets discarded */
+		return;
+	}
 
-	if (!data || (length == 0)) {
-		errno = EINVAL;
-		register_device_error(dev, "Zero buffer/length");
-		return -1;
+	io_uring_prep_cancel(sqe, op, 0);
+	io_uring_sqe_set_data(sqe, NULL);
+}
+
+static void hidraw_uring_release_slot(hid_hidraw_uring *ring, struct hidraw_uring_slot *slot)
+{
+	slot->dev->uring = NULL;
+	slot->dev = NULL;
+	slot->callback = NULL;
+	slot->user_data = NULL;
+	slot->generation++;
+
+	if (slot->read_armed) {
+		/* Cancelling the poll cancels the linked read as well,
+		   unless the poll has completed already */
+		hidraw_uring_cancel(ring, &slot->poll_op);
+		hidraw_uring_cancel(ring, &slot->read_op);
 	}
+}
 
-	bytes_written = write(dev->device_handle, data, length);
+/* Remove the device from the engine and report the read error to the callback */
+static void hidraw_uring_fail_read(hid_hidraw_uring *ring, struct hidraw_uring_slot *slot, int err)
+{
+	hid_device *dev = slot->dev;
+	hid_hidraw_uring_callback_fn callback = slot->callback;
+	void *user_data = slot->user_data;
 
-	register_device_error(dev, (bytes_written == -1)? strerror(errno): NULL);
+	errno = err;
+	register_device_read_error_id(dev, HID_ERROR_ERRNO, err);
 
-	return bytes_written;
-}
+	hidraw_uring_release_slot(ring, slot);
 
+	callback(dev, HID_HIDRAW_URING_READ, NULL, -1, user_data);
+}
 
-int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+/* Handle a single completion. Returns 1 if a callback was invoked, 0 otherwise. */
+static int hidraw_uring_complete(hid_hidraw_uring *ring, struct hidraw_uring_op *op, int res)
 {
-	if (!data || (length == 0)) {
-		errno = EINVAL;
-		register_error_str(&dev->last_read_error_str, "Zero buffer/length");
-		return -1;
+	struct hidraw_uring_slot *slot;
+
+	if (op == NULL) {
+		/* A cancellation request */
+		return 0;
 	}
 
-	/* Set device error to none */
-	register_error_str(&dev->last_read_error_str, NULL);
+	slot = op->slot;
 
-	int bytes_read;
+	switch (op->kind) {
+	case HIDRAW_URING_OP_POLL:
+		/* The linked read reports the result */
+		return 0;
 
-	if (milliseconds >= 0) {
-		/* Milliseconds is either 0 (non-blocking) or > 0 (contains
-		   a valid timeout). In both cases we want to call poll()
-		   and wait for data to arrive.  Don't rely on non-blocking
-		   operation (O_NONBLOCK) since some kernels don't seem to
-		   properly report device disconnection through read() when
-		   in non-blocking mode.  */
-		int ret;
-		struct pollfd fds;
+	case HIDRAW_URING_OP_READ: {
+		hid_device *dev = slot->dev;
 
-		fds.fd = dev->device_handle;
-		fds.events = POLLIN;
-		fds.revents = 0;
-		ret = poll(&fds, 1, milliseconds);
-		if (ret == 0) {
-			/* Timeout */
-			return ret;
-		}
-		if (ret == -1) {
-			/* Error */
-			register_error_str(&dev->last_read_error_str, strerror(errno));
-			return ret;
+		ring->num_inflight--;
+		slot->read_armed = 0;
+
+		if (dev == NULL) {
+			/* The device was removed while the read was in flight */
+			return 0;
 		}
-		else {
-			/* Check for errors on the file descriptor. This will
-			   indicate a device disconnection. */
-			if (fds.revents & (POLLERR | POLLHUP | POLLNVAL)) {
-				// We cannot use strerror() here as no -1 was returned from poll().
-				errno = EIO;
-				register_error_str(&dev->last_read_error_str, "hid_read_timeout: unexpected poll error (device disconnected)");
-				return -1;
-			}
+
+		if (res < 0) {
+			/* -ECANCELED here means the poll failed */
+			hidraw_uring_fail_read(ring, slot, -res);
+			return 1;
 		}
-	}
 
-	bytes_read = read(dev->device_handle, data, length);
-	if (bytes_read < 0) {
-		if (errno == EAGAIN || errno == EINPROGRESS)
-			bytes_read = 0;
-		else
-			register_error_str(&dev->last_read_error_str, strerror(errno));
+		slot->callback(dev, HID_HIDRAW_URING_READ, slot->buffer, res, slot->user_data);
+
+		/* The callback may have removed the device, or removed it and
+		   added another one (which arms its own read) to this slot */
+		if (slot->dev != NULL && !slot->read_armed) {
+			if (hidraw_uring_arm_read(ring, slot) < 0)
+				hidraw_uring_fail_read(ring, slot, errno);
+		}
+		return 1;
 	}
 
-	return bytes_read;
-}
+	case HIDRAW_URING_OP_WRITE: {
+		struct hidraw_uring_write *write_op = (struct hidraw_uring_write *) op;
+		hid_device *dev = write_op->dev;
+		int invoked = 0;
 
-int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
-{
-	return hid_read_timeout(dev, data, length, (dev->blocking)? -1: 0);
-}
+		ring->num_inflight--;
 
-HID_API_EXPORT const wchar_t * HID_API_CALL  hid_read_error(hid_device *dev)
-{
-	if (dev->last_read_error_str == NULL)
-		return L"Success";
-	return dev->last_read_error_str;
-}
+		/* Don't report writes of devices which are no longer part of the engine */
+		if (slot->dev == dev && slot->generation == write_op->generation) {
+			if (res < 0) {
+				errno = -res;
+				register_device_error_id(dev, HID_ERROR_ERRNO, -res);
+			}
+			slot->callback(dev, HID_HIDRAW_URING_WRITE, write_op->data, (res < 0)? -1: res, slot->user_data);
+			invoked = 1;
+		}
 
-int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
-{
-	/* Do all non-blocking in userspace using poll(), since it looks
-	   like there's a bug in the kernel in some versions where
-	   read() will not return -1 on disconnection of the USB device */
+		free(write_op);
+		return invoked;
+	}
+	}
 
-	dev->blocking = !nonblock;
-	return 0; /* Success */
+	return 0;
 }
 
-int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length)
+hid_hidraw_uring * HID_API_EXPORT HID_API_CALL hid_hidraw_uring_new(unsigned int max_devices, size_t report_size)
 {
+	hid_hidraw_uring *ring;
+	struct iovec iov;
+	unsigned int entries, i;
 	int res;
 
-	if (!data || (length == 0)) {
+	register_global_error(NULL);
+
+	if (max_devices == 0) {
 		errno = EINVAL;
-		register_device_error(dev, "Zero buffer/length");
-		return -1;
+		register_global_error("hid_hidraw_uring_new: max_devices must be greater than 0");
+		return NULL;
 	}
 
-	register_device_error(dev, NULL);
+	if (report_size == 0)
+		report_size = HIDRAW_URING_DEFAULT_REPORT_SIZE;
 
-	res = ioctl(dev->device_handle, HIDIOCSFEATURE(length), data);
-	if (res < 0)
-		register_device_error_format(dev, "ioctl (SFEATURE): %s", strerror(errno));
+	if (report_size > (size_t) INT_MAX || report_size > SIZE_MAX / max_devices) {
+		errno = EINVAL;
+		register_global_error("hid_hidraw_uring_new: report_size is too large");
+		return NULL;
+	}
 
-	return res;
-}
+	ring = (hid_hidraw_uring *) calloc(1, sizeof(hid_hidraw_uring));
+	if (ring == NULL) {
+		errno = ENOMEM;
+		register_global_error("Couldn't allocate memory");
+		return NULL;
+	}
 
-int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data, size_t length)
-{
-	int res;
+	ring->num_slots = max_devices;
+	ring->report_size = report_size;
+	ring->slots = (struct hidraw_uring_slot *) calloc(max_devices, sizeof(struct hidraw_uring_slot));
+	ring->buffers = (unsigned char *) malloc(max_devices * report_size);
+	if (ring->slots == NULL || ring->buffers == NULL) {
+		free(ring->slots);
+		free(ring->buffers);
+		free(ring);
+		errno = ENOMEM;
+		register_global_error("Couldn't allocate memory");
+		return NULL;
+	}
 
-	if (!data || (length == 0)) {
-		errno = EINVAL;
-		register_device_error(dev, "Zero buffer/length");
-		return -1;
+	for (i = 0; i < max_devices; i++) {
+		struct hidraw_uring_slot *slot = &ring->slots[i];
+		slot->poll_op.kind = HIDRAW_URING_OP_POLL;
+		slot->poll_op.slot = slot;
+		slot->read_op.kind = HIDRAW_URING_OP_READ;
+		slot->read_op.slot = slot;
+		slot->buffer = ring->buffers + i * report_size;
 	}
 
-	register_device_error(dev, NULL);
+	/* Two entries per armed read (the poll and the read), plus room for writes */
+	entries = (max_devices < HIDRAW_URING_MAX_ENTRIES / 2)? max_devices * 2 + 16: HIDRAW_URING_MAX_ENTRIES;
 
-	res = ioctl(dev->device_handle, HIDIOCGFEATURE(length), data);
-	if (res < 0)
-		register_device_error_format(dev, "ioctl (GFEATURE): %s", strerror(errno));
+	res = io_uring_queue_init(entries, &ring->ring, 0);
+	if (res < 0) {
+		free(ring->slots);
+		free(ring->buffers);
+		free(ring);
+		errno = -res;
+		register_global_error_format("io_uring_queue_init: %s", strerror(-res));
+		return NULL;
+	}
 
-	return res;
+	/* All the read buffers are registered as a single buffer, so the kernel
+	   maps them once instead of on every read. If that fails (e.g. because of
+	   RLIMIT_MEMLOCK), the engine falls back to regular reads. */
+	iov.iov_base = ring->buffers;
+	iov.iov_len = max_devices * report_size;
+	ring->fixed_buffers = (io_uring_register_buffers(&ring->ring, &iov, 1) == 0);
+
+	return ring;
 }
 
-int HID_API_EXPORT HID_API_CALL hid_send_output_report(hid_device *dev, const unsigned char *data, size_t length)
+int HID_API_EXPORT HID_API_CALL hid_hidraw_uring_add_device(hid_hidraw_uring *ring, hid_device *dev, hid_hidraw_uring_callback_fn callback, void *user_data)
 {
-	int res;
+	struct hidraw_uring_slot *slot = NULL;
+	unsigned int i;
 
-	if (!data || (length == 0)) {
+	register_global_error(NULL);
+
+	if (!ring || !dev || !callback) {
 		errno = EINVAL;
-		register_device_error(dev, "Zero buffer/length");
+		register_global_error("hid_hidraw_uring_add_device: invalid argument");
 		return -1;
 	}
 
-	register_device_error(dev, NULL);
-
-	res = ioctl(dev->device_handle, HIDIOCSOUTPUT(length), data);
-	if (res < 0)
-		register_device_error_format(dev, "ioctl (SOUTPUT): %s", strerror(errno));
+	if (dev->uring || dev->reactor) {
+		errno = EBUSY;
+		register_global_error("hid_hidraw_uring_add_device: the device is already added to an io_uring engine or a reactor");
+		return -1;
+	}
 
-	return res;
-}
+	if (dev->read_ring) {
+		errno = EBUSY;
+		register_global_error("hid_hidraw_uring_add_device: the device has the background reader enabled");
+		return -1;
+	}
 
-int HID_API_EXPORT HID_API_CALL hid_get_input_report(hid_device *dev, unsigned char *data, size_t length)
-{
-	int res;
+	for (i = 0; i < ring->num_slots; i++) {
+		if (ring->slots[i].dev == NULL && !ring->slots[i].read_armed) {
+			slot = &ring->slots[i];
+			break;
+		}
+	}
 
-	if (!data || (length == 0)) {
-		errno = EINVAL;
-		register_device_error(dev, "Zero buffer/length");
+	if (slot == NULL) {
+		errno = ENOSPC;
+		register_global_error("hid_hidraw_uring_add_device: the engine is full");
 		return -1;
 	}
 
-	register_device_error(dev, NULL);
+	slot->dev = dev;
+	slot->callback = callback;
+	slot->user_data = user_data;
+	dev->uring = ring;
+	dev->uring_slot = i;
 
-	res = ioctl(dev->device_handle, HIDIOCGINPUT(length), data);
-	if (res < 0)
-		register_device_error_format(dev, "ioctl (GINPUT): %s", strerror(errno));
+	if (hidraw_uring_arm_read(ring, slot) < 0) {
+		register_global_error_format("hid_hidraw_uring_add_device: %s", strerror(errno));
+		hidraw_uring_release_slot(ring, slot);
+		return -1;
+	}
 
-	return res;
+	return 0;
 }
 
-void HID_API_EXPORT hid_close(hid_device *dev)
+int HID_API_EXPORT HID_API_CALL hid_hidraw_uring_remove_device(hid_hidraw_uring *ring, hid_device *dev)
 {
-	if (!dev)
-		return;
-
-	close(dev->device_handle);
-
-	free(dev->last_error_str);
-	free(dev->last_read_error_str);
+	if (!ring || !dev || dev->uring != ring) {
+		errno = EINVAL;
+		return -1;
+	}
 
-	hid_free_enumeration(dev->device_info);
+	hidraw_uring_release_slot(ring, &ring->slots[dev->uring_slot]);
 
-	free(dev);
+	return 0;
 }
 
-
-int HID_API_EXPORT_CALL hid_get_manufacturer_string(hid_device *dev, wchar_t *string, size_t maxlen)
+int HID_API_EXPORT HID_API_CALL hid_hidraw_uring_write(hid_hidraw_uring *ring, hid_device *dev, const unsigned char *data, size_t length)
 {
-	if (!string || !maxlen) {
+	struct hidraw_uring_write *write_op;
+	struct io_uring_sqe *sqe;
+
+	if (!data || (length == 0)) {
 		errno = EINVAL;
-		register_device_error(dev, "Zero buffer/length");
+		register_device_error_id(dev, HID_ERROR_ZERO_BUFFER, 0);
 		return -1;
 	}
 
-	struct hid_device_info *info = hid_get_device_info(dev);
-	if (!info) {
-		// hid_get_device_info will have set an error already
+	if (!ring || dev->uring != ring) {
+		errno = EINVAL;
+		register_device_error(dev, "hid_hidraw_uring_write: the device is not added to this io_uring engine");
 		return -1;
 	}
 
-	if (info->manufacturer_string) {
-		wcsncpy(string, info->manufacturer_string, maxlen);
-		string[maxlen - 1] = L'\0';
+	write_op = (struct hidraw_uring_write *) malloc(sizeof(struct hidraw_uring_write) + length);
+	if (write_op == NULL) {
+		errno = ENOMEM;
+		register_device_error_id(dev, HID_ERROR_NO_MEMORY, 0);
+		return -1;
 	}
-	else {
-		string[0] = L'\0';
+
+	sqe = hidraw_uring_get_sqe(ring);
+	if (sqe == NULL) {
+		free(write_op);
+		errno = EBUSY;
+		register_device_error(dev, "hid_hidraw_uring_write: the submission queue is full");
+		return -1;
 	}
 
+	write_op->op.kind = HIDRAW_URING_OP_WRITE;
+	write_op->op.slot = &ring->slots[dev->uring_slot];
+	write_op->dev = dev;
+	write_op->generation = write_op->op.slot->generation;
+	write_op->length = length;
+	memcpy(write_op->data, data, length);
+
+	io_uring_prep_write(sqe, dev->device_handle, write_op->data, (unsigned) length, 0);
+	io_uring_sqe_set_data(sqe, &write_op->op);
+	ring->num_inflight++;
+
+	register_device_error(dev, NULL);
+
 	return 0;
 }
 
-int HID_API_EXPORT_CALL hid_get_product_string(hid_device *dev, wchar_t *string, size_t maxlen)
+int HID_API_EXPORT HID_API_CALL hid_hidraw_uring_process(hid_hidraw_uring *ring, int milliseconds)
 {
-	if (!string || !maxlen) {
+	struct io_uring_cqe *cqe;
+	int res, count = 0;
+
+	if (!ring) {
 		errno = EINVAL;
-		register_device_error(dev, "Zero buffer/length");
+		register_global_error("hid_hidraw_uring_process: invalid argument");
 		return -1;
 	}
 
-	struct hid_device_info *info = hid_get_device_info(dev);
-	if (!info) {
-		// hid_get_device_info will have set an error already
+	register_global_error(NULL);
+
+	res = io_uring_submit(&ring->ring);
+	if (res < 0) {
+		errno = -res;
+		register_global_error_format("io_uring_submit: %s", strerror(-res));
 		return -1;
 	}
 
-	if (info->product_string) {
-		wcsncpy(string, info->product_string, maxlen);
-		string[maxlen - 1] = L'\0';
+	if (milliseconds < 0) {
+		res = io_uring_wait_cqe(&ring->ring, &cqe);
+	}
+	else if (milliseconds == 0) {
+		res = io_uring_peek_cqe(&ring->ring, &cqe);
 	}
 	else {
-		string[0] = L'\0';
+		struct __kernel_timespec ts;
+		ts.tv_sec = milliseconds / 1000;
+		ts.tv_nsec = (milliseconds % 1000) * 1000000L;
+		res = io_uring_wait_cqe_timeout(&ring->ring, &cqe, &ts);
 	}
 
-	return 0;
-}
-
-int HID_API_EXPORT_CALL hid_get_serial_number_string(hid_device *dev, wchar_t *string, size_t maxlen)
-{
-	if (!string || !maxlen) {
-		errno = EINVAL;
-		register_device_error(dev, "Zero buffer/length");
-		return -1;
+	if (res == -ETIME || res == -EAGAIN || res == -EINTR) {
+		/* Timeout */
+		return 0;
 	}
-
-	struct hid_device_info *info = hid_get_device_info(dev);
-	if (!info) {
-		// hid_get_device_info will have set an error already
+	if (res < 0) {
+		errno = -res;
+		register_global_error_format("io_uring_wait_cqe: %s", strerror(-res));
 		return -1;
 	}
 
-	if (info->serial_number) {
-		wcsncpy(string, info->serial_number, maxlen);
-		string[maxlen - 1] = L'\0';
-	}
-	else {
-		string[0] = L'\0';
+	/* Dispatch everything that is ready. The completion is consumed
+	   before the callback, which may queue new requests. */
+	while (io_uring_peek_cqe(&ring->ring, &cqe) == 0) {
+		struct hidraw_uring_op *op = (struct hidraw_uring_op *) io_uring_cqe_get_data(cqe);
+		int cqe_res = cqe->res;
+
+		io_uring_cqe_seen(&ring->ring, cqe);
+		count += hidraw_uring_complete(ring, op, cqe_res);
 	}
 
-	return 0;
+	/* Submit the re-armed reads right away, so no report waits for the next call */
+	io_uring_submit(&ring->ring);
+
+	return count;
 }
 
+void HID_API_EXPORT HID_API_CALL hid_hidraw_uring_free(hid_hidraw_uring *ring)
+{
+	struct io_uring_cqe *cqe;
+	unsigned int i;
 
-HID_API_EXPORT struct hid_device_info *HID_API_CALL hid_get_device_info(hid_device *dev) {
-	if (dev->device_info) {
-		register_device_error(dev, NULL);
+	if (!ring)
+		return;
+
+	for (i = 0; i < ring->num_slots; i++) {
+		if (ring->slots[i].dev)
+			hidraw_uring_release_slot(ring, &ring->slots[i]);
 	}
-	else {
-		// Lazy initialize device_info
-		dev->device_info = create_device_info_for_hid_device(dev);
+
+	/* Wait for the cancelled reads and the pending writes,
+	   the kernel may still access their buffers */
+	io_uring_submit(&ring->ring);
+	while (ring->num_inflight > 0) {
+		struct hidraw_uring_op *op;
+		int res = io_uring_wait_cqe(&ring->ring, &cqe);
+		if (res == -EINTR)
+			continue;
+		if (res < 0)
+			break;
+
+		op = (struct hidraw_uring_op *) io_uring_cqe_get_data(cqe);
+		res = cqe->res;
+		io_uring_cqe_seen(&ring->ring, cqe);
+		hidraw_uring_complete(ring, op, res);
 	}
 
-	// create_device_info_for_hid_device will set an error if needed
-	return dev->device_info;
+	io_uring_queue_exit(&ring->ring);
+
+	free(ring->slots);
+	free(ring->buffers);
+	free(ring);
 }
 
-int HID_API_EXPORT_CALL hid_get_indexed_string(hid_device *dev, int string_index, wchar_t *string, size_t maxlen)
+#else /* HIDAPI_HAVE_LIBURING */
+
+hid_hidraw_uring * HID_API_EXPORT HID_API_CALL hid_hidraw_uring_new(unsigned int max_devices, size_t report_size)
 {
-	(void)string_index;
-	(void)string;
-	(void)maxlen;
+	(void) max_devices;
+	(void) report_size;
 
 	errno = ENOSYS;
-	register_device_error(dev, "hid_get_indexed_string: not supported by hidraw");
+	register_global_error("hid_hidraw_uring_new: hidapi is built without io_uring support");
+	return NULL;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_hidraw_uring_add_device(hid_hidraw_uring *ring, hid_device *dev, hid_hidraw_uring_callback_fn callback, void *user_data)
+{
+	(void) ring;
+	(void) dev;
+	(void) callback;
+	(void) user_data;
 
+	errno = ENOSYS;
+	register_global_error("hid_hidraw_uring_add_device: hidapi is built without io_uring support");
 	return -1;
 }
 
-
-int HID_API_EXPORT_CALL hid_get_report_descriptor(hid_device *dev, unsigned char *buf, size_t buf_size)
+int HID_API_EXPORT HID_API_CALL hid_hidraw_uring_remove_device(hid_hidraw_uring *ring, hid_device *dev)
 {
-	struct hidraw_report_descriptor rpt_desc;
+	(void) ring;
+	(void) dev;
 
-	if (!buf || !buf_size) {
-		errno = EINVAL;
-		register_device_error(dev, "Zero buffer/length");
-		return -1;
-	}
+	errno = ENOSYS;
+	return -1;
+}
 
-	register_device_error(dev, NULL);
+int HID_API_EXPORT HID_API_CALL hid_hidraw_uring_write(hid_hidraw_uring *ring, hid_device *dev, const unsigned char *data, size_t length)
+{
+	(void) ring;
+	(void) data;
+	(void) length;
 
-	int res = get_hid_report_descriptor_from_hidraw(dev, &rpt_desc);
-	if (res < 0) {
-		/* error already registered */
-		return res;
-	}
+	errno = ENOSYS;
+	register_device_error(dev, "hid_hidraw_uring_write: hidapi is built without io_uring support");
+	return -1;
+}
 
-	if (rpt_desc.size < buf_size) {
-		buf_size = (size_t) rpt_desc.size;
-	}
+int HID_API_EXPORT HID_API_CALL hid_hidraw_uring_process(hid_hidraw_uring *ring, int milliseconds)
+{
+	(void) ring;
+	(void) milliseconds;
 
-	memcpy(buf, rpt_desc.value, buf_size);
+	errno = ENOSYS;
+	register_global_error("hid_hidraw_uring_process: hidapi is built without io_uring support");
+	return -1;
+}
 
-	return (int) buf_size;
+void HID_API_EXPORT HID_API_CALL hid_hidraw_uring_free(hid_hidraw_uring *ring)
+{
+	(void) ring;
 }
 
+#endif /* HIDAPI_HAVE_LIBURING */
+
 
 /* Passing in NULL means asking for the last global error message. */
 HID_API_EXPORT const wchar_t * HID_API_CALL  hid_error(hid_device *dev)
 {
-	if (dev) {
-		if (dev->last_error_str == NULL)
-			return L"Success";
-		return dev->last_error_str;
-	}
+	if (dev)
+		return error_to_wchar_t(&dev->last_error);
 
-	if (last_global_error_str == NULL)
-		return L"Success";
-	return last_global_error_str;
+	return error_to_wchar_t(&last_global_error);
+}
+
+/* Passing in NULL means asking for the last global error code. */
+HID_API_EXPORT int HID_API_CALL hid_error_code(hid_device *dev)
+{
+	struct hid_error *error = dev ? &dev->last_error : &last_global_error;
+	return error->errnum;
 }
@@ -0,0 +1,401 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2024, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+/** @file
+ * @defgroup API hidapi API
+
+ * Since version 0.16.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 16, 0).
+ */
+
+#ifndef HIDAPI_HIDRAW_H__
+#define HIDAPI_HIDRAW_H__
+
+#include <stddef.h>
+
+#include "hidapi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+		/** @brief Set the number of threads used by hid_enumerate().
+
+			By default the hidraw nodes are enumerated one at a time.
+			With more than one thread, reading the sysfs attributes and
+			report descriptors of the nodes is spread over a pool of threads
+			created for each hid_enumerate() call. The resulting list
+			is in the same order as with a single thread.
+
+			This only applies when the nodes are read from /sys/class/hidraw
+			directly; the udev fallback always uses a single thread.
+
+			@ingroup API
+			@param num_threads The number of threads, the calling one included.
+				1 (the default) enumerates on the calling thread only,
+				0 is treated as 1, and the value is capped at 32.
+
+			@note Must not be called concurrently with hid_enumerate().
+		*/
+		void HID_API_EXPORT HID_API_CALL hid_hidraw_set_enumerate_threads(unsigned int num_threads);
+
+		/** @brief Getter for the option set by hid_hidraw_set_enumerate_threads().
+
+			@ingroup API
+			@returns The number of threads used by hid_enumerate().
+		*/
+		unsigned int HID_API_EXPORT HID_API_CALL hid_hidraw_get_enumerate_threads(void);
+
+		/** @brief Answer hid_enumerate() from a device list kept up to date by hotplug events.
+
+			When enabled, the hotplug monitor used by hid_hotplug_register_callback()
+			keeps running even with no callbacks registered. hid_enumerate(),
+			hid_enumerate_ex() and hid_open() then copy the matching devices
+			from the list it maintains, instead of reading sysfs again.
+			The list is shared with the hotplug callbacks, so it reflects
+			the devices reported by the last @ref HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED
+			and @ref HID_API_HOTPLUG_EVENT_DEVICE_LEFT events.
+
+			The monitor runs on a thread of its own until the cache is disabled
+			(or hid_exit() is called) and no callbacks are left.
+
+			@ingroup API
+			@param enable Non-zero to enable the cache, 0 to disable it (the default).
+
+			@returns
+				This function returns 0 on success and -1 if the monitor
+				could not be started.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_hidraw_set_enumerate_cache(int enable);
+
+		/** @brief Getter for the option set by hid_hidraw_set_enumerate_cache().
+
+			@ingroup API
+			@returns 1 if the enumeration cache is enabled, 0 otherwise.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_hidraw_get_enumerate_cache(void);
+
+		/** @brief Invoke the hotplug callbacks on a pool of threads.
+
+			By default the hotplug callbacks are invoked by the hotplug
+			monitor thread, one after the other, so a slow callback delays
+			every later event, and hid_hotplug_register_callback() waits
+			for it in other threads.
+
+			With one or more threads, the monitor only queues a copy of
+			the device info of each event for the matching callbacks,
+			and the threads of the pool invoke them. A callback is run by
+			one thread at a time and gets its events in the order they
+			happened, the @ref HID_API_HOTPLUG_ENUMERATE replay first;
+			different callbacks run concurrently. The device info passed
+			to a callback is only valid for the duration of the call.
+
+			hid_hotplug_deregister_callback() drops the events queued for
+			the callback. If the callback is being run by another thread
+			at that moment, that call still completes after
+			hid_hotplug_deregister_callback() returns.
+
+			The threads are stopped by hid_exit(), without running
+			the callbacks for the events still queued.
+
+			@ingroup API
+			@param num_threads The number of threads, capped at 32.
+				0 (the default) invokes the callbacks on the monitor thread.
+
+			@returns
+				This function returns 0 on success, and -1 if hotplug callbacks
+				are registered or the threads could not be started.
+
+			@note Must not be called from a hotplug callback.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_hidraw_set_hotplug_threads(unsigned int num_threads);
+
+		/** @brief Getter for the option set by hid_hidraw_set_hotplug_threads().
+
+			@ingroup API
+			@returns The number of threads that invoke the hotplug callbacks,
+				0 if they are invoked on the monitor thread.
+		*/
+		unsigned int HID_API_EXPORT HID_API_CALL hid_hidraw_get_hotplug_threads(void);
+
+		/** A Usage Page/Usage pair of a top-level collection.
+		*/
+		struct hid_hidraw_usage {
+			/** Usage Page of the collection */
+			unsigned short usage_page;
+			/** Usage of the collection */
+			unsigned short usage;
+		};
+
+		/** Metadata derived from the report descriptor of a device,
+			see hid_hidraw_get_report_info().
+		*/
+		struct hid_hidraw_report_info {
+			/** The size of the largest Input report, as returned by
+				hid_read(): including the Report ID byte only if
+				the device uses Report IDs. 0 if the device has no Input reports. */
+			size_t max_input_report_size;
+			/** The size of the largest Output report, as passed to
+				hid_write(): always including the Report ID byte.
+				0 if the device has no Output reports. */
+			size_t max_output_report_size;
+			/** The size of the largest Feature report, as passed to
+				hid_send_feature_report(): always including the Report ID byte.
+				0 if the device has no Feature reports. */
+			size_t max_feature_report_size;
+			/** The Usage Page/Usage pairs of the device, the same
+				as reported by hid_enumerate() */
+			const struct hid_hidraw_usage *usages;
+			/** The number of elements in usages */
+			size_t num_usages;
+		};
+
+		/** @brief Get the metadata derived from the report descriptor of a device.
+
+			The report descriptor is read and parsed once, by hid_open_path(),
+			so this function and hid_get_report_descriptor() don't
+			communicate with the device.
+			If the descriptor couldn't be read at that time, the device
+			is still opened, but this function fails.
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+
+			@returns
+				A pointer to the metadata, owned by the device
+				and valid until hid_close(dev), or NULL on error.
+				Call hid_error(dev) to get the failure reason.
+		*/
+		HID_API_EXPORT const struct hid_hidraw_report_info * HID_API_CALL hid_hidraw_get_report_info(hid_device *dev);
+
+		/** Statistics of the background reader,
+			see hid_hidraw_get_read_ring_stats().
+
+			The counters are size_t and wrap around on overflow.
+		*/
+		struct hid_hidraw_read_ring_stats {
+			/** The number of reports the ring can hold */
+			size_t capacity;
+			/** The number of reports currently in the ring */
+			size_t queued;
+			/** The largest number of reports the ring has held at once */
+			size_t high_watermark;
+			/** The number of reports read from the device by the reader thread */
+			size_t received;
+			/** The number of reports dropped because the ring was full */
+			size_t dropped;
+		};
+
+		/** @brief Read Input reports of a device on a background thread.
+
+			By default hid_read() reads directly from the hidraw device,
+			which queues at most 64 reports and silently drops reports
+			when the application doesn't read fast enough.
+
+			Once enabled, a dedicated thread reads every report as soon
+			as the kernel has it, and stores it together with its
+			receive time in a preallocated ring. hid_read(),
+			hid_read_timeout(), hid_read_timestamped(), hid_read_batch()
+			and @ref hid_reactor then take the reports from the ring,
+			and hid_get_pollable_fd() returns a descriptor which is
+			readable while the ring has reports.
+
+			When the ring is full, new reports are dropped and counted,
+			see hid_hidraw_get_read_ring_stats().
+
+			The ring is a single-producer single-consumer queue:
+			the device must not be read from more than one thread at a time.
+			The reader thread is stopped by hid_close().
+
+			This must be called before the device is added to a @ref hid_reactor,
+			and a device with the background reader enabled
+			can't be added to an io_uring engine.
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+			@param num_reports The number of reports the ring can hold,
+				rounded up to a power of two. Pass 0 to use a default of 1024.
+			@param report_size The size of each report in the ring, in bytes.
+				Must be large enough for the largest Input report
+				(including the Report ID byte) of the device,
+				longer reports are truncated.
+				Pass 0 to use the max_input_report_size
+				of hid_hidraw_get_report_info().
+				When that is not known either, 4096 bytes are used.
+
+			@returns
+				0 on success and -1 on error.
+				Call hid_error(dev) to get the failure reason.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_hidraw_enable_read_ring(hid_device *dev, size_t num_reports, size_t report_size);
+
+		/** @brief Get the statistics of the background reader.
+
+			@ingroup API
+			@param dev A device handle with the background reader enabled,
+				see hid_hidraw_enable_read_ring().
+			@param stats The structure to fill in.
+
+			@returns
+				0 on success and -1 on error.
+				Call hid_error(dev) to get the failure reason.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_hidraw_get_read_ring_stats(hid_device *dev, struct hid_hidraw_read_ring_stats *stats);
+
+		/** An io_uring based I/O engine, which services many
+			hidraw devices from a single thread.
+		*/
+		typedef struct hid_hidraw_uring_ hid_hidraw_uring;
+
+		/** Kind of a completion reported by the io_uring engine.
+		*/
+		typedef enum {
+			/** An Input report was read from the device */
+			HID_HIDRAW_URING_READ = 0,
+			/** A write submitted with hid_hidraw_uring_write() has completed */
+			HID_HIDRAW_URING_WRITE = 1
+		} hid_hidraw_uring_event;
+
+		/** @brief Completion callback of the io_uring engine.
+
+			Called from hid_hidraw_uring_process(), on the thread which called it.
+			It is allowed to call hid_hidraw_uring_add_device(),
+			hid_hidraw_uring_remove_device() and hid_hidraw_uring_write()
+			from within the callback.
+
+			@ingroup API
+			@param dev The device the completion belongs to.
+			@param event The kind of the completion.
+			@param data For @ref HID_HIDRAW_URING_READ - the Input report
+				that was read, only valid for the duration of the callback.
+				For @ref HID_HIDRAW_URING_WRITE - the data that was written.
+			@param length The number of bytes read or written,
+				or -1 on error. For a failed read the error is available
+				with hid_read_error(dev), for a failed write - with hid_error(dev).
+				After a failed read the device is removed from the engine.
+			@param user_data The user data given to hid_hidraw_uring_add_device().
+		*/
+		typedef void (HID_API_CALL *hid_hidraw_uring_callback_fn)(hid_device *dev, hid_hidraw_uring_event event, const unsigned char *data, int length, void *user_data);
+
+		/** @brief Create an io_uring engine.
+
+			The engine keeps one read armed for every added device,
+			using buffers registered with the kernel once,
+			and submits all reads and writes in batches.
+
+			This function is only functional when HIDAPI was built
+			with liburing (see HIDAPI_WITH_LIBURING). Otherwise it always
+			returns NULL and the caller should use hid_read()/hid_write().
+
+			@ingroup API
+			@param max_devices The maximum number of devices
+				which can be added to the engine at the same time.
+			@param report_size The size of each read buffer, in bytes.
+				Must be large enough for the largest Input report
+				(including the Report ID byte) of every added device.
+				Pass 0 to use a default of 4096 bytes.
+
+			@returns
+				A pointer to a new engine on success,
+				or NULL on failure. Call hid_error(NULL) to get the failure reason.
+		*/
+		HID_API_EXPORT hid_hidraw_uring * HID_API_CALL hid_hidraw_uring_new(unsigned int max_devices, size_t report_size);
+
+		/** @brief Add a device to the io_uring engine and arm a read on it.
+
+			While the device is part of the engine it must not be read
+			with hid_read() and friends, and it must not be closed.
+
+			@ingroup API
+			@param ring An engine returned from hid_hidraw_uring_new().
+			@param dev A device handle returned from hid_open().
+			@param callback The callback to be invoked for completions on the device.
+			@param user_data The user data to pass to the callback.
+
+			@returns
+				0 on success and -1 on error.
+				Call hid_error(NULL) to get the failure reason.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_hidraw_uring_add_device(hid_hidraw_uring *ring, hid_device *dev, hid_hidraw_uring_callback_fn callback, void *user_data);
+
+		/** @brief Remove a device from the io_uring engine.
+
+			The armed read is cancelled, and no more callbacks
+			are invoked for the device after this function returns.
+			Writes still in flight are completed silently.
+
+			@ingroup API
+			@param ring An engine returned from hid_hidraw_uring_new().
+			@param dev A device previously added with hid_hidraw_uring_add_device().
+
+			@returns
+				0 on success and -1 if the device is not part of the engine.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_hidraw_uring_remove_device(hid_hidraw_uring *ring, hid_device *dev);
+
+		/** @brief Queue an Output report to be written to a device.
+
+			The data is copied, so the buffer may be reused right away.
+			The write is submitted together with the other pending
+			requests on the next call to hid_hidraw_uring_process(),
+			and its result is reported to the device callback
+			with @ref HID_HIDRAW_URING_WRITE.
+
+			The data format is the same as for hid_write().
+
+			@ingroup API
+			@param ring An engine returned from hid_hidraw_uring_new().
+			@param dev A device previously added with hid_hidraw_uring_add_device().
+			@param data The data to send, including the report number as the first byte.
+			@param length The length in bytes of the data to send.
+
+			@returns
+				0 if the write was queued and -1 on error.
+				Call hid_error(dev) to get the failure reason.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_hidraw_uring_write(hid_hidraw_uring *ring, hid_device *dev, const unsigned char *data, size_t length);
+
+		/** @brief Submit the pending requests and dispatch completions.
+
+			@ingroup API
+			@param ring An engine returned from hid_hidraw_uring_new().
+			@param milliseconds timeout in milliseconds to wait for
+				the first completion, or -1 for blocking wait.
+
+			@returns
+				The number of callbacks invoked,
+				0 if the timeout expired,
+				or -1 on error. Call hid_error(NULL) to get the failure reason.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_hidraw_uring_process(hid_hidraw_uring *ring, int milliseconds);
+
+		/** @brief Destroy an io_uring engine.
+
+			All the armed reads are cancelled. The devices
+			are not closed and may be used with hid_read() again.
+
+			@ingroup API
+			@param ring An engine returned from hid_hidraw_uring_new(), or NULL.
+		*/
+		void HID_API_EXPORT HID_API_CALL hid_hidraw_uring_free(hid_hidraw_uring *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
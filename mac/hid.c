@@ -35,6 +35,7 @@
 #include <sys/time.h>
 #include <unistd.h>
 #include <dlfcn.h>
+#include <mach/mach_time.h>
 
 #include "hidapi_darwin.h"
 
@@ -110,6 +111,7 @@ static int return_data(hid_device *dev, unsigned char *data, size_t length);
 struct input_report {
 	uint8_t *data;
 	size_t len;
+	uint64_t timestamp_ns; /* mach_absolute_time() of the report callback, in nanoseconds */
 	struct input_report *next;
 };
 
@@ -972,6 +974,180 @@ void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
 	}
 }
 
+static int hid_internal_match_filter(const struct hid_device_info *info, const struct hid_enumerate_filter *filter)
+{
+	return (filter->vendor_id == 0x0 || info->vendor_id == filter->vendor_id) &&
+		(filter->product_id == 0x0 || info->product_id == filter->product_id) &&
+		(filter->usage_page == 0x0 || info->usage_page == filter->usage_page) &&
+		(filter->usage == 0x0 || info->usage == filter->usage) &&
+		(filter->bus_type == HID_API_BUS_UNKNOWN || info->bus_type == filter->bus_type) &&
+		(filter->interface_number == -1 || info->interface_number == filter->interface_number) &&
+		(!filter->serial_number || (info->serial_number && wcscmp(info->serial_number, filter->serial_number) == 0));
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate_ex(const struct hid_enumerate_filter *filter)
+{
+	struct hid_device_info *root;
+	struct hid_device_info **link;
+
+	if (!filter)
+		return hid_enumerate(0, 0);
+
+	/* The system is only queried by VID/PID here, the rest of the filter is applied to the result */
+	root = hid_enumerate(filter->vendor_id, filter->product_id);
+
+	link = &root;
+	while (*link) {
+		struct hid_device_info *cur_dev = *link;
+
+		if (!hid_internal_match_filter(cur_dev, filter)) {
+			*link = cur_dev->next;
+			cur_dev->next = NULL;
+			hid_free_enumeration(cur_dev);
+			continue;
+		}
+
+		if (filter->flags & HID_API_ENUMERATE_NO_STRINGS) {
+			free(cur_dev->serial_number);
+			free(cur_dev->manufacturer_string);
+			free(cur_dev->product_string);
+			cur_dev->serial_number = NULL;
+			cur_dev->manufacturer_string = NULL;
+			cur_dev->product_string = NULL;
+		}
+
+		link = &cur_dev->next;
+	}
+
+	if (root == NULL) {
+		register_global_error("No HID devices matching the filter found in the system.");
+	}
+
+	return root;
+}
+
+/* Encode a wide string as UTF-8 into out, or only measure it if out is NULL.
+   At most out_size bytes are written, cutting before the first character
+   which doesn't fit entirely. Surrogate pairs are combined, for when
+   wchar_t holds UTF-16.
+   Returns the size of the whole string, including the terminator. */
+static size_t hid_internal_wcs_to_utf8(const wchar_t *wcs, char *out, size_t out_size)
+{
+	size_t size = 0, out_len = 0;
+
+	for (; *wcs; wcs++) {
+		unsigned long c = (unsigned long) *wcs;
+		unsigned long low = (unsigned long) wcs[1];
+		unsigned char buf[4];
+		size_t n;
+
+		if (c >= 0xD800 && c < 0xDC00 && low >= 0xDC00 && low < 0xE000) {
+			c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+			wcs++;
+		}
+		if ((c >= 0xD800 && c < 0xE000) || c > 0x10FFFF)
+			c = 0xFFFD;
+
+		if (c < 0x80) {
+			buf[0] = (unsigned char) c;
+			n = 1;
+		}
+		else if (c < 0x800) {
+			buf[0] = (unsigned char) (0xC0 | (c >> 6));
+			buf[1] = (unsigned char) (0x80 | (c & 0x3F));
+			n = 2;
+		}
+		else if (c < 0x10000) {
+			buf[0] = (unsigned char) (0xE0 | (c >> 12));
+			buf[1] = (unsigned char) (0x80 | ((c >> 6) & 0x3F));
+			buf[2] = (unsigned char) (0x80 | (c & 0x3F));
+			n = 3;
+		}
+		else {
+			buf[0] = (unsigned char) (0xF0 | (c >> 18));
+			buf[1] = (unsigned char) (0x80 | ((c >> 12) & 0x3F));
+			buf[2] = (unsigned char) (0x80 | ((c >> 6) & 0x3F));
+			buf[3] = (unsigned char) (0x80 | (c & 0x3F));
+			n = 4;
+		}
+
+		if (out && out_len == size && size + n < out_size) {
+			memcpy(out + out_len, buf, n);
+			out_len += n;
+		}
+		size += n;
+	}
+
+	if (out && out_size > 0)
+		out[out_len] = '\0';
+
+	return size + 1;
+}
+
+static char *hid_internal_wcsdup_utf8(const wchar_t *wcs)
+{
+	size_t size;
+	char *str;
+
+	if (!wcs)
+		return NULL;
+
+	size = hid_internal_wcs_to_utf8(wcs, NULL, 0);
+	str = (char*) malloc(size);
+	if (str)
+		hid_internal_wcs_to_utf8(wcs, str, size);
+
+	return str;
+}
+
+struct hid_device_info_utf8 HID_API_EXPORT * HID_API_CALL hid_enumerate_utf8(const struct hid_enumerate_filter *filter)
+{
+	struct hid_device_info *devs = hid_enumerate_ex(filter);
+	const struct hid_device_info *info;
+	struct hid_device_info_utf8 *root = NULL;
+	struct hid_device_info_utf8 **link = &root;
+
+	/* The system gives wide strings here, they are converted afterwards */
+	for (info = devs; info; info = info->next) {
+		struct hid_device_info_utf8 *cur_dev = (struct hid_device_info_utf8*) calloc(1, sizeof(struct hid_device_info_utf8));
+		if (!cur_dev)
+			break;
+
+		cur_dev->path = info->path ? strdup(info->path) : NULL;
+		cur_dev->vendor_id = info->vendor_id;
+		cur_dev->product_id = info->product_id;
+		cur_dev->serial_number = hid_internal_wcsdup_utf8(info->serial_number);
+		cur_dev->release_number = info->release_number;
+		cur_dev->manufacturer_string = hid_internal_wcsdup_utf8(info->manufacturer_string);
+		cur_dev->product_string = hid_internal_wcsdup_utf8(info->product_string);
+		cur_dev->usage_page = info->usage_page;
+		cur_dev->usage = info->usage;
+		cur_dev->interface_number = info->interface_number;
+		cur_dev->bus_type = info->bus_type;
+
+		*link = cur_dev;
+		link = &cur_dev->next;
+	}
+
+	hid_free_enumeration(devs);
+
+	return root;
+}
+
+void  HID_API_EXPORT HID_API_CALL hid_free_enumeration_utf8(struct hid_device_info_utf8 *devs)
+{
+	struct hid_device_info_utf8 *d = devs;
+	while (d) {
+		struct hid_device_info_utf8 *next = d->next;
+		free(d->path);
+		free(d->serial_number);
+		free(d->manufacturer_string);
+		free(d->product_string);
+		free(d);
+		d = next;
+	}
+}
+
 static void hid_internal_invoke_callbacks(struct hid_device_info *info, hid_hotplug_event event)
 {
 	pthread_mutex_lock(&hid_hotplug_context.mutex);
@@ -1297,6 +1473,18 @@ int HID_API_EXPORT HID_API_CALL hid_hotplug_deregister_callback(hid_hotplug_call
 	return result;
 }
 
+int HID_API_EXPORT HID_API_CALL hid_hotplug_get_fd(void)
+{
+	register_global_error("hid_hotplug_get_fd: not supported on macOS");
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_hotplug_handle_events(void)
+{
+	register_global_error("hid_hotplug_handle_events: not supported on macOS");
+	return -1;
+}
+
 hid_device * HID_API_EXPORT hid_open(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
 {
 	/* This function is identical to the Linux version. Platform independent. */
@@ -1354,6 +1542,16 @@ static void hid_device_removal_callback(void *context, IOReturn result,
 	CFRunLoopStop(d->run_loop);
 }
 
+/* Current mach_absolute_time(), in nanoseconds.
+   Like CLOCK_MONOTONIC on Linux, it doesn't advance while the system sleeps. */
+static uint64_t get_monotonic_time_ns(void)
+{
+	static mach_timebase_info_data_t timebase;
+	if (timebase.denom == 0)
+		mach_timebase_info(&timebase);
+	return mach_absolute_time() * timebase.numer / timebase.denom;
+}
+
 /* The Run Loop calls this function for each input report received.
    This function puts the data into a linked list to be picked up by
    hid_read(). */
@@ -1374,6 +1572,7 @@ static void hid_report_callback(void *context, IOReturn result, void *sender,
 	rpt->data = (uint8_t*) calloc(1, report_length);
 	memcpy(rpt->data, report, report_length);
 	rpt->len = report_length;
+	rpt->timestamp_ns = get_monotonic_time_ns();
 	rpt->next = NULL;
 
 	/* Lock this section */
@@ -1696,6 +1895,14 @@ static int return_data(hid_device *dev, unsigned char *data, size_t length)
 	return (int) len;
 }
 
+/* Same as return_data(), and also returns the timestamp of the report. */
+static int return_data_timestamped(hid_device *dev, unsigned char *data, size_t length, uint64_t *timestamp_ns)
+{
+	if (timestamp_ns)
+		*timestamp_ns = dev->input_reports->timestamp_ns;
+	return return_data(dev, data, length);
+}
+
 static int cond_wait(hid_device *dev, pthread_cond_t *cond, pthread_mutex_t *mutex)
 {
 	while (!dev->input_reports) {
@@ -1738,7 +1945,7 @@ static int cond_timedwait(hid_device *dev, pthread_cond_t *cond, pthread_mutex_t
 	return 0;
 }
 
-int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+int HID_API_EXPORT HID_API_CALL hid_read_timestamped(hid_device *dev, unsigned char *data, size_t length, uint64_t *timestamp_ns, int milliseconds)
 {
 	int bytes_read = -1;
 
@@ -1755,7 +1962,7 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 	/* There's an input report queued up. Return it. */
 	if (dev->input_reports) {
 		/* Return the first one */
-		bytes_read = return_data(dev, data, length);
+		bytes_read = return_data_timestamped(dev, data, length, timestamp_ns);
 		goto ret;
 	}
 
@@ -1782,7 +1989,7 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 		int res;
 		res = cond_wait(dev, &dev->condition, &dev->mutex);
 		if (res == 0)
-			bytes_read = return_data(dev, data, length);
+			bytes_read = return_data_timestamped(dev, data, length, timestamp_ns);
 		else {
 			/* There was an error, or a device disconnection. */
 			register_error_str(&dev->last_read_error_str, "hid_read_timeout: error waiting for more data");
@@ -1805,7 +2012,7 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 
 		res = cond_timedwait(dev, &dev->condition, &dev->mutex, &ts);
 		if (res == 0) {
-			bytes_read = return_data(dev, data, length);
+			bytes_read = return_data_timestamped(dev, data, length, timestamp_ns);
 		} else if (res == ETIMEDOUT) {
 			bytes_read = 0;
 		} else {
@@ -1824,11 +2031,41 @@ ret:
 	return bytes_read;
 }
 
+int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+	return hid_read_timestamped(dev, data, length, NULL, milliseconds);
+}
+
 int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
 {
 	return hid_read_timeout(dev, data, length, (dev->blocking)? -1: 0);
 }
 
+int HID_API_EXPORT hid_read_batch(hid_device *dev, unsigned char *data, size_t stride, size_t max_reports, size_t *lengths, int milliseconds)
+{
+	size_t count = 0;
+
+	if (!data || !stride || !max_reports || !lengths) {
+		register_error_str(&dev->last_read_error_str, "Zero buffer/length");
+		return -1;
+	}
+
+	/* Only the first read waits; the rest pick up what is already queued. */
+	while (count < max_reports) {
+		int res = hid_read_timeout(dev, data + count * stride, stride, (count == 0)? milliseconds: 0);
+		if (res < 0) {
+			if (count == 0)
+				return -1;
+			break;
+		}
+		if (res == 0)
+			break;
+		lengths[count++] = (size_t) res;
+	}
+
+	return (int) count;
+}
+
 HID_API_EXPORT const wchar_t * HID_API_CALL hid_read_error(hid_device *dev)
 {
 	if (dev->last_read_error_str == NULL)
@@ -1836,6 +2073,49 @@ HID_API_EXPORT const wchar_t * HID_API_CALL hid_read_error(hid_device *dev)
 	return dev->last_read_error_str;
 }
 
+hid_reactor * HID_API_EXPORT HID_API_CALL hid_reactor_new(size_t report_size)
+{
+	(void)report_size;
+	register_global_error("hid_reactor_new: not supported on macOS");
+	return NULL;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_reactor_add(hid_reactor *reactor, hid_device *dev, hid_reactor_callback_fn callback, void *user_data)
+{
+	(void)reactor;
+	(void)dev;
+	(void)callback;
+	(void)user_data;
+	register_global_error("hid_reactor_add: not supported on macOS");
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_reactor_remove(hid_reactor *reactor, hid_device *dev)
+{
+	(void)reactor;
+	(void)dev;
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_reactor_run(hid_reactor *reactor, int milliseconds)
+{
+	(void)reactor;
+	(void)milliseconds;
+	register_global_error("hid_reactor_run: not supported on macOS");
+	return -1;
+}
+
+void HID_API_EXPORT HID_API_CALL hid_reactor_free(hid_reactor *reactor)
+{
+	(void)reactor;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_get_pollable_fd(hid_device *dev)
+{
+	register_device_error(dev, "hid_get_pollable_fd: not supported on macOS");
+	return -1;
+}
+
 int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 {
 	/* All Nonblocking operation is handled by the library. */
@@ -2002,6 +2282,77 @@ int HID_API_EXPORT_CALL hid_get_indexed_string(hid_device *dev, int string_index
 	return -1;
 }
 
+int HID_API_EXPORT_CALL hid_get_manufacturer_string_utf8(hid_device *dev, char *string, size_t maxlen)
+{
+	struct hid_device_info *info;
+
+	if (!string || !maxlen) {
+		register_device_error(dev, "Zero buffer/length");
+		return -1;
+	}
+
+	info = hid_get_device_info(dev);
+	if (!info) {
+		// hid_get_device_info will have set an error already
+		return -1;
+	}
+
+	hid_internal_wcs_to_utf8(info->manufacturer_string ? info->manufacturer_string : L"", string, maxlen);
+
+	return 0;
+}
+
+int HID_API_EXPORT_CALL hid_get_product_string_utf8(hid_device *dev, char *string, size_t maxlen)
+{
+	struct hid_device_info *info;
+
+	if (!string || !maxlen) {
+		register_device_error(dev, "Zero buffer/length");
+		return -1;
+	}
+
+	info = hid_get_device_info(dev);
+	if (!info) {
+		// hid_get_device_info will have set an error already
+		return -1;
+	}
+
+	hid_internal_wcs_to_utf8(info->product_string ? info->product_string : L"", string, maxlen);
+
+	return 0;
+}
+
+int HID_API_EXPORT_CALL hid_get_serial_number_string_utf8(hid_device *dev, char *string, size_t maxlen)
+{
+	struct hid_device_info *info;
+
+	if (!string || !maxlen) {
+		register_device_error(dev, "Zero buffer/length");
+		return -1;
+	}
+
+	info = hid_get_device_info(dev);
+	if (!info) {
+		// hid_get_device_info will have set an error already
+		return -1;
+	}
+
+	hid_internal_wcs_to_utf8(info->serial_number ? info->serial_number : L"", string, maxlen);
+
+	return 0;
+}
+
+int HID_API_EXPORT_CALL hid_get_indexed_string_utf8(hid_device *dev, int string_index, char *string, size_t maxlen)
+{
+	(void) dev;
+	(void) string_index;
+	(void) string;
+	(void) maxlen;
+
+	register_device_error(dev, "hid_get_indexed_string_utf8: not available on this platform");
+	return -1;
+}
+
 int HID_API_EXPORT_CALL hid_darwin_get_location_id(hid_device *dev, uint32_t *location_id)
 {
 	if (!location_id) {
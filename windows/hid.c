@@ -1348,6 +1348,185 @@ void  HID_API_EXPORT HID_API_CALL hid_free_enumeration(struct hid_device_info *d
 	}
 }
 
+static int hid_internal_match_filter(const struct hid_device_info *info, const struct hid_enumerate_filter *filter)
+{
+	return (filter->vendor_id == 0x0 || info->vendor_id == filter->vendor_id) &&
+		(filter->product_id == 0x0 || info->product_id == filter->product_id) &&
+		(filter->usage_page == 0x0 || info->usage_page == filter->usage_page) &&
+		(filter->usage == 0x0 || info->usage == filter->usage) &&
+		(filter->bus_type == HID_API_BUS_UNKNOWN || info->bus_type == filter->bus_type) &&
+		(filter->interface_number == -1 || info->interface_number == filter->interface_number) &&
+		(!filter->serial_number || (info->serial_number && wcscmp(info->serial_number, filter->serial_number) == 0));
+}
+
+struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate_ex(const struct hid_enumerate_filter *filter)
+{
+	struct hid_device_info *root;
+	struct hid_device_info **link;
+
+	if (!filter)
+		return hid_enumerate(0, 0);
+
+	/* The system is only queried by VID/PID here, the rest of the filter is applied to the result */
+	root = hid_enumerate(filter->vendor_id, filter->product_id);
+
+	link = &root;
+	while (*link) {
+		struct hid_device_info *cur_dev = *link;
+
+		if (!hid_internal_match_filter(cur_dev, filter)) {
+			*link = cur_dev->next;
+			cur_dev->next = NULL;
+			hid_free_enumeration(cur_dev);
+			continue;
+		}
+
+		if (filter->flags & HID_API_ENUMERATE_NO_STRINGS) {
+			free(cur_dev->serial_number);
+			free(cur_dev->manufacturer_string);
+			free(cur_dev->product_string);
+			cur_dev->serial_number = NULL;
+			cur_dev->manufacturer_string = NULL;
+			cur_dev->product_string = NULL;
+		}
+
+		link = &cur_dev->next;
+	}
+
+	if (root == NULL) {
+		register_global_error(L"No HID devices matching the filter found in the system.");
+	}
+
+	return root;
+}
+
+/* Encode a wide string as UTF-8 into out, or only measure it if out is NULL.
+   At most out_size bytes are written, cutting before the first character
+   which doesn't fit entirely. Surrogate pairs are combined, for when
+   wchar_t holds UTF-16.
+   Returns the size of the whole string, including the terminator. */
+static size_t hid_internal_wcs_to_utf8(const wchar_t *wcs, char *out, size_t out_size)
+{
+	size_t size = 0, out_len = 0;
+
+	for (; *wcs; wcs++) {
+		unsigned long c = (unsigned long) *wcs;
+		unsigned long low = (unsigned long) wcs[1];
+		unsigned char buf[4];
+		size_t n;
+
+		if (c >= 0xD800 && c < 0xDC00 && low >= 0xDC00 && low < 0xE000) {
+			c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+			wcs++;
+		}
+		if ((c >= 0xD800 && c < 0xE000) || c > 0x10FFFF)
+			c = 0xFFFD;
+
+		if (c < 0x80) {
+			buf[0] = (unsigned char) c;
+			n = 1;
+		}
+		else if (c < 0x800) {
+			buf[0] = (unsigned char) (0xC0 | (c >> 6));
+			buf[1] = (unsigned char) (0x80 | (c & 0x3F));
+			n = 2;
+		}
+		else if (c < 0x10000) {
+			buf[0] = (unsigned char) (0xE0 | (c >> 12));
+			buf[1] = (unsigned char) (0x80 | ((c >> 6) & 0x3F));
+			buf[2] = (unsigned char) (0x80 | (c & 0x3F));
+			n = 3;
+		}
+		else {
+			buf[0] = (unsigned char) (0xF0 | (c >> 18));
+			buf[1] = (unsigned char) (0x80 | ((c >> 12) & 0x3F));
+			buf[2] = (unsigned char) (0x80 | ((c >> 6) & 0x3F));
+			buf[3] = (unsigned char) (0x80 | (c & 0x3F));
+			n = 4;
+		}
+
+		if (out && out_len == size && size + n < out_size) {
+			memcpy(out + out_len, buf, n);
+			out_len += n;
+		}
+		size += n;
+	}
+
+	if (out && out_size > 0)
+		out[out_len] = '\0';
+
+	return size + 1;
+}
+
+static char *hid_internal_wcsdup_utf8(const wchar_t *wcs)
+{
+	size_t size;
+	char *str;
+
+	if (!wcs)
+		return NULL;
+
+	size = hid_internal_wcs_to_utf8(wcs, NULL, 0);
+	str = (char*) malloc(size);
+	if (str)
+		hid_internal_wcs_to_utf8(wcs, str, size);
+
+	return str;
+}
+
+struct hid_device_info_utf8 HID_API_EXPORT * HID_API_CALL hid_enumerate_utf8(const struct hid_enumerate_filter *filter)
+{
+	struct hid_device_info *devs = hid_enumerate_ex(filter);
+	const struct hid_device_info *info;
+	struct hid_device_info_utf8 *root = NULL;
+	struct hid_device_info_utf8 **link = &root;
+
+	/* The system gives wide strings here, they are converted afterwards */
+	for (info = devs; info; info = info->next) {
+		struct hid_device_info_utf8 *cur_dev = (struct hid_device_info_utf8*) calloc(1, sizeof(struct hid_device_info_utf8));
+		if (!cur_dev)
+			break;
+
+		if (info->path) {
+			size_t path_size = strlen(info->path) + 1;
+			cur_dev->path = (char*) malloc(path_size);
+			if (cur_dev->path)
+				memcpy(cur_dev->path, info->path, path_size);
+		}
+		cur_dev->vendor_id = info->vendor_id;
+		cur_dev->product_id = info->product_id;
+		cur_dev->serial_number = hid_internal_wcsdup_utf8(info->serial_number);
+		cur_dev->release_number = info->release_number;
+		cur_dev->manufacturer_string = hid_internal_wcsdup_utf8(info->manufacturer_string);
+		cur_dev->product_string = hid_internal_wcsdup_utf8(info->product_string);
+		cur_dev->usage_page = info->usage_page;
+		cur_dev->usage = info->usage;
+		cur_dev->interface_number = info->interface_number;
+		cur_dev->bus_type = info->bus_type;
+
+		*link = cur_dev;
+		link = &cur_dev->next;
+	}
+
+	hid_free_enumeration(devs);
+
+	return root;
+}
+
+void  HID_API_EXPORT HID_API_CALL hid_free_enumeration_utf8(struct hid_device_info_utf8 *devs)
+{
+	struct hid_device_info_utf8 *d = devs;
+	while (d) {
+		struct hid_device_info_utf8 *next = d->next;
+		free(d->path);
+		free(d->serial_number);
+		free(d->manufacturer_string);
+		free(d->product_string);
+		free(d);
+		d = next;
+	}
+}
+
 DWORD WINAPI hid_internal_notify_callback(HCMNOTIFICATION notify, PVOID context, CM_NOTIFY_ACTION action, PCM_NOTIFY_EVENT_DATA event_data, DWORD event_data_size)
 {
 	struct hid_device_info *device = NULL;
@@ -1598,6 +1777,18 @@ int HID_API_EXPORT HID_API_CALL hid_hotplug_deregister_callback(hid_hotplug_call
 	return 0;
 }
 
+int HID_API_EXPORT HID_API_CALL hid_hotplug_get_fd(void)
+{
+	register_global_error(L"hid_hotplug_get_fd: not supported on Windows");
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_hotplug_handle_events(void)
+{
+	register_global_error(L"hid_hotplug_handle_events: not supported on Windows");
+	return -1;
+}
+
 HID_API_EXPORT hid_device * HID_API_CALL hid_open(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
 {
 	/* TODO: Merge this functions with the Linux version. This function should be platform independent. */
@@ -1905,6 +2096,98 @@ int HID_API_EXPORT HID_API_CALL hid_read(hid_device *dev, unsigned char *data, s
 	return hid_read_timeout(dev, data, length, (dev->blocking)? -1: 0);
 }
 
+/* Current QueryPerformanceCounter() time, in nanoseconds */
+static uint64_t get_monotonic_time_ns(void)
+{
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+
+	/* Split the conversion, so it doesn't overflow */
+	return (uint64_t) (counter.QuadPart / frequency.QuadPart) * 1000000000ULL
+		+ (uint64_t) (counter.QuadPart % frequency.QuadPart) * 1000000000ULL / (uint64_t) frequency.QuadPart;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_read_timestamped(hid_device *dev, unsigned char *data, size_t length, uint64_t *timestamp_ns, int milliseconds)
+{
+	/* The overlapped read doesn't report when it completed,
+	   so the closest we can get is the moment we see the result */
+	int bytes_read = hid_read_timeout(dev, data, length, milliseconds);
+
+	if (bytes_read > 0 && timestamp_ns)
+		*timestamp_ns = get_monotonic_time_ns();
+
+	return bytes_read;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_read_batch(hid_device *dev, unsigned char *data, size_t stride, size_t max_reports, size_t *lengths, int milliseconds)
+{
+	size_t count = 0;
+
+	if (!data || !stride || !max_reports || !lengths) {
+		register_string_error(dev, L"Zero buffer/length");
+		return -1;
+	}
+
+	/* Only the first read waits; the rest pick up what is already there. */
+	while (count < max_reports) {
+		int res = hid_read_timeout(dev, data + count * stride, stride, (count == 0)? milliseconds: 0);
+		if (res < 0) {
+			if (count == 0)
+				return -1;
+			break;
+		}
+		if (res == 0)
+			break;
+		lengths[count++] = (size_t) res;
+	}
+
+	return (int) count;
+}
+
+hid_reactor * HID_API_EXPORT HID_API_CALL hid_reactor_new(size_t report_size)
+{
+	(void)report_size;
+	register_global_error(L"hid_reactor_new: not supported on Windows");
+	return NULL;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_reactor_add(hid_reactor *reactor, hid_device *dev, hid_reactor_callback_fn callback, void *user_data)
+{
+	(void)reactor;
+	(void)dev;
+	(void)callback;
+	(void)user_data;
+	register_global_error(L"hid_reactor_add: not supported on Windows");
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_reactor_remove(hid_reactor *reactor, hid_device *dev)
+{
+	(void)reactor;
+	(void)dev;
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_reactor_run(hid_reactor *reactor, int milliseconds)
+{
+	(void)reactor;
+	(void)milliseconds;
+	register_global_error(L"hid_reactor_run: not supported on Windows");
+	return -1;
+}
+
+void HID_API_EXPORT HID_API_CALL hid_reactor_free(hid_reactor *reactor)
+{
+	(void)reactor;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_get_pollable_fd(hid_device *dev)
+{
+	register_string_error(dev, L"hid_get_pollable_fd: not supported on Windows");
+	return -1;
+}
+
 int HID_API_EXPORT HID_API_CALL hid_set_nonblocking(hid_device *dev, int nonblock)
 {
 	dev->blocking = !nonblock;
@@ -2166,6 +2449,84 @@ int HID_API_EXPORT_CALL HID_API_CALL hid_get_indexed_string(hid_device *dev, int
 	return 0;
 }
 
+int HID_API_EXPORT_CALL hid_get_manufacturer_string_utf8(hid_device *dev, char *string, size_t maxlen)
+{
+	struct hid_device_info *info;
+
+	if (!string || !maxlen) {
+		register_string_error(dev, L"Zero buffer/length");
+		return -1;
+	}
+
+	info = hid_get_device_info(dev);
+	if (!info) {
+		// hid_get_device_info will have set an error already
+		return -1;
+	}
+
+	hid_internal_wcs_to_utf8(info->manufacturer_string ? info->manufacturer_string : L"", string, maxlen);
+
+	return 0;
+}
+
+int HID_API_EXPORT_CALL hid_get_product_string_utf8(hid_device *dev, char *string, size_t maxlen)
+{
+	struct hid_device_info *info;
+
+	if (!string || !maxlen) {
+		register_string_error(dev, L"Zero buffer/length");
+		return -1;
+	}
+
+	info = hid_get_device_info(dev);
+	if (!info) {
+		// hid_get_device_info will have set an error already
+		return -1;
+	}
+
+	hid_internal_wcs_to_utf8(info->product_string ? info->product_string : L"", string, maxlen);
+
+	return 0;
+}
+
+int HID_API_EXPORT_CALL hid_get_serial_number_string_utf8(hid_device *dev, char *string, size_t maxlen)
+{
+	struct hid_device_info *info;
+
+	if (!string || !maxlen) {
+		register_string_error(dev, L"Zero buffer/length");
+		return -1;
+	}
+
+	info = hid_get_device_info(dev);
+	if (!info) {
+		// hid_get_device_info will have set an error already
+		return -1;
+	}
+
+	hid_internal_wcs_to_utf8(info->serial_number ? info->serial_number : L"", string, maxlen);
+
+	return 0;
+}
+
+int HID_API_EXPORT_CALL hid_get_indexed_string_utf8(hid_device *dev, int string_index, char *string, size_t maxlen)
+{
+	wchar_t buf[MAX_STRING_WCHARS + 1];
+
+	if (!string || !maxlen) {
+		register_string_error(dev, L"Zero buffer/length");
+		return -1;
+	}
+
+	if (hid_get_indexed_string(dev, string_index, buf, MAX_STRING_WCHARS + 1) < 0)
+		return -1;
+	buf[MAX_STRING_WCHARS] = L'\0';
+
+	hid_internal_wcs_to_utf8(buf, string, maxlen);
+
+	return 0;
+}
+
 int HID_API_EXPORT_CALL hid_winapi_get_instance_string(hid_device* dev, wchar_t* string, size_t maxlen)
 {
 	wchar_t* interface_path = NULL, *device_id = NULL;
@@ -2349,6 +2710,12 @@ HID_API_EXPORT const wchar_t * HID_API_CALL hid_error(hid_device *dev)
 	return error_str;
 }
 
+HID_API_EXPORT const wchar_t * HID_API_CALL hid_read_error(hid_device *dev)
+{
+	/* The read functions register their errors as regular device errors */
+	return hid_error(dev);
+}
+
 HID_API_EXPORT int HID_API_CALL hid_error_code(hid_device *dev)
 {
 	struct device_error* error = find_device_error(dev);